@@ -1,10 +1,19 @@
 #include <fbxppch.h>
 #include <fbxpstate.h>
 #include <fbxpnorm.h>
+#include <atomic>
+#include <chrono>
 
 using namespace apemode;
 using namespace apemodefb;
 
+namespace {
+    std::atomic< uint64_t > packMeshCount( 0 );
+    std::atomic< uint64_t > packVertexCount( 0 );
+    std::atomic< uint64_t > packSimdVertexCount( 0 );
+    std::atomic< uint64_t > packNanoseconds( 0 );
+}
+
 template < typename TMathFu, typename TFb >
 inline TMathFu Cast( const TFb v ) {
     static_assert( sizeof( TMathFu ) == sizeof( TFb ), "Cannot cast." );
@@ -22,6 +31,15 @@ inline TMathFu Map( const TMathFu input,
     return ( input - input_start ) * output_range / input_range + output_start;
 }
 
+/**
+ * Normalizes the vector with the same float operations as the SIMD kernels (see fbxpackingsimd.cpp),
+ * mathfu::vec3::Normalized( ) can use the reciprocal square root estimate.
+ **/
+inline mathfu::vec3 NormalizedPrecise( const mathfu::vec3 v ) {
+    const float invLength = 1.0f / sqrtf( v.x * v.x + v.y * v.y + v.z * v.z );
+    return mathfu::vec3( v.x * invLength, v.y * invLength, v.z * invLength );
+}
+
 template < typename TMathFu >
 inline void AssertInRange( const TMathFu v, float vmin = 0.0f, float vmax = 1.0f, float tolerance = 0.0001f ) {
     /*float values[ sizeof( TMathFu ) / sizeof( float ) ];
@@ -104,6 +122,19 @@ uint32_t PackTexcoord_16_16_fixed( const mathfu::vec2 texcoord,
     return packed.u;
 }
 
+/**
+ * Packs the texcoords to 16-15 bits, the highest bit is left for the octahedral format (see PackOctahedral).
+ **/
+uint32_t PackTexcoord_16_15_fixed( const mathfu::vec2 texcoord,
+                                   const mathfu::vec2 texcoordMin,
+                                   const mathfu::vec2 texcoordMax ) {
+    const mathfu::vec2 texcoordSize  = texcoordMax - texcoordMin;
+    const mathfu::vec2 texcoordScale = ( texcoord - texcoordMin ) / texcoordSize;
+    AssertInRange( texcoordScale );
+
+    return uint32_t( Unorm< 16 >( texcoordScale.x ).Bits( ) ) | ( uint32_t( Unorm< 15 >( texcoordScale.y ).Bits( ) ) << 16 );
+}
+
 uint32_t PackTexcoord_16_16_half( const mathfu::vec2 texcoord,
                                   const mathfu::vec2 texcoordMin,
                                   const mathfu::vec2 texcoordMax ) {
@@ -134,7 +165,7 @@ uint32_t PackNormal_10_10_10_2( const mathfu::vec3 normal ) {
 uint32_t PackTangent_10_10_10_2( const mathfu::vec4 tangent ) {
     AssertInRange( tangent.w, -1.f, +1.f );
     UIntPack_10_10_10_2 packed;
-    packed.u = PackNormal_10_10_10_2( mathfu::vec3( tangent.x, tangent.y, tangent.z ).Normalized( ) );
+    packed.u = PackNormal_10_10_10_2( NormalizedPrecise( mathfu::vec3( tangent.x, tangent.y, tangent.z ) ) );
     packed.q.w = Unorm< 2 >( tangent.w * 0.5f + 0.5f ).Bits( );
     return packed.u;
 }
@@ -162,6 +193,45 @@ uint32_t PackTangent_8_8_8_8( const mathfu::vec4 tangent ) {
     return packed.u;
 }
 
+void PackScalar( const StaticVertexFb* vertices,
+                 PackedVertexFb*       packed,
+                 const uint32_t        vertexCount,
+                 const mathfu::vec3    positionMin,
+                 const mathfu::vec3    positionMax,
+                 const mathfu::vec2    texcoordsMin,
+                 const mathfu::vec2    texcoordsMax ) {
+    for ( uint32_t i = 0; i < vertexCount; ++i ) {
+        const auto position  = Cast< mathfu::vec3 >( vertices[ i ].position( ) );
+        const auto texcoords = Cast< mathfu::vec2 >( vertices[ i ].uv( ) );
+        const auto normal    = Cast< mathfu::vec3 >( vertices[ i ].normal( ) );
+        const auto tangent   = Cast< mathfu::vec4 >( vertices[ i ].tangent( ) );
+
+        packed[ i ] = PackedVertexFb( PackPosition_10_10_10_2( position, positionMin, positionMax ),
+                                      PackNormal_10_10_10_2( NormalizedPrecise( normal ) ),
+                                      PackTangent_10_10_10_2( tangent ),
+                                      PackTexcoord_16_16_fixed( texcoords, texcoordsMin, texcoordsMax ) );
+    }
+}
+
+//
+// See implementation in fbxpackingsimd.cpp.
+//
+
+const char* GetPackSimdName( );
+uint32_t    PackSimd( const StaticVertexFb* vertices,
+                      PackedVertexFb*       packed,
+                      const uint32_t        vertexCount,
+                      const mathfu::vec3    positionMin,
+                      const mathfu::vec3    positionMax,
+                      const mathfu::vec2    texcoordsMin,
+                      const mathfu::vec2    texcoordsMax );
+
+/**
+ * Packs the vertices with the SIMD kernel (if the CPU supports it), the remaining vertices are packed with the scalar path.
+ * The debug builds verify the kernel output is bit-identical to the scalar path.
+ * The throughput is summed up for LogPackStats( ).
+ * Can be used in multiple threads.
+ **/
 void Pack( const StaticVertexFb* vertices,
            PackedVertexFb*       packed,
            const uint32_t        vertexCount,
@@ -169,15 +239,279 @@ void Pack( const StaticVertexFb* vertices,
            const mathfu::vec3    positionMax,
            const mathfu::vec2    texcoordsMin,
            const mathfu::vec2    texcoordsMax ) {
+    FBXP_PROFILE_ZONE( "Pack" );
+    auto& s = apemode::Get( );
+
+    const auto startTime = std::chrono::steady_clock::now( );
+
+    const uint32_t simdCount = PackSimd( vertices, packed, vertexCount, positionMin, positionMax, texcoordsMin, texcoordsMax );
+    PackScalar( vertices + simdCount, packed + simdCount, vertexCount - simdCount, positionMin, positionMax, texcoordsMin, texcoordsMax );
+
+    const auto nanoseconds = std::chrono::duration_cast< std::chrono::nanoseconds >( std::chrono::steady_clock::now( ) - startTime ).count( );
+    s.console->debug( "Packed {} vertices in {:.3f} ms ({} path).", vertexCount, nanoseconds * 1e-6, simdCount ? GetPackSimdName( ) : "scalar" );
+
+    ++packMeshCount;
+    packVertexCount += vertexCount;
+    packSimdVertexCount += simdCount;
+    packNanoseconds += (uint64_t) nanoseconds;
+
+#if FBXP_DEBUG
+    if ( simdCount ) {
+        std::vector< PackedVertexFb > reference( simdCount );
+        PackScalar( vertices, reference.data( ), simdCount, positionMin, positionMax, texcoordsMin, texcoordsMax );
+
+        for ( uint32_t i = 0; i < simdCount; ++i ) {
+            if ( 0 != memcmp( &reference[ i ], &packed[ i ], sizeof( PackedVertexFb ) ) ) {
+                s.console->error( "Packed vertex #{} differs from the scalar path ({} path).", i, GetPackSimdName( ) );
+                DebugBreak( );
+                break;
+            }
+        }
+    }
+#endif
+}
+
+/**
+ * Prints the packing throughput of all the packed meshes (since the last call).
+ **/
+void LogPackStats( ) {
+    const uint64_t meshes      = packMeshCount.exchange( 0 );
+    const uint64_t vertices    = packVertexCount.exchange( 0 );
+    const uint64_t simd        = packSimdVertexCount.exchange( 0 );
+    const uint64_t nanoseconds = packNanoseconds.exchange( 0 );
+
+    if ( meshes ) {
+        apemode::Get( ).console->info( "Packing: {} vertices in {} mesh(es), {:.3f} ms ({:.1f} M vertices/s), {} vertices with the {} path.",
+                                       vertices,
+                                       meshes,
+                                       nanoseconds * 1e-6,
+                                       nanoseconds ? vertices * 1e3 / nanoseconds : 0.0,
+                                       simd,
+                                       GetPackSimdName( ) );
+    }
+}
+
+//
+// Octahedral normal and tangent encoding (see PackedOctahedralVertexFb).
+// The normal is mapped to the octahedron and unfolded to the square, the tangent is stored as the angle
+// in the plane of the decoded normal (the basis is reconstructed from the normal, so the decoder gets the same one).
+//
+
+inline float SignNotZero( float v ) {
+    return v >= 0.0f ? 1.0f : -1.0f;
+}
+
+inline float Dot( const mathfu::vec3 a, const mathfu::vec3 b ) {
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+/**
+ * Builds the orthonormal basis for the unit vector without branches on the vector direction.
+ * Building an Orthonormal Basis, Revisited (Duff et al., 2017).
+ **/
+void GetOrthonormalBasis( const mathfu::vec3 n, mathfu::vec3& b1, mathfu::vec3& b2 ) {
+    const float sign = SignNotZero( n.z );
+    const float a    = -1.0f / ( sign + n.z );
+    const float b    = n.x * n.y * a;
+    b1 = mathfu::vec3( 1.0f + sign * n.x * n.x * a, sign * b, -sign * n.x );
+    b2 = mathfu::vec3( b, sign + n.y * n.y * a, -n.y );
+}
+
+/**
+ * Decode reference for PackNormal_Oct_11_11.
+ **/
+mathfu::vec3 UnpackNormal_Oct_11_11( const uint32_t bits ) {
+    const float x = float( bits & 0x7ff ) / 2047.0f * 2.0f - 1.0f;
+    const float y = float( ( bits >> 11 ) & 0x7ff ) / 2047.0f * 2.0f - 1.0f;
+
+    mathfu::vec3 n( x, y, 1.0f - fabsf( x ) - fabsf( y ) );
+    if ( n.z < 0.0f ) {
+        n.x = ( 1.0f - fabsf( y ) ) * SignNotZero( x );
+        n.y = ( 1.0f - fabsf( x ) ) * SignNotZero( y );
+    }
+
+    return NormalizedPrecise( n );
+}
+
+/**
+ * Packs the normal to 11-11 bits octahedral coordinates.
+ * All the 4 nearest quantized coordinates are decoded, the one with the smallest angular error is taken.
+ **/
+uint32_t PackNormal_Oct_11_11( const mathfu::vec3 normal ) {
+    const float l1 = fabsf( normal.x ) + fabsf( normal.y ) + fabsf( normal.z );
+    if ( !( l1 > 0.0f ) )
+        return PackNormal_Oct_11_11( mathfu::vec3( 0.0f, 0.0f, 1.0f ) );
+
+    float x = normal.x / l1;
+    float y = normal.y / l1;
+    if ( normal.z < 0.0f ) {
+        const float ox = x;
+        x = ( 1.0f - fabsf( y ) ) * SignNotZero( ox );
+        y = ( 1.0f - fabsf( ox ) ) * SignNotZero( y );
+    }
+
+    const float fx = details::clamp( x * 0.5f + 0.5f, 0.0f, 1.0f ) * 2047.0f;
+    const float fy = details::clamp( y * 0.5f + 0.5f, 0.0f, 1.0f ) * 2047.0f;
+    const mathfu::vec3 n = NormalizedPrecise( normal );
+
+    uint32_t bestBits = 0;
+    float    bestDot  = -2.0f;
+    for ( const float qx : {floorf( fx ), ceilf( fx )} ) {
+        for ( const float qy : {floorf( fy ), ceilf( fy )} ) {
+            const uint32_t bits = uint32_t( qx ) | ( uint32_t( qy ) << 11 );
+            const float    dot  = Dot( UnpackNormal_Oct_11_11( bits ), n );
+            if ( dot > bestDot ) {
+                bestDot  = dot;
+                bestBits = bits;
+            }
+        }
+    }
+
+    return bestBits;
+}
+
+const float kTwoPi = 6.28318530718f;
+
+/**
+ * Decode reference for PackTangent_Angle_12.
+ **/
+mathfu::vec3 UnpackTangent_Angle_12( const uint32_t bits, const mathfu::vec3 normal ) {
+    mathfu::vec3 b1, b2;
+    GetOrthonormalBasis( normal, b1, b2 );
+
+    const float angle = ( float( bits & 4095 ) / 4096.0f - 0.5f ) * kTwoPi;
+    const float c     = cosf( angle );
+    const float s     = sinf( angle );
+    return mathfu::vec3( b1.x * c + b2.x * s, b1.y * c + b2.y * s, b1.z * c + b2.z * s );
+}
+
+/**
+ * Packs the tangent to the 12 bits angle in the plane of the normal.
+ * Both nearest quantized angles are decoded, the one closer to the tangent is taken
+ * (the decoded normal differs from the source one, so the nearest angle is not always the closest tangent).
+ * @param tangent The unit tangent orthogonal to the source normal.
+ * @param normal The decoded normal (see UnpackNormal_Oct_11_11).
+ **/
+uint32_t PackTangent_Angle_12( const mathfu::vec3 tangent, const mathfu::vec3 normal ) {
+    mathfu::vec3 b1, b2;
+    GetOrthonormalBasis( normal, b1, b2 );
+
+    const float x = Dot( tangent, b1 );
+    const float y = Dot( tangent, b2 );
+
+    // The tangent is zero (or NaN for the degenerate source tangent).
+    if ( !( x * x + y * y > 0.0f ) )
+        return 0;
+
+    // [-pi; pi] to [0; 4096], the full circle wraps around.
+    const float angle = ( atan2f( y, x ) / kTwoPi + 0.5f ) * 4096.0f;
+
+    uint32_t bestBits = 0;
+    float    bestDot  = -2.0f;
+    for ( const float q : {floorf( angle ), ceilf( angle )} ) {
+        const uint32_t bits = uint32_t( q ) & 4095;
+        const float    dot  = Dot( UnpackTangent_Angle_12( bits, normal ), tangent );
+        if ( dot > bestDot ) {
+            bestDot  = dot;
+            bestBits = bits;
+        }
+    }
+
+    return bestBits;
+}
+
+/**
+ * Decode reference for PackNormal_10_10_10_2 (used for the error report).
+ **/
+mathfu::vec3 UnpackNormal_10_10_10_2( const uint32_t bits ) {
+    return NormalizedPrecise( mathfu::vec3( float( bits & 0x3ff ) / 1023.0f * 2.0f - 1.0f,
+                                            float( ( bits >> 10 ) & 0x3ff ) / 1023.0f * 2.0f - 1.0f,
+                                            float( ( bits >> 20 ) & 0x3ff ) / 1023.0f * 2.0f - 1.0f ) );
+}
+
+/**
+ * Angular error statistics in degrees.
+ **/
+struct AngularError {
+    double   sum   = 0;
+    double   max   = 0;
+    uint32_t count = 0;
+
+    void Add( const mathfu::vec3 reference, const mathfu::vec3 decoded ) {
+        const float dot = Dot( reference, decoded );
+        if ( dot != dot )
+            return; // Degenerate input vector.
+
+        const double degrees = acos( details::clamp( dot, -1.0f, 1.0f ) ) * 360.0 / kTwoPi;
+        sum += degrees;
+        max = std::max( max, degrees );
+        ++count;
+    }
+
+    double GetMean( ) const {
+        return count ? sum / count : 0.0;
+    }
+};
+
+/**
+ * Packs the vertices to the octahedral format and logs the size and the angular error compared to the 10-10-10-2 format.
+ * Can be used in multiple threads.
+ **/
+void PackOctahedral( const StaticVertexFb*     vertices,
+                     PackedOctahedralVertexFb* packed,
+                     const uint32_t            vertexCount,
+                     const mathfu::vec3        positionMin,
+                     const mathfu::vec3        positionMax,
+                     const mathfu::vec2        texcoordsMin,
+                     const mathfu::vec2        texcoordsMax,
+                     const char*               meshName ) {
+    FBXP_PROFILE_ZONE( "Pack octahedral" );
+    AngularError normalError, tangentError, normalError10, tangentError10;
+
     for ( uint32_t i = 0; i < vertexCount; ++i ) {
         const auto position  = Cast< mathfu::vec3 >( vertices[ i ].position( ) );
         const auto texcoords = Cast< mathfu::vec2 >( vertices[ i ].uv( ) );
-        const auto normal    = Cast< mathfu::vec3 >( vertices[ i ].normal( ) );
+        const auto normal    = NormalizedPrecise( Cast< mathfu::vec3 >( vertices[ i ].normal( ) ) );
         const auto tangent   = Cast< mathfu::vec4 >( vertices[ i ].tangent( ) );
 
-        packed[ i ] = PackedVertexFb( PackPosition_10_10_10_2( position, positionMin, positionMax ),
-                                      PackNormal_10_10_10_2( normal.Normalized( ) ),
-                                      PackTangent_10_10_10_2( tangent ),
-                                      PackTexcoord_16_16_fixed( texcoords, texcoordsMin, texcoordsMax ) );
+        const uint32_t     normalBits     = PackNormal_Oct_11_11( normal );
+        const mathfu::vec3 decodedNormal  = UnpackNormal_Oct_11_11( normalBits );
+        const mathfu::vec3 tangentXYZ     = mathfu::vec3( tangent.x, tangent.y, tangent.z );
+        const uint32_t     tangentSignBit = tangent.w >= 0.0f ? 1 : 0;
+
+        // The tangent is orthogonalized in the plane of the source normal, it is the reference for the error too.
+        const mathfu::vec3 orthoTangent = NormalizedPrecise( mathfu::vec3( tangentXYZ.x - normal.x * Dot( normal, tangentXYZ ),
+                                                                           tangentXYZ.y - normal.y * Dot( normal, tangentXYZ ),
+                                                                           tangentXYZ.z - normal.z * Dot( normal, tangentXYZ ) ) );
+
+        const uint32_t tangentBits = PackTangent_Angle_12( orthoTangent, decodedNormal );
+
+        packed[ i ] = PackedOctahedralVertexFb( PackPosition_10_10_10_2( position, positionMin, positionMax ) | ( ( tangentBits & 1 ) << 30 ) | ( tangentSignBit << 31 ),
+                                                normalBits | ( ( ( tangentBits >> 1 ) & 1023 ) << 22 ),
+                                                PackTexcoord_16_15_fixed( texcoords, texcoordsMin, texcoordsMax ) | ( ( tangentBits >> 11 ) << 31 ) );
+
+        normalError.Add( normal, decodedNormal );
+        tangentError.Add( orthoTangent, UnpackTangent_Angle_12( tangentBits, decodedNormal ) );
+        normalError10.Add( normal, UnpackNormal_10_10_10_2( PackNormal_10_10_10_2( normal ) ) );
+        tangentError10.Add( orthoTangent, UnpackNormal_10_10_10_2( PackNormal_10_10_10_2( NormalizedPrecise( tangentXYZ ) ) ) );
     }
-}
\ No newline at end of file
+
+    auto& s = apemode::Get( );
+    s.console->info( "Mesh \"{}\" octahedral vertices: {} bytes ({} bytes packed, {} bytes static).",
+                     meshName,
+                     vertexCount * sizeof( PackedOctahedralVertexFb ),
+                     vertexCount * sizeof( PackedVertexFb ),
+                     vertexCount * sizeof( StaticVertexFb ) );
+    s.console->info( "Mesh \"{}\" normal error: mean {:.4f}, max {:.4f} degrees (10-10-10: mean {:.4f}, max {:.4f}).",
+                     meshName,
+                     normalError.GetMean( ),
+                     normalError.max,
+                     normalError10.GetMean( ),
+                     normalError10.max );
+    s.console->info( "Mesh \"{}\" tangent error: mean {:.4f}, max {:.4f} degrees (10-10-10: mean {:.4f}, max {:.4f}).",
+                     meshName,
+                     tangentError.GetMean( ),
+                     tangentError.max,
+                     tangentError10.GetMean( ),
+                     tangentError10.max );
+}
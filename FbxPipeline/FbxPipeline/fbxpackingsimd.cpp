@@ -0,0 +1,322 @@
+#include <fbxppch.h>
+#include <fbxpstate.h>
+#include <intrin.h>
+#include <immintrin.h>
+
+using namespace apemodefb;
+
+//
+// SSE4.1 and AVX2 kernels for Pack( ), 4 and 8 vertices per iteration.
+// The vertices are transposed to SoA (a register per vertex component), packed with exactly the same
+// float operations as the scalar path (see fbxpacking.cpp), and transposed back.
+// The kernels are selected at runtime (see GetPackKernel).
+//
+
+namespace {
+    const uint32_t kStaticVertexFloatCount = sizeof( StaticVertexFb ) / sizeof( float );
+    static_assert( kStaticVertexFloatCount == 12, "Position (3), normal (3), tangent (4), uv (2)." );
+
+    /**
+     * 4-wide SSE4.1 operations.
+     **/
+    struct SimdSSE41 {
+        typedef __m128  F;
+        typedef __m128i I;
+        static const uint32_t kWidth = 4;
+
+        static F Set1( float f ) { return _mm_set1_ps( f ); }
+        static F Add( F a, F b ) { return _mm_add_ps( a, b ); }
+        static F Sub( F a, F b ) { return _mm_sub_ps( a, b ); }
+        static F Mul( F a, F b ) { return _mm_mul_ps( a, b ); }
+        static F Div( F a, F b ) { return _mm_div_ps( a, b ); }
+        static F Min( F a, F b ) { return _mm_min_ps( a, b ); }
+        static F Max( F a, F b ) { return _mm_max_ps( a, b ); }
+        static F Sqrt( F a ) { return _mm_sqrt_ps( a ); }
+        static F Floor( F a ) { return _mm_floor_ps( a ); }
+        static I Truncate( F a ) { return _mm_cvttps_epi32( a ); }
+        static I Or( I a, I b ) { return _mm_or_si128( a, b ); }
+
+        template < int Shift >
+        static I ShiftLeft( I a ) { return _mm_slli_epi32( a, Shift ); }
+
+        /**
+         * Loads 4 vertices and transposes them to 12 component registers.
+         **/
+        static void Load( const float* vertices, F ( &soa )[ kStaticVertexFloatCount ] ) {
+            for ( uint32_t c = 0; c < kStaticVertexFloatCount; c += 4 ) {
+                F r0 = _mm_loadu_ps( vertices + 0 * kStaticVertexFloatCount + c );
+                F r1 = _mm_loadu_ps( vertices + 1 * kStaticVertexFloatCount + c );
+                F r2 = _mm_loadu_ps( vertices + 2 * kStaticVertexFloatCount + c );
+                F r3 = _mm_loadu_ps( vertices + 3 * kStaticVertexFloatCount + c );
+                _MM_TRANSPOSE4_PS( r0, r1, r2, r3 );
+                soa[ c + 0 ] = r0;
+                soa[ c + 1 ] = r1;
+                soa[ c + 2 ] = r2;
+                soa[ c + 3 ] = r3;
+            }
+        }
+
+        /**
+         * Transposes 4 packed attribute registers back to 4 packed vertices and stores them.
+         **/
+        static void Store( I position, I normal, I tangent, I uv, PackedVertexFb* packed ) {
+            F r0 = _mm_castsi128_ps( position );
+            F r1 = _mm_castsi128_ps( normal );
+            F r2 = _mm_castsi128_ps( tangent );
+            F r3 = _mm_castsi128_ps( uv );
+            _MM_TRANSPOSE4_PS( r0, r1, r2, r3 );
+
+            float* dst = reinterpret_cast< float* >( packed );
+            _mm_storeu_ps( dst + 0, r0 );
+            _mm_storeu_ps( dst + 4, r1 );
+            _mm_storeu_ps( dst + 8, r2 );
+            _mm_storeu_ps( dst + 12, r3 );
+        }
+    };
+
+    /**
+     * 8-wide AVX2 operations.
+     * The transposes work within 128-bit lanes: vertices #0-3 are in the low lanes, vertices #4-7 are in the high lanes.
+     **/
+    struct SimdAVX2 {
+        typedef __m256  F;
+        typedef __m256i I;
+        static const uint32_t kWidth = 8;
+
+        static F Set1( float f ) { return _mm256_set1_ps( f ); }
+        static F Add( F a, F b ) { return _mm256_add_ps( a, b ); }
+        static F Sub( F a, F b ) { return _mm256_sub_ps( a, b ); }
+        static F Mul( F a, F b ) { return _mm256_mul_ps( a, b ); }
+        static F Div( F a, F b ) { return _mm256_div_ps( a, b ); }
+        static F Min( F a, F b ) { return _mm256_min_ps( a, b ); }
+        static F Max( F a, F b ) { return _mm256_max_ps( a, b ); }
+        static F Sqrt( F a ) { return _mm256_sqrt_ps( a ); }
+        static F Floor( F a ) { return _mm256_floor_ps( a ); }
+        static I Truncate( F a ) { return _mm256_cvttps_epi32( a ); }
+        static I Or( I a, I b ) { return _mm256_or_si256( a, b ); }
+
+        template < int Shift >
+        static I ShiftLeft( I a ) { return _mm256_slli_epi32( a, Shift ); }
+
+        static void Transpose( F& r0, F& r1, F& r2, F& r3 ) {
+            const F t0 = _mm256_unpacklo_ps( r0, r1 );
+            const F t1 = _mm256_unpacklo_ps( r2, r3 );
+            const F t2 = _mm256_unpackhi_ps( r0, r1 );
+            const F t3 = _mm256_unpackhi_ps( r2, r3 );
+            r0 = _mm256_shuffle_ps( t0, t1, _MM_SHUFFLE( 1, 0, 1, 0 ) );
+            r1 = _mm256_shuffle_ps( t0, t1, _MM_SHUFFLE( 3, 2, 3, 2 ) );
+            r2 = _mm256_shuffle_ps( t2, t3, _MM_SHUFFLE( 1, 0, 1, 0 ) );
+            r3 = _mm256_shuffle_ps( t2, t3, _MM_SHUFFLE( 3, 2, 3, 2 ) );
+        }
+
+        static F Load2( const float* lo, const float* hi ) {
+            return _mm256_insertf128_ps( _mm256_castps128_ps256( _mm_loadu_ps( lo ) ), _mm_loadu_ps( hi ), 1 );
+        }
+
+        /**
+         * Loads 8 vertices and transposes them to 12 component registers.
+         **/
+        static void Load( const float* vertices, F ( &soa )[ kStaticVertexFloatCount ] ) {
+            for ( uint32_t c = 0; c < kStaticVertexFloatCount; c += 4 ) {
+                F r0 = Load2( vertices + 0 * kStaticVertexFloatCount + c, vertices + 4 * kStaticVertexFloatCount + c );
+                F r1 = Load2( vertices + 1 * kStaticVertexFloatCount + c, vertices + 5 * kStaticVertexFloatCount + c );
+                F r2 = Load2( vertices + 2 * kStaticVertexFloatCount + c, vertices + 6 * kStaticVertexFloatCount + c );
+                F r3 = Load2( vertices + 3 * kStaticVertexFloatCount + c, vertices + 7 * kStaticVertexFloatCount + c );
+                Transpose( r0, r1, r2, r3 );
+                soa[ c + 0 ] = r0;
+                soa[ c + 1 ] = r1;
+                soa[ c + 2 ] = r2;
+                soa[ c + 3 ] = r3;
+            }
+        }
+
+        /**
+         * Transposes 4 packed attribute registers back to 8 packed vertices and stores them.
+         **/
+        static void Store( I position, I normal, I tangent, I uv, PackedVertexFb* packed ) {
+            F r[ 4 ] = {_mm256_castsi256_ps( position ),
+                        _mm256_castsi256_ps( normal ),
+                        _mm256_castsi256_ps( tangent ),
+                        _mm256_castsi256_ps( uv )};
+            Transpose( r[ 0 ], r[ 1 ], r[ 2 ], r[ 3 ] );
+
+            float* dst = reinterpret_cast< float* >( packed );
+            for ( uint32_t i = 0; i < 4; ++i ) {
+                _mm_storeu_ps( dst + i * 4, _mm256_castps256_ps128( r[ i ] ) );
+                _mm_storeu_ps( dst + ( i + 4 ) * 4, _mm256_extractf128_ps( r[ i ], 1 ) );
+            }
+        }
+    };
+
+    /**
+     * Unorm< N >( f ).Bits( ): round( clamp( f, 0, 1 ) * ( 2^N - 1 ) ).
+     * NaNs become zeros (max returns the second operand).
+     **/
+    template < typename TSimd >
+    typename TSimd::I Unorm( typename TSimd::F f, typename TSimd::F scale ) {
+        const typename TSimd::F zero = TSimd::Set1( 0.0f );
+        const typename TSimd::F one  = TSimd::Set1( 1.0f );
+        const typename TSimd::F half = TSimd::Set1( 0.5f );
+        return TSimd::Truncate( TSimd::Floor( TSimd::Add( TSimd::Mul( TSimd::Min( TSimd::Max( f, zero ), one ), scale ), half ) ) );
+    }
+
+    /**
+     * PackNormal_10_10_10_2( NormalizedPrecise( n ) ).
+     **/
+    template < typename TSimd >
+    typename TSimd::I PackNormal( typename TSimd::F x, typename TSimd::F y, typename TSimd::F z ) {
+        typedef typename TSimd::F F;
+
+        const F one         = TSimd::Set1( 1.0f );
+        const F half        = TSimd::Set1( 0.5f );
+        const F scale       = TSimd::Set1( 1023.0f );
+        const F lengthSq    = TSimd::Add( TSimd::Add( TSimd::Mul( x, x ), TSimd::Mul( y, y ) ), TSimd::Mul( z, z ) );
+        const F invLength   = TSimd::Div( one, TSimd::Sqrt( lengthSq ) );
+
+        const F nx = TSimd::Add( TSimd::Mul( TSimd::Mul( x, invLength ), half ), half );
+        const F ny = TSimd::Add( TSimd::Mul( TSimd::Mul( y, invLength ), half ), half );
+        const F nz = TSimd::Add( TSimd::Mul( TSimd::Mul( z, invLength ), half ), half );
+
+        return TSimd::Or( TSimd::Or( Unorm< TSimd >( nx, scale ),
+                                     TSimd::template ShiftLeft< 10 >( Unorm< TSimd >( ny, scale ) ) ),
+                          TSimd::template ShiftLeft< 20 >( Unorm< TSimd >( nz, scale ) ) );
+    }
+
+    /**
+     * Packs the vertices in batches of TSimd::kWidth.
+     * @return The number of the packed vertices, the rest should be packed with the scalar path.
+     **/
+    template < typename TSimd >
+    uint32_t PackKernel( const StaticVertexFb* vertices,
+                         PackedVertexFb*       packed,
+                         const uint32_t        vertexCount,
+                         const mathfu::vec3    positionMin,
+                         const mathfu::vec3    positionMax,
+                         const mathfu::vec2    texcoordsMin,
+                         const mathfu::vec2    texcoordsMax ) {
+        typedef typename TSimd::F F;
+        typedef typename TSimd::I I;
+
+        const mathfu::vec3 positionSize  = positionMax - positionMin;
+        const mathfu::vec2 texcoordsSize = texcoordsMax - texcoordsMin;
+
+        const F positionMinX  = TSimd::Set1( positionMin.x );
+        const F positionMinY  = TSimd::Set1( positionMin.y );
+        const F positionMinZ  = TSimd::Set1( positionMin.z );
+        const F positionSizeX = TSimd::Set1( positionSize.x );
+        const F positionSizeY = TSimd::Set1( positionSize.y );
+        const F positionSizeZ = TSimd::Set1( positionSize.z );
+        const F texcoordMinX  = TSimd::Set1( texcoordsMin.x );
+        const F texcoordMinY  = TSimd::Set1( texcoordsMin.y );
+        const F texcoordSizeX = TSimd::Set1( texcoordsSize.x );
+        const F texcoordSizeY = TSimd::Set1( texcoordsSize.y );
+        const F half          = TSimd::Set1( 0.5f );
+        const F scale2        = TSimd::Set1( 3.0f );
+        const F scale10       = TSimd::Set1( 1023.0f );
+        const F scale16       = TSimd::Set1( 65535.0f );
+
+        const uint32_t batchCount = vertexCount / TSimd::kWidth;
+        for ( uint32_t b = 0; b < batchCount; ++b ) {
+            F v[ kStaticVertexFloatCount ];
+            TSimd::Load( reinterpret_cast< const float* >( vertices + b * TSimd::kWidth ), v );
+
+            const I position = TSimd::Or(
+                TSimd::Or( Unorm< TSimd >( TSimd::Div( TSimd::Sub( v[ 0 ], positionMinX ), positionSizeX ), scale10 ),
+                           TSimd::template ShiftLeft< 10 >(
+                               Unorm< TSimd >( TSimd::Div( TSimd::Sub( v[ 1 ], positionMinY ), positionSizeY ), scale10 ) ) ),
+                TSimd::template ShiftLeft< 20 >(
+                    Unorm< TSimd >( TSimd::Div( TSimd::Sub( v[ 2 ], positionMinZ ), positionSizeZ ), scale10 ) ) );
+
+            const I normal = PackNormal< TSimd >( v[ 3 ], v[ 4 ], v[ 5 ] );
+
+            const I tangent = TSimd::Or( PackNormal< TSimd >( v[ 6 ], v[ 7 ], v[ 8 ] ),
+                                         TSimd::template ShiftLeft< 30 >(
+                                             Unorm< TSimd >( TSimd::Add( TSimd::Mul( v[ 9 ], half ), half ), scale2 ) ) );
+
+            const I uv = TSimd::Or(
+                Unorm< TSimd >( TSimd::Div( TSimd::Sub( v[ 10 ], texcoordMinX ), texcoordSizeX ), scale16 ),
+                TSimd::template ShiftLeft< 16 >(
+                    Unorm< TSimd >( TSimd::Div( TSimd::Sub( v[ 11 ], texcoordMinY ), texcoordSizeY ), scale16 ) ) );
+
+            TSimd::Store( position, normal, tangent, uv, packed + b * TSimd::kWidth );
+        }
+
+        return batchCount * TSimd::kWidth;
+    }
+
+    bool IsAVX2Supported( ) {
+        int info[ 4 ];
+        __cpuid( info, 0 );
+        if ( info[ 0 ] < 7 )
+            return false;
+
+        __cpuid( info, 1 );
+        const bool osxsave = ( info[ 2 ] & ( 1 << 27 ) ) != 0;
+        const bool avx     = ( info[ 2 ] & ( 1 << 28 ) ) != 0;
+        if ( !osxsave || !avx )
+            return false;
+
+        // The OS must save the YMM registers.
+        if ( ( _xgetbv( 0 ) & 6 ) != 6 )
+            return false;
+
+        __cpuidex( info, 7, 0 );
+        return ( info[ 1 ] & ( 1 << 5 ) ) != 0;
+    }
+
+    bool IsSSE41Supported( ) {
+        int info[ 4 ];
+        __cpuid( info, 1 );
+        return ( info[ 2 ] & ( 1 << 19 ) ) != 0;
+    }
+
+    enum EPackKernel {
+        ePackKernel_Scalar,
+        ePackKernel_SSE41,
+        ePackKernel_AVX2,
+    };
+
+    /**
+     * @return The best kernel the CPU supports (detected once).
+     **/
+    EPackKernel GetPackKernel( ) {
+        static const EPackKernel kernel = IsAVX2Supported( ) ? ePackKernel_AVX2
+                                                           : IsSSE41Supported( ) ? ePackKernel_SSE41 : ePackKernel_Scalar;
+        return kernel;
+    }
+}
+
+/**
+ * @return The name of the SIMD kernel used by PackSimd( ).
+ **/
+const char* GetPackSimdName( ) {
+    switch ( GetPackKernel( ) ) {
+        case ePackKernel_AVX2:
+            return "AVX2";
+        case ePackKernel_SSE41:
+            return "SSE4.1";
+        default:
+            return "scalar";
+    }
+}
+
+/**
+ * Packs the vertices with the best SIMD kernel the CPU supports.
+ * @return The number of the packed vertices (multiple of the kernel width), the rest should be packed with the scalar path.
+ **/
+uint32_t PackSimd( const StaticVertexFb* vertices,
+                   PackedVertexFb*       packed,
+                   const uint32_t        vertexCount,
+                   const mathfu::vec3    positionMin,
+                   const mathfu::vec3    positionMax,
+                   const mathfu::vec2    texcoordsMin,
+                   const mathfu::vec2    texcoordsMax ) {
+    switch ( GetPackKernel( ) ) {
+        case ePackKernel_AVX2:
+            return PackKernel< SimdAVX2 >( vertices, packed, vertexCount, positionMin, positionMax, texcoordsMin, texcoordsMax );
+        case ePackKernel_SSE41:
+            return PackKernel< SimdSSE41 >( vertices, packed, vertexCount, positionMin, positionMax, texcoordsMin, texcoordsMax );
+        default:
+            return 0;
+    }
+}
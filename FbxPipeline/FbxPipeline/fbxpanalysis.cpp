@@ -0,0 +1,418 @@
+#include <fbxppch.h>
+#include <fbxpstate.h>
+#include <fbxparena.h>
+#include <fbxpmeshopt.h>
+#include <fstream>
+#include <limits>
+#include <mutex>
+
+//
+// Mesh analysis (--analyze option): post-transform cache, overdraw and vertex fetch metrics of every subset,
+// measured before and after the optimization (-t). The report is written next to the output file as JSON.
+//  - ACMR (average cache miss ratio) is the number of the transformed vertices per triangle,
+//    ATVR (average transformed vertex ratio) is the number of the transformed vertices per unique vertex (1 is the best),
+//    both are measured for every cache model (FIFO or LRU of the given size, see --analyze-cache).
+//  - Overdraw is the number of the shaded pixels per covered pixel, the triangles are rasterized in their order
+//    with the depth test (no culling) into the orthographic views along the +-X, +-Y and +-Z axes.
+//  - Overfetch is the number of the bytes read from the vertex buffer (64-byte lines through the 16 KB direct-mapped cache,
+//    the post-transform cache is FIFO of 16 vertices) per unique vertex byte (1 is the best).
+// The cache and fetch simulations are shared with the optimization pass stats (see fbxpmeshopt.h).
+//
+
+namespace {
+    const uint32_t kViewCount      = 6;
+    const uint32_t kViewResolution = 256;
+
+    struct CacheModel {
+        std::string name;
+        uint32_t    size = 0;
+        bool        lru  = false;
+    };
+
+    struct CacheMetrics {
+        uint64_t misses = 0;
+    };
+
+    /**
+     * The metrics of the subset (or the sums for the mesh), the ratios are calculated when reported.
+     **/
+    struct SubsetMetrics {
+        uint64_t                    triangleCount = 0;
+        uint64_t                    vertexCount   = 0; // Unique vertices.
+        std::vector< CacheMetrics > caches;
+        uint64_t                    shadedPixels  = 0;
+        uint64_t                    coveredPixels = 0;
+        uint64_t                    fetchedBytes  = 0;
+        uint64_t                    vertexBytes   = 0;
+
+        void operator+=( SubsetMetrics const& other ) {
+            triangleCount += other.triangleCount;
+            vertexCount += other.vertexCount;
+            shadedPixels += other.shadedPixels;
+            coveredPixels += other.coveredPixels;
+            fetchedBytes += other.fetchedBytes;
+            vertexBytes += other.vertexBytes;
+
+            caches.resize( other.caches.size( ) );
+            for ( size_t i = 0; i < other.caches.size( ); ++i )
+                caches[ i ].misses += other.caches[ i ].misses;
+        }
+    };
+
+    struct StageMetrics {
+        std::string                  stage;
+        std::vector< SubsetMetrics > subsets;
+        SubsetMetrics                total;
+    };
+
+    struct MeshAnalysis {
+        std::string                 name;
+        uint32_t                    vertexCount = 0;
+        std::vector< StageMetrics > stages;
+    };
+
+    std::vector< CacheModel >   cacheModels;
+    std::vector< MeshAnalysis > meshAnalyses; // Indexed by the mesh id.
+    std::mutex                  meshAnalysesMutex;
+
+    inline double Ratio( uint64_t a, uint64_t b ) {
+        return b ? double( a ) / b : 0.0;
+    }
+
+    /**
+     * Rasterizes the triangles in their order into the views, counts the pixels that pass the depth test (shaded)
+     * and the pixels that have at least one triangle (covered).
+     * @param positions The mesh positions normalized to the unit cube.
+     **/
+    template < typename TIndex >
+    void Rasterize( apemode::ArenaVector< mathfu::vec3 > const& positions, const TIndex* indices, uint32_t indexCount, uint64_t& shadedPixels, uint64_t& coveredPixels ) {
+        const float kResolution = float( kViewResolution );
+
+        apemode::ArenaVector< float > depths( kViewResolution * kViewResolution );
+
+        for ( uint32_t view = 0; view < kViewCount; ++view ) {
+            // The view axis and the two screen axes, the odd views look in the opposite direction.
+            const uint32_t axis       = view / 2;
+            const uint32_t screenAxis = ( axis + 1 ) % 3;
+            const uint32_t upAxis     = ( axis + 2 ) % 3;
+            const bool     flip       = ( view & 1 ) != 0;
+
+            std::fill( depths.begin( ), depths.end( ), std::numeric_limits< float >::max( ) );
+
+            for ( uint32_t i = 0; i + 2 < indexCount; i += 3 ) {
+                float x[ 3 ], y[ 3 ], z[ 3 ];
+                for ( uint32_t k = 0; k < 3; ++k ) {
+                    const mathfu::vec3& p = positions[ indices[ i + k ] ];
+                    x[ k ] = p[ screenAxis ] * kResolution;
+                    y[ k ] = p[ upAxis ] * kResolution;
+                    z[ k ] = flip ? 1.0f - p[ axis ] : p[ axis ];
+                }
+
+                const float area = ( x[ 1 ] - x[ 0 ] ) * ( y[ 2 ] - y[ 0 ] ) - ( x[ 2 ] - x[ 0 ] ) * ( y[ 1 ] - y[ 0 ] );
+                if ( area == 0.0f )
+                    continue;
+
+                const int minX = std::max( 0, (int) std::floor( std::min( { x[ 0 ], x[ 1 ], x[ 2 ] } ) ) );
+                const int minY = std::max( 0, (int) std::floor( std::min( { y[ 0 ], y[ 1 ], y[ 2 ] } ) ) );
+                const int maxX = std::min( (int) kViewResolution - 1, (int) std::ceil( std::max( { x[ 0 ], x[ 1 ], x[ 2 ] } ) ) );
+                const int maxY = std::min( (int) kViewResolution - 1, (int) std::ceil( std::max( { y[ 0 ], y[ 1 ], y[ 2 ] } ) ) );
+
+                const float invArea = 1.0f / area;
+
+                for ( int py = minY; py <= maxY; ++py ) {
+                    for ( int px = minX; px <= maxX; ++px ) {
+                        // The barycentric coordinates of the pixel center (both windings are rasterized).
+                        const float cx = px + 0.5f;
+                        const float cy = py + 0.5f;
+                        const float b0 = ( ( x[ 1 ] - cx ) * ( y[ 2 ] - cy ) - ( x[ 2 ] - cx ) * ( y[ 1 ] - cy ) ) * invArea;
+                        const float b1 = ( ( x[ 2 ] - cx ) * ( y[ 0 ] - cy ) - ( x[ 0 ] - cx ) * ( y[ 2 ] - cy ) ) * invArea;
+                        const float b2 = 1.0f - b0 - b1;
+
+                        if ( b0 < 0.0f || b1 < 0.0f || b2 < 0.0f )
+                            continue;
+
+                        float& depth = depths[ py * kViewResolution + px ];
+                        const float pixelDepth = b0 * z[ 0 ] + b1 * z[ 1 ] + b2 * z[ 2 ];
+                        if ( pixelDepth < depth ) {
+                            depth = pixelDepth;
+                            ++shadedPixels;
+                        }
+                    }
+                }
+            }
+
+            coveredPixels += std::count_if( depths.begin( ), depths.end( ), []( float depth ) { return depth != std::numeric_limits< float >::max( ); } );
+        }
+    }
+
+    template < typename TIndex >
+    SubsetMetrics AnalyzeSubset( apemode::Mesh const& m, apemode::ArenaVector< mathfu::vec3 > const& positions, uint32_t baseIndex, uint32_t indexCount ) {
+        const TIndex* indices = reinterpret_cast< const TIndex* >( m.subsetIndices.data( ) ) + baseIndex;
+
+        SubsetMetrics metrics;
+        metrics.triangleCount = indexCount / 3;
+
+        apemode::ArenaVector< TIndex > uniqueVertices( indices, indices + indexCount );
+        std::sort( uniqueVertices.begin( ), uniqueVertices.end( ) );
+        metrics.vertexCount = std::unique( uniqueVertices.begin( ), uniqueVertices.end( ) ) - uniqueVertices.begin( );
+        metrics.vertexBytes = metrics.vertexCount * sizeof( apemodefb::StaticVertexFb );
+
+        for ( const auto& model : cacheModels ) {
+            metrics.caches.emplace_back( );
+            metrics.caches.back( ).misses = apemode::CountCacheMisses( indices, indexCount, model.size, model.lru );
+        }
+
+        Rasterize( positions, indices, indexCount, metrics.shadedPixels, metrics.coveredPixels );
+        metrics.fetchedBytes = apemode::CountFetchedBytes( indices, indexCount, sizeof( apemodefb::StaticVertexFb ) );
+        return metrics;
+    }
+
+    void WriteMetrics( std::ofstream& stream, SubsetMetrics const& metrics ) {
+        stream << "\"triangles\": " << metrics.triangleCount << ", \"vertices\": " << metrics.vertexCount << ", \"cache\": {";
+        for ( size_t i = 0; i < cacheModels.size( ); ++i ) {
+            stream << ( i ? ", " : " " ) << "\"" << cacheModels[ i ].name << "\": { \"acmr\": " << Ratio( metrics.caches[ i ].misses, metrics.triangleCount )
+                   << ", \"atvr\": " << Ratio( metrics.caches[ i ].misses, metrics.vertexCount ) << " }";
+        }
+        stream << " }, \"overdraw\": " << Ratio( metrics.shadedPixels, metrics.coveredPixels )
+               << ", \"overfetch\": " << Ratio( metrics.fetchedBytes, metrics.vertexBytes );
+    }
+
+    std::string EscapeJson( std::string const& value ) {
+        std::string escaped;
+        for ( const char c : value ) {
+            if ( c == '"' || c == '\\' ) {
+                escaped += '\\';
+                escaped += c;
+            } else if ( (unsigned char) c < 0x20 ) {
+                char code[ 8 ];
+                sprintf_s( code, "\\u%04x", (unsigned) c );
+                escaped += code;
+            } else {
+                escaped += c;
+            }
+        }
+        return escaped;
+    }
+}
+
+bool IsAnalysisEnabled( ) {
+    return apemode::Get( ).options[ "analyze" ].as< bool >( );
+}
+
+/**
+ * Parses the cache models (--analyze-cache) and reserves the mesh reports.
+ * Must be called before the meshes are processed.
+ **/
+void InitializeAnalysis( ) {
+    auto& s = apemode::Get( );
+
+    const std::string modelList = s.options.count( "analyze-cache" ) ? s.options[ "analyze-cache" ].as< std::string >( ) : "fifo16,fifo32,lru16";
+
+    cacheModels.clear( );
+    for ( size_t first = 0; first <= modelList.size( ); ) {
+        size_t last = modelList.find( ',', first );
+        if ( last == std::string::npos )
+            last = modelList.size( );
+
+        CacheModel model;
+        model.name = modelList.substr( first, last - first );
+        first = last + 1;
+
+        if ( model.name.empty( ) )
+            continue;
+
+        const size_t prefixLength = model.name.compare( 0, 4, "fifo" ) == 0 ? 4 : model.name.compare( 0, 3, "lru" ) == 0 ? 3 : 0;
+        model.lru  = prefixLength == 3;
+        model.size = prefixLength ? (uint32_t) atoi( model.name.c_str( ) + prefixLength ) : 0;
+
+        if ( 0 == model.size ) {
+            s.console->warn( "Unknown cache model \"{}\" (fifo<size> or lru<size>), skipped.", model.name );
+            continue;
+        }
+
+        cacheModels.push_back( model );
+    }
+
+    if ( cacheModels.empty( ) ) {
+        cacheModels.emplace_back( );
+        cacheModels.back( ).name = "fifo16";
+        cacheModels.back( ).size = 16;
+    }
+
+    meshAnalyses.clear( );
+    meshAnalyses.resize( s.meshes.size( ) );
+}
+
+/**
+ * Measures the subset metrics of the mesh (the LODs and the meshlets are not included).
+ * Can be used in multiple threads.
+ * @param stage The stage name ("before" and "after" the optimization).
+ **/
+template < typename TIndex >
+void AnalyzeMesh( apemode::Mesh const& m, uint32_t vertexCount, const char* meshName, const char* stage ) {
+    FBXP_PROFILE_ZONE( "Analyze mesh" );
+    const apemode::ArenaScope arenaScope( "Analyze mesh" );
+    auto& s = apemode::Get( );
+
+    // The mesh id is the slot of the mesh in the state.
+    const size_t meshId = &m - s.meshes.data( );
+    assert( meshId < meshAnalyses.size( ) );
+
+    // Normalize the positions to the unit cube (the views keep the mesh proportions).
+    const auto vertices = reinterpret_cast< const apemodefb::StaticVertexFb* >( m.vertices.data( ) );
+
+    const mathfu::vec3 positionMin( m.positionMin.x( ), m.positionMin.y( ), m.positionMin.z( ) );
+    const mathfu::vec3 positionMax( m.positionMax.x( ), m.positionMax.y( ), m.positionMax.z( ) );
+    const mathfu::vec3 extent    = positionMax - positionMin;
+    const float        maxExtent = std::max( { extent.x, extent.y, extent.z } );
+    const float        scale     = maxExtent > 0 ? 1.0f / maxExtent : 1.0f;
+
+    apemode::ArenaVector< mathfu::vec3 > positions( vertexCount );
+    for ( uint32_t i = 0; i < vertexCount; ++i ) {
+        const mathfu::vec3 position( vertices[ i ].position( ).x( ), vertices[ i ].position( ).y( ), vertices[ i ].position( ).z( ) );
+        positions[ i ] = ( position - positionMin ) * scale;
+    }
+
+    StageMetrics metrics;
+    metrics.stage = stage;
+    metrics.total.caches.resize( cacheModels.size( ) );
+    for ( const auto& subset : m.subsets ) {
+        metrics.subsets.push_back( AnalyzeSubset< TIndex >( m, positions, subset.base_index( ), subset.index_count( ) ) );
+        metrics.total += metrics.subsets.back( );
+    }
+
+    std::lock_guard< std::mutex > lock( meshAnalysesMutex );
+
+    MeshAnalysis& analysis = meshAnalyses[ meshId ];
+    analysis.name        = meshName;
+    analysis.vertexCount = vertexCount;
+    analysis.stages.push_back( std::move( metrics ) );
+}
+
+void AnalyzeMesh16( apemode::Mesh const& mesh, uint32_t vertexCount, const char* meshName, const char* stage ) {
+    AnalyzeMesh< uint16_t >( mesh, vertexCount, meshName, stage );
+}
+
+void AnalyzeMesh32( apemode::Mesh const& mesh, uint32_t vertexCount, const char* meshName, const char* stage ) {
+    AnalyzeMesh< uint32_t >( mesh, vertexCount, meshName, stage );
+}
+
+/**
+ * Moves the mesh reports to the mesh ids after the identical meshes are merged (see DeduplicateMeshes),
+ * so the report ids match NodeFb.mesh_id. The merged meshes have the same buffers, the first report is kept.
+ * @param meshRemap The unique mesh id of every original mesh id.
+ **/
+void RemapAnalysisMeshes( std::vector< uint32_t > const& meshRemap ) {
+    assert( meshRemap.size( ) == meshAnalyses.size( ) );
+
+    std::vector< MeshAnalysis > remappedAnalyses( meshAnalyses.size( ) );
+    size_t                      uniqueMeshCount = 0;
+
+    for ( size_t meshId = 0; meshId < meshAnalyses.size( ); ++meshId ) {
+        const uint32_t uniqueMeshId = meshRemap[ meshId ];
+        uniqueMeshCount = std::max< size_t >( uniqueMeshCount, uniqueMeshId + 1 );
+
+        if ( remappedAnalyses[ uniqueMeshId ].stages.empty( ) )
+            remappedAnalyses[ uniqueMeshId ] = std::move( meshAnalyses[ meshId ] );
+    }
+
+    remappedAnalyses.resize( uniqueMeshCount );
+    meshAnalyses = std::move( remappedAnalyses );
+}
+
+/**
+ * Prints the mesh metrics (for the first cache model) and writes the JSON report.
+ * @return True if written.
+ **/
+bool WriteAnalysisReport( std::string const& reportFile ) {
+    FBXP_PROFILE_ZONE( "Write analysis report" );
+    auto& s = apemode::Get( );
+
+    std::ofstream stream( reportFile );
+    if ( false == stream.good( ) ) {
+        s.console->error( "Failed to write the analysis report \"{}\".", reportFile );
+        return false;
+    }
+
+    stream << "{\n  \"input\": \"" << EscapeJson( s.inputFile ) << "\",\n";
+    stream << "  \"views\": " << kViewCount << ",\n  \"resolution\": " << kViewResolution << ",\n  \"cacheModels\": [";
+    for ( size_t i = 0; i < cacheModels.size( ); ++i )
+        stream << ( i ? ", " : " " ) << "{ \"name\": \"" << cacheModels[ i ].name << "\", \"size\": " << cacheModels[ i ].size
+               << ", \"replacement\": \"" << ( cacheModels[ i ].lru ? "lru" : "fifo" ) << "\" }";
+    stream << " ],\n  \"meshes\": [";
+
+    std::map< std::string, std::pair< SubsetMetrics, uint32_t > > totals; // Stage totals and the mesh counts.
+
+    bool firstMesh = true;
+    for ( size_t meshId = 0; meshId < meshAnalyses.size( ); ++meshId ) {
+        const MeshAnalysis& analysis = meshAnalyses[ meshId ];
+        if ( analysis.stages.empty( ) )
+            continue;
+
+        stream << ( firstMesh ? "\n" : ",\n" ) << "    { \"id\": " << meshId << ", \"name\": \"" << EscapeJson( analysis.name )
+               << "\", \"vertexCount\": " << analysis.vertexCount << ", \"stages\": {";
+        firstMesh = false;
+
+        for ( size_t i = 0; i < analysis.stages.size( ); ++i ) {
+            const StageMetrics& metrics = analysis.stages[ i ];
+            stream << ( i ? ",\n" : "\n" ) << "      \"" << metrics.stage << "\": {\n        \"total\": { ";
+            WriteMetrics( stream, metrics.total );
+            stream << " },\n        \"subsets\": [";
+            for ( size_t ss = 0; ss < metrics.subsets.size( ); ++ss ) {
+                stream << ( ss ? ",\n" : "\n" ) << "          { \"subset\": " << ss << ", ";
+                WriteMetrics( stream, metrics.subsets[ ss ] );
+                stream << " }";
+            }
+            stream << " ] }";
+
+            totals[ metrics.stage ].first += metrics.total;
+            ++totals[ metrics.stage ].second;
+        }
+
+        stream << " } }";
+
+        const SubsetMetrics& first = analysis.stages.front( ).total;
+        const SubsetMetrics& last  = analysis.stages.back( ).total;
+        s.console->info( "Mesh \"{}\" analysis ({} -> {}): ACMR ({}) {:.3f} -> {:.3f}, ATVR {:.3f} -> {:.3f}, overdraw {:.3f} -> {:.3f}, overfetch {:.3f} -> {:.3f}.",
+                         analysis.name,
+                         analysis.stages.front( ).stage,
+                         analysis.stages.back( ).stage,
+                         cacheModels.front( ).name,
+                         Ratio( first.caches.front( ).misses, first.triangleCount ),
+                         Ratio( last.caches.front( ).misses, last.triangleCount ),
+                         Ratio( first.caches.front( ).misses, first.vertexCount ),
+                         Ratio( last.caches.front( ).misses, last.vertexCount ),
+                         Ratio( first.shadedPixels, first.coveredPixels ),
+                         Ratio( last.shadedPixels, last.coveredPixels ),
+                         Ratio( first.fetchedBytes, first.vertexBytes ),
+                         Ratio( last.fetchedBytes, last.vertexBytes ) );
+    }
+
+    stream << "\n  ],\n  \"totals\": {";
+    for ( auto it = totals.begin( ); it != totals.end( ); ++it ) {
+        stream << ( it == totals.begin( ) ? "\n" : ",\n" ) << "    \"" << it->first << "\": { \"meshes\": " << it->second.second << ", ";
+        WriteMetrics( stream, it->second.first );
+        stream << " }";
+
+        const SubsetMetrics& total = it->second.first;
+        s.console->info( "Analysis ({}, {} mesh(es)): ACMR ({}) {:.3f}, ATVR {:.3f}, overdraw {:.3f}, overfetch {:.3f}.",
+                         it->first,
+                         it->second.second,
+                         cacheModels.front( ).name,
+                         Ratio( total.caches.front( ).misses, total.triangleCount ),
+                         Ratio( total.caches.front( ).misses, total.vertexCount ),
+                         Ratio( total.shadedPixels, total.coveredPixels ),
+                         Ratio( total.fetchedBytes, total.vertexBytes ) );
+    }
+    stream << "\n  }\n}\n";
+
+    meshAnalyses.clear( );
+
+    if ( false == stream.good( ) ) {
+        s.console->error( "Failed to write the analysis report \"{}\".", reportFile );
+        return false;
+    }
+
+    s.console->info( "Analysis report: \"{}\".", reportFile );
+    return true;
+}
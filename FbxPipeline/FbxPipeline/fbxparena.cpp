@@ -0,0 +1,190 @@
+#include <fbxppch.h>
+#include <fbxpstate.h>
+#include <fbxparena.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+
+#if FBXP_ARENA
+
+namespace {
+    /**
+     * The minimal block size, the larger allocations get the blocks of their size.
+     **/
+    const size_t kArenaBlockSize = 1 << 20;
+
+    /**
+     * The maximum size of the block kept by the worker when its last scope is closed.
+     **/
+    const size_t kArenaRetainedSize = 64 << 20;
+
+    /**
+     * The minimal alignment (SSE loads).
+     **/
+    const size_t kArenaAlignment = 16;
+
+    struct ArenaStageStats {
+        uint64_t scopeCount     = 0;
+        uint64_t allocatedBytes = 0;
+        uint64_t peakBytes      = 0;
+    };
+
+    std::atomic< bool >                       arenaStatsEnabled( false );
+    std::mutex                                arenaStatsMutex;
+    std::map< std::string, ArenaStageStats > arenaStageStats;
+    size_t                                    arenaReservedBytes = 0; // Maximum per worker.
+
+    thread_local apemode::Arena threadArena;
+}
+
+apemode::Arena::Arena( ) {
+}
+
+apemode::Arena::~Arena( ) {
+    for ( auto& block : blocks )
+        ::operator delete( block.data );
+}
+
+void* apemode::Arena::Allocate( size_t size, size_t alignment ) {
+    alignment = std::max( alignment, kArenaAlignment );
+
+    // The blocks after the current one are free, the ones that are too small are skipped.
+    for ( ; blockIndex < blocks.size( ); ++blockIndex, offset = 0 ) {
+        const uintptr_t address = ( reinterpret_cast< uintptr_t >( blocks[ blockIndex ].data + offset ) + alignment - 1 ) & ~( alignment - 1 );
+        const size_t    begin   = address - reinterpret_cast< uintptr_t >( blocks[ blockIndex ].data );
+
+        if ( begin + size <= blocks[ blockIndex ].size ) {
+            offset = begin + size;
+            usedBytes += size;
+            allocatedBytes += size;
+            peakBytes = std::max( peakBytes, usedBytes );
+            return blocks[ blockIndex ].data + begin;
+        }
+    }
+
+    Block block;
+    block.size = std::max( kArenaBlockSize, size + alignment );
+    block.data = static_cast< uint8_t* >( ::operator new( block.size ) );
+    blocks.push_back( block );
+
+    blockIndex = blocks.size( ) - 1;
+    offset     = 0;
+    return Allocate( size, alignment );
+}
+
+void apemode::Arena::Deallocate( void* p, size_t size ) {
+    if ( blockIndex < blocks.size( ) && static_cast< uint8_t* >( p ) + size == blocks[ blockIndex ].data + offset ) {
+        offset = static_cast< uint8_t* >( p ) - blocks[ blockIndex ].data;
+        usedBytes -= size;
+    }
+}
+
+apemode::Arena::Marker apemode::Arena::GetMarker( ) const {
+    return Marker{blockIndex, offset, usedBytes};
+}
+
+void apemode::Arena::Rewind( Marker const& marker ) {
+    blockIndex = marker.blockIndex;
+    offset     = marker.offset;
+    usedBytes  = marker.usedBytes;
+}
+
+void apemode::Arena::Trim( ) {
+    assert( 0 == usedBytes && 0 == blockIndex && 0 == offset );
+
+    if ( blocks.size( ) == 1 && blocks[ 0 ].size <= kArenaRetainedSize )
+        return;
+
+    const size_t retainedSize = std::min( GetReservedBytes( ), kArenaRetainedSize );
+
+    for ( auto& block : blocks )
+        ::operator delete( block.data );
+    blocks.clear( );
+
+    if ( retainedSize ) {
+        Block block;
+        block.size = retainedSize;
+        block.data = static_cast< uint8_t* >( ::operator new( block.size ) );
+        blocks.push_back( block );
+    }
+}
+
+size_t apemode::Arena::GetReservedBytes( ) const {
+    size_t reservedBytes = 0;
+    for ( auto& block : blocks )
+        reservedBytes += block.size;
+
+    return reservedBytes;
+}
+
+apemode::Arena* apemode::Arena::GetCurrent( ) {
+    return threadArena.scopeDepth ? &threadArena : nullptr;
+}
+
+apemode::ArenaScope::ArenaScope( const char* stage )
+    : arena( threadArena ), marker( threadArena.GetMarker( ) ), stage( stage ), outerPeakBytes( threadArena.peakBytes ), allocatedBytes( threadArena.allocatedBytes ) {
+    ++arena.scopeDepth;
+    arena.peakBytes = arena.usedBytes;
+}
+
+apemode::ArenaScope::~ArenaScope( ) {
+    if ( arenaStatsEnabled.load( std::memory_order_relaxed ) ) {
+        std::lock_guard< std::mutex > lock( arenaStatsMutex );
+
+        ArenaStageStats& stats = arenaStageStats[ stage ];
+        ++stats.scopeCount;
+        stats.allocatedBytes += arena.allocatedBytes - allocatedBytes;
+        stats.peakBytes = std::max< uint64_t >( stats.peakBytes, arena.peakBytes - marker.usedBytes );
+        arenaReservedBytes = std::max( arenaReservedBytes, arena.GetReservedBytes( ) );
+    }
+
+    arena.peakBytes = std::max( outerPeakBytes, arena.peakBytes );
+    arena.Rewind( marker );
+
+    if ( 0 == --arena.scopeDepth )
+        arena.Trim( );
+}
+
+#endif
+
+void InitializeArena( ) {
+    auto& s = apemode::Get( );
+
+#if FBXP_ARENA
+    arenaStatsEnabled = s.options[ "arena-stats" ].as< bool >( );
+#else
+    if ( s.options[ "arena-stats" ].as< bool >( ) )
+        s.console->warn( "Arena is disabled (FBXP_ARENA=0), no arena statistics." );
+#endif
+}
+
+/**
+ * Prints the number of scopes, the total allocated and the peak bytes of every stage (since the last call).
+ * The peak of the stage includes its nested stages.
+ **/
+void LogArenaStats( ) {
+#if FBXP_ARENA
+    if ( false == arenaStatsEnabled )
+        return;
+
+    std::lock_guard< std::mutex > lock( arenaStatsMutex );
+    if ( arenaStageStats.empty( ) )
+        return;
+
+    auto&        s    = apemode::Get( );
+    const double toMb = 1.0 / ( 1024.0 * 1024.0 );
+
+    s.console->info( "Arena: {:.1f} MB reserved (maximum per worker).", arenaReservedBytes * toMb );
+    s.console->info( "\t{:<28} {:>8} {:>12} {:>12}", "Stage", "Scopes", "Total, MB", "Peak, MB" );
+    for ( auto& stage : arenaStageStats ) {
+        s.console->info( "\t{:<28} {:>8} {:>12.1f} {:>12.1f}",
+                         stage.first,
+                         stage.second.scopeCount,
+                         stage.second.allocatedBytes * toMb,
+                         stage.second.peakBytes * toMb );
+    }
+
+    arenaStageStats.clear( );
+    arenaReservedBytes = 0;
+#endif
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <fbxppch.h>
+#include <vector>
+
+//
+// Per-worker arena for the temporaries of the mesh processing stages.
+// The stage opens a scope and allocates its temporaries as ArenaVector, the scope rewinds the arena on exit,
+// so the blocks are reused by the next stages and the next meshes of the worker.
+// The rules:
+//      - the arena vectors are created, resized and destroyed by the thread that opened the scope,
+//        the jobs can only read and write their elements;
+//      - the arena vectors must not outlive the scope and must not grow inside the nested scopes.
+// FBXP_ARENA=0 builds allocate the arena vectors with the system allocator (for the comparison).
+//
+
+#ifndef FBXP_ARENA
+#define FBXP_ARENA 1
+#endif
+
+namespace apemode {
+
+#if FBXP_ARENA
+
+    /**
+     * Monotonic allocator, the memory is allocated from the blocks with a bump pointer.
+     * The deallocation reclaims only the top allocation, the rest is reclaimed when the scope is rewound.
+     * Not thread-safe, every thread has its own arena.
+     **/
+    class Arena {
+    public:
+        struct Marker {
+            size_t blockIndex;
+            size_t offset;
+            size_t usedBytes;
+        };
+
+        Arena( );
+        ~Arena( );
+
+        void*  Allocate( size_t size, size_t alignment );
+        void   Deallocate( void* p, size_t size );
+        Marker GetMarker( ) const;
+        void   Rewind( Marker const& marker );
+
+        /**
+         * Merges the blocks to a single one (up to the retained size), so the next meshes
+         * of the similar size are allocated from a single block (the arena must be empty).
+         **/
+        void Trim( );
+
+        /**
+         * @return The sum of the block sizes.
+         **/
+        size_t GetReservedBytes( ) const;
+
+        /**
+         * @return The arena of the current thread if the thread has an open scope, nullptr otherwise.
+         **/
+        static Arena* GetCurrent( );
+
+    private:
+        friend class ArenaScope;
+
+        struct Block {
+            uint8_t* data;
+            size_t   size;
+        };
+
+        Arena( Arena const& ) = delete;
+        Arena& operator=( Arena const& ) = delete;
+
+        std::vector< Block > blocks;
+        size_t               blockIndex     = 0;
+        size_t               offset         = 0;
+        size_t               usedBytes      = 0;
+        size_t               peakBytes      = 0;
+        size_t               allocatedBytes = 0;
+        uint32_t             scopeDepth     = 0;
+    };
+
+    /**
+     * Opens the arena of the current thread, rewinds it on exit (releases the temporaries of the stage).
+     * The peak and the total bytes of the stage go to the statistics (see --arena-stats option).
+     * The stage must be a string literal.
+     **/
+    class ArenaScope {
+    public:
+        explicit ArenaScope( const char* stage );
+        ~ArenaScope( );
+
+    private:
+        ArenaScope( ArenaScope const& ) = delete;
+        ArenaScope& operator=( ArenaScope const& ) = delete;
+
+        Arena&        arena;
+        Arena::Marker marker;
+        const char*   stage;
+        size_t        outerPeakBytes;
+        size_t        allocatedBytes;
+    };
+
+    /**
+     * Allocates from the arena of the thread that created the allocator,
+     * falls back to the system allocator if the thread has no open scope.
+     **/
+    template < typename T >
+    class ArenaAllocator {
+    public:
+        typedef T value_type;
+
+        ArenaAllocator( ) : arena( Arena::GetCurrent( ) ) {
+        }
+
+        template < typename U >
+        ArenaAllocator( ArenaAllocator< U > const& other ) : arena( other.arena ) {
+        }
+
+        T* allocate( size_t n ) {
+            return static_cast< T* >( arena ? arena->Allocate( n * sizeof( T ), alignof( T ) ) : ::operator new( n * sizeof( T ) ) );
+        }
+
+        void deallocate( T* p, size_t n ) {
+            if ( arena )
+                arena->Deallocate( p, n * sizeof( T ) );
+            else
+                ::operator delete( p );
+        }
+
+        Arena* arena;
+    };
+
+    template < typename T, typename U >
+    bool operator==( ArenaAllocator< T > const& a, ArenaAllocator< U > const& b ) {
+        return a.arena == b.arena;
+    }
+
+    template < typename T, typename U >
+    bool operator!=( ArenaAllocator< T > const& a, ArenaAllocator< U > const& b ) {
+        return a.arena != b.arena;
+    }
+
+    template < typename T >
+    using ArenaVector = std::vector< T, ArenaAllocator< T > >;
+
+#else
+
+    class ArenaScope {
+    public:
+        explicit ArenaScope( const char* ) {
+        }
+    };
+
+    template < typename T >
+    using ArenaVector = std::vector< T >;
+
+#endif
+}
@@ -0,0 +1,362 @@
+#include <fbxppch.h>
+#include <fbxpstate.h>
+#include <chrono>
+#include <fstream>
+#include <numeric>
+#include <thread>
+
+std::string GetExecutable( );
+void ExportScene( FbxScene* pScene );
+void ConvertScene( FbxManager* lSdkManager, FbxScene* lScene, FbxString lFilePath );
+
+//
+// Batch conversion.
+// The files of the batch are converted one after another with the same FBX manager (plugins, IO settings)
+// and the same search file index, the state is reset between the files.
+// The FBX SDK is not thread-safe, so the large batches are split among the child processes,
+// every child process converts its part of the batch and writes the timings to the report file.
+//
+
+namespace {
+    /**
+     * The number of files a child process should have at least to pay off its startup cost.
+     **/
+    const uint32_t kMinFilesPerProcess = 4;
+
+    struct BatchFile {
+        std::string inputFile;
+        std::string outputFile;
+        uint64_t    size      = 0;
+        double      seconds   = 0;
+        bool        succeeded = false;
+    };
+
+    std::string Trim( std::string const& str ) {
+        const size_t first = str.find_first_not_of( " \t\r\n" );
+        if ( first == str.npos )
+            return "";
+
+        const size_t last = str.find_last_not_of( " \t\r\n" );
+        return str.substr( first, last - first + 1 );
+    }
+
+    double GetSecondsSince( std::chrono::steady_clock::time_point startTime ) {
+        return std::chrono::duration< double >( std::chrono::steady_clock::now( ) - startTime ).count( );
+    }
+
+    /**
+     * Reads the manifest file, every line is "input[|output]", empty lines and lines starting with '#' are skipped.
+     **/
+    bool ReadManifest( std::string const& manifestFile, std::vector< BatchFile >& files ) {
+        std::ifstream stream( manifestFile );
+        if ( !stream.good( ) ) {
+            apemode::Get( ).console->error( "Failed to read manifest \"{}\".", manifestFile );
+            return false;
+        }
+
+        std::string line;
+        while ( std::getline( stream, line ) ) {
+            line = Trim( line );
+            if ( line.empty( ) || line[ 0 ] == '#' )
+                continue;
+
+            BatchFile file;
+            const size_t separator = line.find( '|' );
+            file.inputFile = Trim( line.substr( 0, separator ) );
+            if ( separator != line.npos )
+                file.outputFile = Trim( line.substr( separator + 1 ) );
+
+            files.push_back( file );
+        }
+
+        return true;
+    }
+
+    /**
+     * Collects the -i/-o pairs and the manifest files.
+     **/
+    std::vector< BatchFile > GetBatchFiles( ) {
+        auto& s = apemode::Get( );
+
+        auto& inputFiles  = s.options[ "i" ].as< std::vector< std::string > >( );
+        auto& outputFiles = s.options[ "o" ].as< std::vector< std::string > >( );
+        if ( outputFiles.size( ) > inputFiles.size( ) )
+            s.console->warn( "There are more output files than input files, extra output files are ignored." );
+
+        std::vector< BatchFile > files( inputFiles.size( ) );
+        for ( size_t i = 0; i < inputFiles.size( ); ++i ) {
+            files[ i ].inputFile = inputFiles[ i ];
+            if ( i < outputFiles.size( ) )
+                files[ i ].outputFile = outputFiles[ i ];
+        }
+
+        const std::string manifestFile = s.options[ "manifest" ].as< std::string >( );
+        if ( false == manifestFile.empty( ) )
+            ReadManifest( manifestFile, files );
+
+        return files;
+    }
+
+    /**
+     * @return The number of processes to split the batch among, 1 means the batch is converted in this process.
+     **/
+    uint32_t GetBatchProcessCount( size_t fileCount ) {
+        auto& s = apemode::Get( );
+
+        // This is a child process of the batch.
+        if ( false == s.options[ "batch-report" ].as< std::string >( ).empty( ) )
+            return 1;
+
+        int processCount = s.options[ "batch-processes" ].as< int >( );
+        if ( processCount <= 0 ) {
+            const uint32_t coreCount = std::max( 1u, std::thread::hardware_concurrency( ) );
+            processCount = (int) std::min< size_t >( coreCount, ( fileCount + kMinFilesPerProcess - 1 ) / kMinFilesPerProcess );
+        }
+
+        return (uint32_t) std::max< size_t >( 1, std::min< size_t >( processCount, fileCount ) );
+    }
+
+    bool ConvertFile( BatchFile& file, bool convert, bool reset ) {
+        FBXP_PROFILE_ZONE_ARG( "Convert file", file.inputFile.c_str( ) );
+        auto& s = apemode::Get( );
+
+        const auto startTime = std::chrono::steady_clock::now( );
+
+        if ( reset )
+            s.Reset( );
+
+        s.inputFile  = file.inputFile;
+        s.outputFile = file.outputFile;
+        s.console->info( "Converting \"{}\".", file.inputFile );
+
+        file.succeeded = s.Load( );
+        if ( file.succeeded ) {
+            if ( convert ) {
+                ConvertScene( s.manager, s.scene, file.inputFile.c_str( ) );
+            } else {
+                ExportScene( s.scene );
+                file.succeeded = s.Finish( );
+            }
+        }
+
+        file.seconds = GetSecondsSince( startTime );
+        return file.succeeded;
+    }
+
+    /**
+     * Quotes the argument for the command line (see CommandLineToArgvW rules).
+     **/
+    std::string QuoteArgument( std::string const& arg ) {
+        if ( false == arg.empty( ) && arg.find_first_of( " \t\"" ) == arg.npos )
+            return arg;
+
+        std::string quoted = "\"";
+        size_t backslashCount = 0;
+        for ( char c : arg ) {
+            if ( c == '\\' ) {
+                ++backslashCount;
+            } else {
+                // Backslashes are only special before the quotes.
+                quoted.append( c == '"' ? backslashCount * 2 + 1 : backslashCount, '\\' );
+                quoted += c;
+                backslashCount = 0;
+            }
+        }
+
+        quoted.append( backslashCount * 2, '\\' );
+        quoted += '"';
+        return quoted;
+    }
+
+    /**
+     * @return The number of the arguments the batch option occupies (the option and its value),
+     *         0 if the argument is not a batch option. The batch options are replaced for the child processes.
+     **/
+    uint32_t GetBatchArgumentCount( std::string const& arg ) {
+        static const char* batchOptions[] = {
+            "-i", "--input-file", "-o", "--output-file", "--manifest", "--batch-processes", "--batch-report"};
+
+        for ( auto option : batchOptions ) {
+            const size_t optionLength = strlen( option );
+            if ( arg == option )
+                return 2;
+
+            // "--manifest=file" or "-ifile"
+            if ( 0 == arg.compare( 0, optionLength, option ) && ( arg[ optionLength ] == '=' || option[ 1 ] != '-' ) )
+                return 1;
+        }
+
+        return 0;
+    }
+
+    void WriteBatchReport( std::string const& reportFile, std::vector< BatchFile > const& files ) {
+        std::ofstream stream( reportFile );
+        for ( auto& file : files )
+            stream << file.seconds << ' ' << ( file.succeeded ? 1 : 0 ) << ' ' << file.inputFile << '\n';
+    }
+
+    /**
+     * Reads the report of the child process, the lines match the files of its manifest.
+     **/
+    void ReadBatchReport( std::string const& reportFile, std::vector< BatchFile >& files, std::vector< uint32_t > const& fileIndices ) {
+        std::ifstream stream( reportFile );
+
+        std::string line;
+        for ( auto fileIndex : fileIndices ) {
+            int succeeded = 0;
+            if ( !( stream >> files[ fileIndex ].seconds >> succeeded ) || !std::getline( stream, line ) )
+                break;
+
+            files[ fileIndex ].succeeded = succeeded != 0;
+        }
+    }
+
+    /**
+     * Splits the batch among the child processes and waits for them.
+     * The files are balanced by size (the largest files go first to the least loaded process).
+     **/
+    void RunBatchProcesses( std::vector< std::string > const& args, std::vector< BatchFile >& files, uint32_t processCount ) {
+        auto& s = apemode::Get( );
+
+        std::vector< uint32_t > fileOrder( files.size( ) );
+        std::iota( fileOrder.begin( ), fileOrder.end( ), 0 );
+
+        for ( auto& file : files ) {
+            const std::streamoff size = std::ifstream( file.inputFile, std::ios::binary | std::ios::ate ).tellg( );
+            file.size = (uint64_t) std::max< std::streamoff >( 0, size );
+        }
+
+        std::stable_sort( fileOrder.begin( ), fileOrder.end( ), [&]( uint32_t a, uint32_t b ) {
+            return files[ a ].size > files[ b ].size;
+        } );
+
+        std::vector< std::vector< uint32_t > > processFiles( processCount );
+        std::vector< uint64_t >                processSizes( processCount, 0 );
+        for ( auto fileIndex : fileOrder ) {
+            const size_t processIndex = std::min_element( processSizes.begin( ), processSizes.end( ) ) - processSizes.begin( );
+            processFiles[ processIndex ].push_back( fileIndex );
+            processSizes[ processIndex ] += files[ fileIndex ].size + 1;
+        }
+
+        //
+        // The child processes get the same options, except for the batch ones.
+        // The cores are shared among the processes unless the number of jobs is set explicitly.
+        //
+
+        std::string commandLine = QuoteArgument( GetExecutable( ) );
+        for ( size_t i = 1; i < args.size( ); ) {
+            if ( const uint32_t argumentCount = GetBatchArgumentCount( args[ i ] ) ) {
+                i += argumentCount;
+                continue;
+            }
+
+            commandLine += " " + QuoteArgument( args[ i++ ] );
+        }
+
+        if ( 0 == s.options.count( "j" ) ) {
+            const uint32_t coreCount = std::max( 1u, std::thread::hardware_concurrency( ) );
+            commandLine += " --jobs " + std::to_string( std::max( 1u, coreCount / processCount ) );
+        }
+
+        char tempPath[ MAX_PATH ] = {0};
+        GetTempPathA( MAX_PATH, tempPath );
+
+        const std::string tempFilePrefix = std::string( tempPath ) + "fbxp-batch-" + std::to_string( GetCurrentProcessId( ) ) + "-";
+
+        std::vector< PROCESS_INFORMATION > processes( processCount );
+        for ( uint32_t i = 0; i < processCount; ++i ) {
+            const std::string manifestFile = tempFilePrefix + std::to_string( i ) + ".txt";
+            const std::string reportFile   = tempFilePrefix + std::to_string( i ) + ".report";
+
+            {
+                std::ofstream stream( manifestFile );
+                for ( auto fileIndex : processFiles[ i ] )
+                    stream << files[ fileIndex ].inputFile << '|' << files[ fileIndex ].outputFile << '\n';
+            }
+
+            std::string processCommandLine = commandLine +
+                                             " --manifest " + QuoteArgument( manifestFile ) +
+                                             " --batch-report " + QuoteArgument( reportFile );
+
+            STARTUPINFOA startupInfo = {0};
+            startupInfo.cb           = sizeof( startupInfo );
+
+            if ( FALSE == CreateProcessA( nullptr, &processCommandLine[ 0 ], nullptr, nullptr, FALSE, 0, nullptr, nullptr, &startupInfo, &processes[ i ] ) ) {
+                s.console->error( "Failed to start batch process: {}", processCommandLine );
+                processes[ i ] = PROCESS_INFORMATION( );
+            }
+        }
+
+        s.console->info( "Started {} batch process(es).", processCount );
+
+        for ( uint32_t i = 0; i < processCount; ++i ) {
+            if ( processes[ i ].hProcess ) {
+                WaitForSingleObject( processes[ i ].hProcess, INFINITE );
+                CloseHandle( processes[ i ].hProcess );
+                CloseHandle( processes[ i ].hThread );
+            }
+
+            const std::string manifestFile = tempFilePrefix + std::to_string( i ) + ".txt";
+            const std::string reportFile   = tempFilePrefix + std::to_string( i ) + ".report";
+
+            // The files are reported as failed if the process has crashed.
+            ReadBatchReport( reportFile, files, processFiles[ i ] );
+            DeleteFileA( manifestFile.c_str( ) );
+            DeleteFileA( reportFile.c_str( ) );
+        }
+    }
+
+    void LogBatchSummary( std::vector< BatchFile > const& files, double seconds ) {
+        auto& s = apemode::Get( );
+
+        double   convertingSeconds = 0;
+        uint32_t failedCount       = 0;
+
+        s.console->info( "Batch summary:" );
+        for ( auto& file : files ) {
+            s.console->info( "{:>10.3f}s {} \"{}\"", file.seconds, file.succeeded ? "ok    " : "FAILED", file.inputFile );
+            convertingSeconds += file.seconds;
+            failedCount += file.succeeded ? 0 : 1;
+        }
+
+        s.console->info( "{} file(s), {} failed, {:.3f}s converting, {:.3f}s total.",
+                         files.size( ),
+                         failedCount,
+                         convertingSeconds,
+                         seconds );
+    }
+}
+
+/**
+ * Converts all the files of the batch (-i/-o pairs and manifest files).
+ * @param args The original command line arguments (forwarded to the child processes).
+ * @return The process exit code, 0 if all the files were converted.
+ **/
+int RunBatch( std::vector< std::string > const& args, bool convert ) {
+    auto& s = apemode::Get( );
+
+    std::vector< BatchFile > files = GetBatchFiles( );
+    if ( files.empty( ) ) {
+        s.console->error( "No input files." );
+        return 1;
+    }
+
+    const auto startTime = std::chrono::steady_clock::now( );
+
+    const uint32_t processCount = GetBatchProcessCount( files.size( ) );
+    if ( processCount > 1 ) {
+        RunBatchProcesses( args, files, processCount );
+    } else if ( s.Initialize( ) ) {
+        for ( size_t i = 0; i < files.size( ); ++i )
+            ConvertFile( files[ i ], convert, i != 0 );
+    }
+
+    const std::string reportFile = s.options[ "batch-report" ].as< std::string >( );
+    if ( false == reportFile.empty( ) )
+        WriteBatchReport( reportFile, files );
+    else if ( files.size( ) > 1 )
+        LogBatchSummary( files, GetSecondsSince( startTime ) );
+
+    const bool succeeded = std::all_of( files.begin( ), files.end( ), []( const BatchFile& file ) { return file.succeeded; } );
+    return succeeded ? 0 : 1;
+}
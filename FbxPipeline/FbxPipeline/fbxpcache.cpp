@@ -0,0 +1,315 @@
+#include <fbxppch.h>
+#include <fbxpstate.h>
+#include <city.h>
+#include <atomic>
+#include <fstream>
+#include <thread>
+
+//
+// Content-addressed cache of the processed meshes.
+// The key is the hash of the mesh source data and the options that affect mesh processing,
+// the value is the processed apemode::Mesh, stored as "<cache-dir>/<key>.fbxpmesh".
+//
+
+namespace {
+    const uint32_t kMeshCacheMagic   = 0x43505846; // "FXPC"
+    const uint32_t kMeshCacheVersion = 16;
+
+    std::atomic< uint32_t > meshCacheHits( 0 );
+    std::atomic< uint32_t > meshCacheMisses( 0 );
+
+    uint128 HashBytes( const void* data, size_t size, uint128 seed ) {
+        return CityHash128WithSeed( reinterpret_cast< const char* >( data ), size, seed );
+    }
+
+    template < typename T >
+    uint128 HashValue( const T& value, uint128 seed ) {
+        return HashBytes( &value, sizeof( T ), seed );
+    }
+
+    template < typename T >
+    uint128 HashVector( const std::vector< T >& values, uint128 seed ) {
+        seed = HashValue( (uint64_t) values.size( ), seed );
+        return values.empty( ) ? seed : HashBytes( values.data( ), values.size( ) * sizeof( T ), seed );
+    }
+
+    /**
+     * Appends the components of the element layer value (vector elements, see AppendElementValue( int ) for the smoothing).
+     **/
+    template < typename TValue >
+    void AppendElementValue( std::vector< double >& values, const TValue& value ) {
+        values.insert( values.end( ), value.mData, value.mData + sizeof( value.mData ) / sizeof( double ) );
+    }
+
+    /**
+     * Appends the edge or polygon smoothing flag (or group) of the smoothing element layer.
+     **/
+    void AppendElementValue( std::vector< double >& values, int value ) {
+        values.push_back( value );
+    }
+
+    /**
+     * Hashes mapping and reference modes, direct and index arrays of the element layer.
+     **/
+    template < typename TElementLayer >
+    uint128 HashElementLayer( const TElementLayer* elementLayer, uint128 seed ) {
+        if ( nullptr == elementLayer )
+            return HashValue( (int32_t) -1, seed );
+
+        seed = HashValue( (int32_t) elementLayer->GetMappingMode( ), seed );
+        seed = HashValue( (int32_t) elementLayer->GetReferenceMode( ), seed );
+
+        const auto& directArray = elementLayer->GetDirectArray( );
+        std::vector< double > values;
+        values.reserve( directArray.GetCount( ) * 4 );
+        for ( int i = 0; i < directArray.GetCount( ); ++i )
+            AppendElementValue( values, directArray.GetAt( i ) );
+
+        seed = HashVector( values, seed );
+
+        if ( elementLayer->GetReferenceMode( ) != FbxLayerElement::eDirect ) {
+            const auto& indexArray = elementLayer->GetIndexArray( );
+            std::vector< int > indices( indexArray.GetCount( ) );
+            for ( int i = 0; i < indexArray.GetCount( ); ++i )
+                indices[ i ] = indexArray.GetAt( i );
+
+            seed = HashVector( indices, seed );
+        }
+
+        return seed;
+    }
+
+    template < typename T >
+    void WriteValue( std::ofstream& stream, const T& value ) {
+        stream.write( reinterpret_cast< const char* >( &value ), sizeof( T ) );
+    }
+
+    template < typename T >
+    void WriteVector( std::ofstream& stream, const std::vector< T >& values ) {
+        WriteValue( stream, (uint64_t) values.size( ) );
+        if ( !values.empty( ) )
+            stream.write( reinterpret_cast< const char* >( values.data( ) ), values.size( ) * sizeof( T ) );
+    }
+
+    template < typename T >
+    bool ReadValue( std::ifstream& stream, T& value ) {
+        return !!stream.read( reinterpret_cast< char* >( &value ), sizeof( T ) );
+    }
+
+    /**
+     * @return The number of bytes from the current position to the end of the stream (0 if it fails).
+     **/
+    uint64_t GetRemainingSize( std::ifstream& stream ) {
+        const std::streamoff position = stream.tellg( );
+        if ( position < 0 || !stream.seekg( 0, std::ios::end ) )
+            return 0;
+
+        const std::streamoff size = stream.tellg( );
+        if ( size < position || !stream.seekg( position, std::ios::beg ) )
+            return 0;
+
+        return uint64_t( size - position );
+    }
+
+    /**
+     * Reads the size prefix and the elements.
+     * The size is checked against the remaining stream length, so the corrupted or truncated file
+     * fails to load (cache miss) instead of allocating the arbitrary size.
+     **/
+    template < typename T >
+    bool ReadVector( std::ifstream& stream, std::vector< T >& values ) {
+        uint64_t size = 0;
+        if ( !ReadValue( stream, size ) || size > GetRemainingSize( stream ) / sizeof( T ) )
+            return false;
+
+        values.resize( (size_t) size );
+        return values.empty( ) || !!stream.read( reinterpret_cast< char* >( values.data( ) ), values.size( ) * sizeof( T ) );
+    }
+
+    std::string GetCachedMeshPath( std::string const& key ) {
+        auto& s = apemode::Get( );
+
+        std::string cacheDirectory = s.options[ "cache-dir" ].as< std::string >( );
+        if ( cacheDirectory.back( ) != '/' && cacheDirectory.back( ) != '\\' )
+            cacheDirectory += '/';
+
+        return cacheDirectory + key + ".fbxpmesh";
+    }
+}
+
+bool IsMeshCacheEnabled( ) {
+    return false == apemode::Get( ).options[ "cache-dir" ].as< std::string >( ).empty( );
+}
+
+/**
+ * Creates the cache directory.
+ **/
+void InitializeMeshCache( ) {
+    auto& s = apemode::Get( );
+
+    if ( IsMeshCacheEnabled( ) ) {
+        const std::string cacheDirectory = s.options[ "cache-dir" ].as< std::string >( );
+        CreateDirectoryA( cacheDirectory.c_str( ), 0 );
+        s.console->info( "Mesh cache: \"{}\".", cacheDirectory );
+    }
+}
+
+/**
+ * Calculates the cache key of the mesh: control points, polygon vertices, layer elements,
+ * material mapping and the options that affect mesh processing.
+ * Can be used in multiple threads.
+ **/
+std::string GetMeshCacheKey( FbxMesh* mesh ) {
+    FBXP_PROFILE_ZONE( "Get mesh cache key" );
+    auto& s = apemode::Get( );
+
+    uint128 h( kMeshCacheMagic, kMeshCacheVersion );
+
+    h = HashValue( s.options[ "p" ].as< bool >( ), h );
+    h = HashValue( s.options[ "pack-octahedral" ].as< bool >( ), h );
+    h = HashValue( s.options[ "t" ].as< bool >( ), h );
+    h = HashValue( s.options.count( "optimize-passes" ) ? CityHash64( s.options[ "optimize-passes" ].as< std::string >( ).data( ), s.options[ "optimize-passes" ].as< std::string >( ).size( ) ) : 0, h );
+    h = HashValue( s.options[ "overdraw-threshold" ].as< float >( ), h );
+    h = HashValue( s.options[ "s" ].as< bool >( ), h );
+    h = HashValue( s.options[ "meshlets" ].as< bool >( ), h );
+    h = HashValue( s.options[ "lods" ].as< int >( ), h );
+    h = HashValue( s.options[ "lod-error" ].as< float >( ), h );
+    h = HashValue( s.options[ "compress-indices" ].as< bool >( ), h );
+    h = HashValue( s.options[ "c" ].as< bool >( ), h );
+    h = HashValue( s.options[ "compress-position-bits" ].as< int >( ), h );
+    h = HashValue( s.options[ "compress-normal-bits" ].as< int >( ), h );
+    h = HashValue( s.options[ "compress-texcoord-bits" ].as< int >( ), h );
+    h = HashValue( s.options.count( "compress-speed" ) ? s.options[ "compress-speed" ].as< int >( ) : -1, h );
+    h = HashValue( s.options[ "normals-crease-angle" ].as< float >( ), h );
+    h = HashValue( s.options.count( "normals-weighting" ) ? CityHash64( s.options[ "normals-weighting" ].as< std::string >( ).data( ), s.options[ "normals-weighting" ].as< std::string >( ).size( ) ) : 0, h );
+    h = HashValue( s.options[ "weld-epsilon" ].as< float >( ), h );
+
+    h = HashValue( mesh->GetNode( )->GetMaterialCount( ), h );
+    h = HashValue( mesh->GetPolygonCount( ), h );
+    h = HashBytes( mesh->GetControlPoints( ), sizeof( FbxVector4 ) * mesh->GetControlPointsCount( ), h );
+    h = HashBytes( mesh->GetPolygonVertices( ), sizeof( int ) * mesh->GetPolygonVertexCount( ), h );
+
+    h = HashElementLayer( mesh->GetElementUV( ), h );
+    h = HashElementLayer( mesh->GetElementNormal( ), h );
+    h = HashElementLayer( mesh->GetElementTangent( ), h );
+    h = HashElementLayer( mesh->GetElementSmoothing( ), h );
+
+    for ( int i = 0; i < mesh->GetElementMaterialCount( ); ++i ) {
+        const auto materialElement = mesh->GetElementMaterial( i );
+        const auto& materialIndices = materialElement->GetIndexArray( );
+
+        std::vector< int > indices( materialIndices.GetCount( ) );
+        for ( int j = 0; j < materialIndices.GetCount( ); ++j )
+            indices[ j ] = materialIndices.GetAt( j );
+
+        h = HashValue( (int32_t) materialElement->GetMappingMode( ), h );
+        h = HashVector( indices, h );
+    }
+
+    char key[ 33 ];
+    sprintf_s( key, "%016llx%016llx", (unsigned long long) Uint128High64( h ), (unsigned long long) Uint128Low64( h ) );
+    return key;
+}
+
+/**
+ * Loads the processed mesh from the cache.
+ * Can be used in multiple threads.
+ * @return True on cache hit.
+ **/
+bool LoadCachedMesh( std::string const& key, apemode::Mesh& m ) {
+    FBXP_PROFILE_ZONE( "Load cached mesh" );
+    std::ifstream stream( GetCachedMeshPath( key ), std::ios::binary );
+
+    uint32_t magic = 0, version = 0;
+    const bool loaded = stream.good( ) &&
+                        ReadValue( stream, magic ) && magic == kMeshCacheMagic &&
+                        ReadValue( stream, version ) && version == kMeshCacheVersion &&
+                        ReadValue( stream, m.hasTexcoords ) &&
+                        ReadValue( stream, m.positionMin ) &&
+                        ReadValue( stream, m.positionMax ) &&
+                        ReadValue( stream, m.positionOffset ) &&
+                        ReadValue( stream, m.positionScale ) &&
+                        ReadValue( stream, m.texcoordMin ) &&
+                        ReadValue( stream, m.texcoordMax ) &&
+                        ReadValue( stream, m.texcoordOffset ) &&
+                        ReadValue( stream, m.texcoordScale ) &&
+                        ReadVector( stream, m.submeshes ) &&
+                        ReadVector( stream, m.subsets ) &&
+                        ReadVector( stream, m.subsetsPolies ) &&
+                        ReadVector( stream, m.subsetIndices ) &&
+                        ReadVector( stream, m.vertices ) &&
+                        ReadVector( stream, m.indices ) &&
+                        ReadValue( stream, m.subsetIndexType ) &&
+                        ReadVector( stream, m.subsetLods ) &&
+                        ReadVector( stream, m.meshlets ) &&
+                        ReadVector( stream, m.meshletVertices ) &&
+                        ReadVector( stream, m.meshletIndices ) &&
+                        ReadVector( stream, m.draco );
+
+    if ( loaded ) {
+        ++meshCacheHits;
+        return true;
+    }
+
+    // Partially loaded mesh must not be used.
+    m = apemode::Mesh( );
+    ++meshCacheMisses;
+    return false;
+}
+
+/**
+ * Stores the processed mesh to the cache.
+ * The mesh is written to the temporary file first, so the concurrent exporters never read incomplete files.
+ * Can be used in multiple threads.
+ **/
+void StoreCachedMesh( std::string const& key, apemode::Mesh const& m ) {
+    FBXP_PROFILE_ZONE( "Store cached mesh" );
+    const std::string path     = GetCachedMeshPath( key );
+    const std::string tempPath = path + "." + std::to_string( std::hash< std::thread::id >( )( std::this_thread::get_id( ) ) );
+
+    {
+        std::ofstream stream( tempPath, std::ios::binary );
+        if ( !stream.good( ) ) {
+            apemode::Get( ).console->warn( "Failed to write mesh cache file \"{}\".", tempPath );
+            return;
+        }
+
+        WriteValue( stream, kMeshCacheMagic );
+        WriteValue( stream, kMeshCacheVersion );
+        WriteValue( stream, m.hasTexcoords );
+        WriteValue( stream, m.positionMin );
+        WriteValue( stream, m.positionMax );
+        WriteValue( stream, m.positionOffset );
+        WriteValue( stream, m.positionScale );
+        WriteValue( stream, m.texcoordMin );
+        WriteValue( stream, m.texcoordMax );
+        WriteValue( stream, m.texcoordOffset );
+        WriteValue( stream, m.texcoordScale );
+        WriteVector( stream, m.submeshes );
+        WriteVector( stream, m.subsets );
+        WriteVector( stream, m.subsetsPolies );
+        WriteVector( stream, m.subsetIndices );
+        WriteVector( stream, m.vertices );
+        WriteVector( stream, m.indices );
+        WriteValue( stream, m.subsetIndexType );
+        WriteVector( stream, m.subsetLods );
+        WriteVector( stream, m.meshlets );
+        WriteVector( stream, m.meshletVertices );
+        WriteVector( stream, m.meshletIndices );
+        WriteVector( stream, m.draco );
+    }
+
+    if ( FALSE == MoveFileExA( tempPath.c_str( ), path.c_str( ), MOVEFILE_REPLACE_EXISTING ) )
+        DeleteFileA( tempPath.c_str( ) );
+}
+
+void LogMeshCacheStats( ) {
+    if ( IsMeshCacheEnabled( ) ) {
+        const uint32_t hits   = meshCacheHits.exchange( 0 );
+        const uint32_t misses = meshCacheMisses.exchange( 0 );
+        apemode::Get( ).console->info( "Mesh cache: {} hit(s), {} miss(es) ({:.1f}% hit rate).",
+                                       hits,
+                                       misses,
+                                       ( hits + misses ) ? 100.0 * hits / ( hits + misses ) : 0.0 );
+    }
+}
@@ -0,0 +1,159 @@
+#include <fbxppch.h>
+#include <fbxpstate.h>
+#include <fbxpcontainer.h>
+#include <chrono>
+#include <fstream>
+
+//
+// Block-compressed container writer (--container option), the layout is described in fbxpcontainer.h.
+//
+
+namespace {
+    const uint32_t kDefaultContainerBlockSize = 256 * 1024;
+
+    struct PendingBlock {
+        const uint8_t*         data    = nullptr;
+        uint32_t               rawSize = 0;
+        apemode::ContainerBlock block;
+        std::vector< uint8_t > compressed;
+    };
+}
+
+bool IsContainerEnabled( ) {
+    return false == apemode::Get( ).options[ "container" ].as< std::string >( ).empty( );
+}
+
+/**
+ * Moves the byte vector from the scene FlatBuffer to the container section.
+ * The empty vectors are not moved.
+ * Can be used in multiple threads (called under the builder mutex).
+ **/
+void MoveToContainerSection( uint32_t type, uint32_t id, std::vector< uint8_t >& data ) {
+    if ( false == data.empty( ) ) {
+        auto& s = apemode::Get( );
+        s.pendingSections.emplace_back( );
+        s.pendingSections.back( ).type = type;
+        s.pendingSections.back( ).id   = id;
+        s.pendingSections.back( ).data.swap( data );
+    }
+}
+
+/**
+ * Splits the scene FlatBuffer and the pending sections into the blocks, compresses the blocks on the job pool
+ * and writes the container.
+ * @return True if written.
+ **/
+bool WriteContainer( const std::string& output, const uint8_t* sceneData, size_t sceneSize ) {
+    auto& s = apemode::Get( );
+
+    const std::string codec = s.options[ "container" ].as< std::string >( );
+    if ( codec != "lz4" && codec != "lz4hc" ) {
+        s.console->error( "Unknown container codec \"{}\" (lz4 or lz4hc).", codec );
+        return false;
+    }
+
+    const bool     strong    = codec == "lz4hc";
+    const int      blockSize = s.options[ "container-block-size" ].as< int >( );
+    const uint32_t maxBlock  = blockSize > 0 ? (uint32_t) blockSize * 1024 : kDefaultContainerBlockSize;
+
+    //
+    // Split the sections (the scene FlatBuffer is the first one) into the blocks.
+    //
+
+    std::vector< apemode::ContainerSection > sections;
+    std::vector< PendingBlock >              blocks;
+
+    auto addSection = [&]( uint32_t type, uint32_t id, const uint8_t* data, size_t size ) {
+        apemode::ContainerSection section;
+        section.type       = type;
+        section.id         = id;
+        section.firstBlock = (uint32_t) blocks.size( );
+        section.blockCount = 0;
+        section.rawSize    = size;
+
+        for ( size_t offset = 0; offset < size; offset += maxBlock ) {
+            blocks.emplace_back( );
+            blocks.back( ).data            = data + offset;
+            blocks.back( ).rawSize         = (uint32_t) std::min< size_t >( maxBlock, size - offset );
+            blocks.back( ).block.rawOffset = offset;
+            ++section.blockCount;
+        }
+
+        sections.push_back( section );
+    };
+
+    addSection( apemode::eContainerSection_Scene, 0, sceneData, sceneSize );
+    for ( const auto& pendingSection : s.pendingSections )
+        addSection( pendingSection.type, pendingSection.id, pendingSection.data.data( ), pendingSection.data.size( ) );
+
+    //
+    // Compress the blocks, the block is stored raw if it does not compress.
+    //
+
+    const auto compressStartTime = std::chrono::steady_clock::now( );
+
+    apemode::ParallelFor( *s.jobs, (uint32_t) blocks.size( ), [&]( uint32_t i ) {
+        PendingBlock& pendingBlock = blocks[ i ];
+        apemode::CompressLz4( pendingBlock.data, pendingBlock.rawSize, pendingBlock.compressed, strong );
+
+        pendingBlock.block.rawSize  = pendingBlock.rawSize;
+        pendingBlock.block.reserved = 0;
+        if ( pendingBlock.compressed.size( ) < pendingBlock.rawSize ) {
+            pendingBlock.block.codec          = apemode::eContainerCodec_LZ4;
+            pendingBlock.block.compressedSize = (uint32_t) pendingBlock.compressed.size( );
+        } else {
+            pendingBlock.block.codec          = apemode::eContainerCodec_None;
+            pendingBlock.block.compressedSize = pendingBlock.rawSize;
+            std::vector< uint8_t >( ).swap( pendingBlock.compressed );
+        }
+    } );
+
+    const auto compressTime = std::chrono::steady_clock::now( ) - compressStartTime;
+
+    //
+    // Write the tables and the blocks.
+    //
+
+    apemode::ContainerHeader header;
+    header.magic        = apemode::details::kContainerMagic;
+    header.version      = apemode::details::kContainerVersion;
+    header.sectionCount = (uint32_t) sections.size( );
+    header.blockCount   = (uint32_t) blocks.size( );
+
+    uint64_t offset = sizeof( header ) + sections.size( ) * sizeof( apemode::ContainerSection ) + blocks.size( ) * sizeof( apemode::ContainerBlock );
+    uint64_t rawSize = 0;
+    for ( auto& pendingBlock : blocks ) {
+        pendingBlock.block.offset = offset;
+        offset += pendingBlock.block.compressedSize;
+        rawSize += pendingBlock.rawSize;
+    }
+
+    std::ofstream stream( output, std::ios::binary );
+    if ( false == stream.good( ) )
+        return false;
+
+    stream.write( reinterpret_cast< const char* >( &header ), sizeof( header ) );
+    stream.write( reinterpret_cast< const char* >( sections.data( ) ), sections.size( ) * sizeof( apemode::ContainerSection ) );
+    for ( const auto& pendingBlock : blocks )
+        stream.write( reinterpret_cast< const char* >( &pendingBlock.block ), sizeof( apemode::ContainerBlock ) );
+    for ( const auto& pendingBlock : blocks ) {
+        if ( pendingBlock.block.codec == apemode::eContainerCodec_None )
+            stream.write( reinterpret_cast< const char* >( pendingBlock.data ), pendingBlock.rawSize );
+        else
+            stream.write( reinterpret_cast< const char* >( pendingBlock.compressed.data( ) ), pendingBlock.compressed.size( ) );
+    }
+
+    if ( false == stream.good( ) )
+        return false;
+
+    s.console->info( "Container ({}): {} section(s), {} block(s), {} bytes ({} bytes uncompressed, {:.1f}%), compressed in {:.1f} ms.",
+                     codec,
+                     sections.size( ),
+                     blocks.size( ),
+                     offset,
+                     rawSize,
+                     rawSize ? 100.0 * offset / rawSize : 0.0,
+                     std::chrono::duration_cast< std::chrono::microseconds >( compressTime ).count( ) * 1e-3 );
+
+    return true;
+}
@@ -0,0 +1,400 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+//
+// Block-compressed container (--container option).
+// The header has no dependencies, it is shared by the pipeline (writer) and the viewers (reader).
+//
+// The scene FlatBuffer and the large byte vectors (MeshFb.vertices, MeshFb.subset_indices, MeshFb.draco, FileFb.buffer)
+// are stored as the sections, the moved vectors are empty in the scene FlatBuffer.
+// Every section is split into the blocks that are compressed independently with the LZ4 block format
+// (the fast greedy compressor or the strong hash chain compressor, the decoder is the same),
+// so the reader decompresses only the sections it needs, and the blocks can be decompressed in parallel.
+// The block that does not compress is stored raw.
+//
+// Layout (little endian):
+//  header   : magic "FXPZ", version, section count, block count (uint32 each),
+//  sections : type, id, first block, block count (uint32 each), raw size (uint64),
+//  blocks   : codec, raw size, compressed size, reserved (uint32 each), offset in the file, offset in the section (uint64 each),
+//  block data.
+//
+
+namespace apemode {
+
+    enum EContainerSection : uint32_t {
+        eContainerSection_Scene,
+        eContainerSection_MeshVertices,
+        eContainerSection_MeshSubsetIndices,
+        eContainerSection_MeshDraco,
+        eContainerSection_FileBuffer,
+    };
+
+    enum EContainerCodec : uint32_t {
+        eContainerCodec_None,
+        eContainerCodec_LZ4,
+    };
+
+    struct ContainerHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t sectionCount;
+        uint32_t blockCount;
+    };
+
+    struct ContainerSection {
+        uint32_t type;
+        uint32_t id;
+        uint32_t firstBlock;
+        uint32_t blockCount;
+        uint64_t rawSize;
+    };
+
+    struct ContainerBlock {
+        uint32_t codec;
+        uint32_t rawSize;
+        uint32_t compressedSize;
+        uint32_t reserved;
+        uint64_t offset;
+        uint64_t rawOffset;
+    };
+
+    static_assert( sizeof( ContainerHeader ) == 16, "Must match the layout." );
+    static_assert( sizeof( ContainerSection ) == 24, "Must match the layout." );
+    static_assert( sizeof( ContainerBlock ) == 32, "Must match the layout." );
+
+    namespace details {
+        const uint32_t kContainerMagic      = 0x5a505846; // "FXPZ"
+        const uint32_t kContainerVersion    = 1;
+        const size_t   kLz4MinMatch         = 4;
+        const size_t   kLz4LastLiterals     = 5;  // The last 5 bytes are always literals.
+        const size_t   kLz4MatchStartMargin = 12; // The last match starts at least 12 bytes before the end.
+        const size_t   kLz4MaxDistance      = 65535;
+        const uint32_t kLz4HashBits         = 16;
+        const uint32_t kLz4NoPosition       = 0xffffffff;
+
+        inline uint32_t ReadUInt32( const uint8_t* p ) {
+            uint32_t value;
+            memcpy( &value, p, sizeof( value ) );
+            return value;
+        }
+
+        inline uint32_t HashLz4( const uint8_t* p ) {
+            return ( ReadUInt32( p ) * 2654435761u ) >> ( 32 - kLz4HashBits );
+        }
+
+        inline void WriteLz4Length( std::vector< uint8_t >& out, size_t length ) {
+            for ( ; length >= 255; length -= 255 )
+                out.push_back( 255 );
+            out.push_back( uint8_t( length ) );
+        }
+
+        /**
+         * Writes the sequence (the literals and the match), the last sequence has no match.
+         **/
+        inline void WriteLz4Sequence( std::vector< uint8_t >& out, const uint8_t* literals, size_t literalLength, size_t offset, size_t matchLength, bool last ) {
+            const size_t matchCode = last ? 0 : matchLength - kLz4MinMatch;
+            out.push_back( uint8_t( ( std::min< size_t >( literalLength, 15 ) << 4 ) | std::min< size_t >( matchCode, 15 ) ) );
+            if ( literalLength >= 15 )
+                WriteLz4Length( out, literalLength - 15 );
+
+            out.insert( out.end( ), literals, literals + literalLength );
+
+            if ( false == last ) {
+                out.push_back( uint8_t( offset ) );
+                out.push_back( uint8_t( offset >> 8 ) );
+                if ( matchCode >= 15 )
+                    WriteLz4Length( out, matchCode - 15 );
+            }
+        }
+    }
+
+    /**
+     * Compresses the bytes to the LZ4 block.
+     * The fast compressor checks the last position with the same hash and skips faster through the incompressible data,
+     * the strong compressor searches the hash chains for the longest match and checks if the next position has a longer one.
+     * @param maxAttempts The hash chain search depth of the strong compressor.
+     **/
+    inline void CompressLz4( const uint8_t* src, size_t size, std::vector< uint8_t >& out, bool strong, uint32_t maxAttempts = 64 ) {
+        using namespace details;
+
+        out.clear( );
+        out.reserve( size + size / 255 + 16 );
+
+        size_t anchor = 0;
+        if ( size > kLz4MatchStartMargin ) {
+            std::vector< uint32_t > head( size_t( 1 ) << kLz4HashBits, kLz4NoPosition );
+            std::vector< uint32_t > chain( strong ? kLz4MaxDistance + 1 : 0, kLz4NoPosition );
+
+            const size_t matchStartLimit = size - kLz4MatchStartMargin;
+            const size_t matchEndLimit   = size - kLz4LastLiterals;
+            size_t       insertPosition  = 0;
+
+            auto insert = [&]( size_t position ) {
+                const uint32_t h = HashLz4( src + position );
+                if ( strong )
+                    chain[ position & kLz4MaxDistance ] = head[ h ];
+                head[ h ] = (uint32_t) position;
+            };
+
+            // Returns the match length (0 if no match), the strong compressor inserts all the positions before.
+            auto findMatch = [&]( size_t position, size_t& matchPosition ) {
+                if ( strong ) {
+                    for ( ; insertPosition < position; ++insertPosition )
+                        insert( insertPosition );
+                }
+
+                size_t   bestLength = 0;
+                uint32_t candidate  = head[ HashLz4( src + position ) ];
+                for ( uint32_t attempt = 0; attempt < maxAttempts && candidate != kLz4NoPosition && position - candidate <= kLz4MaxDistance; ++attempt ) {
+                    if ( ReadUInt32( src + candidate ) == ReadUInt32( src + position ) ) {
+                        size_t length = kLz4MinMatch;
+                        while ( position + length < matchEndLimit && src[ candidate + length ] == src[ position + length ] )
+                            ++length;
+
+                        if ( length > bestLength ) {
+                            bestLength    = length;
+                            matchPosition = candidate;
+                        }
+                    }
+
+                    if ( false == strong )
+                        break;
+
+                    const uint32_t next = chain[ candidate & kLz4MaxDistance ];
+                    if ( next == kLz4NoPosition || next >= candidate )
+                        break;
+
+                    candidate = next;
+                }
+
+                if ( false == strong )
+                    insert( position );
+
+                return bestLength;
+            };
+
+            size_t position = 0;
+            while ( position <= matchStartLimit ) {
+                size_t matchPosition = 0;
+                size_t matchLength   = findMatch( position, matchPosition );
+
+                if ( 0 == matchLength ) {
+                    position += strong ? 1 : 1 + ( ( position - anchor ) >> 6 );
+                    continue;
+                }
+
+                // Lazy matching, the literal is emitted if the next position has a longer match.
+                while ( strong && position + 1 <= matchStartLimit ) {
+                    size_t nextMatchPosition = 0;
+                    size_t nextMatchLength   = findMatch( position + 1, nextMatchPosition );
+                    if ( nextMatchLength <= matchLength )
+                        break;
+
+                    ++position;
+                    matchLength   = nextMatchLength;
+                    matchPosition = nextMatchPosition;
+                }
+
+                while ( position > anchor && matchPosition > 0 && src[ position - 1 ] == src[ matchPosition - 1 ] ) {
+                    --position;
+                    --matchPosition;
+                    ++matchLength;
+                }
+
+                WriteLz4Sequence( out, src + anchor, position - anchor, position - matchPosition, matchLength, false );
+                position += matchLength;
+                anchor = position;
+
+                if ( false == strong && position - 2 <= matchStartLimit )
+                    insert( position - 2 );
+            }
+        }
+
+        WriteLz4Sequence( out, src + anchor, size - anchor, 0, 0, true );
+    }
+
+    /**
+     * Decompresses the LZ4 block, all the reads and writes are checked.
+     * @return True if the block is decoded to exactly dstSize bytes.
+     **/
+    inline bool DecompressLz4( const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize ) {
+        const uint8_t* ip   = src;
+        const uint8_t* iend = src + srcSize;
+        uint8_t*       op   = dst;
+        uint8_t*       oend = dst + dstSize;
+
+        auto readLength = [&]( size_t& length ) {
+            uint8_t value = 255;
+            while ( value == 255 ) {
+                if ( ip >= iend )
+                    return false;
+                value = *ip++;
+                length += value;
+            }
+            return true;
+        };
+
+        for ( ;; ) {
+            if ( ip >= iend )
+                return false;
+
+            const uint8_t token = *ip++;
+
+            size_t literalLength = token >> 4;
+            if ( literalLength == 15 && !readLength( literalLength ) )
+                return false;
+            if ( literalLength > size_t( iend - ip ) || literalLength > size_t( oend - op ) )
+                return false;
+
+            if ( literalLength )
+                memcpy( op, ip, literalLength );
+
+            op += literalLength;
+            ip += literalLength;
+
+            // The last sequence has only literals.
+            if ( ip == iend )
+                return op == oend;
+
+            if ( iend - ip < 2 )
+                return false;
+
+            const size_t offset = size_t( ip[ 0 ] ) | ( size_t( ip[ 1 ] ) << 8 );
+            ip += 2;
+
+            size_t matchLength = token & 15;
+            if ( matchLength == 15 && !readLength( matchLength ) )
+                return false;
+
+            matchLength += details::kLz4MinMatch;
+            if ( 0 == offset || offset > size_t( op - dst ) || matchLength > size_t( oend - op ) )
+                return false;
+
+            // The match can overlap the output (repeated patterns), the copied pattern is doubled every step.
+            const uint8_t* match = op - offset;
+            while ( matchLength ) {
+                const size_t length = std::min( matchLength, size_t( op - match ) );
+                memcpy( op, match, length );
+                op += length;
+                matchLength -= length;
+            }
+        }
+    }
+
+    /**
+     * Checks the container magic.
+     **/
+    inline bool IsContainer( const uint8_t* data, size_t size ) {
+        return size >= sizeof( ContainerHeader ) && details::ReadUInt32( data ) == details::kContainerMagic;
+    }
+
+    /**
+     * Reads the container tables and decompresses the sections and the blocks.
+     * The tables are validated in Open, the reader does not own the data.
+     * Decompression can be used in multiple threads.
+     **/
+    class ContainerReader {
+    public:
+        bool Open( const uint8_t* data, size_t size ) {
+            using namespace details;
+
+            this->data = data;
+            this->size = size;
+            sections.clear( );
+            blocks.clear( );
+
+            ContainerHeader header;
+            if ( false == IsContainer( data, size ) )
+                return false;
+
+            memcpy( &header, data, sizeof( header ) );
+            if ( header.version != kContainerVersion )
+                return false;
+
+            const uint64_t tablesSize = sizeof( ContainerHeader ) + uint64_t( header.sectionCount ) * sizeof( ContainerSection ) +
+                                        uint64_t( header.blockCount ) * sizeof( ContainerBlock );
+            if ( tablesSize > size )
+                return false;
+
+            sections.resize( header.sectionCount );
+            blocks.resize( header.blockCount );
+            if ( header.sectionCount )
+                memcpy( sections.data( ), data + sizeof( ContainerHeader ), sections.size( ) * sizeof( ContainerSection ) );
+            if ( header.blockCount )
+                memcpy( blocks.data( ), data + sizeof( ContainerHeader ) + sections.size( ) * sizeof( ContainerSection ), blocks.size( ) * sizeof( ContainerBlock ) );
+
+            for ( const auto& section : sections ) {
+                if ( uint64_t( section.firstBlock ) + section.blockCount > blocks.size( ) )
+                    return false;
+
+                uint64_t rawOffset = 0;
+                for ( uint32_t i = section.firstBlock; i < section.firstBlock + section.blockCount; ++i ) {
+                    const ContainerBlock& block = blocks[ i ];
+                    if ( block.rawOffset != rawOffset || block.offset < tablesSize || block.offset > size || block.compressedSize > size - block.offset )
+                        return false;
+                    if ( block.codec != eContainerCodec_None && block.codec != eContainerCodec_LZ4 )
+                        return false;
+                    if ( block.codec == eContainerCodec_None && block.compressedSize != block.rawSize )
+                        return false;
+                    // LZ4 cannot expand the data more than 255 times (protects from the huge allocations).
+                    if ( block.codec == eContainerCodec_LZ4 && block.rawSize / 255 > block.compressedSize )
+                        return false;
+
+                    rawOffset += block.rawSize;
+                }
+
+                if ( rawOffset != section.rawSize )
+                    return false;
+            }
+
+            return true;
+        }
+
+        const std::vector< ContainerSection >& GetSections( ) const {
+            return sections;
+        }
+
+        const ContainerSection* FindSection( uint32_t type, uint32_t id ) const {
+            for ( const auto& section : sections )
+                if ( section.type == type && section.id == id )
+                    return &section;
+            return nullptr;
+        }
+
+        /**
+         * Decompresses the block of the section to its position in the section data.
+         * @param blockIndex The block index in the section.
+         * @param sectionData The section data (ContainerSection.rawSize bytes).
+         **/
+        bool DecompressBlock( const ContainerSection& section, uint32_t blockIndex, uint8_t* sectionData ) const {
+            if ( blockIndex >= section.blockCount )
+                return false;
+
+            const ContainerBlock& block = blocks[ section.firstBlock + blockIndex ];
+            if ( block.codec == eContainerCodec_None ) {
+                memcpy( sectionData + block.rawOffset, data + block.offset, block.rawSize );
+                return true;
+            }
+
+            return DecompressLz4( data + block.offset, block.compressedSize, sectionData + block.rawOffset, block.rawSize );
+        }
+
+        bool DecompressSection( const ContainerSection& section, std::vector< uint8_t >& sectionData ) const {
+            sectionData.resize( (size_t) section.rawSize );
+            for ( uint32_t i = 0; i < section.blockCount; ++i )
+                if ( false == DecompressBlock( section, i, sectionData.data( ) ) )
+                    return false;
+            return true;
+        }
+
+    private:
+        const uint8_t*                  data = nullptr;
+        size_t                          size = 0;
+        std::vector< ContainerSection > sections;
+        std::vector< ContainerBlock >   blocks;
+    };
+}
@@ -0,0 +1,281 @@
+#include <fbxppch.h>
+#include <fbxpstate.h>
+#include <fbxparena.h>
+#include <fbxpdraco.h>
+#include <compression/encode.h>
+#include <atomic>
+#include <chrono>
+
+//
+// Draco mesh compression (-c option), the payload layout is described in fbxpdraco.h.
+// Every compressed mesh is compared to the raw packed format (PackedVertexFb vertices and the subset indices):
+// the size, the encoding time (Draco encoding vs packing) and the decoding time (Draco decoding vs copying).
+// The raw size is calculated, the raw format is only packed and copied for the timing with --analyze.
+//
+
+namespace {
+    std::atomic< uint64_t > dracoMeshCount( 0 );
+    std::atomic< uint64_t > dracoBytes( 0 );
+    std::atomic< uint64_t > dracoEncodeNanoseconds( 0 );
+    std::atomic< uint64_t > dracoDecodeNanoseconds( 0 );
+    std::atomic< uint64_t > rawPackedBytes( 0 );
+    std::atomic< uint64_t > rawPackNanoseconds( 0 );
+    std::atomic< uint64_t > rawCopyNanoseconds( 0 );
+
+    int GetQuantizationBits( const char* option, int defaultBits ) {
+        const int bits = apemode::Get( ).options[ option ].as< int >( );
+        return bits > 0 ? std::min( bits, 30 ) : defaultBits;
+    }
+
+    template < typename TDuration >
+    uint64_t ToNanoseconds( TDuration duration ) {
+        return (uint64_t) std::chrono::duration_cast< std::chrono::nanoseconds >( duration ).count( );
+    }
+}
+
+//
+// See implementation in fbxpanalysis.cpp.
+//
+
+bool IsAnalysisEnabled( );
+
+//
+// See implementation in fbxpacking.cpp.
+//
+
+void Pack( const apemodefb::StaticVertexFb* vertices,
+           apemodefb::PackedVertexFb*       packed,
+           const uint32_t                  vertexCount,
+           const mathfu::vec3              positionMin,
+           const mathfu::vec3              positionMax,
+           const mathfu::vec2              texcoordsMin,
+           const mathfu::vec2              texcoordsMax );
+
+/**
+ * Encodes the vertices and the subset indices to the Draco mesh payload (must be the last stage that touches them).
+ * The payload is decoded back (the decoding time goes to the report), the mesh stays uncompressed if it fails.
+ * Can be used in multiple threads.
+ * @param vertexCount The vertex count, the decoded vertex count on return.
+ * @return True if compressed.
+ **/
+template < typename TIndex >
+bool EncodeDracoMesh( apemode::Mesh& m, uint32_t& vertexCount, const char* meshName ) {
+    FBXP_PROFILE_ZONE( "Encode Draco mesh" );
+    const apemode::ArenaScope arenaScope( "Encode Draco mesh" );
+    auto& s = apemode::Get( );
+
+    const int positionBits = GetQuantizationBits( "compress-position-bits", 14 );
+    const int normalBits   = GetQuantizationBits( "compress-normal-bits", 10 );
+    const int texcoordBits = GetQuantizationBits( "compress-texcoord-bits", 12 );
+    const int speed        = s.options.count( "compress-speed" ) ? std::max( 0, std::min( 10, s.options[ "compress-speed" ].as< int >( ) ) ) : 5;
+
+    const apemodefb::StaticVertexFb* vertices   = reinterpret_cast< const apemodefb::StaticVertexFb* >( m.vertices.data( ) );
+    const TIndex*                    indices    = reinterpret_cast< const TIndex* >( m.subsetIndices.data( ) );
+    const size_t                     indexCount = m.subsetIndices.size( ) / sizeof( TIndex );
+
+    //
+    // Split the vertices shared by the subsets, every point must belong to a single subset.
+    //
+
+    apemode::ArenaVector< uint32_t > pointVertices;
+    apemode::ArenaVector< uint32_t > pointSubsets;
+    apemode::ArenaVector< uint32_t > corners( indexCount );
+    apemode::ArenaVector< uint32_t > vertexPoints( vertexCount, (uint32_t) -1 );
+    std::map< std::pair< uint32_t, uint32_t >, uint32_t > splitPoints;
+
+    pointVertices.reserve( vertexCount );
+    pointSubsets.reserve( vertexCount );
+
+    for ( uint32_t subsetId = 0; subsetId < (uint32_t) m.subsets.size( ); ++subsetId ) {
+        const auto& subset = m.subsets[ subsetId ];
+        for ( uint32_t i = subset.base_index( ); i < subset.base_index( ) + subset.index_count( ); ++i ) {
+            const uint32_t vertexId = (uint32_t) indices[ i ];
+
+            uint32_t pointId = vertexPoints[ vertexId ];
+            if ( pointId == (uint32_t) -1 || pointSubsets[ pointId ] != subsetId ) {
+                const auto splitPointIt = splitPoints.find( std::make_pair( vertexId, subsetId ) );
+                if ( pointId != (uint32_t) -1 && splitPointIt != splitPoints.end( ) ) {
+                    pointId = splitPointIt->second;
+                } else {
+                    pointId = (uint32_t) pointVertices.size( );
+                    pointVertices.push_back( vertexId );
+                    pointSubsets.push_back( subsetId );
+
+                    if ( vertexPoints[ vertexId ] == (uint32_t) -1 )
+                        vertexPoints[ vertexId ] = pointId;
+                    else
+                        splitPoints[ std::make_pair( vertexId, subsetId ) ] = pointId;
+                }
+            }
+
+            corners[ i ] = pointId;
+        }
+    }
+
+    //
+    // Fill the Draco mesh (the attribute order matters, see fbxpdraco.h).
+    //
+
+    const uint32_t pointCount = (uint32_t) pointVertices.size( );
+
+    draco::Mesh dracoMesh;
+    dracoMesh.set_num_points( pointCount );
+
+    auto addAttribute = [&]( draco::GeometryAttribute::Type type, int8_t componentCount, draco::DataType dataType, int64_t componentSize ) {
+        draco::GeometryAttribute attribute;
+        attribute.Init( type, nullptr, componentCount, dataType, false, componentCount * componentSize, 0 );
+        return dracoMesh.attribute( dracoMesh.AddAttribute( attribute, true, pointCount ) );
+    };
+
+    draco::PointAttribute* positions = addAttribute( draco::GeometryAttribute::POSITION, 3, draco::DT_FLOAT32, sizeof( float ) );
+    draco::PointAttribute* normals   = addAttribute( draco::GeometryAttribute::NORMAL, 3, draco::DT_FLOAT32, sizeof( float ) );
+    draco::PointAttribute* texcoords = addAttribute( draco::GeometryAttribute::TEX_COORD, 2, draco::DT_FLOAT32, sizeof( float ) );
+    draco::PointAttribute* tangents  = addAttribute( draco::GeometryAttribute::GENERIC, 4, draco::DT_FLOAT32, sizeof( float ) );
+    draco::PointAttribute* subsetIds = addAttribute( draco::GeometryAttribute::GENERIC, 1, draco::DT_UINT32, sizeof( uint32_t ) );
+
+    for ( uint32_t i = 0; i < pointCount; ++i ) {
+        const apemodefb::StaticVertexFb& vertex = vertices[ pointVertices[ i ] ];
+        const float position[] = {vertex.position( ).x( ), vertex.position( ).y( ), vertex.position( ).z( )};
+        const float normal[]   = {vertex.normal( ).x( ), vertex.normal( ).y( ), vertex.normal( ).z( )};
+        const float texcoord[] = {vertex.uv( ).x( ), vertex.uv( ).y( )};
+        const float tangent[]  = {vertex.tangent( ).x( ), vertex.tangent( ).y( ), vertex.tangent( ).z( ), vertex.tangent( ).w( )};
+
+        positions->SetAttributeValue( draco::AttributeValueIndex( i ), position );
+        normals->SetAttributeValue( draco::AttributeValueIndex( i ), normal );
+        texcoords->SetAttributeValue( draco::AttributeValueIndex( i ), texcoord );
+        tangents->SetAttributeValue( draco::AttributeValueIndex( i ), tangent );
+        subsetIds->SetAttributeValue( draco::AttributeValueIndex( i ), &pointSubsets[ i ] );
+    }
+
+    for ( size_t i = 0; i < indexCount; i += 3 ) {
+        draco::Mesh::Face face;
+        face[ 0 ] = draco::PointIndex( corners[ i + 0 ] );
+        face[ 1 ] = draco::PointIndex( corners[ i + 1 ] );
+        face[ 2 ] = draco::PointIndex( corners[ i + 2 ] );
+        dracoMesh.AddFace( face );
+    }
+
+    //
+    // Encode, decode and compare to the raw packed format.
+    //
+
+    draco::EncoderOptions options = draco::CreateDefaultEncoderOptions( );
+    draco::SetSpeedOptions( &options, speed, speed );
+    draco::SetNamedAttributeQuantization( &options, dracoMesh, draco::GeometryAttribute::POSITION, positionBits );
+    draco::SetNamedAttributeQuantization( &options, dracoMesh, draco::GeometryAttribute::NORMAL, normalBits );
+    draco::SetNamedAttributeQuantization( &options, dracoMesh, draco::GeometryAttribute::TEX_COORD, texcoordBits );
+    draco::SetAttributeQuantization( &options, dracoMesh.GetNamedAttributeId( draco::GeometryAttribute::GENERIC, 0 ), normalBits );
+
+    draco::EncoderBuffer buffer;
+
+    const auto encodeStartTime = std::chrono::steady_clock::now( );
+    const bool encoded = draco::EncodeMeshToBuffer( dracoMesh, options, &buffer );
+    const auto encodeTime = std::chrono::steady_clock::now( ) - encodeStartTime;
+
+    if ( false == encoded ) {
+        s.console->error( "Mesh \"{}\" Draco encoding failed (mesh is not compressed).", meshName );
+        return false;
+    }
+
+    std::vector< apemodefb::StaticVertexFb > decodedVertices;
+    std::vector< uint32_t >                  decodedIndices;
+
+    const auto decodeStartTime = std::chrono::steady_clock::now( );
+    const bool decoded = apemode::DecodeDracoMesh( reinterpret_cast< const uint8_t* >( buffer.data( ) ),
+                                                   buffer.size( ),
+                                                   m.subsets.data( ),
+                                                   m.subsets.size( ),
+                                                   decodedVertices,
+                                                   decodedIndices );
+    const auto decodeTime = std::chrono::steady_clock::now( ) - decodeStartTime;
+
+    if ( false == decoded ) {
+        s.console->error( "Mesh \"{}\" Draco round trip failed (mesh is not compressed).", meshName );
+        return false;
+    }
+
+    const size_t packedSize = vertexCount * sizeof( apemodefb::PackedVertexFb ) + m.subsetIndices.size( );
+
+    // The raw format is packed (a full extra pack of the mesh) for the timing comparison only.
+    if ( IsAnalysisEnabled( ) ) {
+        apemode::ArenaVector< uint8_t > packed( packedSize );
+
+        const auto packStartTime = std::chrono::steady_clock::now( );
+        Pack( vertices,
+              reinterpret_cast< apemodefb::PackedVertexFb* >( packed.data( ) ),
+              vertexCount,
+              mathfu::vec3( m.positionMin.x( ), m.positionMin.y( ), m.positionMin.z( ) ),
+              mathfu::vec3( m.positionMax.x( ), m.positionMax.y( ), m.positionMax.z( ) ),
+              mathfu::vec2( m.texcoordMin.x( ), m.texcoordMin.y( ) ),
+              mathfu::vec2( m.texcoordMax.x( ), m.texcoordMax.y( ) ) );
+        memcpy( packed.data( ) + vertexCount * sizeof( apemodefb::PackedVertexFb ), m.subsetIndices.data( ), m.subsetIndices.size( ) );
+        const auto packTime = std::chrono::steady_clock::now( ) - packStartTime;
+
+        // The raw packed payload is loaded with a single copy.
+        const auto copyStartTime = std::chrono::steady_clock::now( );
+        apemode::ArenaVector< uint8_t > loaded( packed );
+        const auto copyTime = std::chrono::steady_clock::now( ) - copyStartTime;
+
+        rawPackNanoseconds += ToNanoseconds( packTime );
+        rawCopyNanoseconds += ToNanoseconds( copyTime );
+    }
+
+    ++dracoMeshCount;
+    dracoBytes += buffer.size( );
+    dracoEncodeNanoseconds += ToNanoseconds( encodeTime );
+    dracoDecodeNanoseconds += ToNanoseconds( decodeTime );
+    rawPackedBytes += packedSize;
+
+    s.console->info( "Mesh \"{}\" Draco: {} bytes ({:.1f}% of {} packed bytes), {} points ({} split), encoded in {:.3f} ms, decoded in {:.3f} ms.",
+                     meshName,
+                     buffer.size( ),
+                     packedSize ? 100.0 * buffer.size( ) / packedSize : 0.0,
+                     packedSize,
+                     decodedVertices.size( ),
+                     pointCount - vertexCount,
+                     ToNanoseconds( encodeTime ) * 1e-6,
+                     ToNanoseconds( decodeTime ) * 1e-6 );
+
+    m.draco.assign( reinterpret_cast< const uint8_t* >( buffer.data( ) ), reinterpret_cast< const uint8_t* >( buffer.data( ) ) + buffer.size( ) );
+    std::vector< uint8_t >( ).swap( m.vertices );
+    std::vector< uint8_t >( ).swap( m.subsetIndices );
+
+    vertexCount = (uint32_t) decodedVertices.size( );
+    return true;
+}
+
+bool EncodeDracoMesh16( apemode::Mesh& mesh, uint32_t& vertexCount, const char* meshName ) {
+    return EncodeDracoMesh< uint16_t >( mesh, vertexCount, meshName );
+}
+
+bool EncodeDracoMesh32( apemode::Mesh& mesh, uint32_t& vertexCount, const char* meshName ) {
+    return EncodeDracoMesh< uint32_t >( mesh, vertexCount, meshName );
+}
+
+/**
+ * Prints the Draco vs raw packed comparison of all the compressed meshes (since the last call).
+ **/
+void LogDracoStats( ) {
+    const uint64_t meshes            = dracoMeshCount.exchange( 0 );
+    const uint64_t compressedBytes   = dracoBytes.exchange( 0 );
+    const uint64_t encodeNanoseconds = dracoEncodeNanoseconds.exchange( 0 );
+    const uint64_t decodeNanoseconds = dracoDecodeNanoseconds.exchange( 0 );
+    const uint64_t packedBytes       = rawPackedBytes.exchange( 0 );
+    const uint64_t packNanoseconds   = rawPackNanoseconds.exchange( 0 );
+    const uint64_t copyNanoseconds   = rawCopyNanoseconds.exchange( 0 );
+
+    if ( meshes ) {
+        auto& s = apemode::Get( );
+        s.console->info( "Draco: {} mesh(es).", meshes );
+        s.console->info( "|Format|Size (bytes)|Ratio|Encoding (ms)|Decoding (ms)|" );
+        if ( IsAnalysisEnabled( ) )
+            s.console->info( "|Packed|{}|100.0%|{:.3f}|{:.3f}|", packedBytes, packNanoseconds * 1e-6, copyNanoseconds * 1e-6 );
+        else
+            s.console->info( "|Packed|{}|100.0%|-|-|", packedBytes );
+        s.console->info( "|Draco|{}|{:.1f}%|{:.3f}|{:.3f}|",
+                         compressedBytes,
+                         packedBytes ? 100.0 * compressedBytes / packedBytes : 0.0,
+                         encodeNanoseconds * 1e-6,
+                         decodeNanoseconds * 1e-6 );
+    }
+}
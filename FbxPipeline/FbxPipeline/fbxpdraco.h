@@ -0,0 +1,104 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <compression/decode.h>
+#include <scene_generated.h>
+
+//
+// Draco mesh payload (MeshFb.draco, see the -c option).
+// The header is shared by the pipeline (round trip check) and the viewers (decoder).
+//
+// The payload is a single Draco mesh with the attributes:
+//  - POSITION (3 floats), NORMAL (3 floats), TEX_COORD (2 floats),
+//  - the first GENERIC attribute is the tangent (4 floats, w is the bitangent sign),
+//  - the second GENERIC attribute is the subset id (1 uint, the index in MeshFb.subsets).
+// Draco reorders the points and the faces, so the vertices shared by the subsets are split before encoding,
+// every point belongs to a single subset and the faces are grouped back by the subset id of their first corner.
+// The decoded indices match the subset ranges (the triangles are reordered within the subsets),
+// the decoded vertices are StaticVertexFb (SubmeshFb.vertex_count is the decoded vertex count).
+// The code uses the pre-1.0 Draco API (compression/encode.h and decode.h, EncoderOptions,
+// DecodeMeshFromBuffer returns unique_ptr), the submodule is pinned to 0.9.1 (see ThirdParty/CMakeDraco.sh),
+// Draco 1.0 replaced it with draco::Encoder and StatusOr.
+//
+
+namespace apemode {
+
+    /**
+     * Decodes the Draco mesh payload.
+     * Can be used in multiple threads.
+     * @param subsets The mesh subsets (MeshFb.subsets), the decoded indices are written to their ranges.
+     * @return True if decoded, false if the payload is corrupted or does not match the subsets.
+     **/
+    inline bool DecodeDracoMesh( const uint8_t*                            data,
+                                 size_t                                    size,
+                                 const apemodefb::SubsetFb*                subsets,
+                                 size_t                                    subsetCount,
+                                 std::vector< apemodefb::StaticVertexFb >& vertices,
+                                 std::vector< uint32_t >&                  indices ) {
+        draco::DecoderBuffer buffer;
+        buffer.Init( reinterpret_cast< const char* >( data ), size );
+
+        std::unique_ptr< draco::Mesh > mesh = draco::DecodeMeshFromBuffer( &buffer );
+        if ( nullptr == mesh )
+            return false;
+
+        const draco::PointAttribute* positions = mesh->GetNamedAttribute( draco::GeometryAttribute::POSITION );
+        const draco::PointAttribute* normals   = mesh->GetNamedAttribute( draco::GeometryAttribute::NORMAL );
+        const draco::PointAttribute* texcoords = mesh->GetNamedAttribute( draco::GeometryAttribute::TEX_COORD );
+        const draco::PointAttribute* tangents  = mesh->GetNamedAttribute( draco::GeometryAttribute::GENERIC, 0 );
+        const draco::PointAttribute* subsetIds = mesh->GetNamedAttribute( draco::GeometryAttribute::GENERIC, 1 );
+
+        if ( !positions || !normals || !texcoords || !tangents || !subsetIds )
+            return false;
+
+        vertices.resize( mesh->num_points( ) );
+        for ( draco::PointIndex i( 0 ); i < mesh->num_points( ); ++i ) {
+            float position[ 3 ];
+            float normal[ 3 ];
+            float tangent[ 4 ];
+            float texcoord[ 2 ];
+
+            positions->GetValue( positions->mapped_index( i ), position );
+            normals->GetValue( normals->mapped_index( i ), normal );
+            tangents->GetValue( tangents->mapped_index( i ), tangent );
+            texcoords->GetValue( texcoords->mapped_index( i ), texcoord );
+
+            vertices[ i.value( ) ] = apemodefb::StaticVertexFb( apemodefb::vec3( position[ 0 ], position[ 1 ], position[ 2 ] ),
+                                                                apemodefb::vec3( normal[ 0 ], normal[ 1 ], normal[ 2 ] ),
+                                                                apemodefb::vec4( tangent[ 0 ], tangent[ 1 ], tangent[ 2 ], tangent[ 3 ] ),
+                                                                apemodefb::vec2( texcoord[ 0 ], texcoord[ 1 ] ) );
+        }
+
+        // The write positions of the subsets.
+        std::vector< uint32_t > subsetCursors( subsetCount );
+        uint32_t                indexCount = 0;
+        for ( size_t i = 0; i < subsetCount; ++i ) {
+            subsetCursors[ i ] = subsets[ i ].base_index( );
+            indexCount         = std::max( indexCount, subsets[ i ].base_index( ) + subsets[ i ].index_count( ) );
+        }
+
+        if ( indexCount != mesh->num_faces( ) * 3 )
+            return false;
+
+        indices.resize( indexCount );
+        for ( draco::FaceIndex i( 0 ); i < mesh->num_faces( ); ++i ) {
+            const draco::Mesh::Face& face = mesh->face( i );
+
+            uint32_t subsetId = 0;
+            subsetIds->GetValue( subsetIds->mapped_index( face[ 0 ] ), &subsetId );
+
+            if ( subsetId >= subsetCount || subsetCursors[ subsetId ] + 3 > subsets[ subsetId ].base_index( ) + subsets[ subsetId ].index_count( ) )
+                return false;
+
+            uint32_t& cursor = subsetCursors[ subsetId ];
+            indices[ cursor++ ] = face[ 0 ].value( );
+            indices[ cursor++ ] = face[ 1 ].value( );
+            indices[ cursor++ ] = face[ 2 ].value( );
+        }
+
+        return true;
+    }
+}
@@ -39,30 +39,48 @@ std::string& RealPath( std::string& path ) {
     return path = std::filesystem::canonical( path ).string( );
 }
 
+/**
+ * @return The canonical path with the forward slashes, the directory paths always end with the slash
+ *         (canonicalization removes the trailing slash of the input, so it is appended after).
+ **/
 std::string ResolveFullPath( const char* path ) {
-    if ( std::filesystem::is_directory( path ) ) {
-        const size_t lastIndex = strlen( path ) - 1;
-        if ( path[ lastIndex ] != '\\' && path[ lastIndex ] != '/' )
-            return ReplaceSlashes( RealPath( std::filesystem::absolute( path ).string( ) ) ) + "/";
-    }
+    std::string fullPath = std::filesystem::absolute( path ).string( );
+    ReplaceSlashes( RealPath( fullPath ) );
+
+    if ( std::filesystem::is_directory( fullPath ) && ( fullPath.empty( ) || fullPath.back( ) != '/' ) )
+        fullPath += '/';
+
+    return fullPath;
+}
+
+std::string ToLowerCase( std::string str ) {
+    std::transform( str.begin( ), str.end( ), str.begin( ), []( char c ) { return (char) tolower( c ); } );
+    return str;
+}
 
-    return ReplaceSlashes( RealPath( std::filesystem::absolute( path ).string( ) ) );
+std::string GetExtension( const std::string& filename ) {
+    const size_t found = filename.find_last_of( '.' );
+    return found != filename.npos ? filename.substr( found + 1 ) : "";
 }
 
+/**
+ * Looks up the file by its name in the search file index (see InitializeSeachLocations).
+ * If there are multiple files with the same name, the one in the first search location wins.
+ * Falls back to the case-insensitive lookup.
+ **/
 std::string FindFile( const char* filepath ) {
     auto& s = apemode::Get( );
 
     assert( filepath && strlen( filepath ) );
     const std::string filename = GetFileName( filepath );
 
-    for ( auto& searchLocation : s.searchLocations ) {
-        for ( auto fileOrFolderPath : std::filesystem::directory_iterator( searchLocation ) ) {
-            if ( std::filesystem::is_regular_file( fileOrFolderPath ) &&
-                 fileOrFolderPath.path( ).filename( ) == filename ) {
-                return ResolveFullPath( fileOrFolderPath.path( ).string( ).c_str( ) );
-            }
-        }
-    }
+    auto it = s.searchFileIndex.find( filename );
+    if ( it != s.searchFileIndex.end( ) )
+        return s.searchFiles[ it->second ];
+
+    it = s.searchFileIndexLowerCase.find( ToLowerCase( filename ) );
+    if ( it != s.searchFileIndexLowerCase.end( ) )
+        return s.searchFiles[ it->second ];
 
     return "";
 }
@@ -71,17 +89,64 @@ std::vector< uint8_t > ReadFile( const char* filepath ) {
     const std::string fullpath = FindFile( filepath );
 
     if ( false == fullpath.empty( ) ) {
-        std::ifstream filestream( fullpath, std::ios::binary );
+        std::ifstream filestream( fullpath, std::ios::binary | std::ios::ate );
 
-        if ( filestream.good( ) )
-            return std::vector< uint8_t >( std::istreambuf_iterator< char >( filestream ),
-                                           std::istreambuf_iterator< char >( ) );
+        if ( filestream.good( ) ) {
+            std::vector< uint8_t > buffer( (size_t) std::max< std::streamoff >( 0, filestream.tellg( ) ) );
+            filestream.seekg( 0 );
+            filestream.read( reinterpret_cast< char* >( buffer.data( ) ), (std::streamsize) buffer.size( ) );
+
+            // The partial file is not exported.
+            if ( (size_t) filestream.gcount( ) != buffer.size( ) ) {
+                apemode::Get( ).console->error( "Failed to read file \"{}\", skipped.", fullpath );
+                return std::vector< uint8_t >( );
+            }
+
+            return buffer;
+        }
     }
 
     assert( false && "Failed to open file." );
     return std::vector< uint8_t >( );
 }
 
+/**
+ * Reads the file directly to the uninitialized builder vector (no intermediate buffer).
+ * @return The vector offset, or the null offset if the file cannot be (fully) read or is empty.
+ **/
+flatbuffers::Offset< flatbuffers::Vector< uint8_t > > ReadFile( const char* filepath, flatbuffers::FlatBufferBuilder& builder ) {
+    const std::string fullpath = FindFile( filepath );
+
+    if ( false == fullpath.empty( ) ) {
+        std::ifstream filestream( fullpath, std::ios::binary | std::ios::ate );
+
+        if ( filestream.good( ) ) {
+            const std::streamoff size = filestream.tellg( );
+            if ( size <= 0 )
+                return 0;
+
+            filestream.seekg( 0 );
+
+            uint8_t* data = nullptr;
+            const auto offset = builder.CreateUninitializedVector( (size_t) size, &data );
+            filestream.read( reinterpret_cast< char* >( data ), (std::streamsize) size );
+
+            // The vector is already in the builder and cannot be removed, it is zeroed (deterministic output)
+            // and left unreferenced, the partial file is not exported.
+            if ( filestream.gcount( ) != size ) {
+                apemode::Get( ).console->error( "Failed to read file \"{}\", skipped.", fullpath );
+                memset( data, 0, (size_t) size );
+                return 0;
+            }
+
+            return offset;
+        }
+    }
+
+    assert( false && "Failed to open file." );
+    return 0;
+}
+
 void InitializeSeachLocations( ) {
     auto& s = apemode::Get( );
     auto& sl = s.options[ "e" ].as< std::vector< std::string > >( );
@@ -92,8 +157,8 @@ void InitializeSeachLocations( ) {
 
         if ( d.size( ) > 4 ) {
             const size_t ds = d.size( );
-            addSubDirectories |= d.compare( ds - 3, 3, "\\**" );
-            addSubDirectories |= d.compare( ds - 3, 3, "/**" );
+            addSubDirectories |= 0 == d.compare( ds - 3, 3, "\\**" );
+            addSubDirectories |= 0 == d.compare( ds - 3, 3, "/**" );
 
             if ( addSubDirectories )
                 d = d.substr( 0, d.size( ) - 2 );
@@ -120,16 +185,69 @@ void InitializeSeachLocations( ) {
         s.console->info( "\t{}", l );
     }
 
+    //
+    // List and resolve the files of the search locations in parallel,
+    // then index them in the search location order (the first location wins).
+    // The indexed paths are canonical (the embedded file keys are stable).
+    //
+
+    struct SearchFile {
+        std::string filename;
+        std::string fullPath;
+    };
+
+    std::vector< std::vector< SearchFile > > searchLocationFiles( s.searchLocations.size( ) );
+    apemode::ParallelFor( *s.jobs, (uint32_t) s.searchLocations.size( ), [&]( uint32_t i ) {
+        for ( auto fileOrFolderPath : std::filesystem::directory_iterator( s.searchLocations[ i ] ) ) {
+            if ( std::filesystem::is_regular_file( fileOrFolderPath ) ) {
+                searchLocationFiles[ i ].push_back( SearchFile{fileOrFolderPath.path( ).filename( ).string( ),
+                                                               ResolveFullPath( fileOrFolderPath.path( ).string( ).c_str( ) )} );
+            }
+        }
+    } );
+
+    s.searchFiles.clear( );
+    s.searchFileIndex.clear( );
+    s.searchFileIndexLowerCase.clear( );
+    s.searchFileIndexByExtension.clear( );
+
+    for ( uint32_t i = 0; i < (uint32_t) s.searchLocations.size( ); ++i ) {
+        for ( auto& searchFile : searchLocationFiles[ i ] ) {
+            const std::string& filename  = searchFile.filename;
+            const uint32_t     fileIndex = (uint32_t) s.searchFiles.size( );
+            s.searchFiles.push_back( searchFile.fullPath );
+            s.searchFileIndex.emplace( filename, fileIndex );
+            s.searchFileIndexLowerCase.emplace( ToLowerCase( filename ), fileIndex );
+            s.searchFileIndexByExtension[ GetExtension( filename ) ].push_back( fileIndex );
+        }
+    }
+
+    s.console->info( "Indexed {} files.", s.searchFiles.size( ) );
+
+    //
+    // The patterns like ".*\.png" only need the files with the extension,
+    // the other patterns are matched against all the indexed files.
+    //
+
+    const std::regex extensionPattern( "\\.\\*\\\\\\.([A-Za-z0-9_]+)" );
+
     auto& ef = s.options[ "m" ].as< std::vector< std::string > >( );
     for ( auto f : ef ) {
-        std::regex pattern( f );
-        for ( auto& searchLocation : s.searchLocations ) {
-            for ( auto fileOrFolderPath : std::filesystem::directory_iterator( searchLocation ) ) {
-                if ( std::filesystem::is_regular_file( fileOrFolderPath ) &&
-                     std::regex_match( fileOrFolderPath.path( ).string( ), pattern ) ) {
-                    s.embedQueue.insert( ResolveFullPath( fileOrFolderPath.path( ).string( ).c_str( ) ) );
-                }
+        std::smatch extensionMatch;
+        if ( std::regex_match( f, extensionMatch, extensionPattern ) ) {
+            auto it = s.searchFileIndexByExtension.find( extensionMatch[ 1 ].str( ) );
+            if ( it != s.searchFileIndexByExtension.end( ) ) {
+                for ( auto fileIndex : it->second )
+                    s.embedPatternFiles.insert( s.searchFiles[ fileIndex ] );
+            }
+        } else {
+            const std::regex pattern( f );
+            for ( auto& file : s.searchFiles ) {
+                if ( std::regex_match( file, pattern ) )
+                    s.embedPatternFiles.insert( file );
             }
         }
     }
+
+    s.embedQueue = s.embedPatternFiles;
 }
\ No newline at end of file
@@ -0,0 +1,96 @@
+#include <fbxppch.h>
+#include <fbxpstate.h>
+#include <fbxparena.h>
+#include <fbxpindexcodec.h>
+#include <atomic>
+#include <chrono>
+
+namespace {
+    std::atomic< uint64_t > codecTriangleCount( 0 );
+    std::atomic< uint64_t > codecSourceBytes( 0 );
+    std::atomic< uint64_t > codecEncodedBytes( 0 );
+    std::atomic< uint64_t > codecDecodeNanoseconds( 0 );
+}
+
+/**
+ * Compresses the subset indices (see fbxpindexcodec.h), must be the last stage that touches the indices.
+ * The indices are decoded back and compared to the source ones (up to the triangle rotation),
+ * the indices stay uncompressed if the round trip fails.
+ * Can be used in multiple threads.
+ **/
+template < typename TIndex >
+void CompressIndices( apemode::Mesh& m, const char* meshName ) {
+    FBXP_PROFILE_ZONE( "Compress indices" );
+    const apemode::ArenaScope arenaScope( "Compress indices" );
+    auto& s = apemode::Get( );
+
+    const TIndex* indices    = reinterpret_cast< const TIndex* >( m.subsetIndices.data( ) );
+    const size_t  indexCount = m.subsetIndices.size( ) / sizeof( TIndex );
+
+    // The encoded indices are usually smaller than the source ones.
+    apemode::ArenaVector< uint8_t > encoded;
+    encoded.reserve( m.subsetIndices.size( ) );
+    apemode::EncodeIndices( indices, indexCount, encoded );
+
+    apemode::ArenaVector< TIndex > decoded( indexCount );
+
+    const auto decodeStartTime = std::chrono::steady_clock::now( );
+    bool roundTrip = apemode::DecodeIndices( encoded.data( ), encoded.size( ), decoded.data( ), indexCount );
+    const auto decodeTime = std::chrono::steady_clock::now( ) - decodeStartTime;
+
+    for ( size_t i = 0; i < indexCount && roundTrip; i += 3 ) {
+        roundTrip = ( decoded[ i ] == indices[ i + 0 ] && decoded[ i + 1 ] == indices[ i + 1 ] && decoded[ i + 2 ] == indices[ i + 2 ] ) ||
+                    ( decoded[ i ] == indices[ i + 1 ] && decoded[ i + 1 ] == indices[ i + 2 ] && decoded[ i + 2 ] == indices[ i + 0 ] ) ||
+                    ( decoded[ i ] == indices[ i + 2 ] && decoded[ i + 1 ] == indices[ i + 0 ] && decoded[ i + 2 ] == indices[ i + 1 ] );
+    }
+
+    if ( false == roundTrip ) {
+        s.console->error( "Mesh \"{}\" index codec round trip failed (indices are not compressed).", meshName );
+        return;
+    }
+
+    const uint64_t decodeNanoseconds = std::chrono::duration_cast< std::chrono::nanoseconds >( decodeTime ).count( );
+    const size_t   triangleCount     = indexCount / 3;
+
+    codecTriangleCount += triangleCount;
+    codecSourceBytes += m.subsetIndices.size( );
+    codecEncodedBytes += encoded.size( );
+    codecDecodeNanoseconds += decodeNanoseconds;
+
+    s.console->info( "Mesh \"{}\" indices: {} bytes ({} bytes uncompressed, {:.2f} bits per triangle, decoded in {:.3f} ms).",
+                     meshName,
+                     encoded.size( ),
+                     m.subsetIndices.size( ),
+                     triangleCount ? encoded.size( ) * 8.0 / triangleCount : 0.0,
+                     decodeNanoseconds * 1e-6 );
+
+    // The source index storage is reused.
+    m.subsetIndices.assign( encoded.begin( ), encoded.end( ) );
+    m.subsetIndexType = std::is_same< TIndex, uint16_t >::value ? apemodefb::EIndexTypeFb_UInt16Compressed : apemodefb::EIndexTypeFb_UInt32Compressed;
+}
+
+void CompressIndices16( apemode::Mesh& mesh, const char* meshName ) {
+    CompressIndices< uint16_t >( mesh, meshName );
+}
+
+void CompressIndices32( apemode::Mesh& mesh, const char* meshName ) {
+    CompressIndices< uint32_t >( mesh, meshName );
+}
+
+/**
+ * Prints the index compression ratio and the decoding throughput of all the meshes (since the last call).
+ **/
+void LogIndexCodecStats( ) {
+    const uint64_t triangles    = codecTriangleCount.exchange( 0 );
+    const uint64_t sourceBytes  = codecSourceBytes.exchange( 0 );
+    const uint64_t encodedBytes = codecEncodedBytes.exchange( 0 );
+    const uint64_t nanoseconds  = codecDecodeNanoseconds.exchange( 0 );
+
+    if ( triangles ) {
+        apemode::Get( ).console->info( "Indices: {} bytes ({} bytes uncompressed, {:.2f} bits per triangle), decoding {:.2f} GB/s.",
+                                       encodedBytes,
+                                       sourceBytes,
+                                       encodedBytes * 8.0 / triangles,
+                                       nanoseconds ? double( sourceBytes ) / nanoseconds : 0.0 );
+    }
+}
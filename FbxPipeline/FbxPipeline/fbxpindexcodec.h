@@ -0,0 +1,529 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+//
+// Index buffer codec (EIndexTypeFb_UInt16Compressed and EIndexTypeFb_UInt32Compressed).
+// The header has no dependencies, it is shared by the pipeline (encoder) and the viewers (decoder).
+//
+// The triangles are coded with the edge and vertex FIFOs (works best on the vertex cache optimized indices):
+//  - the triangle that shares the edge with one of the last 15 triangle edges is coded with the edge index,
+//    its third vertex is "next" (the next unseen vertex), one of the last 14 new vertices, or explicit.
+//  - otherwise all the three vertices are coded separately.
+// The code bytes (one per triangle) and the data bytes (varints) are stored in two sections,
+// every section is compressed with the order-0 byte-oriented rANS if it is smaller.
+// The decoded triangles can be rotated (the winding is preserved).
+//
+// Layout: version (byte), index count (varint), code section, data section.
+// Section: mode (byte, 0 - raw, 1 - rANS), raw size (varint),
+//          rANS only: symbol count (varint), symbol (byte) and frequency (varint) pairs,
+//          payload size (varint), payload.
+//
+
+namespace apemode {
+    namespace details {
+        const uint8_t  kIndexCodecVersion   = 1;
+        const uint32_t kIndexCodecFifoSize  = 16;
+        const uint8_t  kIndexCodecCodeNext3 = 0xf0; // Three next vertices.
+        const uint8_t  kIndexCodecCodeFree  = 0xff; // Three separately coded vertices.
+        const uint32_t kRansScaleBits       = 12;
+        const uint32_t kRansScale           = 1 << kRansScaleBits;
+        const uint32_t kRansLowerBound      = 1 << 23;
+
+        template < typename TBytes >
+        void WriteVarint( TBytes& out, uint64_t value ) {
+            while ( value >= 0x80 ) {
+                out.push_back( uint8_t( value | 0x80 ) );
+                value >>= 7;
+            }
+            out.push_back( uint8_t( value ) );
+        }
+
+        inline bool ReadVarint( const uint8_t*& data, const uint8_t* end, uint64_t& value ) {
+            value = 0;
+            for ( uint32_t shift = 0; shift < 64; shift += 7 ) {
+                if ( data == end )
+                    return false;
+
+                const uint8_t byte = *data++;
+                value |= uint64_t( byte & 0x7f ) << shift;
+                if ( 0 == ( byte & 0x80 ) )
+                    return true;
+            }
+
+            return false;
+        }
+
+        /**
+         * Ring buffers of the last edges and vertices, entry 0 is the most recent one.
+         **/
+        struct IndexCodecFifos {
+            uint32_t edges[ kIndexCodecFifoSize ][ 2 ];
+            uint32_t vertices[ kIndexCodecFifoSize ];
+            uint32_t edgeOffset   = 0;
+            uint32_t vertexOffset = 0;
+            uint32_t next         = 0;
+            uint32_t last         = 0;
+
+            IndexCodecFifos( ) {
+                memset( edges, 0xff, sizeof( edges ) );
+                memset( vertices, 0xff, sizeof( vertices ) );
+            }
+
+            void PushEdge( uint32_t a, uint32_t b ) {
+                edges[ edgeOffset & ( kIndexCodecFifoSize - 1 ) ][ 0 ] = a;
+                edges[ edgeOffset & ( kIndexCodecFifoSize - 1 ) ][ 1 ] = b;
+                ++edgeOffset;
+            }
+
+            const uint32_t* GetEdge( uint32_t i ) const {
+                return edges[ ( edgeOffset - 1 - i ) & ( kIndexCodecFifoSize - 1 ) ];
+            }
+
+            void PushVertex( uint32_t v ) {
+                vertices[ vertexOffset++ & ( kIndexCodecFifoSize - 1 ) ] = v;
+            }
+
+            uint32_t GetVertex( uint32_t i ) const {
+                return vertices[ ( vertexOffset - 1 - i ) & ( kIndexCodecFifoSize - 1 ) ];
+            }
+
+            uint32_t FindVertex( uint32_t v, uint32_t count ) const {
+                for ( uint32_t i = 0; i < count; ++i )
+                    if ( GetVertex( i ) == v )
+                        return i;
+                return uint32_t( -1 );
+            }
+        };
+
+        /**
+         * Vertex in the data stream: 0 - next, [1; 16] - vertex FIFO, 17 and above - zigzag delta to the last explicit vertex.
+         **/
+        template < typename TBytes >
+        void EncodeVertex( IndexCodecFifos& fifos, TBytes& data, uint32_t v ) {
+            if ( v == fifos.next ) {
+                WriteVarint( data, 0 );
+                fifos.PushVertex( fifos.next++ );
+            } else {
+                const uint32_t fifoIndex = fifos.FindVertex( v, kIndexCodecFifoSize );
+                if ( fifoIndex != uint32_t( -1 ) ) {
+                    WriteVarint( data, fifoIndex + 1 );
+                } else {
+                    const int32_t delta = int32_t( v - fifos.last );
+                    WriteVarint( data, 17 + uint64_t( ( uint32_t( delta ) << 1 ) ^ uint32_t( delta >> 31 ) ) );
+                    fifos.last = v;
+                    fifos.PushVertex( v );
+                }
+            }
+        }
+
+        inline bool DecodeVertex( IndexCodecFifos& fifos, const uint8_t*& data, const uint8_t* end, uint32_t& v ) {
+            uint64_t value;
+            if ( !ReadVarint( data, end, value ) )
+                return false;
+
+            if ( value == 0 ) {
+                v = fifos.next++;
+                fifos.PushVertex( v );
+            } else if ( value <= kIndexCodecFifoSize ) {
+                v = fifos.GetVertex( uint32_t( value - 1 ) );
+            } else {
+                const uint32_t zigzag = uint32_t( value - 17 );
+                v = fifos.last + uint32_t( ( zigzag >> 1 ) ^ ( 0u - ( zigzag & 1 ) ) );
+                fifos.last = v;
+                fifos.PushVertex( v );
+            }
+
+            return true;
+        }
+
+        /**
+         * Writes the section, compresses it with rANS if it is smaller.
+         * The temporaries are allocated with the allocator of the output.
+         **/
+        template < typename TBytes >
+        void WriteSection( TBytes& out, TBytes const& raw ) {
+            uint32_t counts[ 256 ] = {};
+            for ( const auto byte : raw )
+                ++counts[ byte ];
+
+            //
+            // Normalize the frequencies to the rANS scale, every present symbol must keep a non-zero frequency.
+            //
+
+            uint32_t frequencies[ 256 ] = {};
+            uint32_t starts[ 256 ]      = {};
+            uint32_t symbolCount        = 0;
+
+            if ( false == raw.empty( ) ) {
+                uint32_t sum = 0;
+                for ( uint32_t s = 0; s < 256; ++s ) {
+                    if ( counts[ s ] ) {
+                        frequencies[ s ] = std::max< uint32_t >( 1, uint32_t( uint64_t( counts[ s ] ) * kRansScale / raw.size( ) ) );
+                        sum += frequencies[ s ];
+                        ++symbolCount;
+                    }
+                }
+
+                while ( sum != kRansScale ) {
+                    uint32_t largest = 0;
+                    for ( uint32_t s = 1; s < 256; ++s )
+                        if ( frequencies[ s ] > frequencies[ largest ] )
+                            largest = s;
+
+                    if ( sum < kRansScale ) {
+                        frequencies[ largest ] += kRansScale - sum;
+                        sum = kRansScale;
+                    } else {
+                        const uint32_t decrement = std::min( sum - kRansScale, frequencies[ largest ] - 1 );
+                        frequencies[ largest ] -= decrement;
+                        sum -= decrement;
+                    }
+                }
+
+                for ( uint32_t s = 1; s < 256; ++s )
+                    starts[ s ] = starts[ s - 1 ] + frequencies[ s - 1 ];
+            }
+
+            //
+            // Encode in the reverse order, the decoder reads the reversed bytes forward.
+            //
+
+            TBytes payload( out.get_allocator( ) );
+            if ( symbolCount ) {
+                payload.reserve( raw.size( ) / 2 + 16 );
+
+                uint32_t x = kRansLowerBound;
+                for ( size_t i = raw.size( ); i > 0; --i ) {
+                    const uint8_t  s    = raw[ i - 1 ];
+                    const uint32_t xMax = ( ( kRansLowerBound >> kRansScaleBits ) << 8 ) * frequencies[ s ];
+                    while ( x >= xMax ) {
+                        payload.push_back( uint8_t( x ) );
+                        x >>= 8;
+                    }
+
+                    x = ( ( x / frequencies[ s ] ) << kRansScaleBits ) + ( x % frequencies[ s ] ) + starts[ s ];
+                }
+
+                for ( uint32_t i = 0; i < 4; ++i, x >>= 8 )
+                    payload.push_back( uint8_t( x ) );
+
+                std::reverse( payload.begin( ), payload.end( ) );
+            }
+
+            TBytes table( out.get_allocator( ) );
+            WriteVarint( table, symbolCount );
+            for ( uint32_t s = 0; s < 256; ++s ) {
+                if ( frequencies[ s ] ) {
+                    table.push_back( uint8_t( s ) );
+                    WriteVarint( table, frequencies[ s ] );
+                }
+            }
+
+            const bool compressed = symbolCount && ( table.size( ) + payload.size( ) < raw.size( ) );
+            out.push_back( compressed ? 1 : 0 );
+            WriteVarint( out, raw.size( ) );
+
+            if ( compressed ) {
+                out.insert( out.end( ), table.begin( ), table.end( ) );
+                WriteVarint( out, payload.size( ) );
+                out.insert( out.end( ), payload.begin( ), payload.end( ) );
+            } else {
+                WriteVarint( out, raw.size( ) );
+                out.insert( out.end( ), raw.begin( ), raw.end( ) );
+            }
+        }
+
+        /**
+         * Reads the section, the raw sections are not copied.
+         * @param maxSize The maximum section size, the larger (corrupted) sections are rejected before the allocation.
+         * @param decoded The storage for the decompressed section.
+         * @param sectionData Set to the section bytes (raw or decompressed).
+         **/
+        inline bool ReadSection( const uint8_t*&          data,
+                                 const uint8_t*           end,
+                                 size_t                   maxSize,
+                                 std::vector< uint8_t >&  decoded,
+                                 const uint8_t*&          sectionData,
+                                 size_t&                  sectionSize ) {
+            if ( data == end )
+                return false;
+
+            const uint8_t mode = *data++;
+
+            uint64_t rawSize;
+            if ( mode > 1 || !ReadVarint( data, end, rawSize ) || rawSize > maxSize )
+                return false;
+
+            uint32_t frequencies[ 256 ] = {};
+            uint32_t starts[ 256 ]      = {};
+
+            if ( mode == 1 ) {
+                uint64_t symbolCount, sum = 0;
+                if ( !ReadVarint( data, end, symbolCount ) || symbolCount > 256 )
+                    return false;
+
+                for ( uint64_t i = 0; i < symbolCount; ++i ) {
+                    uint64_t frequency;
+                    if ( data == end )
+                        return false;
+
+                    // Every symbol is listed once.
+                    const uint8_t s = *data++;
+                    if ( frequencies[ s ] || !ReadVarint( data, end, frequency ) || frequency == 0 || frequency > kRansScale )
+                        return false;
+
+                    frequencies[ s ] = uint32_t( frequency );
+                    sum += frequency;
+                }
+
+                if ( sum != kRansScale )
+                    return false;
+
+                for ( uint32_t s = 1; s < 256; ++s )
+                    starts[ s ] = starts[ s - 1 ] + frequencies[ s - 1 ];
+            }
+
+            uint64_t payloadSize;
+            if ( !ReadVarint( data, end, payloadSize ) || payloadSize > uint64_t( end - data ) )
+                return false;
+
+            const uint8_t* payload = data;
+            data += payloadSize;
+
+            if ( mode == 0 ) {
+                if ( payloadSize != rawSize )
+                    return false;
+
+                sectionData = payload;
+                sectionSize = size_t( rawSize );
+                return true;
+            }
+
+            if ( payloadSize < 4 )
+                return false;
+
+            uint8_t symbols[ kRansScale ];
+            for ( uint32_t s = 0; s < 256; ++s )
+                memset( symbols + starts[ s ], int( s ), frequencies[ s ] );
+
+            const uint8_t* payloadEnd = payload + payloadSize;
+            uint32_t x = ( uint32_t( payload[ 0 ] ) << 24 ) | ( uint32_t( payload[ 1 ] ) << 16 ) | ( uint32_t( payload[ 2 ] ) << 8 ) | payload[ 3 ];
+            payload += 4;
+
+            decoded.resize( size_t( rawSize ) );
+            for ( size_t i = 0; i < decoded.size( ); ++i ) {
+                const uint8_t s = symbols[ x & ( kRansScale - 1 ) ];
+                decoded[ i ] = s;
+
+                x = frequencies[ s ] * ( x >> kRansScaleBits ) + ( x & ( kRansScale - 1 ) ) - starts[ s ];
+                while ( x < kRansLowerBound ) {
+                    if ( payload == payloadEnd )
+                        return false;
+                    x = ( x << 8 ) | *payload++;
+                }
+            }
+
+            sectionData = decoded.data( );
+            sectionSize = decoded.size( );
+            return true;
+        }
+    }
+
+    /**
+     * Encodes the triangle list indices.
+     * @param indices The indices, the count must be a multiple of 3.
+     * @param encoded The encoded indices are appended (std::vector of bytes, the temporaries use its allocator).
+     **/
+    template < typename TIndex, typename TBytes >
+    void EncodeIndices( const TIndex* indices, size_t indexCount, TBytes& encoded ) {
+        using namespace details;
+
+        TBytes codes( encoded.get_allocator( ) );
+        TBytes data( encoded.get_allocator( ) );
+        codes.reserve( indexCount / 3 );
+        data.reserve( indexCount / 3 );
+
+        IndexCodecFifos fifos;
+
+        for ( size_t i = 0; i + 2 < indexCount; i += 3 ) {
+            const uint32_t a = indices[ i + 0 ];
+            const uint32_t b = indices[ i + 1 ];
+            const uint32_t c = indices[ i + 2 ];
+
+            // The edge index 15 is reserved for the separately coded triangles.
+            uint32_t edgeIndex = uint32_t( -1 );
+            uint32_t p = 0, q = 0, r = 0;
+            for ( uint32_t e = 0; e < kIndexCodecFifoSize - 1 && edgeIndex == uint32_t( -1 ); ++e ) {
+                const uint32_t* edge = fifos.GetEdge( e );
+                if ( edge[ 0 ] == a && edge[ 1 ] == b ) {
+                    edgeIndex = e, p = a, q = b, r = c;
+                } else if ( edge[ 0 ] == b && edge[ 1 ] == c ) {
+                    edgeIndex = e, p = b, q = c, r = a;
+                } else if ( edge[ 0 ] == c && edge[ 1 ] == a ) {
+                    edgeIndex = e, p = c, q = a, r = b;
+                }
+            }
+
+            if ( edgeIndex != uint32_t( -1 ) ) {
+                // The third vertex: 0 - next, [1; 14] - vertex FIFO, 15 - explicit.
+                uint32_t vertexCode;
+                if ( r == fifos.next ) {
+                    vertexCode = 0;
+                    fifos.PushVertex( fifos.next++ );
+                } else {
+                    const uint32_t fifoIndex = fifos.FindVertex( r, kIndexCodecFifoSize - 2 );
+                    if ( fifoIndex != uint32_t( -1 ) ) {
+                        vertexCode = fifoIndex + 1;
+                    } else {
+                        vertexCode = 15;
+                        const int32_t delta = int32_t( r - fifos.last );
+                        WriteVarint( data, ( uint32_t( delta ) << 1 ) ^ uint32_t( delta >> 31 ) );
+                        fifos.last = r;
+                        fifos.PushVertex( r );
+                    }
+                }
+
+                codes.push_back( uint8_t( ( edgeIndex << 4 ) | vertexCode ) );
+                fifos.PushEdge( r, q );
+                fifos.PushEdge( p, r );
+            } else {
+                if ( a == fifos.next && b == fifos.next + 1 && c == fifos.next + 2 ) {
+                    codes.push_back( kIndexCodecCodeNext3 );
+                    fifos.PushVertex( fifos.next++ );
+                    fifos.PushVertex( fifos.next++ );
+                    fifos.PushVertex( fifos.next++ );
+                } else {
+                    codes.push_back( kIndexCodecCodeFree );
+                    EncodeVertex( fifos, data, a );
+                    EncodeVertex( fifos, data, b );
+                    EncodeVertex( fifos, data, c );
+                }
+
+                fifos.PushEdge( b, a );
+                fifos.PushEdge( c, b );
+                fifos.PushEdge( a, c );
+            }
+        }
+
+        encoded.push_back( kIndexCodecVersion );
+        WriteVarint( encoded, indexCount );
+        WriteSection( encoded, codes );
+        WriteSection( encoded, data );
+    }
+
+    /**
+     * Reads the index count of the encoded indices.
+     * The count comes from the encoded data, it must be checked against the expected count (the subset ranges)
+     * before allocating the storage for the decoded indices.
+     **/
+    inline bool GetEncodedIndexCount( const uint8_t* encoded, size_t encodedSize, size_t& indexCount ) {
+        const uint8_t* end = encoded + encodedSize;
+
+        uint64_t count;
+        if ( encodedSize == 0 || *encoded++ != details::kIndexCodecVersion || !details::ReadVarint( encoded, end, count ) || count % 3 )
+            return false;
+
+        indexCount = size_t( count );
+        return true;
+    }
+
+    /**
+     * Decodes the triangle list indices.
+     * @param indices The storage for the decoded indices, see GetEncodedIndexCount.
+     * @return False if the encoded data is corrupted or the index count does not match.
+     **/
+    template < typename TIndex >
+    bool DecodeIndices( const uint8_t* encoded, size_t encodedSize, TIndex* indices, size_t indexCount ) {
+        using namespace details;
+
+        size_t encodedIndexCount;
+        if ( !GetEncodedIndexCount( encoded, encodedSize, encodedIndexCount ) || encodedIndexCount != indexCount )
+            return false;
+
+        const uint8_t* end  = encoded + encodedSize;
+        const uint8_t* data = encoded + 1;
+
+        uint64_t count;
+        ReadVarint( data, end, count );
+
+        std::vector< uint8_t > decodedCodes;
+        std::vector< uint8_t > decodedData;
+        const uint8_t*         codes;
+        const uint8_t*         vertexData;
+        size_t                 codeCount, vertexDataSize;
+
+        // A code per triangle, up to 3 vertices (5-byte varints at most) per triangle.
+        if ( !ReadSection( data, end, indexCount / 3, decodedCodes, codes, codeCount ) ||
+             !ReadSection( data, end, indexCount * 5, decodedData, vertexData, vertexDataSize ) ||
+             codeCount != indexCount / 3 )
+            return false;
+
+        const uint8_t* vertexDataEnd = vertexData + vertexDataSize;
+
+        IndexCodecFifos fifos;
+
+        for ( size_t i = 0; i < codeCount; ++i ) {
+            const uint8_t code = codes[ i ];
+            uint32_t a, b, c;
+
+            if ( ( code >> 4 ) != 15 ) {
+                const uint32_t* edge = fifos.GetEdge( code >> 4 );
+                a = edge[ 0 ];
+                b = edge[ 1 ];
+
+                const uint32_t vertexCode = code & 15;
+                if ( vertexCode == 0 ) {
+                    c = fifos.next++;
+                    fifos.PushVertex( c );
+                } else if ( vertexCode < 15 ) {
+                    c = fifos.GetVertex( vertexCode - 1 );
+                } else {
+                    uint64_t zigzag;
+                    if ( !ReadVarint( vertexData, vertexDataEnd, zigzag ) )
+                        return false;
+
+                    c = fifos.last + uint32_t( ( uint32_t( zigzag ) >> 1 ) ^ ( 0u - ( uint32_t( zigzag ) & 1 ) ) );
+                    fifos.last = c;
+                    fifos.PushVertex( c );
+                }
+
+                fifos.PushEdge( c, b );
+                fifos.PushEdge( a, c );
+            } else {
+                if ( code == kIndexCodecCodeNext3 ) {
+                    a = fifos.next++;
+                    b = fifos.next++;
+                    c = fifos.next++;
+                    fifos.PushVertex( a );
+                    fifos.PushVertex( b );
+                    fifos.PushVertex( c );
+                } else if ( code == kIndexCodecCodeFree ) {
+                    if ( !DecodeVertex( fifos, vertexData, vertexDataEnd, a ) ||
+                         !DecodeVertex( fifos, vertexData, vertexDataEnd, b ) ||
+                         !DecodeVertex( fifos, vertexData, vertexDataEnd, c ) )
+                        return false;
+                } else {
+                    return false;
+                }
+
+                fifos.PushEdge( b, a );
+                fifos.PushEdge( c, b );
+                fifos.PushEdge( a, c );
+            }
+
+            // The corrupted data can produce the vertices out of the index type range.
+            if ( a > TIndex( -1 ) || b > TIndex( -1 ) || c > TIndex( -1 ) )
+                return false;
+
+            indices[ i * 3 + 0 ] = TIndex( a );
+            indices[ i * 3 + 1 ] = TIndex( b );
+            indices[ i * 3 + 2 ] = TIndex( c );
+        }
+
+        return true;
+    }
+}
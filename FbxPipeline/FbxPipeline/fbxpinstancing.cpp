@@ -0,0 +1,210 @@
+#include <fbxppch.h>
+#include <fbxpstate.h>
+#include <city.h>
+#include <unordered_map>
+
+//
+// Geometry instancing.
+// The nodes that share the FbxMesh reference a single mesh (see ExportMesh( FbxNode*, apemode::Node& )),
+// the meshes with the identical processed buffers (the copies of the same geometry) are merged after the processing,
+// so every unique geometry is written once and NodeFb.mesh_id of its nodes points at the same MeshFb.
+//
+
+namespace {
+    template < typename T >
+    uint64_t HashBuffer( std::vector< T > const& buffer, uint64_t seed ) {
+        return CityHash64WithSeed( reinterpret_cast< const char* >( buffer.data( ) ), buffer.size( ) * sizeof( T ), seed );
+    }
+
+    template < typename T >
+    bool AreBuffersEqual( std::vector< T > const& a, std::vector< T > const& b ) {
+        return a.size( ) == b.size( ) && ( a.empty( ) || 0 == memcmp( a.data( ), b.data( ), a.size( ) * sizeof( T ) ) );
+    }
+
+    template < typename T >
+    size_t GetBufferSize( std::vector< T > const& buffer ) {
+        return buffer.size( ) * sizeof( T );
+    }
+
+    /**
+     * Hashes the buffers that are serialized (see State::SerializeMesh).
+     **/
+    uint64_t HashMesh( apemode::Mesh const& m ) {
+        uint64_t h = (uint64_t) m.subsetIndexType;
+        h = HashBuffer( m.vertices, h );
+        h = HashBuffer( m.submeshes, h );
+        h = HashBuffer( m.subsets, h );
+        h = HashBuffer( m.subsetIndices, h );
+        h = HashBuffer( m.subsetLods, h );
+        h = HashBuffer( m.meshlets, h );
+        h = HashBuffer( m.meshletVertices, h );
+        h = HashBuffer( m.meshletIndices, h );
+        h = HashBuffer( m.draco, h );
+        return h;
+    }
+
+    bool AreMeshesEqual( apemode::Mesh const& a, apemode::Mesh const& b ) {
+        return a.subsetIndexType == b.subsetIndexType && AreBuffersEqual( a.vertices, b.vertices ) &&
+               AreBuffersEqual( a.submeshes, b.submeshes ) && AreBuffersEqual( a.subsets, b.subsets ) &&
+               AreBuffersEqual( a.subsetIndices, b.subsetIndices ) && AreBuffersEqual( a.subsetLods, b.subsetLods ) &&
+               AreBuffersEqual( a.meshlets, b.meshlets ) && AreBuffersEqual( a.meshletVertices, b.meshletVertices ) &&
+               AreBuffersEqual( a.meshletIndices, b.meshletIndices ) && AreBuffersEqual( a.draco, b.draco );
+    }
+
+    /**
+     * @return The size of the serialized buffers of the mesh (without the flatbuffers overhead).
+     **/
+    size_t GetMeshSize( apemode::Mesh const& m ) {
+        return GetBufferSize( m.vertices ) + GetBufferSize( m.submeshes ) + GetBufferSize( m.subsets ) +
+               GetBufferSize( m.subsetIndices ) + GetBufferSize( m.subsetLods ) + GetBufferSize( m.meshlets ) +
+               GetBufferSize( m.meshletVertices ) + GetBufferSize( m.meshletIndices ) + GetBufferSize( m.draco );
+    }
+}
+
+//
+// See implementation in fbxpanalysis.cpp.
+//
+
+bool IsAnalysisEnabled( );
+void RemapAnalysisMeshes( std::vector< uint32_t > const& meshRemap );
+
+bool IsInstancingEnabled( ) {
+    auto& s = apemode::Get( );
+    return false == s.options[ "no-instancing" ].as< bool >( );
+}
+
+/**
+ * Merges the meshes with the identical buffers and prints the instancing report.
+ * Must be called after the meshes are processed and before the pending meshes are cleared.
+ * The streamed meshes are already serialized, only the shared FbxMesh instances are reported for them.
+ * The analysis reports (--analyze) are remapped to the unique mesh ids.
+ **/
+void DeduplicateMeshes( ) {
+    FBXP_PROFILE_ZONE( "Deduplicate meshes" );
+    auto& s = apemode::Get( );
+
+    if ( false == IsInstancingEnabled( ) || s.meshes.empty( ) )
+        return;
+
+    const bool stream = s.options[ "l" ].as< bool >( );
+    const uint32_t meshCount = (uint32_t) s.meshes.size( );
+    assert( s.pendingMeshes.size( ) == meshCount );
+
+    // The sizes of the streamed meshes are unknown (their buffers are released).
+    std::vector< size_t >   meshSizes( meshCount, 0 );
+    std::vector< uint32_t > meshRemap( meshCount );
+    std::vector< uint32_t > sourceMeshIds; // The first source mesh of every unique mesh (for the names).
+    uint32_t                duplicateCount = 0;
+    size_t                  duplicateBytes = 0;
+
+    if ( stream ) {
+        for ( uint32_t meshId = 0; meshId < meshCount; ++meshId ) {
+            meshRemap[ meshId ] = meshId;
+            sourceMeshIds.push_back( meshId );
+        }
+    } else {
+        std::vector< uint64_t > meshHashes( meshCount );
+        apemode::ParallelFor( *s.jobs, meshCount, [&]( uint32_t meshId ) {
+            meshHashes[ meshId ] = HashMesh( s.meshes[ meshId ] );
+            meshSizes[ meshId ]  = GetMeshSize( s.meshes[ meshId ] );
+        } );
+
+        // The first mesh of the identical ones is kept, the unique meshes are compacted in their original order.
+        std::unordered_multimap< uint64_t, uint32_t > uniqueMeshes;
+
+        for ( uint32_t meshId = 0; meshId < meshCount; ++meshId ) {
+            uint32_t uniqueMeshId = (uint32_t) -1;
+
+            auto range = uniqueMeshes.equal_range( meshHashes[ meshId ] );
+            for ( auto it = range.first; it != range.second; ++it ) {
+                if ( AreMeshesEqual( s.meshes[ it->second ], s.meshes[ meshId ] ) ) {
+                    uniqueMeshId = it->second;
+                    break;
+                }
+            }
+
+            if ( uniqueMeshId != (uint32_t) -1 ) {
+                s.console->debug( "Mesh \"{}\" is identical to mesh \"{}\" (merged).",
+                                  s.pendingMeshes[ meshId ].node->GetName( ),
+                                  s.pendingMeshes[ sourceMeshIds[ uniqueMeshId ] ].node->GetName( ) );
+
+                meshRemap[ meshId ] = uniqueMeshId;
+                duplicateBytes += meshSizes[ meshId ];
+                ++duplicateCount;
+                continue;
+            }
+
+            uniqueMeshId = (uint32_t) sourceMeshIds.size( );
+            if ( uniqueMeshId != meshId )
+                s.meshes[ uniqueMeshId ] = std::move( s.meshes[ meshId ] );
+
+            uniqueMeshes.emplace( meshHashes[ meshId ], uniqueMeshId );
+            meshRemap[ meshId ] = uniqueMeshId;
+            sourceMeshIds.push_back( meshId );
+        }
+
+        s.meshes.resize( sourceMeshIds.size( ) );
+
+        if ( IsAnalysisEnabled( ) )
+            RemapAnalysisMeshes( meshRemap );
+    }
+
+    // Count the nodes of the unique meshes (the nodes of the shared FbxMesh already reference the same mesh).
+    const uint32_t          uniqueMeshCount = (uint32_t) sourceMeshIds.size( );
+    std::vector< uint32_t > instanceCounts( uniqueMeshCount, 0 );
+
+    uint32_t meshNodeCount = 0;
+    for ( auto& node : s.nodes ) {
+        if ( node.meshId != (uint32_t) -1 ) {
+            node.meshId = meshRemap[ node.meshId ];
+            ++instanceCounts[ node.meshId ];
+            ++meshNodeCount;
+        }
+    }
+
+    // The meshes with a single instance are not listed, the other ones are sorted by the instance count.
+    std::vector< uint32_t > instancedMeshIds;
+    size_t                  instanceBytes = 0;
+    for ( uint32_t meshId = 0; meshId < uniqueMeshCount; ++meshId ) {
+        if ( instanceCounts[ meshId ] > 1 ) {
+            instancedMeshIds.push_back( meshId );
+            instanceBytes += ( instanceCounts[ meshId ] - 1 ) * meshSizes[ sourceMeshIds[ meshId ] ];
+        }
+    }
+
+    if ( instancedMeshIds.empty( ) )
+        return;
+
+    std::stable_sort( instancedMeshIds.begin( ), instancedMeshIds.end( ), [&]( uint32_t a, uint32_t b ) {
+        return instanceCounts[ a ] > instanceCounts[ b ];
+    } );
+
+    const double toMb = 1.0 / ( 1024.0 * 1024.0 );
+
+    s.console->info( "Instancing: {} node(s) reference {} unique mesh(es), {} mesh(es) are instanced, {} identical mesh(es) merged.",
+                     meshNodeCount,
+                     uniqueMeshCount,
+                     instancedMeshIds.size( ),
+                     duplicateCount );
+
+    if ( stream )
+        s.console->info( "Instancing: the identical meshes are not merged for the streamed meshes." );
+    else
+        s.console->info( "Instancing: {:.2f} MB of mesh buffers saved ({:.2f} MB merged).", instanceBytes * toMb, duplicateBytes * toMb );
+
+    const size_t kListedMeshCount = 10;
+    s.console->info( "\t{:<40} {:>10} {:>12}", "Mesh", "Instances", "Size, MB" );
+    for ( size_t i = 0; i < instancedMeshIds.size( ) && i < kListedMeshCount; ++i ) {
+        const uint32_t meshId = instancedMeshIds[ i ];
+        const uint32_t sourceMeshId = sourceMeshIds[ meshId ];
+
+        // The streamed meshes released their buffers, their sizes are unknown.
+        if ( stream )
+            s.console->info( "\t{:<40} {:>10} {:>12}", s.pendingMeshes[ sourceMeshId ].node->GetName( ), instanceCounts[ meshId ], "-" );
+        else
+            s.console->info( "\t{:<40} {:>10} {:>12.2f}", s.pendingMeshes[ sourceMeshId ].node->GetName( ), instanceCounts[ meshId ], meshSizes[ sourceMeshId ] * toMb );
+    }
+
+    if ( instancedMeshIds.size( ) > kListedMeshCount )
+        s.console->info( "\t... {} more instanced mesh(es).", instancedMeshIds.size( ) - kListedMeshCount );
+}
@@ -0,0 +1,134 @@
+#include <fbxppch.h>
+#include <fbxpjobs.h>
+#include <algorithm>
+
+namespace {
+    thread_local uint32_t tlsWorkerIndex = 0;
+    thread_local uint32_t tlsJobDepth    = 0; // The number of the jobs running on the thread (nested in the waits).
+}
+
+apemode::JobPool::JobPool( uint32_t workerCount )
+    : pushCounter( 0 ), queuedCount( 0 ), pendingCount( 0 ), stopping( false ) {
+    if ( workerCount == 0 )
+        workerCount = std::max( 1u, std::thread::hardware_concurrency( ) );
+
+    queues.reserve( workerCount );
+    for ( uint32_t i = 0; i < workerCount; ++i )
+        queues.emplace_back( new Queue( ) );
+
+    // Worker #0 is the thread that calls Wait( ).
+    threads.reserve( workerCount - 1 );
+    for ( uint32_t i = 1; i < workerCount; ++i )
+        threads.emplace_back( &JobPool::WorkerMain, this, i );
+}
+
+apemode::JobPool::~JobPool( ) {
+    Wait( );
+
+    {
+        std::lock_guard< std::mutex > lock( sleepMutex );
+        stopping = true;
+    }
+
+    sleepCondition.notify_all( );
+    for ( auto& thread : threads )
+        thread.join( );
+}
+
+uint32_t apemode::JobPool::GetWorkerCount( ) const {
+    return (uint32_t) queues.size( );
+}
+
+uint32_t apemode::JobPool::GetWorkerIndex( ) {
+    return tlsWorkerIndex;
+}
+
+void apemode::JobPool::Push( Job job, const std::atomic< uint32_t >* group ) {
+    // Keep the jobs local when pushed from a worker or from a job (worker #0 included), distribute otherwise.
+    const uint32_t queueIndex = ( tlsWorkerIndex || tlsJobDepth ) ? tlsWorkerIndex : ( pushCounter++ % GetWorkerCount( ) );
+
+    ++pendingCount;
+    {
+        // The queued count is updated with the queue, so it never goes below the number of the queued jobs.
+        auto& queue = *queues[ queueIndex ];
+        std::lock_guard< std::mutex > lock( queue.mutex );
+        queue.jobs.push_back( QueuedJob{std::move( job ), group} );
+        ++queuedCount;
+    }
+
+    // The sleeping worker checks the queued count under the sleep mutex, so the notification is not lost.
+    { std::lock_guard< std::mutex > lock( sleepMutex ); }
+    sleepCondition.notify_one( );
+}
+
+/**
+ * Runs a queued job of the group (or any job if the group is null).
+ * @return True if a job was run.
+ **/
+bool apemode::JobPool::TryRunOne( uint32_t workerIndex, const std::atomic< uint32_t >* group ) {
+    if ( queuedCount == 0 )
+        return false;
+
+    Job job;
+    const uint32_t queueCount = GetWorkerCount( );
+
+    // Own queue first (back, LIFO), then steal from the others (front, FIFO).
+    for ( uint32_t i = 0; i < queueCount && !job; ++i ) {
+        auto& queue = *queues[ ( workerIndex + i ) % queueCount ];
+        std::lock_guard< std::mutex > lock( queue.mutex );
+
+        const auto isRunnable = [group]( QueuedJob const& queuedJob ) { return nullptr == group || queuedJob.group == group; };
+        if ( i == 0 ) {
+            const auto it = std::find_if( queue.jobs.rbegin( ), queue.jobs.rend( ), isRunnable );
+            if ( it != queue.jobs.rend( ) ) {
+                job = std::move( it->job );
+                queue.jobs.erase( std::next( it ).base( ) );
+                --queuedCount;
+            }
+        } else {
+            const auto it = std::find_if( queue.jobs.begin( ), queue.jobs.end( ), isRunnable );
+            if ( it != queue.jobs.end( ) ) {
+                job = std::move( it->job );
+                queue.jobs.erase( it );
+                --queuedCount;
+            }
+        }
+    }
+
+    if ( !job )
+        return false;
+
+    ++tlsJobDepth;
+    job( );
+    --tlsJobDepth;
+    --pendingCount;
+    return true;
+}
+
+void apemode::JobPool::WorkerMain( uint32_t workerIndex ) {
+    tlsWorkerIndex = workerIndex;
+
+    for ( ;; ) {
+        if ( TryRunOne( workerIndex, nullptr ) )
+            continue;
+
+        std::unique_lock< std::mutex > lock( sleepMutex );
+        sleepCondition.wait( lock, [&] { return stopping || queuedCount != 0; } );
+        if ( stopping && queuedCount == 0 )
+            return;
+    }
+}
+
+void apemode::JobPool::Wait( ) {
+    while ( pendingCount != 0 ) {
+        if ( false == TryRunOne( tlsWorkerIndex, nullptr ) )
+            std::this_thread::yield( );
+    }
+}
+
+void apemode::JobPool::Wait( const std::atomic< uint32_t >& counter ) {
+    while ( counter != 0 ) {
+        if ( false == TryRunOne( tlsWorkerIndex, &counter ) )
+            std::this_thread::yield( );
+    }
+}
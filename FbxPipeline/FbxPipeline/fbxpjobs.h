@@ -0,0 +1,107 @@
+#pragma once
+
+#include <fbxppch.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace apemode {
+
+    /**
+     * Work-stealing job pool.
+     * Every worker owns a queue, it pops the jobs from the back of its own queue,
+     * and steals from the front of the other queues when its own queue is empty.
+     * The thread that waits for the jobs acts as a worker #0, so the pool with a single
+     * worker does not create any threads and runs everything serially in Wait( ).
+     * The jobs can be tagged with the counter of their group (see ParallelFor), the thread that waits
+     * for the group only runs the jobs of that group, so the nested waits never start the unrelated jobs.
+     **/
+    class JobPool {
+    public:
+        typedef std::function< void( ) > Job;
+
+        /**
+         * @param workerCount The number of workers including the calling thread (0 = hardware concurrency).
+         **/
+        explicit JobPool( uint32_t workerCount );
+        ~JobPool( );
+
+        /**
+         * Distributes jobs among the worker queues in round-robin order.
+         * Jobs pushed from a worker thread or from a running job go to the queue of that worker.
+         * @param group The counter of the job group (see Wait( counter )), or null.
+         **/
+        void Push( Job job, const std::atomic< uint32_t >* group = nullptr );
+
+        /**
+         * Helps executing the queued jobs until all the pushed jobs are completed.
+         **/
+        void Wait( );
+
+        /**
+         * Helps executing the queued jobs of the group (pushed with the counter) until the counter reaches zero.
+         * Can be called from the worker threads and the jobs (nested parallelism), the jobs of the other groups
+         * are not started, so the nesting depth is bounded by the nesting of the groups.
+         **/
+        void Wait( const std::atomic< uint32_t >& counter );
+
+        /**
+         * @return The number of workers including the calling thread.
+         **/
+        uint32_t GetWorkerCount( ) const;
+
+        /**
+         * @return The index of the current worker thread ([0; GetWorkerCount( )), 0 for the non-worker threads).
+         **/
+        static uint32_t GetWorkerIndex( );
+
+    private:
+        struct QueuedJob {
+            Job                            job;
+            const std::atomic< uint32_t >* group;
+        };
+
+        struct Queue {
+            std::mutex              mutex;
+            std::deque< QueuedJob > jobs;
+        };
+
+        bool TryRunOne( uint32_t workerIndex, const std::atomic< uint32_t >* group );
+        void WorkerMain( uint32_t workerIndex );
+
+        std::vector< std::unique_ptr< Queue > > queues;
+        std::vector< std::thread >              threads;
+        std::atomic< uint32_t >                 pushCounter;
+        std::atomic< uint32_t >                 queuedCount;
+        std::atomic< uint32_t >                 pendingCount;
+        std::atomic< bool >                     stopping;
+        std::mutex                              sleepMutex;
+        std::condition_variable                 sleepCondition;
+    };
+
+    /**
+     * Runs func( i ) for every i in [0; count) on the pool and waits for the completion.
+     **/
+    template < typename TFunc >
+    void ParallelFor( JobPool& pool, uint32_t count, TFunc func ) {
+        if ( count == 1 || pool.GetWorkerCount( ) == 1 ) {
+            for ( uint32_t i = 0; i < count; ++i )
+                func( i );
+            return;
+        }
+
+        std::atomic< uint32_t > counter( count );
+        for ( uint32_t i = 0; i < count; ++i ) {
+            pool.Push( [&counter, &func, i] {
+                func( i );
+                --counter;
+            }, &counter );
+        }
+
+        pool.Wait( counter );
+    }
+}
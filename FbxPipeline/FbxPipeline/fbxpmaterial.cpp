@@ -83,10 +83,10 @@ void ExportVideo( std::string const& pn, apemode::Material& m, FbxProperty& pp,
                               apemodefb::EMaterialPropTypeFb_Video,
                               apemodefb::vec3( static_cast< float >( s.textures.back( ).id( ) ), 0, 0 ) );
 
-        s.console->info( "Found video \"{}\" (\"{}\") (\"{}\")",
-                         v->GetName( ),
-                         GetFileName( url.c_str( ) ).c_str( ),
-                         pp.GetName( ).Buffer( ) );
+        s.console->debug( "Found video \"{}\" (\"{}\") (\"{}\")",
+                          v->GetName( ),
+                          GetFileName( url.c_str( ) ).c_str( ),
+                          pp.GetName( ).Buffer( ) );
     }
 }
 
@@ -117,10 +117,10 @@ void ExportTexture( std::string const& pn, apemode::Material& m, FbxProperty& pp
                               apemodefb::EMaterialPropTypeFb_Texture,
                               apemodefb::vec3( static_cast< float >( s.textures.back( ).id( ) ), 0, 0 ) );
 
-        s.console->info( "Found texture \"{}\" (\"{}\") (\"{}\")",
-                         t->GetName( ),
-                         GetFileName( url.c_str( ) ).c_str( ),
-                         pp.GetName( ).Buffer( ) );
+        s.console->debug( "Found texture \"{}\" (\"{}\") (\"{}\")",
+                          t->GetName( ),
+                          GetFileName( url.c_str( ) ).c_str( ),
+                          pp.GetName( ).Buffer( ) );
     }
 }
 
@@ -147,6 +147,7 @@ void ExportTextures( std::string const& pn, apemode::Material& m, FbxProperty& p
 }
 
 void ExportMaterials( FbxScene* scene ) {
+    FBXP_PROFILE_ZONE( "Export materials" );
     auto& s = apemode::Get( );
 
     if ( auto c = scene->GetMaterialCount( ) ) {
@@ -163,7 +164,7 @@ void ExportMaterials( FbxScene* scene ) {
             m.nameId = s.PushName( material->GetName( ) );
 
             s.materialDict[ m.nameId ] = id;
-            s.console->info( "Found material \"{}\"", material->GetName( ) );
+            s.console->debug( "Found material \"{}\"", material->GetName( ) );
 
             if ( material->GetClassId( ).Is( FbxSurfaceLambert::ClassId ) )
                 ExportMaterial< FbxSurfaceLambert >( material, m );
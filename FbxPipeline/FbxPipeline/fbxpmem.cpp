@@ -1,5 +1,29 @@
 #include <fbxppch.h>
+#include <fbxpstate.h>
 #include <new>
+#include <Windows.h>
+#include <Psapi.h>
+
+/**
+ * Prints the current and the peak working set sizes after the stage.
+ * The peak is process-wide, the growth of the peak shows the contribution of the stage.
+ **/
+void LogMemoryUsage( const char* stage ) {
+    static size_t lastPeakWorkingSetSize = 0;
+
+    PROCESS_MEMORY_COUNTERS counters;
+    if ( FALSE == GetProcessMemoryInfo( GetCurrentProcess( ), &counters, sizeof( counters ) ) )
+        return;
+
+    const double toMb = 1.0 / ( 1024.0 * 1024.0 );
+    apemode::Get( ).console->info( "Memory after \"{}\": working set {:.1f} MB, peak {:.1f} MB (+{:.1f} MB).",
+                                   stage,
+                                   counters.WorkingSetSize * toMb,
+                                   counters.PeakWorkingSetSize * toMb,
+                                   ( counters.PeakWorkingSetSize - std::min( lastPeakWorkingSetSize, counters.PeakWorkingSetSize ) ) * toMb );
+
+    lastPeakWorkingSetSize = counters.PeakWorkingSetSize;
+}
 
 #ifndef MALLOC_ALIGNMENT
 #define MALLOC_ALIGNMENT 16
@@ -1,97 +1,481 @@
 #include <fbxppch.h>
 #include <fbxpstate.h>
+#include <fbxparena.h>
 #include <fbxpnorm.h>
+#include <numeric>
+#include <atomic>
+#include <emmintrin.h>
 
 /**
- * Helper function to calculate tangents when the tangent element layer is missing.
- * Can be used in multiple threads.
- * http://gamedev.stackexchange.com/a/68617/39505
+ * Returns nullptr in case element layer has unsupported properties or is null.
  **/
-template < typename TVertex >
-void CalculateTangents( TVertex* vertices, size_t vertexCount ) {
-    std::vector< mathfu::vec3 > tan;
-    tan.resize( vertexCount * 2 );
-    memset( tan.data( ), 0, sizeof( mathfu::vec3 ) * vertexCount * 2 );
+template < typename TElementLayer >
+const TElementLayer* VerifyElementLayer( const TElementLayer* elementLayer ) {
+    if ( nullptr == elementLayer ) {
+        apemode::Get( ).console->error( "Missing element layer." );
+        return nullptr;
+    }
+
+    switch ( const auto mappingMode = elementLayer->GetMappingMode( ) ) {
+        case FbxLayerElement::EMappingMode::eByControlPoint:
+        case FbxLayerElement::EMappingMode::eByPolygon:
+        case FbxLayerElement::EMappingMode::eByPolygonVertex:
+            break;
+        default:
+            apemode::Get( ).console->error(
+                "Mapping mode {} of layer \"{}\" "
+                "is not supported.",
+                mappingMode,
+                elementLayer->GetName( ) );
+            return nullptr;
+    }
+
+    switch ( const auto referenceMode = elementLayer->GetReferenceMode( ) ) {
+        case FbxLayerElement::EReferenceMode::eDirect:
+        case FbxLayerElement::EReferenceMode::eIndex:
+        case FbxLayerElement::EReferenceMode::eIndexToDirect:
+            break;
+        default:
+            apemode::Get( ).console->error(
+                "Reference mode {} of layer \"{}\" "
+                "is not supported.",
+                referenceMode,
+                elementLayer->GetName( ) );
+            return nullptr;
+    }
+
+    return elementLayer;
+}
+
+/**
+ * Helper structure to assign vertex property values
+ **/
+struct StaticVertex {
+    float position[ 3 ];
+    float normal[ 3 ];
+    float tangent[ 4 ];
+    float texCoords[ 2 ];
+};
+
+//
+// Flatbuffers takes care about correct platform-independent alignment.
+//
+
+static_assert( sizeof( StaticVertex ) == sizeof( apemodefb::StaticVertexFb ), "Must match" );
+static_assert( sizeof( apemodefb::PackedVertexFb ) == sizeof( apemodefb::PackedVertexFb ), "Must match" );
+
+//
+// Element layer readers.
+// The mapping and reference modes are resolved once per layer (see ElementLayerReader), the readers are specialized
+// per mapping and reference mode, so the vertex loops have no branches and no FBX SDK calls.
+// The arrays are locked and read as contiguous doubles, the values are converted to floats with SSE2
+// (the rounding matches the scalar conversion).
+//
 
-    auto tan1 = tan.data( );
-    auto tan2 = tan1 + vertexCount;
+/**
+ * Locks the element array for reading (nullptr means the empty array).
+ **/
+template < typename T >
+class LockedElementArray {
+public:
+    LockedElementArray( const FbxLayerElementArrayTemplate< T >* elementArray )
+        : elementArray( const_cast< FbxLayerElementArrayTemplate< T >* >( elementArray ) )
+        , data( elementArray ? this->elementArray->GetLocked( FbxLayerElementArray::eReadLock ) : nullptr )
+        , count( elementArray ? (uint32_t) elementArray->GetCount( ) : 0 ) {
+    }
 
-    for ( size_t i = 0; i < vertexCount; i += 3 ) {
-        const TVertex v0 = vertices[ i + 0 ];
-        const TVertex v1 = vertices[ i + 1 ];
-        const TVertex v2 = vertices[ i + 2 ];
+    ~LockedElementArray( ) {
+        if ( data )
+            elementArray->Release( &data );
+    }
 
-        const float x1 = v1.position[ 0 ] - v0.position[ 0 ];
-        const float x2 = v2.position[ 0 ] - v0.position[ 0 ];
-        const float y1 = v1.position[ 1 ] - v0.position[ 1 ];
-        const float y2 = v2.position[ 1 ] - v0.position[ 1 ];
-        const float z1 = v1.position[ 2 ] - v0.position[ 2 ];
-        const float z2 = v2.position[ 2 ] - v0.position[ 2 ];
+    FbxLayerElementArrayTemplate< T >* elementArray;
+    T*                                 data;
+    uint32_t                           count;
+};
 
-        const float s1 = v1.texCoords[ 0 ] - v0.texCoords[ 0 ];
-        const float s2 = v2.texCoords[ 0 ] - v0.texCoords[ 0 ];
-        const float t1 = v1.texCoords[ 1 ] - v0.texCoords[ 1 ];
-        const float t2 = v2.texCoords[ 1 ] - v0.texCoords[ 1 ];
+inline __m128 LoadFloat4( const double* values ) {
+    return _mm_movelh_ps( _mm_cvtpd_ps( _mm_loadu_pd( values ) ), _mm_cvtpd_ps( _mm_loadu_pd( values + 2 ) ) );
+}
 
-        const float r = 1.0f / ( s1 * t2 - s2 * t1 );
-        const mathfu::vec3 sdir( ( t2 * x1 - t1 * x2 ) * r, ( t2 * y1 - t1 * y2 ) * r, ( t2 * z1 - t1 * z2 ) * r );
-        const mathfu::vec3 tdir( ( s1 * x2 - s2 * x1 ) * r, ( s1 * y2 - s2 * y1 ) * r, ( s1 * z2 - s2 * z1 ) * r );
+template < uint32_t N >
+void StoreElement( float* attribute, const double* value );
 
-        // assert( !isnan( sdir.x ) && !isnan( sdir.y ) && !isnan( sdir.z ) );
-        // assert( !isnan( tdir.x ) && !isnan( tdir.y ) && !isnan( tdir.z ) );
+template <>
+inline void StoreElement< 2 >( float* attribute, const double* value ) {
+    _mm_storel_pi( reinterpret_cast< __m64* >( attribute ), _mm_cvtpd_ps( _mm_loadu_pd( value ) ) );
+}
+
+template <>
+inline void StoreElement< 3 >( float* attribute, const double* value ) {
+    const __m128 v = LoadFloat4( value );
+    _mm_storel_pi( reinterpret_cast< __m64* >( attribute ), v );
+    _mm_store_ss( attribute + 2, _mm_movehl_ps( v, v ) );
+}
 
-        tan1[ i + 0 ] += sdir;
-        tan1[ i + 1 ] += sdir;
-        tan1[ i + 2 ] += sdir;
+template <>
+inline void StoreElement< 4 >( float* attribute, const double* value ) {
+    _mm_storeu_ps( attribute, LoadFloat4( value ) );
+}
+
+/**
+ * Stores N components of the mapped element values to the vertices [firstVertex; lastVertex).
+ * The eAllSame mapping mode stores the first value to all the vertices (used for the missing layers).
+ * @param values The direct array, valueSize doubles per value.
+ * @param valueIndices The index array (for the indexed reference modes).
+ * @param controlPointIndices The control point indices of the vertices (starting from firstVertex).
+ * @param attributes The attribute of the first mesh vertex, attributeStride floats between the vertices.
+ **/
+template < uint32_t N, FbxLayerElement::EMappingMode eMappingMode, bool bIndexed >
+void ReadElement( const double*    values,
+                  uint32_t         valueSize,
+                  const int*       valueIndices,
+                  const uint32_t*  controlPointIndices,
+                  float*           attributes,
+                  uint32_t         attributeStride,
+                  uint32_t         firstVertex,
+                  uint32_t         lastVertex ) {
+    for ( uint32_t vi = firstVertex; vi < lastVertex; ++vi ) {
+        const uint32_t i = eMappingMode == FbxLayerElement::eByControlPoint ? controlPointIndices[ vi - firstVertex ]
+                         : eMappingMode == FbxLayerElement::eByPolygon ? vi / 3
+                         : eMappingMode == FbxLayerElement::eByPolygonVertex ? vi : 0;
+
+        StoreElement< N >( attributes + vi * attributeStride, values + ( bIndexed ? (uint32_t) valueIndices[ i ] : i ) * valueSize );
+    }
+}
+
+/**
+ * Reads N components of the element layer values to the vertex attributes.
+ * The missing layer (nullptr) and the layer with the indices out of range are read as the default element value.
+ * The element arrays stay locked while the reader exists.
+ **/
+template < typename TElementLayer, typename TElementValue, uint32_t N >
+class ElementLayerReader {
+public:
+    static_assert( sizeof( TElementValue ) % sizeof( double ) == 0 && N <= sizeof( TElementValue ) / sizeof( double ), "Values must be doubles." );
+
+    ElementLayerReader( const TElementLayer* elementLayer, uint32_t controlPointCount, uint32_t vertexCount )
+        : directArray( elementLayer ? &elementLayer->GetDirectArray( ) : nullptr )
+        , indexArray( elementLayer && elementLayer->GetReferenceMode( ) != FbxLayerElement::eDirect ? &elementLayer->GetIndexArray( ) : nullptr ) {
+        if ( nullptr == elementLayer )
+            return;
+
+        const auto mappingMode = elementLayer->GetMappingMode( );
+        const bool indexed     = elementLayer->GetReferenceMode( ) != FbxLayerElement::eDirect;
+
+        const uint32_t mappedCount = mappingMode == FbxLayerElement::eByControlPoint
+                                         ? controlPointCount
+                                         : mappingMode == FbxLayerElement::eByPolygon ? vertexCount / 3 : vertexCount;
+
+        // The indices are checked once, so the readers do not check them.
+        bool valid = nullptr != directArray.data || 0 == mappedCount;
+        if ( valid && indexed ) {
+            valid = indexArray.count >= mappedCount &&
+                    std::all_of( indexArray.data, indexArray.data + mappedCount, [&]( int i ) { return i >= 0 && (uint32_t) i < directArray.count; } );
+        } else if ( valid ) {
+            valid = directArray.count >= mappedCount;
+        }
+
+        if ( false == valid ) {
+            apemode::Get( ).console->error( "Layer \"{}\" has {} values and {} indices for {} mapped elements (out of range, ignored).",
+                                            elementLayer->GetName( ),
+                                            directArray.count,
+                                            indexArray.count,
+                                            mappedCount );
+            DebugBreak( );
+            return;
+        }
+
+        switch ( mappingMode ) {
+            case FbxLayerElement::eByControlPoint:
+                reader = indexed ? &ReadElement< N, FbxLayerElement::eByControlPoint, true > : &ReadElement< N, FbxLayerElement::eByControlPoint, false >;
+                break;
+            case FbxLayerElement::eByPolygon:
+                reader = indexed ? &ReadElement< N, FbxLayerElement::eByPolygon, true > : &ReadElement< N, FbxLayerElement::eByPolygon, false >;
+                break;
+            case FbxLayerElement::eByPolygonVertex:
+                reader = indexed ? &ReadElement< N, FbxLayerElement::eByPolygonVertex, true > : &ReadElement< N, FbxLayerElement::eByPolygonVertex, false >;
+                break;
+            default:
+                // See VerifyElementLayer.
+                assert( false );
+                return;
+        }
+
+        values       = reinterpret_cast< const double* >( directArray.data );
+        valueIndices = indexArray.data;
+    }
 
-        tan2[ i + 0 ] += tdir;
-        tan2[ i + 1 ] += tdir;
-        tan2[ i + 2 ] += tdir;
+    /**
+     * Reads the attributes of the vertices [firstVertex; lastVertex).
+     * @param controlPointIndices The control point indices of the vertices (starting from firstVertex).
+     * @param attributes The attribute of the first mesh vertex, attributeStride floats between the vertices.
+     **/
+    void Read( const uint32_t* controlPointIndices, float* attributes, uint32_t attributeStride, uint32_t firstVertex, uint32_t lastVertex ) const {
+        reader( values, valueSize, valueIndices, controlPointIndices, attributes, attributeStride, firstVertex, lastVertex );
     }
 
-    for ( size_t i = 0; i < vertexCount; i += 1 ) {
-        TVertex& v = vertices[ i ];
-        const auto n = mathfu::vec3( v.normal[ 0 ], v.normal[ 1 ], v.normal[ 2 ] );
-        const auto t = tan1[ i ];
+private:
+    using Reader = void ( * )( const double*, uint32_t, const int*, const uint32_t*, float*, uint32_t, uint32_t, uint32_t );
+
+    static const uint32_t valueSize = sizeof( TElementValue ) / sizeof( double );
+
+    LockedElementArray< TElementValue > directArray;
+    LockedElementArray< int >           indexArray;
+    TElementValue                       defaultValue = TElementValue( );
+    const double*                       values       = reinterpret_cast< const double* >( &defaultValue );
+    const int*                          valueIndices = nullptr;
+    Reader                              reader       = &ReadElement< N, FbxLayerElement::eAllSame, false >;
+};
+
+/**
+ * Reads the control point positions of the vertices [firstVertex; lastVertex),
+ * the bounds are accumulated in the same pass (x, y, z lanes).
+ * @param controlPointIndices The control point indices of the vertices (starting from firstVertex).
+ * @param positions The position of the first mesh vertex, positionStride floats between the vertices.
+ **/
+inline void ReadPositions( const FbxVector4* controlPoints,
+                           const uint32_t*   controlPointIndices,
+                           float*            positions,
+                           uint32_t          positionStride,
+                           uint32_t          firstVertex,
+                           uint32_t          lastVertex,
+                           __m128&           positionMin,
+                           __m128&           positionMax ) {
+    static_assert( sizeof( FbxVector4 ) == 4 * sizeof( double ), "Control points must be 4 doubles." );
+
+    for ( uint32_t vi = firstVertex; vi < lastVertex; ++vi ) {
+        const __m128 p = LoadFloat4( controlPoints[ controlPointIndices[ vi - firstVertex ] ].mData );
+        positionMin    = _mm_min_ps( positionMin, p );
+        positionMax    = _mm_max_ps( positionMax, p );
+
+        float* position = positions + vi * positionStride;
+        _mm_storel_pi( reinterpret_cast< __m64* >( position ), p );
+        _mm_store_ss( position + 2, _mm_movehl_ps( p, p ) );
+    }
+}
+
+/**
+ * Accumulates the texcoord bounds of the vertices [firstVertex; lastVertex) (x, y lanes).
+ * @param texcoords The texcoord of the first mesh vertex, texcoordStride floats between the vertices.
+ **/
+inline void AccumulateTexcoordBounds( const float* texcoords, uint32_t texcoordStride, uint32_t firstVertex, uint32_t lastVertex, __m128& texcoordMin, __m128& texcoordMax ) {
+    for ( uint32_t vi = firstVertex; vi < lastVertex; ++vi ) {
+        const __m128 uv = _mm_castpd_ps( _mm_load_sd( reinterpret_cast< const double* >( texcoords + vi * texcoordStride ) ) );
+        texcoordMin     = _mm_min_ps( texcoordMin, uv );
+        texcoordMax     = _mm_max_ps( texcoordMax, uv );
+    }
+}
+
+//
+// Smooth normals.
+//
+
+//
+// See implementation in fbxpnormals.cpp.
+//
+
+void CalculateSmoothNormals( const float*    positions,
+                             float*          normals,
+                             uint32_t        vertexStride,
+                             const uint32_t* controlPointIndices,
+                             uint32_t        vertexCount,
+                             uint32_t        controlPointCount,
+                             const int*      smoothingGroups,
+                             float           creaseAngle,
+                             bool            areaWeighted );
+
+/**
+ * Calculates the smooth normals when the normal layer is missing.
+ * Reads the control points of the polygon vertices and the smoothing groups (if the mesh has them),
+ * the normals are smoothed within the crease angle and weighted by the polygon vertex angle or the polygon area
+ * (see --normals-crease-angle and --normals-weighting).
+ **/
+template < typename TVertex >
+void CalculateSmoothNormals( FbxMesh* mesh, TVertex* vertices, uint32_t vertexCount ) {
+    const apemode::ArenaScope arenaScope( "Read smoothing" );
+    auto& s = apemode::Get( );
+
+    const uint32_t pc = vertexCount / 3;
+    const uint32_t cc = (uint32_t) mesh->GetControlPointsCount( );
+
+    const float creaseAngle  = s.options[ "normals-crease-angle" ].as< float >( ) > 0 ? s.options[ "normals-crease-angle" ].as< float >( ) : 60.0f;
+    const bool  areaWeighted = s.options.count( "normals-weighting" ) && s.options[ "normals-weighting" ].as< std::string >( ) == "area";
 
-        mathfu::vec3 tt = mathfu::normalize( t - n * mathfu::dot( n, t ) );
-        // assert( !isnan( tt.x ) && !isnan( tt.y ) && !isnan( tt.z ) );
+    const uint32_t kChunkSize      = 64 * 1024;
+    const uint32_t chunkCount      = ( pc + kChunkSize - 1 ) / kChunkSize;
+    const int*     polygonVertices = mesh->GetPolygonVertices( );
 
-        v.tangent[ 0 ]  = tt.x;
-        v.tangent[ 1 ]  = tt.y;
-        v.tangent[ 2 ]  = tt.z;
-        v.tangent[ 3 ]  = ( mathfu::dot( mathfu::cross( n, t ), tan2[ i ] ) < 0 ) ? -1.0f : 1.0f;
+    //
+    // Control point indices.
+    //
+
+    apemode::ArenaVector< uint32_t > controlPointIndices( vertexCount );
+
+    apemode::ParallelFor( *s.jobs, chunkCount, [&]( uint32_t chunk ) {
+        for ( uint32_t pi = chunk * kChunkSize; pi < std::min( pc, ( chunk + 1 ) * kChunkSize ); ++pi ) {
+            const int* polygon = polygonVertices + mesh->GetPolygonVertexIndex( (int) pi );
+            controlPointIndices[ pi * 3 + 0 ] = (uint32_t) polygon[ 0 ];
+            controlPointIndices[ pi * 3 + 1 ] = (uint32_t) polygon[ 1 ];
+            controlPointIndices[ pi * 3 + 2 ] = (uint32_t) polygon[ 2 ];
+        }
+    } );
+
+    //
+    // Smoothing groups (bit masks, the polygons are smoothed together if they share a bit).
+    //
+
+    apemode::ArenaVector< int > smoothingGroups;
+    if ( const auto smoothingElement = mesh->GetElementSmoothing( ) ) {
+        const bool indexed = smoothingElement->GetReferenceMode( ) != FbxLayerElement::eDirect;
+
+        const LockedElementArray< int > directArray( &smoothingElement->GetDirectArray( ) );
+        const LockedElementArray< int > indexArray( indexed ? &smoothingElement->GetIndexArray( ) : nullptr );
+
+        if ( smoothingElement->GetMappingMode( ) != FbxLayerElement::eByPolygon ) {
+            s.console->info( "Mesh \"{}\" has smoothing layer with mapping mode {} (ignored, only the crease angle is used).",
+                             mesh->GetNode( )->GetName( ),
+                             smoothingElement->GetMappingMode( ) );
+        } else if ( ( indexed ? indexArray.count : directArray.count ) < pc ||
+                    ( indexed && std::any_of( indexArray.data, indexArray.data + pc, [&]( int i ) {
+                          return i < 0 || (uint32_t) i >= directArray.count;
+                      } ) ) ) {
+            s.console->error( "Mesh \"{}\" has smoothing layer out of range (ignored).", mesh->GetNode( )->GetName( ) );
+        } else {
+            smoothingGroups.resize( pc );
+            for ( uint32_t pi = 0; pi < pc; ++pi )
+                smoothingGroups[ pi ] = directArray.data[ indexed ? indexArray.data[ pi ] : pi ];
+        }
     }
+
+    static_assert( sizeof( TVertex ) % sizeof( float ) == 0, "The vertex must consist of floats." );
+    CalculateSmoothNormals( vertices->position,
+                            vertices->normal,
+                            (uint32_t) ( sizeof( TVertex ) / sizeof( float ) ),
+                            controlPointIndices.data( ),
+                            vertexCount,
+                            cc,
+                            smoothingGroups.empty( ) ? nullptr : smoothingGroups.data( ),
+                            creaseAngle,
+                            areaWeighted );
 }
 
 /**
- * Calculate normals for the faces (does not weight triangles).
- * Fast and usable results, however incorrect.
- * TODO: Implement vertex normal calculations.
+ * Initialize vertices with very basic properties like 'position', 'normal', 'tangent', 'texCoords'.
+ * Calculate mesh position and texcoord min max values.
+ * @param generateTangents Set if the tangents must be generated after welding (see GenerateTangents),
+ *                         the tangents are left default then, so they do not prevent welding.
  **/
 template < typename TVertex >
-void CalculateFaceNormals( TVertex* vertices, size_t vertexCount ) {
-    for ( size_t i = 0; i < vertexCount; i += 3 ) {
-        TVertex& v0 = vertices[ i + 0 ];
-        TVertex& v1 = vertices[ i + 1 ];
-        TVertex& v2 = vertices[ i + 2 ];
+void InitializeVertices( FbxMesh*      mesh,
+                         apemode::Mesh&   m,
+                         TVertex*      vertices,
+                         size_t        vertexCount,
+                         mathfu::vec3& positionMin,
+                         mathfu::vec3& positionMax,
+                         mathfu::vec2& texcoordMin,
+                         mathfu::vec2& texcoordMax,
+                         bool&         generateTangents ) {
+    FBXP_PROFILE_ZONE( "Initialize vertices" );
+    auto& s = apemode::Get( );
+    const uint32_t cc = (uint32_t) mesh->GetControlPointsCount( );
+    const uint32_t pc = (uint32_t) mesh->GetPolygonCount( );
+
+    s.console->debug( "Mesh \"{}\" has {} control points.", mesh->GetNode( )->GetName( ), cc );
+    s.console->debug( "Mesh \"{}\" has {} polygons.", mesh->GetNode( )->GetName( ), pc );
+
+    const auto uve = VerifyElementLayer( mesh->GetElementUV( ) );
+    const auto ne  = VerifyElementLayer( mesh->GetElementNormal( ) );
+    const auto te  = VerifyElementLayer( mesh->GetElementTangent( ) );
+
+    assert( vertexCount == pc * 3 );
 
-        const mathfu::vec3 p0( v0.position );
-        const mathfu::vec3 p1( v1.position );
-        const mathfu::vec3 p2( v2.position );
-        const mathfu::vec3 n( mathfu::normalize( mathfu::cross( p1 - p0, p2 - p0 ) ) );
+    const uint32_t vc     = (uint32_t) vertexCount;
+    const uint32_t stride = (uint32_t) ( sizeof( TVertex ) / sizeof( float ) );
 
-        v0.normal[ 0 ] = n.x;
-        v0.normal[ 1 ] = n.y;
-        v0.normal[ 2 ] = n.z;
+    const ElementLayerReader< FbxGeometryElementUV, FbxVector2, 2 >      uvReader( uve, cc, vc );
+    const ElementLayerReader< FbxGeometryElementNormal, FbxVector4, 3 >  normalReader( ne, cc, vc );
+    const ElementLayerReader< FbxGeometryElementTangent, FbxVector4, 4 > tangentReader( te, cc, vc );
 
-        v1.normal[ 0 ] = n.x;
-        v1.normal[ 1 ] = n.y;
-        v1.normal[ 2 ] = n.z;
+    const FbxVector4* controlPoints   = mesh->GetControlPoints( );
+    const int*        polygonVertices = mesh->GetPolygonVertices( );
+
+    __m128 positionMinLanes = _mm_set1_ps( std::numeric_limits< float >::max( ) );
+    __m128 positionMaxLanes = _mm_set1_ps( std::numeric_limits< float >::lowest( ) );
+    __m128 texcoordMinLanes = positionMinLanes;
+    __m128 texcoordMaxLanes = positionMaxLanes;
+
+    // The vertices are read in chunks that fit the cache, every reader writes its attribute of the chunk.
+    const uint32_t kChunkPolygonCount = 1024;
+    uint32_t       controlPointIndices[ kChunkPolygonCount * 3 ];
+
+    for ( uint32_t firstPolygon = 0; firstPolygon < pc; firstPolygon += kChunkPolygonCount ) {
+        const uint32_t lastPolygon = std::min( pc, firstPolygon + kChunkPolygonCount );
+        const uint32_t firstVertex = firstPolygon * 3;
+        const uint32_t lastVertex  = lastPolygon * 3;
+
+        for ( uint32_t pi = firstPolygon; pi < lastPolygon; ++pi ) {
+            assert( 3 == mesh->GetPolygonSize( pi ) );
+
+            const int* polygon = polygonVertices + mesh->GetPolygonVertexIndex( (int) pi );
+            uint32_t*  indices = controlPointIndices + ( pi - firstPolygon ) * 3;
+            indices[ 0 ] = (uint32_t) polygon[ 0 ];
+            indices[ 1 ] = (uint32_t) polygon[ 1 ];
+            indices[ 2 ] = (uint32_t) polygon[ 2 ];
+        }
+
+        ReadPositions( controlPoints, controlPointIndices, vertices->position, stride, firstVertex, lastVertex, positionMinLanes, positionMaxLanes );
+        normalReader.Read( controlPointIndices, vertices->normal, stride, firstVertex, lastVertex );
+        tangentReader.Read( controlPointIndices, vertices->tangent, stride, firstVertex, lastVertex );
+        uvReader.Read( controlPointIndices, vertices->texCoords, stride, firstVertex, lastVertex );
+        AccumulateTexcoordBounds( vertices->texCoords, stride, firstVertex, lastVertex, texcoordMinLanes, texcoordMaxLanes );
+    }
+
+    float bounds[ 16 ];
+    _mm_storeu_ps( bounds + 0, positionMinLanes );
+    _mm_storeu_ps( bounds + 4, positionMaxLanes );
+    _mm_storeu_ps( bounds + 8, texcoordMinLanes );
+    _mm_storeu_ps( bounds + 12, texcoordMaxLanes );
+
+    positionMin = mathfu::vec3( bounds[ 0 ], bounds[ 1 ], bounds[ 2 ] );
+    positionMax = mathfu::vec3( bounds[ 4 ], bounds[ 5 ], bounds[ 6 ] );
+    texcoordMin = mathfu::vec2( bounds[ 8 ], bounds[ 9 ] );
+    texcoordMax = mathfu::vec2( bounds[ 12 ], bounds[ 13 ] );
+
+#ifdef _DEBUG
+    for ( size_t vi = 0; vi < vertexCount; ++vi ) {
+        const auto& v = vertices[ vi ];
+        assert( !isnan( v.position[ 0 ] ) && !isnan( v.position[ 1 ] ) && !isnan( v.position[ 2 ] ) );
+        assert( !isnan( v.normal[ 0 ] ) && !isnan( v.normal[ 1 ] ) && !isnan( v.normal[ 2 ] ) );
+        assert( !isnan( v.tangent[ 0 ] ) && !isnan( v.tangent[ 1 ] ) && !isnan( v.tangent[ 2 ] ) && !isnan( v.tangent[ 3 ] ) );
+        assert( !isnan( v.texCoords[ 0 ] ) && !isnan( v.texCoords[ 1 ] ) );
+    }
+#endif
+
+    m.positionMin = apemodefb::vec3( positionMin.x, positionMin.y, positionMin.z );
+    m.positionMax = apemodefb::vec3( positionMax.x, positionMax.y, positionMax.z );
+    m.texcoordMin = apemodefb::vec2( texcoordMin.x, texcoordMin.y );
+    m.texcoordMax = apemodefb::vec2( texcoordMax.x, texcoordMax.y );
+
+    if ( nullptr == uve ) {
+        s.console->error( "Mesh \"{}\" does not have texcoords geometry layer.",
+                          mesh->GetNode( )->GetName( ) );
+    }
+
+    if ( nullptr == ne ) {
+        s.console->warn( "Mesh \"{}\" does not have normal geometry layer.",
+                          mesh->GetNode( )->GetName( ) );
+
+        // Calculate smooth normals ourselves.
+        CalculateSmoothNormals( mesh, vertices, vc );
+    }
+
+    if ( nullptr == te && nullptr != uve ) {
+        s.console->warn( "Mesh \"{}\" does not have tangent geometry layer.",
+                         mesh->GetNode( )->GetName( ) );
 
-        v2.normal[ 0 ] = n.x;
-        v2.normal[ 1 ] = n.y;
-        v2.normal[ 2 ] = n.z;
+        // Calculate tangents ourselves (after welding) if UVs are available.
+        generateTangents = true;
     }
 }
 
@@ -103,21 +487,25 @@ void CalculateFaceNormals( TVertex* vertices, size_t vertexCount ) {
  *                     2) render polygon range [12, 64] with 2nd material.
  *                     * range is [base index; index count]
  *
+ * The polygons are bucketed by material with the counting sort (stable, the polygons of the material keep their order):
+ * the polygon chunks are counted and scattered in parallel, the chunk offsets are the prefix sums in (material, chunk) order.
+ *
  * @param indices The indices of the mesh that will be used to draw the mesh with multiple materials.
  * @param subsets The ranges of the vertex indices for each material of the node.
  * @param subsetPolies A mapping of material indices to polygon ranges (useful for knowing the basic structure).
  * @return True on success.
  **/
 template < typename TIndex >
-bool GetSubsets( FbxMesh*                           mesh,
-                 apemode::Mesh&                        m,
-                 std::vector< TIndex >&             indices,
+bool GetSubsets( FbxMesh*                            mesh,
+                 apemode::Mesh&                      m,
+                 std::vector< TIndex >&              indices,
                  std::vector< apemodefb::SubsetFb >& subsets,
-                 std::vector< apemodefb::SubsetFb >& subsetPolies,
-                 std::vector< std::tuple< TIndex, TIndex > >& items ) {
+                 std::vector< apemodefb::SubsetFb >& subsetPolies ) {
+    FBXP_PROFILE_ZONE( "Get subsets" );
+    const apemode::ArenaScope arenaScope( "Get subsets" );
     auto& s = apemode::Get( );
 
-    s.console->info("Mesh \"{}\" has {} material(s) assigned.", mesh->GetNode( )->GetName( ), mesh->GetNode( )->GetMaterialCount( ) );
+    s.console->debug( "Mesh \"{}\" has {} material(s) assigned.", mesh->GetNode( )->GetName( ), mesh->GetNode( )->GetMaterialCount( ) );
 
     // No submeshes for a node that has only 1 or no materials.
     if (mesh->GetNode()->GetMaterialCount() < 2) {
@@ -128,180 +516,151 @@ bool GetSubsets( FbxMesh*                           mesh,
     // Print materials attached to a node.
     //
 
+#if FBXP_LOG_TRACE
     for ( auto k = 0; k < mesh->GetNode( )->GetMaterialCount( ); ++k ) {
-        s.console->info( "\t#{} - \"{}\".", k, mesh->GetNode( )->GetMaterial( k )->GetName( ) );
+        FBXP_TRACE( "\t#{} - \"{}\".", k, mesh->GetNode( )->GetMaterial( k )->GetName( ) );
     }
+#endif
 
-    items.clear( );
     indices.clear( );
     subsets.clear( );
     subsetPolies.clear( );
 
-    items.reserve( mesh->GetPolygonCount( ) );
-    indices.reserve( mesh->GetPolygonCount( ) * 3 );
-    subsets.reserve( mesh->GetNode( )->GetMaterialCount( ) );
-    subsetPolies.reserve( mesh->GetNode( )->GetMaterialCount( ) );
+    const uint32_t pc = (uint32_t) mesh->GetPolygonCount( );
+    const uint32_t mc = (uint32_t) mesh->GetNode( )->GetMaterialCount( );
 
-    // Go though all the material elements and map them.
-    if ( const uint32_t mc = (uint32_t) mesh->GetElementMaterialCount( ) ) {
-        s.console->info( "Mesh \"{}\" has {} material elements.", mesh->GetNode( )->GetName( ), mc );
+    // Find the material element that maps the polygons.
+    const FbxGeometryElementMaterial* materialElement = nullptr;
+    if ( const uint32_t ec = (uint32_t) mesh->GetElementMaterialCount( ) ) {
+        s.console->debug( "Mesh \"{}\" has {} material elements.", mesh->GetNode( )->GetName( ), ec );
 
-        for ( uint32_t m = 0; m < mc; ++m ) {
-            if ( const auto materialElement = mesh->GetElementMaterial( m ) ) {
+        for ( uint32_t e = 0; e < ec && nullptr == materialElement; ++e ) {
+            if ( const auto element = mesh->GetElementMaterial( e ) ) {
                 // The only mapping mode for materials that makes sense is polygon mapping.
-                const auto materialMappingMode = materialElement->GetMappingMode( );
+                const auto materialMappingMode = element->GetMappingMode( );
 
                 // Handle the case with splitted meshes.
-                if (materialMappingMode == FbxLayerElement::eAllSame)
+                if ( materialMappingMode == FbxLayerElement::eAllSame )
                     continue;
 
                 if ( materialMappingMode != FbxLayerElement::eByPolygon ) {
-                    s.console->error( "Material element #{} has {} mapping mode (not supported).", m, materialMappingMode );
+                    s.console->error( "Material element #{} has {} mapping mode (not supported).", e, materialMappingMode );
                     DebugBreak( );
                     continue;
                 }
 
                 // Mapping is done though the polygon indices.
                 // For each polygon we have assigned material index.
-                const auto& materialIndices = materialElement->GetIndexArray( );
-                if (materialIndices.GetCount() < 1) {
-                    s.console->error( "Material element {} has no indices, skipped.", m );
+                if ( (uint32_t) element->GetIndexArray( ).GetCount( ) < pc ) {
+                    s.console->error( "Material element #{} has {} indices for {} polygons, skipped.", e, element->GetIndexArray( ).GetCount( ), pc );
                     DebugBreak( );
                     continue;
                 }
 
-                const uint32_t pc = (uint32_t) mesh->GetPolygonCount( );
-                for ( uint32_t i = 0; i < pc; ++i )
-                    items.emplace_back( (TIndex) materialIndices.GetAt( i ), i );
+                materialElement = element;
             }
         }
     }
 
-    if ( items.empty( ) ) {
+    if ( nullptr == materialElement || 0 == pc ) {
         s.console->error( "Mesh \"{}\" has no correctly mapped materials (fallback to first one).", mesh->GetNode( )->GetName( ) );
         // Splitted meshes per material case, do not issues a debug break.
         // DebugBreak( );
         return false;
     }
 
+    const LockedElementArray< int > materialIndices( &materialElement->GetIndexArray( ) );
+
+    // The polygons with the invalid material indices are drawn with the first material.
+    auto getMaterialIndex = [&]( uint32_t pi ) {
+        const int mi = materialIndices.data[ pi ];
+        return ( mi >= 0 && (uint32_t) mi < mc ) ? (uint32_t) mi : 0u;
+    };
+
     //
-    // The most important part:
-    // 1) Make sure our mapping is sorted, the FBX SDK doc does not state their data is sorted
-    //    but in practice I did not see the unsorted polygon indices.
-    // 2) Fill all the polygon ranges (consider breaks in the sorted ranges).
-    //    If the polygon indices are [2, 3, 4, 10, 11, 12, 13, 15, 17]
-    //    we will get {2, 3} (range starts at 2 and is 3 polygons long),
-    //                {10, 4}, {15, 1}, {17, 1}.
+    // Counting sort by material.
+    // 1) Count the polygons of every material in every chunk.
+    // 2) Replace the counts with the offsets of the chunk polygons in the sorted order.
+    // 3) Scatter the polygon indices to the offsets, the polygons of the chunk keep their order.
     //
 
-    using U = std::tuple< TIndex, TIndex >;
-    auto sortByMaterialIndex = [&]( const U& a, const U& b ) { return std::get< 0 >( a ) < std::get< 0 >( b ); };
-    auto sortByPolygonIndex  = [&]( const U& a, const U& b ) { return std::get< 1 >( a ) < std::get< 1 >( b ); };
-
-    // Sort items by material index.
-    std::sort( items.begin( ), items.end( ), sortByMaterialIndex );
-
-    auto extractSubsetsFromRange = [&]( const uint32_t mii, const uint32_t ii, const uint32_t i ) {
-        uint32_t ki = ii;
-        TIndex k  = std::get< 1 >( items[ ii ] );
-
-        uint32_t j = ii;
-        for ( ; j < i; ++j ) {
-            //indices.push_back( j * 3 + 0 );
-            //indices.push_back( j * 3 + 0 );
-            //indices.push_back( j * 3 + 2 );
-
-            const TIndex kk  = std::get< 1 >( items[ j ] );
-            if ((kk - k) > 1) {
-                // s.console->info( "Break in {} - {} vs {}", j, k, kk );
-                // Process a case where there is a break in polygon indices.
-                s.console->info( "\tAdding subset: material #{}, polygon #{}, count {} ({} - {}).", mii, k, j - ki, ki, j - 1 );
-
-                // subsetPolies.emplace_back( mii, k, j - ki );
-                subsetPolies.emplace_back( mii, ki, j - ki );
-                // subsets.emplace_back( mii, ki, j - ki );
-                // subsets.emplace_back( mii, ki * 3, ( j - ki ) * 3 );
-                ki = j;
-                k  = kk;
-            }
+    const uint32_t kChunkPolygonCount = 64 * 1024;
+    const uint32_t chunkCount         = ( pc + kChunkPolygonCount - 1 ) / kChunkPolygonCount;
 
-            k = kk;
-        }
+    apemode::ArenaVector< uint32_t > chunkOffsets( chunkCount * mc, 0 ); // [chunk * mc + material]
+    apemode::ArenaVector< uint32_t > chunkInvalidCounts( chunkCount, 0 );
 
-        s.console->info( "\tAdding subset: material #{}, polygon #{}, count {} ({} - {}).", mii, k, j - ki, ki, j - 1 );
+    apemode::ParallelFor( *s.jobs, chunkCount, [&]( uint32_t chunk ) {
+        uint32_t* counts = chunkOffsets.data( ) + chunk * mc;
+        for ( uint32_t pi = chunk * kChunkPolygonCount; pi < std::min( pc, ( chunk + 1 ) * kChunkPolygonCount ); ++pi ) {
+            const int mi = materialIndices.data[ pi ];
+            chunkInvalidCounts[ chunk ] += ( mi < 0 || (uint32_t) mi >= mc ) ? 1 : 0;
+            ++counts[ getMaterialIndex( pi ) ];
+        }
+    } );
 
-        // subsetPolies.emplace_back( mii, k, j - ki );
-        subsetPolies.emplace_back( mii, ki, j - ki );
-        // subsets.emplace_back( mii, ki, j - ki );
-        // subsets.emplace_back( mii, ki * 3, ( j - ki ) * 3 );
-    };
+    if ( const uint32_t invalidCount = std::accumulate( chunkInvalidCounts.begin( ), chunkInvalidCounts.end( ), 0u ) ) {
+        s.console->error( "Mesh \"{}\" has {} polygon(s) with invalid material index (fallback to first one).", mesh->GetNode( )->GetName( ), invalidCount );
+    }
 
-    uint32_t ii = 0;
-    TIndex mii = std::get< 0 >( items.front( ) );
-
-    uint32_t i  = 0;
-    const uint32_t ic = (uint32_t) items.size( );
-    for ( ; i < ic; ++i ) {
-        const TIndex mi = std::get< 0 >( items[ i ] );
-        if ( mi != mii ) {
-            s.console->info( "Material #{} has {} assigned polygons ({} - {}).", mii, i - ii, ii, i - 1 );
-
-            // Sort items by polygon index.
-            std::sort( items.data( ) + ii, items.data( ) + i, sortByPolygonIndex );
-            extractSubsetsFromRange( mii, ii, i );
-            ii  = i;
-            mii = mi;
+    apemode::ArenaVector< uint32_t > materialPolygonCounts( mc, 0 );
+    uint32_t                offset = 0;
+    for ( uint32_t mi = 0; mi < mc; ++mi ) {
+        for ( uint32_t chunk = 0; chunk < chunkCount; ++chunk ) {
+            const uint32_t count = chunkOffsets[ chunk * mc + mi ];
+            chunkOffsets[ chunk * mc + mi ] = offset;
+            materialPolygonCounts[ mi ] += count;
+            offset += count;
         }
     }
 
-    s.console->info( "Material #{} has {} assigned polygons ({} - {}).", mii, i - ii, ii, i - 1 );
-    std::sort( items.data( ) + ii, items.data( ) + i, sortByPolygonIndex );
-    extractSubsetsFromRange( mii, ii, i );
-
-    TIndex subsetStartIndex = 0;
-    uint32_t materialIndex = (uint32_t) -1;
+    indices.resize( pc * 3 );
+    apemode::ParallelFor( *s.jobs, chunkCount, [&]( uint32_t chunk ) {
+        uint32_t* offsets = chunkOffsets.data( ) + chunk * mc;
+        for ( uint32_t pi = chunk * kChunkPolygonCount; pi < std::min( pc, ( chunk + 1 ) * kChunkPolygonCount ); ++pi ) {
+            TIndex* polygonIndices = indices.data( ) + offsets[ getMaterialIndex( pi ) ]++ * 3;
+            polygonIndices[ 0 ] = ( TIndex )( pi * 3 + 0 );
+            polygonIndices[ 1 ] = ( TIndex )( pi * 3 + 1 );
+            polygonIndices[ 2 ] = ( TIndex )( pi * 3 + 2 );
+        }
+    } );
 
-    if ( !subsetPolies.empty( ) ) {
-        s.console->info( "Mesh index subsets from {} polygon ranges:", subsetPolies.size( ) );
-    }
+    //
+    // Fill the subsets and the polygon ranges (consider breaks in the sorted polygons).
+    // If the polygon indices of the material are [2, 3, 4, 10, 11, 12, 13, 15, 17]
+    // we will get {2, 3} (range starts at 2 and is 3 polygons long),
+    //             {10, 4}, {15, 1}, {17, 1}.
+    //
 
-    for ( auto& sp : subsetPolies ) {
-        if ( materialIndex != sp.material_id( ) ) {
-            const TIndex indexCount = (TIndex) indices.size( );
+    uint32_t firstPolygon = 0;
+    for ( uint32_t mi = 0; mi < mc; ++mi ) {
+        const uint32_t count = materialPolygonCounts[ mi ];
+        if ( 0 == count )
+            continue;
 
-            if ( materialIndex != (uint32_t) -1 ) {
-                const auto subsetLength = indexCount - subsetStartIndex;
-                subsets.emplace_back( materialIndex, (uint32_t)subsetStartIndex, (uint32_t)subsetLength );
+        const size_t rangeIndex = subsetPolies.size( );
+        for ( uint32_t j = firstPolygon; j < firstPolygon + count; ) {
+            const uint32_t rangePolygon = (uint32_t) indices[ j * 3 ] / 3;
 
-                s.console->info( "\tMesh subset #{} for material #{} index range: [{}; {}].",
-                                 subsets.size( ) - 1,
-                                 materialIndex,
-                                 subsetStartIndex,
-                                 subsetLength );
-            }
+            uint32_t k = j + 1;
+            while ( k < firstPolygon + count && (uint32_t) indices[ k * 3 ] / 3 == rangePolygon + ( k - j ) )
+                ++k;
 
-            materialIndex    = sp.material_id( );
-            subsetStartIndex = indexCount;
+            subsetPolies.emplace_back( mi, rangePolygon, k - j );
+            j = k;
         }
 
-        for ( uint32_t pp = 0; pp < sp.index_count( ); ++pp ) {
-            const TIndex pii = ( TIndex )( sp.base_index( ) + pp );
-            indices.push_back( pii * 3 + 0 );
-            indices.push_back( pii * 3 + 1 );
-            indices.push_back( pii * 3 + 2 );
-        }
-    }
+        subsets.emplace_back( mi, firstPolygon * 3, count * 3 );
 
-    if ( !subsetPolies.empty( ) ) {
-        const TIndex indexCount   = (TIndex) indices.size( );
-        const auto subsetLength = indexCount - subsetStartIndex;
-        subsets.emplace_back( materialIndex, subsetStartIndex, subsetLength );
+        FBXP_TRACE( "\tMesh subset #{} for material #{} index range: [{}; {}], {} polygon range(s).",
+                    subsets.size( ) - 1,
+                    mi,
+                    firstPolygon * 3,
+                    count * 3,
+                    subsetPolies.size( ) - rangeIndex );
+        (void) rangeIndex;
 
-        s.console->info( "\tMesh subset #{} for material #{} index range: [{}; {}].",
-                         subsets.size( ) - 1,
-                         materialIndex,
-                         subsetStartIndex,
-                         subsetLength );
+        firstPolygon += count;
     }
 
     assert( indices.size( ) == ( size_t )( mesh->GetPolygonCount( ) * 3 ) );
@@ -310,245 +669,62 @@ bool GetSubsets( FbxMesh*                           mesh,
 }
 
 //
-// Helper function to get values from geometry element layers
-// with their reference and mapping modes.
+// See implementation in fbxpmeshopt.cpp.
 //
 
-/**
- * Returns the value from the element layer by index with respect to reference mode.
- **/
-template < typename TElementLayer, typename TElementValue >
-TElementValue GetElementValue( const TElementLayer* elementLayer, uint32_t i ) {
-    assert( elementLayer );
-    switch ( const auto referenceMode = elementLayer->GetReferenceMode( ) ) {
-        case FbxLayerElement::EReferenceMode::eDirect:
-            return elementLayer->GetDirectArray( ).GetAt( i );
-        case FbxLayerElement::EReferenceMode::eIndex:
-        case FbxLayerElement::EReferenceMode::eIndexToDirect: {
-            const int j = elementLayer->GetIndexArray( ).GetAt( i );
-            return elementLayer->GetDirectArray( ).GetAt( j );
-        }
-
-        default:
-            apemode::Get( ).console->error(
-                "Reference mode {} of layer \"{}\" "
-                "is not supported.",
-                referenceMode,
-                elementLayer->GetName( ) );
-
-            DebugBreak( );
-            return TElementValue( );
-    }
-}
-
-/**
- * Returns the value from the element layer with respect to reference and mapping modes.
- **/
-template < typename TElementLayer, typename TElementValue >
-TElementValue GetElementValue( const TElementLayer* elementLayer,
-                               uint32_t             controlPointIndex,
-                               uint32_t             vertexIndex,
-                               uint32_t             polygonIndex ) {
-    if ( nullptr == elementLayer )
-        return TElementValue( );
-
-    switch ( const auto mappingMode = elementLayer->GetMappingMode( ) ) {
-        case FbxLayerElement::EMappingMode::eByControlPoint:
-            return GetElementValue< TElementLayer, TElementValue >( elementLayer, controlPointIndex );
-        case FbxLayerElement::EMappingMode::eByPolygon:
-            return GetElementValue< TElementLayer, TElementValue >( elementLayer, polygonIndex );
-        case FbxLayerElement::EMappingMode::eByPolygonVertex:
-            return GetElementValue< TElementLayer, TElementValue >( elementLayer, vertexIndex );
-
-        default:
-            apemode::Get( ).console->error(
-                "Mapping mode {} of layer \"{}\" "
-                "is not supported.",
-                mappingMode,
-                elementLayer->GetName( ) );
-
-            DebugBreak( );
-            return TElementValue( );
-    }
-}
-
-/**
- * Returns nullptr in case element layer has unsupported properties or is null.
- **/
-template < typename TElementLayer >
-const TElementLayer* VerifyElementLayer( const TElementLayer* elementLayer ) {
-    if ( nullptr == elementLayer ) {
-        apemode::Get( ).console->error( "Missing element layer." );
-        return nullptr;
-    }
-
-    switch ( const auto mappingMode = elementLayer->GetMappingMode( ) ) {
-        case FbxLayerElement::EMappingMode::eByControlPoint:
-        case FbxLayerElement::EMappingMode::eByPolygon:
-        case FbxLayerElement::EMappingMode::eByPolygonVertex:
-            break;
-        default:
-            apemode::Get( ).console->error(
-                "Mapping mode {} of layer \"{}\" "
-                "is not supported.",
-                mappingMode,
-                elementLayer->GetName( ) );
-            return nullptr;
-    }
-
-    switch ( const auto referenceMode = elementLayer->GetReferenceMode( ) ) {
-        case FbxLayerElement::EReferenceMode::eDirect:
-        case FbxLayerElement::EReferenceMode::eIndex:
-        case FbxLayerElement::EReferenceMode::eIndexToDirect:
-            break;
-        default:
-            apemode::Get( ).console->error(
-                "Reference mode {} of layer \"{}\" "
-                "is not supported.",
-                referenceMode,
-                elementLayer->GetName( ) );
-            return nullptr;
-    }
-
-    return elementLayer;
-}
-
-/**
- * Helper structure to assign vertex property values
- **/
-struct StaticVertex {
-    float position[ 3 ];
-    float normal[ 3 ];
-    float tangent[ 4 ];
-    float texCoords[ 2 ];
-};
+void Optimize32( apemode::Mesh& mesh, uint32_t vertexCount, const char* meshName );
+void Optimize16( apemode::Mesh& mesh, uint32_t vertexCount, const char* meshName );
+void InitializeOptimizationPasses( );
+void LogOptimizationStats( );
+uint32_t WeldVertices( std::vector< uint8_t >& vertices, uint32_t vertexCount, uint32_t vertexStride, float epsilon, std::vector< uint32_t >& remap );
 
 //
-// Flatbuffers takes care about correct platform-independent alignment.
+// See implementation in fbxptangents.cpp.
 //
 
-static_assert( sizeof( StaticVertex ) == sizeof( apemodefb::StaticVertexFb ), "Must match" );
-static_assert( sizeof( apemodefb::PackedVertexFb ) == sizeof( apemodefb::PackedVertexFb ), "Must match" );
-
-/**
- * Initialize vertices with very basic properties like 'position', 'normal', 'tangent', 'texCoords'.
- * Calculate mesh position and texcoord min max values.
- **/
-template < typename TVertex >
-void InitializeVertices( FbxMesh*      mesh,
-                         apemode::Mesh&   m,
-                         TVertex*      vertices,
-                         size_t        vertexCount,
-                         mathfu::vec3& positionMin,
-                         mathfu::vec3& positionMax,
-                         mathfu::vec2& texcoordMin,
-                         mathfu::vec2& texcoordMax ) {
-    auto& s = apemode::Get( );
-    const uint32_t cc = (uint32_t) mesh->GetControlPointsCount( );
-    const uint32_t pc = (uint32_t) mesh->GetPolygonCount( );
-
-    s.console->info( "Mesh \"{}\" has {} control points.", mesh->GetNode( )->GetName( ), cc );
-    s.console->info( "Mesh \"{}\" has {} polygons.", mesh->GetNode( )->GetName( ), pc );
-
-    positionMin.x = std::numeric_limits< float >::max( );
-    positionMin.y = std::numeric_limits< float >::max( );
-    positionMin.z = std::numeric_limits< float >::max( );
-    positionMax.x = std::numeric_limits< float >::min( );
-    positionMax.y = std::numeric_limits< float >::min( );
-    positionMax.z = std::numeric_limits< float >::min( );
+uint32_t GenerateTangents( apemode::Mesh& m, std::vector< uint32_t >& indices, uint32_t vertexCount, const char* meshName );
+void     LogTangentStats( );
 
-    texcoordMin.x = std::numeric_limits< float >::max( );
-    texcoordMin.y = std::numeric_limits< float >::max( );
-    texcoordMax.x = std::numeric_limits< float >::min( );
-    texcoordMax.y = std::numeric_limits< float >::min( );
+//
+// See implementation in fbxpanalysis.cpp.
+//
 
-    const auto uve = VerifyElementLayer( mesh->GetElementUV( ) );
-    const auto ne  = VerifyElementLayer( mesh->GetElementNormal( ) );
-    const auto te  = VerifyElementLayer( mesh->GetElementTangent( ) );
+bool IsAnalysisEnabled( );
+void InitializeAnalysis( );
+void AnalyzeMesh16( apemode::Mesh const& mesh, uint32_t vertexCount, const char* meshName, const char* stage );
+void AnalyzeMesh32( apemode::Mesh const& mesh, uint32_t vertexCount, const char* meshName, const char* stage );
 
-    uint32_t vi = 0;
-    for ( uint32_t pi = 0; pi < pc; ++pi ) {
-        assert( 3 == mesh->GetPolygonSize( pi ) );
-
-        // Having this array we can easily control polygon winding order.
-        // Since mesh is triangular we can make it static [3] at compile-time.
-        for ( const uint32_t pvi : {0, 1, 2} ) {
-            const uint32_t ci = (uint32_t) mesh->GetPolygonVertex( (int) pi, (int) pvi );
-
-            const auto cp = mesh->GetControlPointAt( ci );
-            const auto uv = GetElementValue< FbxGeometryElementUV, FbxVector2 >( uve, ci, vi, pi );
-            const auto n  = GetElementValue< FbxGeometryElementNormal, FbxVector4 >( ne, ci, vi, pi );
-            const auto t  = GetElementValue< FbxGeometryElementTangent, FbxVector4 >( te, ci, vi, pi );
-
-            auto& vvii          = vertices[ vi ];
-            vvii.position[ 0 ]  = (float) cp[ 0 ];
-            vvii.position[ 1 ]  = (float) cp[ 1 ];
-            vvii.position[ 2 ]  = (float) cp[ 2 ];
-            vvii.normal[ 0 ]    = (float) n[ 0 ];
-            vvii.normal[ 1 ]    = (float) n[ 1 ];
-            vvii.normal[ 2 ]    = (float) n[ 2 ];
-            vvii.tangent[ 0 ]   = (float) t[ 0 ];
-            vvii.tangent[ 1 ]   = (float) t[ 1 ];
-            vvii.tangent[ 2 ]   = (float) t[ 2 ];
-            vvii.tangent[ 3 ]   = (float) t[ 3 ];
-            vvii.texCoords[ 0 ] = (float) uv[ 0 ];
-            vvii.texCoords[ 1 ] = (float) uv[ 1 ];
-
-            assert( !isnan( (float) cp[ 0 ] ) && !isnan( (float) cp[ 1 ] ) && !isnan( (float) cp[ 2 ] ) );
-            assert( !isnan( (float) n[ 0 ] ) && !isnan( (float) n[ 1 ] ) && !isnan( (float) n[ 2 ] ) );
-            assert( !isnan( (float) t[ 0 ] ) && !isnan( (float) t[ 1 ] ) && !isnan( (float) t[ 2 ] ) && !isnan( (float) t[ 3 ] ) );
-            assert( !isnan( (float) uv[ 0 ] ) && !isnan( (float) uv[ 1 ] ) );
-
-            positionMin.x = std::min( positionMin.x, (float) cp[ 0 ] );
-            positionMin.y = std::min( positionMin.y, (float) cp[ 1 ] );
-            positionMin.z = std::min( positionMin.z, (float) cp[ 2 ] );
-            positionMax.x = std::max( positionMax.x, (float) cp[ 0 ] );
-            positionMax.y = std::max( positionMax.y, (float) cp[ 1 ] );
-            positionMax.z = std::max( positionMax.z, (float) cp[ 2 ] );
-
-            texcoordMin.x = std::min( texcoordMin.x, (float) uv[ 0 ] );
-            texcoordMin.y = std::min( texcoordMin.y, (float) uv[ 1 ] );
-            texcoordMax.x = std::max( texcoordMax.x, (float) uv[ 0 ] );
-            texcoordMax.y = std::max( texcoordMax.y, (float) uv[ 1 ] );
-
-            ++vi;
-        }
-    }
+//
+// See implementation in fbxpmeshlets.cpp.
+//
 
-    m.positionMin = apemodefb::vec3( positionMin.x, positionMin.y, positionMin.z );
-    m.positionMax = apemodefb::vec3( positionMax.x, positionMax.y, positionMax.z );
-    m.texcoordMin = apemodefb::vec2( texcoordMin.x, texcoordMin.y );
-    m.texcoordMax = apemodefb::vec2( texcoordMax.x, texcoordMax.y );
+void BuildMeshlets16( apemode::Mesh& mesh, uint32_t vertexCount, const char* meshName );
+void BuildMeshlets32( apemode::Mesh& mesh, uint32_t vertexCount, const char* meshName );
+void LogMeshletStats( );
 
-    if ( nullptr == uve ) {
-        s.console->error( "Mesh \"{}\" does not have texcoords geometry layer.",
-                          mesh->GetNode( )->GetName( ) );
-    }
-
-    if ( nullptr == ne ) {
-        s.console->warn( "Mesh \"{}\" does not have normal geometry layer.",
-                          mesh->GetNode( )->GetName( ) );
+//
+// See implementation in fbxpmeshlod.cpp.
+//
 
-        // Calculate face normals ourselves.
-        // Usable but incorrect.
-        CalculateFaceNormals( vertices, vertexCount );
-    }
+void GenerateLods16( apemode::Mesh& mesh, uint32_t vertexCount, uint32_t maxLodCount, float lodError, bool optimize, const char* meshName );
+void GenerateLods32( apemode::Mesh& mesh, uint32_t vertexCount, uint32_t maxLodCount, float lodError, bool optimize, const char* meshName );
+void LogLodStats( );
 
-    if ( nullptr == te && nullptr != uve ) {
-        s.console->warn( "Mesh \"{}\" does not have tangent geometry layer.",
-                         mesh->GetNode( )->GetName( ) );
+//
+// See implementation in fbxpindexcodec.cpp.
+//
 
-        // Calculate tangents ourselves if UVs are available.
-        CalculateTangents( vertices, vertexCount );
-    }
-}
+void CompressIndices16( apemode::Mesh& mesh, const char* meshName );
+void CompressIndices32( apemode::Mesh& mesh, const char* meshName );
+void LogIndexCodecStats( );
 
 //
-// See implementation in fbxpmeshopt.cpp.
+// See implementation in fbxpdraco.cpp.
 //
 
-void Optimize32( apemode::Mesh& mesh, apemodefb::StaticVertexFb const* vertices, uint32_t & vertexCount, uint32_t vertexStride );
-void Optimize16( apemode::Mesh& mesh, apemodefb::StaticVertexFb const* vertices, uint32_t & vertexCount, uint32_t vertexStride );
+bool EncodeDracoMesh16( apemode::Mesh& mesh, uint32_t& vertexCount, const char* meshName );
+bool EncodeDracoMesh32( apemode::Mesh& mesh, uint32_t& vertexCount, const char* meshName );
+void LogDracoStats( );
 
 //
 // See implementation in fbxpmeshpacking.cpp.
@@ -562,39 +738,59 @@ void Pack( const apemodefb::StaticVertexFb* vertices,
            const mathfu::vec2              texcoordsMin,
            const mathfu::vec2              texcoordsMax );
 
+void PackOctahedral( const apemodefb::StaticVertexFb*     vertices,
+                     apemodefb::PackedOctahedralVertexFb* packed,
+                     const uint32_t                      vertexCount,
+                     const mathfu::vec3                  positionMin,
+                     const mathfu::vec3                  positionMax,
+                     const mathfu::vec2                  texcoordsMin,
+                     const mathfu::vec2                  texcoordsMax,
+                     const char*                         meshName );
+
+void LogPackStats( );
+
+/**
+ * Stores the welded subset indices, optimizes the indices, builds the meshlets and the LODs, compresses the indices,
+ * packs the vertices, and adds the submesh.
+ * With Draco compression (-c) the mesh is compressed right after the optimization (Draco reorders the vertices
+ * and the triangles, so the meshlets, the LODs, the index compression and the packing are skipped if it succeeds).
+ * @param indices The subset indices (remapped to the welded vertices).
+ * @param vertexCount The welded vertex count.
+ **/
 template < typename TIndex >
-void ExportMesh( FbxNode* node, FbxMesh* mesh, apemode::Node& n, apemode::Mesh& m, uint32_t vertexCount, bool pack, bool optimize ) {
+void ExportMesh( FbxMesh*                       mesh,
+                 apemode::Mesh&                 m,
+                 std::vector< uint32_t > const& indices,
+                 std::vector< uint32_t > const& remap,
+                 uint32_t                       vertexCount,
+                 bool                           pack,
+                 bool                           optimize ) {
     auto& s = apemode::Get( );
 
+    const bool compress   = s.options[ "c" ].as< bool >( );
+    const bool octahedral = pack && s.options[ "pack-octahedral" ].as< bool >( );
+    const apemodefb::EVertexFormat packedVertexFormat = octahedral ? apemodefb::EVertexFormat_PackedOctahedral : apemodefb::EVertexFormat_Packed;
+
     const uint16_t vertexStride           = (uint16_t) sizeof( apemodefb::StaticVertexFb );
-    const uint32_t vertexBufferSize       = vertexCount * vertexStride;
-    const uint16_t packedVertexStride     = (uint16_t) sizeof( apemodefb::PackedVertexFb );
+    const uint16_t packedVertexStride     = (uint16_t) ( octahedral ? sizeof( apemodefb::PackedOctahedralVertexFb ) : sizeof( apemodefb::PackedVertexFb ) );
     const uint32_t packedVertexBufferSize = vertexCount * packedVertexStride;
 
-    m.vertices.resize( vertexBufferSize );
-
-    std::vector< TIndex > tempSubsetIndices;
-    std::vector< std::tuple< TIndex, TIndex > > tempItems;
-
-    mathfu::vec3 positionMin;
-    mathfu::vec3 positionMax;
-    mathfu::vec2 texcoordMin;
-    mathfu::vec2 texcoordMax;
-
-    InitializeVertices( mesh,
-                        m,
-                        reinterpret_cast< StaticVertex* >( m.vertices.data( ) ),
-                        vertexCount,
-                        positionMin,
-                        positionMax,
-                        texcoordMin,
-                        texcoordMax );
-
-    GetSubsets( mesh, m, tempSubsetIndices, m.subsets, m.subsetsPolies, tempItems );
-
-    if ( const size_t subsetIndexBufferSize = sizeof( TIndex ) * tempSubsetIndices.size( ) ) {
-        m.subsetIndices.resize( subsetIndexBufferSize );
-        std::memcpy( m.subsetIndices.data( ), tempSubsetIndices.data( ), subsetIndexBufferSize );
+    const mathfu::vec3 positionMin( m.positionMin.x( ), m.positionMin.y( ), m.positionMin.z( ) );
+    const mathfu::vec3 positionMax( m.positionMax.x( ), m.positionMax.y( ), m.positionMax.z( ) );
+    const mathfu::vec2 texcoordMin( m.texcoordMin.x( ), m.texcoordMin.y( ) );
+    const mathfu::vec2 texcoordMax( m.texcoordMax.x( ), m.texcoordMax.y( ) );
+
+    // The indices are remapped (if the remap is not empty) and converted while they are written to the mesh.
+    m.subsetIndices.resize( sizeof( TIndex ) * indices.size( ) );
+    auto subsetIndices = reinterpret_cast< TIndex* >( m.subsetIndices.data( ) );
+    if ( remap.empty( ) ) {
+        for ( size_t i = 0; i < indices.size( ); ++i ) {
+            subsetIndices[ i ] = (TIndex) indices[ i ];
+        }
+    } else {
+        for ( size_t i = 0; i < indices.size( ); ++i ) {
+            subsetIndices[ i ] = (TIndex) remap[ indices[ i ] ];
+        }
     }
 
     if ( std::is_same< TIndex, uint16_t >::value ) {
@@ -605,30 +801,99 @@ void ExportMesh( FbxNode* node, FbxMesh* mesh, apemode::Node& n, apemode::Mesh&
         assert( false );
     }
 
+    // The analysis measures the subsets before and after the optimization (or the source subsets only).
+    const bool analyze = IsAnalysisEnabled( );
+    if ( analyze ) {
+        if ( std::is_same< TIndex, uint16_t >::value ) {
+            AnalyzeMesh16( m, vertexCount, mesh->GetNode( )->GetName( ), optimize ? "before" : "source" );
+        } else if ( std::is_same< TIndex, uint32_t >::value ) {
+            AnalyzeMesh32( m, vertexCount, mesh->GetNode( )->GetName( ), optimize ? "before" : "source" );
+        }
+    }
+
     if ( optimize ) {
-        auto initializedVertices = reinterpret_cast< const apemodefb::StaticVertexFb* >( m.vertices.data( ) );
+        if ( std::is_same< TIndex, uint16_t >::value ) {
+            Optimize16( m, vertexCount, mesh->GetNode( )->GetName( ) );
+        } else if ( std::is_same< TIndex, uint32_t >::value ) {
+            Optimize32( m, vertexCount, mesh->GetNode( )->GetName( ) );
+        }
+
+        if ( analyze ) {
+            if ( std::is_same< TIndex, uint16_t >::value ) {
+                AnalyzeMesh16( m, vertexCount, mesh->GetNode( )->GetName( ), "after" );
+            } else if ( std::is_same< TIndex, uint32_t >::value ) {
+                AnalyzeMesh32( m, vertexCount, mesh->GetNode( )->GetName( ), "after" );
+            }
+        }
+    }
 
+    // The mesh stays uncompressed if Draco fails, the other stages are skipped for the compressed meshes only.
+    bool compressed = false;
+    if ( compress ) {
         if ( std::is_same< TIndex, uint16_t >::value ) {
-            Optimize16( m, initializedVertices, vertexCount, vertexStride );
+            compressed = EncodeDracoMesh16( m, vertexCount, mesh->GetNode( )->GetName( ) );
         } else if ( std::is_same< TIndex, uint32_t >::value ) {
-            m.subsetIndexType = apemodefb::EIndexTypeFb_UInt32;
-            Optimize32( m, initializedVertices, vertexCount, vertexStride );
+            compressed = EncodeDracoMesh32( m, vertexCount, mesh->GetNode( )->GetName( ) );
+        }
+
+        // The compressed mesh is decoded to the static vertices.
+        if ( compressed )
+            pack = false;
+    }
+
+    if ( false == compressed && s.options[ "meshlets" ].as< bool >( ) ) {
+        if ( std::is_same< TIndex, uint16_t >::value ) {
+            BuildMeshlets16( m, vertexCount, mesh->GetNode( )->GetName( ) );
+        } else if ( std::is_same< TIndex, uint32_t >::value ) {
+            BuildMeshlets32( m, vertexCount, mesh->GetNode( )->GetName( ) );
+        }
+    }
+
+    // The LOD indices are appended after the subset indices, the meshlets are built for the base level only.
+    // Every level halves the triangles, there is nothing left to simplify after 16 levels (the target count shift overflows at 32).
+    const int kMaxLodCount = 16;
+    const int lodCount     = std::min( s.options[ "lods" ].as< int >( ), kMaxLodCount );
+    if ( false == compressed && lodCount > 0 ) {
+        const float lodError = s.options[ "lod-error" ].as< float >( ) > 0 ? s.options[ "lod-error" ].as< float >( ) : 0.01f;
+        if ( std::is_same< TIndex, uint16_t >::value ) {
+            GenerateLods16( m, vertexCount, (uint32_t) lodCount, lodError, optimize, mesh->GetNode( )->GetName( ) );
+        } else if ( std::is_same< TIndex, uint32_t >::value ) {
+            GenerateLods32( m, vertexCount, (uint32_t) lodCount, lodError, optimize, mesh->GetNode( )->GetName( ) );
+        }
+    }
+
+    if ( false == compressed && s.options[ "compress-indices" ].as< bool >( ) ) {
+        if ( std::is_same< TIndex, uint16_t >::value ) {
+            CompressIndices16( m, mesh->GetNode( )->GetName( ) );
+        } else if ( std::is_same< TIndex, uint32_t >::value ) {
+            CompressIndices32( m, mesh->GetNode( )->GetName( ) );
         }
     }
 
     if ( pack ) {
-        std::vector< apemodefb::StaticVertexFb > tempBuffer;
-        tempBuffer.resize( vertexCount );
-        memcpy( tempBuffer.data( ), m.vertices.data( ), m.vertices.size( ) );
+        // The static vertices are packed to the separate buffer, which replaces them.
+        std::vector< uint8_t > packedVertices( packedVertexBufferSize );
+
+        if ( octahedral ) {
+            PackOctahedral( reinterpret_cast< const apemodefb::StaticVertexFb* >( m.vertices.data( ) ),
+                            reinterpret_cast< apemodefb::PackedOctahedralVertexFb* >( packedVertices.data( ) ),
+                            vertexCount,
+                            positionMin,
+                            positionMax,
+                            texcoordMin,
+                            texcoordMax,
+                            mesh->GetNode( )->GetName( ) );
+        } else {
+            Pack( reinterpret_cast< const apemodefb::StaticVertexFb* >( m.vertices.data( ) ),
+                  reinterpret_cast< apemodefb::PackedVertexFb* >( packedVertices.data( ) ),
+                  vertexCount,
+                  positionMin,
+                  positionMax,
+                  texcoordMin,
+                  texcoordMax );
+        }
 
-        m.vertices.resize( packedVertexBufferSize );
-        Pack( reinterpret_cast< apemodefb::StaticVertexFb* >( tempBuffer.data( ) ),
-              reinterpret_cast< apemodefb::PackedVertexFb* >( m.vertices.data( ) ),
-              vertexCount,
-              positionMin,
-              positionMax,
-              texcoordMin,
-              texcoordMax );
+        m.vertices.swap( packedVertices );
     }
 
     apemodefb::vec3 bboxMin( positionMin.x, positionMin.y, positionMin.z );
@@ -654,7 +919,7 @@ void ExportMesh( FbxNode* node, FbxMesh* mesh, apemode::Node& n, apemode::Mesh&
                                   0,                              // index count
                                   0,                              // base subset
                                   (uint32_t) m.subsets.size( ),   // subset count
-                                  apemodefb::EVertexFormat_Packed, // vertex format
+                                  packedVertexFormat,             // vertex format
                                   packedVertexStride              // vertex stride
                                   );
     } else {
@@ -676,10 +941,124 @@ void ExportMesh( FbxNode* node, FbxMesh* mesh, apemode::Node& n, apemode::Mesh&
     }
 }
 
-void ExportMesh( FbxNode* node, apemode::Node& n, bool pack, bool optimize ) {
+/**
+ * Initializes the vertices (3 per triangle), welds the identical ones, generates the missing tangents
+ * and exports the mesh with 16-bit indices if the vertex count allows it.
+ **/
+void ExportMesh( FbxMesh* mesh, apemode::Mesh& m, bool pack, bool optimize ) {
+    auto& s = apemode::Get( );
+
+    const uint16_t vertexStride = (uint16_t) sizeof( apemodefb::StaticVertexFb );
+    const uint32_t sourceVertexCount = (uint32_t) mesh->GetPolygonCount( ) * 3;
+
+    m.vertices.resize( sourceVertexCount * vertexStride );
+
+    mathfu::vec3 positionMin;
+    mathfu::vec3 positionMax;
+    mathfu::vec2 texcoordMin;
+    mathfu::vec2 texcoordMax;
+    bool         generateTangents = false;
+
+    InitializeVertices( mesh,
+                        m,
+                        reinterpret_cast< StaticVertex* >( m.vertices.data( ) ),
+                        sourceVertexCount,
+                        positionMin,
+                        positionMax,
+                        texcoordMin,
+                        texcoordMax,
+                        generateTangents );
+
+    std::vector< uint32_t > indices;
+
+    if ( false == GetSubsets( mesh, m, indices, m.subsets, m.subsetsPolies ) ) {
+        // The whole mesh is drawn with the first material.
+        indices.resize( sourceVertexCount );
+        std::iota( indices.begin( ), indices.end( ), 0 );
+
+        m.subsets.clear( );
+        m.subsetsPolies.clear( );
+        m.subsets.emplace_back( (uint32_t) 0, (uint32_t) 0, sourceVertexCount );
+    }
+
+    //
+    // Weld the vertices and remap the subset indices.
+    //
+
+    std::vector< uint32_t > remap;
+    const float weldEpsilon = s.options[ "weld-epsilon" ].as< float >( );
+    uint32_t vertexCount = WeldVertices( m.vertices, sourceVertexCount, vertexStride, weldEpsilon, remap );
+
+    s.console->info( "Mesh \"{}\" has {} vertices after welding ({} before, {:.1f}%).",
+                     mesh->GetNode( )->GetName( ),
+                     vertexCount,
+                     sourceVertexCount,
+                     sourceVertexCount ? 100.0 * vertexCount / sourceVertexCount : 0.0 );
+
+    // The tangents need the welded indices, otherwise the indices are remapped while they are written to the mesh.
+    // The vertices with the mirrored texcoords are split, so the vertex count can grow.
+    if ( generateTangents ) {
+        for ( auto& index : indices ) {
+            index = remap[ index ];
+        }
+
+        std::vector< uint32_t >( ).swap( remap );
+        vertexCount = GenerateTangents( m, indices, vertexCount, mesh->GetNode( )->GetName( ) );
+    }
+
+    if ( vertexCount < 0xffff )
+        ExportMesh< uint16_t >( mesh, m, indices, remap, vertexCount, pack, optimize );
+    else
+        ExportMesh< uint32_t >( mesh, m, indices, remap, vertexCount, pack, optimize );
+}
+
+//
+// See implementation in fbxpcache.cpp.
+//
+
+bool        IsMeshCacheEnabled( );
+void        InitializeMeshCache( );
+std::string GetMeshCacheKey( FbxMesh* mesh );
+bool        LoadCachedMesh( std::string const& key, apemode::Mesh& m );
+void        StoreCachedMesh( std::string const& key, apemode::Mesh const& m );
+void        LogMeshCacheStats( );
+
+//
+// See implementation in fbxparena.cpp.
+//
+
+void InitializeArena( );
+void LogArenaStats( );
+
+//
+// See implementation in fbxpinstancing.cpp.
+//
+
+bool IsInstancingEnabled( );
+void DeduplicateMeshes( );
+
+/**
+ * Prepares the mesh of the node for the export: triangulates it if needed and reserves the mesh slot.
+ * The FBX SDK calls that modify the scene happen here (serially), the geometry processing is deferred (see ExportMeshes).
+ * The nodes that share the mesh reference the slot of its first node.
+ **/
+void ExportMesh( FbxNode* node, apemode::Node& n ) {
     auto& s = apemode::Get( );
     if ( auto mesh = node->GetMesh( ) ) {
-        s.console->info( "Node \"{}\" has mesh.", node->GetName( ) );
+        s.console->debug( "Node \"{}\" has mesh.", node->GetName( ) );
+
+        const bool instancing = IsInstancingEnabled( );
+        if ( instancing ) {
+            auto meshIt = s.meshDict.find( mesh );
+            if ( meshIt != s.meshDict.end( ) ) {
+                n.meshId = meshIt->second;
+                s.console->debug( "Node \"{}\" instances mesh #{}.", node->GetName( ), n.meshId );
+                return;
+            }
+        }
+
+        // The triangulated mesh replaces the source one, both are mapped to the slot.
+        FbxMesh* sourceMesh = mesh;
         if ( !mesh->IsTriangleMesh( ) ) {
             s.console->warn( "Mesh \"{}\" is not triangular, processing...", node->GetName( ) );
             FbxGeometryConverter converter( mesh->GetNode( )->GetFbxManager( ) );
@@ -699,13 +1078,88 @@ void ExportMesh( FbxNode* node, apemode::Node& n, bool pack, bool optimize ) {
 
         n.meshId = (uint32_t) s.meshes.size( );
         s.meshes.emplace_back( );
-        apemode::Mesh& m = s.meshes.back( );
 
-        const uint32_t vertexCount = mesh->GetPolygonCount( ) * 3;
+        if ( instancing ) {
+            s.meshDict[ sourceMesh ] = n.meshId;
+            s.meshDict[ mesh ]       = n.meshId;
+        }
+
+        apemode::PendingMesh pendingMesh;
+        pendingMesh.node   = node;
+        pendingMesh.mesh   = mesh;
+        pendingMesh.meshId = n.meshId;
+        s.pendingMeshes.push_back( pendingMesh );
+    }
+}
+
+/**
+ * Processes the geometry of the meshes collected during the node traversal.
+ * The meshes are independent, every job writes only to its own reserved mesh slot,
+ * so the output does not depend on the number of workers or the job order.
+ **/
+void ExportMeshes( bool pack, bool optimize ) {
+    FBXP_PROFILE_ZONE( "Export meshes" );
+    auto& s = apemode::Get( );
+    const bool stream = s.options[ "l" ].as< bool >( );
+    const bool cache  = IsMeshCacheEnabled( );
+
+    InitializeMeshCache( );
+    InitializeArena( );
 
-        if ( vertexCount < 0xffff )
-            ExportMesh< uint16_t >( node, mesh, n, m, vertexCount, pack, optimize );
-        else
-            ExportMesh< uint32_t >( node, mesh, n, m, vertexCount, pack, optimize );
+    if ( optimize )
+        InitializeOptimizationPasses( );
+
+    // The cached meshes are not processed, so they are processed again to be analyzed (and stored to the cache).
+    const bool analyze = IsAnalysisEnabled( );
+    if ( analyze )
+        InitializeAnalysis( );
+
+    s.console->info( "Processing {} mesh(es) on {} worker(s).", s.pendingMeshes.size( ), s.jobs->GetWorkerCount( ) );
+
+    // The meshes with the Draco payload (processed or cached), the stages after the compression are skipped for them.
+    std::atomic< uint32_t > compressedMeshCount( 0 );
+
+    apemode::ParallelFor( *s.jobs, (uint32_t) s.pendingMeshes.size( ), [&]( uint32_t i ) {
+        const apemode::PendingMesh& pendingMesh = s.pendingMeshes[ i ];
+        apemode::Mesh& m = s.meshes[ pendingMesh.meshId ];
+        FBXP_PROFILE_ZONE_ARG( "Export mesh", pendingMesh.node->GetName( ) );
+
+        // The temporaries of the mesh stages are allocated from the worker arena, it is reset after the mesh.
+        const apemode::ArenaScope arenaScope( "Export mesh" );
+
+        const std::string cacheKey = cache ? GetMeshCacheKey( pendingMesh.mesh ) : "";
+
+        if ( false == cache || analyze || false == LoadCachedMesh( cacheKey, m ) ) {
+            ExportMesh( pendingMesh.mesh, m, pack, optimize );
+
+            if ( cache )
+                StoreCachedMesh( cacheKey, m );
+        }
+
+        if ( false == m.draco.empty( ) )
+            ++compressedMeshCount;
+
+        if ( stream ) {
+            FBXP_PROFILE_ZONE( "Stream mesh" );
+            s.StreamMesh( pendingMesh.meshId );
+        }
+    } );
+
+    if ( compressedMeshCount && ( pack || s.options[ "meshlets" ].as< bool >( ) || s.options[ "lods" ].as< int >( ) > 0 ||
+                                  s.options[ "compress-indices" ].as< bool >( ) ) ) {
+        s.console->warn( "Draco compression: packing, meshlets, LODs and index compression are skipped for {} compressed mesh(es).",
+                         compressedMeshCount.load( ) );
     }
+
+    DeduplicateMeshes( );
+    s.pendingMeshes.clear( );
+    LogMeshCacheStats( );
+    LogTangentStats( );
+    LogOptimizationStats( );
+    LogMeshletStats( );
+    LogLodStats( );
+    LogIndexCodecStats( );
+    LogPackStats( );
+    LogDracoStats( );
+    LogArenaStats( );
 }
@@ -0,0 +1,369 @@
+#include <fbxppch.h>
+#include <fbxpstate.h>
+#include <fbxparena.h>
+#include <atomic>
+#include <chrono>
+
+//
+// Meshlets (clusters) for the GPU-driven rendering.
+// Every subset is split into the clusters of up to 64 vertices and 124 triangles,
+// the triangles are referenced with the cluster-local 8-bit indices, the cluster vertices are remapped to the mesh vertices.
+// Every cluster has the bounding sphere and the normal cone for the frustum and backface culling.
+//
+
+namespace {
+    const uint32_t kMaxMeshletVertices  = 64;
+    const uint32_t kMaxMeshletTriangles = 124;
+    const uint8_t  kNotInMeshlet        = 0xff;
+
+    static_assert( kMaxMeshletVertices < kNotInMeshlet, "Local indices must fit 8 bits." );
+
+    std::atomic< uint64_t > meshletCount( 0 );
+    std::atomic< uint64_t > meshletVertexCount( 0 );
+    std::atomic< uint64_t > meshletTriangleCount( 0 );
+    std::atomic< uint64_t > meshletBuildMicroseconds( 0 );
+
+    inline mathfu::vec3 GetPosition( const apemodefb::StaticVertexFb& vertex ) {
+        return mathfu::vec3( vertex.position( ).x( ), vertex.position( ).y( ), vertex.position( ).z( ) );
+    }
+
+    /**
+     * Calculates the bounding sphere (Ritter) and the normal cone of the cluster triangles.
+     * The cone is disabled (the cutoff is 1, the culling test never passes) if the triangle normals diverge too much.
+     * @param triangles The cluster triangles, 3 positions per triangle.
+     **/
+    apemodefb::MeshletFb GetMeshletBounds( apemode::ArenaVector< mathfu::vec3 > const& positions,
+                                          apemode::ArenaVector< mathfu::vec3 > const& triangles,
+                                          uint32_t                                    subsetId,
+                                          uint32_t                                    baseVertex,
+                                          uint32_t                                    baseTriangle ) {
+        assert( false == positions.empty( ) );
+
+        //
+        // Bounding sphere.
+        //
+
+        auto getFarthest = [&]( const mathfu::vec3 from ) {
+            mathfu::vec3 farthest = from;
+            float farthestDistance = 0.0f;
+            for ( const auto position : positions ) {
+                const float distance = ( position - from ).LengthSquared( );
+                if ( distance > farthestDistance ) {
+                    farthestDistance = distance;
+                    farthest = position;
+                }
+            }
+            return farthest;
+        };
+
+        const mathfu::vec3 p1 = getFarthest( positions.front( ) );
+        const mathfu::vec3 p2 = getFarthest( p1 );
+
+        mathfu::vec3 center = ( p1 + p2 ) * 0.5f;
+        float radius = ( p2 - p1 ).Length( ) * 0.5f;
+
+        for ( const auto position : positions ) {
+            const float distance = ( position - center ).Length( );
+            if ( distance > radius ) {
+                const float newRadius = ( radius + distance ) * 0.5f;
+                center += ( position - center ) * ( ( newRadius - radius ) / distance );
+                radius = newRadius;
+            }
+        }
+
+        //
+        // Normal cone.
+        //
+
+        const uint32_t triangleCount = (uint32_t) triangles.size( ) / 3;
+
+        apemode::ArenaVector< mathfu::vec3 > normals;
+        normals.reserve( triangleCount );
+
+        mathfu::vec3 axis( 0.0f, 0.0f, 0.0f );
+        for ( uint32_t i = 0; i < triangleCount; ++i ) {
+            const mathfu::vec3 normal = mathfu::vec3::CrossProduct( triangles[ i * 3 + 1 ] - triangles[ i * 3 ],
+                                                                    triangles[ i * 3 + 2 ] - triangles[ i * 3 ] );
+            const float length = normal.Length( );
+
+            // Degenerate triangles do not affect the cone.
+            normals.push_back( length > 0.0f ? normal / length : mathfu::vec3( 0.0f, 0.0f, 0.0f ) );
+            axis += normals.back( );
+        }
+
+        float coneCutoff = 1.0f;
+        mathfu::vec3 coneApex = center;
+
+        const float axisLength = axis.Length( );
+        axis = axisLength > 0.0f ? axis / axisLength : mathfu::vec3( 0.0f, 0.0f, 1.0f );
+
+        float minDot = 1.0f;
+        for ( const auto normal : normals ) {
+            if ( normal.LengthSquared( ) > 0.0f )
+                minDot = std::min( minDot, mathfu::vec3::DotProduct( axis, normal ) );
+        }
+
+        // The cone is too wide (more than ~84 degrees) to cull anything.
+        if ( axisLength > 0.0f && minDot > 0.1f ) {
+            // Move the apex back along the axis until all the triangle planes are in front of it.
+            float maxT = 0.0f;
+            for ( uint32_t i = 0; i < triangleCount; ++i ) {
+                if ( normals[ i ].LengthSquared( ) > 0.0f ) {
+                    const mathfu::vec3 centroid = ( triangles[ i * 3 ] + triangles[ i * 3 + 1 ] + triangles[ i * 3 + 2 ] ) / 3.0f;
+                    const float dc = mathfu::vec3::DotProduct( centroid - center, normals[ i ] );
+                    const float dn = mathfu::vec3::DotProduct( axis, normals[ i ] );
+                    maxT = std::max( maxT, dc / dn );
+                }
+            }
+
+            coneApex   = center - axis * maxT;
+            coneCutoff = sqrtf( 1.0f - minDot * minDot );
+        }
+
+        return apemodefb::MeshletFb( apemodefb::vec3( center.x, center.y, center.z ),       // center
+                                     radius,                                               // radius
+                                     apemodefb::vec3( coneApex.x, coneApex.y, coneApex.z ), // cone apex
+                                     coneCutoff,                                           // cone cutoff
+                                     apemodefb::vec3( axis.x, axis.y, axis.z ),             // cone axis
+                                     subsetId,                                             // subset id
+                                     baseVertex,                                           // base vertex
+                                     baseTriangle,                                         // base triangle
+                                     (uint16_t) positions.size( ),                         // vertex count
+                                     (uint16_t) ( triangleCount )                          // triangle count
+                                     );
+    }
+}
+
+/**
+ * Splits the subsets into the meshlets with the greedy builder.
+ * The next triangle is the one adjacent to the current meshlet that adds the least vertices
+ * (the closest one to the meshlet center if there are many, which keeps the meshlets compact),
+ * if there are no adjacent triangles, the next triangle in the index buffer is taken (keeps the optimized order locality).
+ * The vertices must be static (not packed).
+ * Can be used in multiple threads.
+ **/
+template < typename TIndex >
+void BuildMeshlets( apemode::Mesh& m, uint32_t vertexCount, const char* meshName ) {
+    FBXP_PROFILE_ZONE( "Build meshlets" );
+    const apemode::ArenaScope arenaScope( "Build meshlets" );
+    auto& s = apemode::Get( );
+
+    const auto startTime = std::chrono::steady_clock::now( );
+
+    auto vertices = reinterpret_cast< const apemodefb::StaticVertexFb* >( m.vertices.data( ) );
+    auto indices  = reinterpret_cast< const TIndex* >( m.subsetIndices.data( ) );
+    const uint32_t triangleCount = (uint32_t) ( m.subsetIndices.size( ) / sizeof( TIndex ) / 3 );
+
+    //
+    // Vertex to triangle adjacency.
+    //
+
+    apemode::ArenaVector< uint32_t > adjacencyOffsets( vertexCount + 1, 0 );
+    apemode::ArenaVector< uint32_t > adjacency( triangleCount * 3 );
+    apemode::ArenaVector< uint32_t > liveTriangleCounts( vertexCount, 0 );
+
+    for ( uint32_t i = 0; i < triangleCount * 3; ++i ) {
+        ++adjacencyOffsets[ indices[ i ] + 1 ];
+    }
+
+    for ( uint32_t i = 0; i < vertexCount; ++i ) {
+        adjacencyOffsets[ i + 1 ] += adjacencyOffsets[ i ];
+    }
+
+    {
+        apemode::ArenaVector< uint32_t > adjacencyCursors( adjacencyOffsets.begin( ), adjacencyOffsets.end( ) - 1 );
+        for ( uint32_t i = 0; i < triangleCount * 3; ++i ) {
+            adjacency[ adjacencyCursors[ indices[ i ] ]++ ] = i / 3;
+        }
+    }
+
+    //
+    // Greedy meshlet builder.
+    // Only the triangles of the current subset are not done, so the meshlets never cross the subset boundaries.
+    //
+
+    apemode::ArenaVector< uint8_t >      triangleDone( triangleCount, 1 );
+    apemode::ArenaVector< uint8_t >      localIndices( vertexCount, kNotInMeshlet );
+    apemode::ArenaVector< uint32_t >     meshletVertices;
+    apemode::ArenaVector< uint32_t >     meshletTriangles;
+    apemode::ArenaVector< mathfu::vec3 > meshletPositions;
+    apemode::ArenaVector< mathfu::vec3 > meshletTrianglePositions;
+    mathfu::vec3                         meshletPositionSum( 0.0f, 0.0f, 0.0f );
+
+    // The meshlet buffers never grow past the meshlet limits.
+    meshletVertices.reserve( kMaxMeshletVertices );
+    meshletTriangles.reserve( kMaxMeshletTriangles );
+    meshletPositions.reserve( kMaxMeshletVertices );
+    meshletTrianglePositions.reserve( kMaxMeshletTriangles * 3 );
+
+    auto getNewVertexCount = [&]( uint32_t triangle ) {
+        const TIndex i0 = indices[ triangle * 3 + 0 ];
+        const TIndex i1 = indices[ triangle * 3 + 1 ];
+        const TIndex i2 = indices[ triangle * 3 + 2 ];
+        return uint32_t( localIndices[ i0 ] == kNotInMeshlet ) +
+               uint32_t( localIndices[ i1 ] == kNotInMeshlet && i1 != i0 ) +
+               uint32_t( localIndices[ i2 ] == kNotInMeshlet && i2 != i0 && i2 != i1 );
+    };
+
+    auto getDistanceToMeshlet = [&]( uint32_t triangle ) {
+        const mathfu::vec3 centroid = ( GetPosition( vertices[ indices[ triangle * 3 + 0 ] ] ) +
+                                        GetPosition( vertices[ indices[ triangle * 3 + 1 ] ] ) +
+                                        GetPosition( vertices[ indices[ triangle * 3 + 2 ] ] ) ) / 3.0f;
+        return ( centroid - meshletPositionSum / float( meshletVertices.size( ) ) ).LengthSquared( );
+    };
+
+    auto addTriangle = [&]( uint32_t triangle ) {
+        triangleDone[ triangle ] = 1;
+        meshletTriangles.push_back( triangle );
+
+        for ( uint32_t k = 0; k < 3; ++k ) {
+            const TIndex index = indices[ triangle * 3 + k ];
+            --liveTriangleCounts[ index ];
+
+            if ( localIndices[ index ] == kNotInMeshlet ) {
+                localIndices[ index ] = (uint8_t) meshletVertices.size( );
+                meshletVertices.push_back( index );
+                meshletPositionSum += GetPosition( vertices[ index ] );
+            }
+        }
+    };
+
+    auto flushMeshlet = [&]( uint32_t subsetId ) {
+        const uint32_t baseVertex   = (uint32_t) m.meshletVertices.size( );
+        const uint32_t baseTriangle = (uint32_t) m.meshletIndices.size( ) / 3;
+
+        meshletPositions.clear( );
+        meshletTrianglePositions.clear( );
+
+        for ( const auto index : meshletVertices ) {
+            m.meshletVertices.push_back( index );
+            meshletPositions.push_back( GetPosition( vertices[ index ] ) );
+        }
+
+        for ( const auto triangle : meshletTriangles ) {
+            for ( uint32_t k = 0; k < 3; ++k ) {
+                const TIndex index = indices[ triangle * 3 + k ];
+                m.meshletIndices.push_back( localIndices[ index ] );
+                meshletTrianglePositions.push_back( GetPosition( vertices[ index ] ) );
+            }
+        }
+
+        m.meshlets.push_back( GetMeshletBounds( meshletPositions, meshletTrianglePositions, subsetId, baseVertex, baseTriangle ) );
+
+        for ( const auto index : meshletVertices ) {
+            localIndices[ index ] = kNotInMeshlet;
+        }
+
+        meshletVertices.clear( );
+        meshletPositionSum = mathfu::vec3( 0.0f, 0.0f, 0.0f );
+        meshletTriangles.clear( );
+    };
+
+    for ( uint32_t ss = 0; ss < m.subsets.size( ); ++ss ) {
+        const uint32_t firstTriangle = m.subsets[ ss ].base_index( ) / 3;
+        const uint32_t lastTriangle  = firstTriangle + m.subsets[ ss ].index_count( ) / 3;
+
+        for ( uint32_t i = firstTriangle; i < lastTriangle; ++i ) {
+            triangleDone[ i ] = 0;
+            for ( uint32_t k = 0; k < 3; ++k ) {
+                ++liveTriangleCounts[ indices[ i * 3 + k ] ];
+            }
+        }
+
+        uint32_t nextTriangle = firstTriangle;
+        for ( ;; ) {
+            uint32_t bestTriangle = (uint32_t) -1;
+            uint32_t bestNewVertexCount = 4;
+            float bestDistance = 0.0f;
+
+            // The adjacent triangle that adds the least vertices, the closest one to the meshlet center if there are many.
+            for ( const auto index : meshletVertices ) {
+                if ( 0 == liveTriangleCounts[ index ] )
+                    continue;
+
+                for ( uint32_t a = adjacencyOffsets[ index ]; a < adjacencyOffsets[ index + 1 ]; ++a ) {
+                    const uint32_t triangle = adjacency[ a ];
+                    if ( triangleDone[ triangle ] )
+                        continue;
+
+                    const uint32_t newVertexCount = getNewVertexCount( triangle );
+                    if ( newVertexCount > bestNewVertexCount )
+                        continue;
+
+                    const float distance = getDistanceToMeshlet( triangle );
+                    if ( newVertexCount < bestNewVertexCount || distance < bestDistance || ( distance == bestDistance && triangle < bestTriangle ) ) {
+                        bestTriangle = triangle;
+                        bestNewVertexCount = newVertexCount;
+                        bestDistance = distance;
+                    }
+                }
+            }
+
+            if ( bestTriangle == (uint32_t) -1 ) {
+                while ( nextTriangle < lastTriangle && triangleDone[ nextTriangle ] )
+                    ++nextTriangle;
+
+                if ( nextTriangle == lastTriangle )
+                    break;
+
+                bestTriangle = nextTriangle;
+                bestNewVertexCount = getNewVertexCount( bestTriangle );
+            }
+
+            if ( meshletVertices.size( ) + bestNewVertexCount > kMaxMeshletVertices || meshletTriangles.size( ) == kMaxMeshletTriangles ) {
+                flushMeshlet( ss );
+                continue;
+            }
+
+            addTriangle( bestTriangle );
+        }
+
+        if ( false == meshletTriangles.empty( ) )
+            flushMeshlet( ss );
+
+        for ( uint32_t i = firstTriangle; i < lastTriangle; ++i ) {
+            triangleDone[ i ] = 1;
+        }
+    }
+
+    const uint64_t microseconds = std::chrono::duration_cast< std::chrono::microseconds >( std::chrono::steady_clock::now( ) - startTime ).count( );
+    const uint64_t builtVertexCount = m.meshletVertices.size( );
+
+    meshletCount += m.meshlets.size( );
+    meshletVertexCount += builtVertexCount;
+    meshletTriangleCount += triangleCount;
+    meshletBuildMicroseconds += microseconds;
+
+    s.console->info( "Mesh \"{}\" has {} meshlets (fill rate: {:.1f}% vertices, {:.1f}% triangles, {:.3f} ms).",
+                     meshName,
+                     m.meshlets.size( ),
+                     m.meshlets.empty( ) ? 0.0 : 100.0 * builtVertexCount / ( m.meshlets.size( ) * kMaxMeshletVertices ),
+                     m.meshlets.empty( ) ? 0.0 : 100.0 * triangleCount / ( m.meshlets.size( ) * kMaxMeshletTriangles ),
+                     microseconds * 0.001 );
+}
+
+void BuildMeshlets16( apemode::Mesh& mesh, uint32_t vertexCount, const char* meshName ) {
+    BuildMeshlets< uint16_t >( mesh, vertexCount, meshName );
+}
+
+void BuildMeshlets32( apemode::Mesh& mesh, uint32_t vertexCount, const char* meshName ) {
+    BuildMeshlets< uint32_t >( mesh, vertexCount, meshName );
+}
+
+/**
+ * Prints the meshlet fill rates and the build time of all the meshes (since the last call).
+ **/
+void LogMeshletStats( ) {
+    const uint64_t meshlets     = meshletCount.exchange( 0 );
+    const uint64_t vertices     = meshletVertexCount.exchange( 0 );
+    const uint64_t triangles    = meshletTriangleCount.exchange( 0 );
+    const uint64_t microseconds = meshletBuildMicroseconds.exchange( 0 );
+
+    if ( meshlets ) {
+        apemode::Get( ).console->info( "Meshlets: {} meshlet(s), fill rate {:.1f}% vertices, {:.1f}% triangles, {:.1f} ms per million triangles.",
+                                       meshlets,
+                                       100.0 * vertices / ( meshlets * kMaxMeshletVertices ),
+                                       100.0 * triangles / ( meshlets * kMaxMeshletTriangles ),
+                                       triangles ? microseconds * 1000.0 / triangles : 0.0 );
+    }
+}
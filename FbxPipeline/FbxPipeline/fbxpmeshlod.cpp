@@ -0,0 +1,449 @@
+#include <fbxppch.h>
+#include <fbxpstate.h>
+#include <fbxparena.h>
+#include <atomic>
+#include <chrono>
+#include <numeric>
+
+//
+// Discrete LODs with the quadric error metric (Garland and Heckbert) edge collapses.
+// The vertices are never moved or created (an edge collapses to one of its vertices),
+// so the LODs share the vertex buffer with the base level and differ only in indices.
+// The seams (UV, normal, material) are preserved: the vertices on the border edges
+// (after welding the seam vertices are split, so their edges are border edges) never collapse.
+//
+
+namespace {
+    std::atomic< uint64_t > lodCount( 0 );
+    std::atomic< uint64_t > lodSourceTriangleCount( 0 );
+    std::atomic< uint64_t > lodTriangleCount( 0 );
+    std::atomic< uint64_t > lodBuildMicroseconds( 0 );
+
+    /**
+     * Symmetric 4x4 matrix of the weighted sum of the squared distances to the planes.
+     * The evaluated value is divided by the total weight, so it is the mean squared distance in mesh units.
+     **/
+    struct Quadric {
+        double a2 = 0, ab = 0, ac = 0, ad = 0, b2 = 0, bc = 0, bd = 0, c2 = 0, cd = 0, d2 = 0, w = 0;
+
+        void AddPlane( double a, double b, double c, double d, double weight ) {
+            a2 += a * a * weight, ab += a * b * weight, ac += a * c * weight, ad += a * d * weight;
+            b2 += b * b * weight, bc += b * c * weight, bd += b * d * weight;
+            c2 += c * c * weight, cd += c * d * weight;
+            d2 += d * d * weight;
+            w += weight;
+        }
+
+        Quadric& operator+=( Quadric const& q ) {
+            a2 += q.a2, ab += q.ab, ac += q.ac, ad += q.ad, b2 += q.b2;
+            bc += q.bc, bd += q.bd, c2 += q.c2, cd += q.cd, d2 += q.d2;
+            w += q.w;
+            return *this;
+        }
+
+        double Evaluate( const mathfu::vec3 p ) const {
+            const double x = p.x, y = p.y, z = p.z;
+            const double e = a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x +
+                             b2 * y * y + 2 * bc * y * z + 2 * bd * y +
+                             c2 * z * z + 2 * cd * z + d2;
+            return w > 0 ? std::max( e / w, 0.0 ) : 0.0;
+        }
+    };
+
+    struct Collapse {
+        double   cost;
+        uint32_t from;
+        uint32_t to;
+
+        bool operator<( Collapse const& other ) const {
+            return std::tie( cost, from, to ) < std::tie( other.cost, other.from, other.to );
+        }
+    };
+
+    inline mathfu::vec3 GetNormal( const mathfu::vec3 p0, const mathfu::vec3 p1, const mathfu::vec3 p2 ) {
+        return mathfu::vec3::CrossProduct( p1 - p0, p2 - p0 );
+    }
+
+    /**
+     * The buffers of the simplification passes, allocated once per subset (sized by the subset vertices and indices),
+     * the passes only shrink them, so they never grow in the arena.
+     **/
+    struct SimplifyBuffers {
+        apemode::ArenaVector< uint32_t > adjacencyOffsets;
+        apemode::ArenaVector< uint32_t > adjacencyCursors;
+        apemode::ArenaVector< uint32_t > adjacency;
+        apemode::ArenaVector< Collapse > collapses;
+        apemode::ArenaVector< uint32_t > remap;
+        apemode::ArenaVector< uint8_t >  touched;
+
+        SimplifyBuffers( uint32_t vertexCount, uint32_t indexCount )
+            : adjacencyOffsets( vertexCount + 1 ), adjacencyCursors( vertexCount ), remap( vertexCount ), touched( vertexCount ) {
+            adjacency.reserve( indexCount );
+            collapses.reserve( indexCount * 2 ); // Both directions of every triangle edge.
+        }
+    };
+
+    /**
+     * Locks the vertices of the edges that have only one triangle (open borders and seams).
+     **/
+    apemode::ArenaVector< uint8_t > GetLockedVertices( apemode::ArenaVector< uint32_t > const& indices, uint32_t vertexCount ) {
+        // The edges are allocated after the result, so they are released from the top of the arena.
+        apemode::ArenaVector< uint8_t >  locked( vertexCount, 0 );
+        apemode::ArenaVector< uint64_t > edges;
+        edges.reserve( indices.size( ) );
+
+        for ( size_t i = 0; i < indices.size( ); i += 3 ) {
+            for ( uint32_t k = 0; k < 3; ++k ) {
+                const uint64_t a = indices[ i + k ];
+                const uint64_t b = indices[ i + ( k + 1 ) % 3 ];
+                edges.push_back( a < b ? ( a << 32 ) | b : ( b << 32 ) | a );
+            }
+        }
+
+        std::sort( edges.begin( ), edges.end( ) );
+
+        for ( size_t i = 0; i < edges.size( ); ) {
+            size_t j = i + 1;
+            while ( j < edges.size( ) && edges[ j ] == edges[ i ] )
+                ++j;
+
+            if ( j - i == 1 ) {
+                locked[ edges[ i ] >> 32 ] = 1;
+                locked[ edges[ i ] & 0xffffffff ] = 1;
+            }
+
+            i = j;
+        }
+
+        return locked;
+    }
+
+    /**
+     * Collapses the edges in the cost order until the triangle count is reached or the next collapse costs too much.
+     * Every pass collapses the independent edges (a vertex and its neighbours are touched once per pass),
+     * so the flip test sees the actual neighbourhood.
+     * @param indices The triangles, the degenerate triangles are removed.
+     * @param quadrics The vertex quadrics, they accumulate the collapsed vertex quadrics, so the chain can be continued.
+     * @param maxCost The maximum squared error, updated with the collapse costs.
+     * @param buffers The pass buffers (sized by the vertex count).
+     **/
+    void Simplify( apemode::ArenaVector< uint32_t >&           indices,
+                   apemode::ArenaVector< Quadric >&            quadrics,
+                   apemode::ArenaVector< mathfu::vec3 > const& positions,
+                   apemode::ArenaVector< uint8_t > const&      locked,
+                   uint32_t                                    targetTriangleCount,
+                   double                                      maxErrorSquared,
+                   double&                                     maxCost,
+                   SimplifyBuffers&                            buffers ) {
+        const uint32_t vertexCount = (uint32_t) positions.size( );
+
+        auto& adjacencyOffsets = buffers.adjacencyOffsets;
+        auto& adjacencyCursors = buffers.adjacencyCursors;
+        auto& adjacency        = buffers.adjacency;
+        auto& collapses        = buffers.collapses;
+        auto& remap            = buffers.remap;
+        auto& touched          = buffers.touched;
+
+        while ( indices.size( ) / 3 > targetTriangleCount ) {
+            const uint32_t triangleCount = (uint32_t) indices.size( ) / 3;
+
+            //
+            // Vertex to triangle adjacency for the flip test.
+            //
+
+            std::fill( adjacencyOffsets.begin( ), adjacencyOffsets.end( ), 0 );
+            adjacency.resize( indices.size( ) );
+
+            for ( const auto index : indices ) {
+                ++adjacencyOffsets[ index + 1 ];
+            }
+
+            for ( uint32_t i = 0; i < vertexCount; ++i ) {
+                adjacencyOffsets[ i + 1 ] += adjacencyOffsets[ i ];
+            }
+
+            std::copy( adjacencyOffsets.begin( ), adjacencyOffsets.end( ) - 1, adjacencyCursors.begin( ) );
+            for ( uint32_t i = 0; i < indices.size( ); ++i ) {
+                adjacency[ adjacencyCursors[ indices[ i ] ]++ ] = i / 3;
+            }
+
+            //
+            // Collapse candidates (both directions of every edge unless the source vertex is locked).
+            //
+
+            collapses.clear( );
+            for ( uint32_t i = 0; i < indices.size( ); i += 3 ) {
+                for ( uint32_t k = 0; k < 3; ++k ) {
+                    const uint32_t a = indices[ i + k ];
+                    const uint32_t b = indices[ i + ( k + 1 ) % 3 ];
+
+                    Quadric q = quadrics[ a ];
+                    q += quadrics[ b ];
+
+                    if ( !locked[ a ] )
+                        collapses.push_back( Collapse{q.Evaluate( positions[ b ] ), a, b} );
+                    if ( !locked[ b ] )
+                        collapses.push_back( Collapse{q.Evaluate( positions[ a ] ), b, a} );
+                }
+            }
+
+            std::sort( collapses.begin( ), collapses.end( ) );
+
+            //
+            // Independent collapses.
+            //
+
+            std::iota( remap.begin( ), remap.end( ), 0 );
+            std::fill( touched.begin( ), touched.end( ), 0 );
+
+            // Every collapse removes at least one triangle (two if the edge is not a border edge).
+            uint32_t collapseBudget = ( triangleCount - targetTriangleCount + 1 ) / 2;
+            uint32_t collapseCount  = 0;
+
+            for ( const auto& collapse : collapses ) {
+                if ( collapse.cost > maxErrorSquared || collapseCount == collapseBudget )
+                    break;
+
+                if ( touched[ collapse.from ] || touched[ collapse.to ] )
+                    continue;
+
+                bool flipped = false;
+                for ( uint32_t a = adjacencyOffsets[ collapse.from ]; a < adjacencyOffsets[ collapse.from + 1 ] && !flipped; ++a ) {
+                    const uint32_t* triangle = indices.data( ) + adjacency[ a ] * 3;
+                    if ( triangle[ 0 ] == collapse.to || triangle[ 1 ] == collapse.to || triangle[ 2 ] == collapse.to )
+                        continue;
+
+                    mathfu::vec3 p[ 3 ] = {positions[ triangle[ 0 ] ], positions[ triangle[ 1 ] ], positions[ triangle[ 2 ] ]};
+                    const mathfu::vec3 normal = GetNormal( p[ 0 ], p[ 1 ], p[ 2 ] );
+
+                    for ( uint32_t k = 0; k < 3; ++k ) {
+                        if ( triangle[ k ] == collapse.from )
+                            p[ k ] = positions[ collapse.to ];
+                    }
+
+                    flipped = mathfu::vec3::DotProduct( normal, GetNormal( p[ 0 ], p[ 1 ], p[ 2 ] ) ) <= 0.0f;
+                }
+
+                if ( flipped )
+                    continue;
+
+                for ( uint32_t a = adjacencyOffsets[ collapse.from ]; a < adjacencyOffsets[ collapse.from + 1 ]; ++a ) {
+                    const uint32_t* triangle = indices.data( ) + adjacency[ a ] * 3;
+                    touched[ triangle[ 0 ] ] = touched[ triangle[ 1 ] ] = touched[ triangle[ 2 ] ] = 1;
+                }
+
+                remap[ collapse.from ] = collapse.to;
+                quadrics[ collapse.to ] += quadrics[ collapse.from ];
+                maxCost = std::max( maxCost, collapse.cost );
+                ++collapseCount;
+            }
+
+            if ( 0 == collapseCount )
+                break;
+
+            //
+            // Apply the collapses and remove the degenerate triangles.
+            //
+
+            uint32_t writeIndex = 0;
+            for ( uint32_t i = 0; i < indices.size( ); i += 3 ) {
+                const uint32_t a = remap[ indices[ i + 0 ] ];
+                const uint32_t b = remap[ indices[ i + 1 ] ];
+                const uint32_t c = remap[ indices[ i + 2 ] ];
+
+                if ( a != b && b != c && c != a ) {
+                    indices[ writeIndex++ ] = a;
+                    indices[ writeIndex++ ] = b;
+                    indices[ writeIndex++ ] = c;
+                }
+            }
+
+            indices.resize( writeIndex );
+        }
+    }
+}
+
+//
+// See implementation in fbxpmeshopt.cpp.
+//
+
+void OptimizeIndices16( apemode::Mesh& mesh, uint32_t baseIndex, uint32_t indexCount, uint32_t vertexCount );
+void OptimizeIndices32( apemode::Mesh& mesh, uint32_t baseIndex, uint32_t indexCount, uint32_t vertexCount );
+
+/**
+ * Generates the LOD chain of every subset: every next LOD has half of the triangles of the previous one,
+ * the chain stops earlier if the error limit does not allow to remove at least 10% of the triangles.
+ * The LOD indices are appended to the subset indices, the ranges are stored in the subset LODs.
+ * The vertices must be static (not packed).
+ * Every subset is simplified in its own compact vertex range (the vertices it references),
+ * so the cost does not depend on the vertex count of the whole mesh.
+ * Can be used in multiple threads.
+ * @param maxLodCount The maximum number of LODs (besides the base level), less than 32.
+ * @param lodError The error limit relative to the mesh size (bounding box diagonal).
+ **/
+template < typename TIndex >
+void GenerateLods( apemode::Mesh& m, uint32_t vertexCount, uint32_t maxLodCount, float lodError, bool optimize, const char* meshName ) {
+    FBXP_PROFILE_ZONE( "Generate LODs" );
+    const apemode::ArenaScope arenaScope( "Generate LODs" );
+    assert( maxLodCount < 32 );
+    auto& s = apemode::Get( );
+
+    const auto startTime = std::chrono::steady_clock::now( );
+
+    auto vertices = reinterpret_cast< const apemodefb::StaticVertexFb* >( m.vertices.data( ) );
+
+    apemode::ArenaVector< mathfu::vec3 > positions( vertexCount );
+    for ( uint32_t i = 0; i < vertexCount; ++i ) {
+        positions[ i ] = mathfu::vec3( vertices[ i ].position( ).x( ), vertices[ i ].position( ).y( ), vertices[ i ].position( ).z( ) );
+    }
+
+    const mathfu::vec3 positionMin( m.positionMin.x( ), m.positionMin.y( ), m.positionMin.z( ) );
+    const mathfu::vec3 positionMax( m.positionMax.x( ), m.positionMax.y( ), m.positionMax.z( ) );
+    const double meshSize = ( positionMax - positionMin ).Length( );
+    const double maxError = lodError * meshSize;
+
+    uint64_t sourceTriangleCount = 0;
+    uint64_t lodTriangles = 0;
+
+    // The subset vertex ids of the mesh vertices, reset after every subset (only the referenced entries).
+    apemode::ArenaVector< uint32_t > subsetVertexIds( vertexCount, uint32_t( -1 ) );
+
+    const uint32_t subsetCount = (uint32_t) m.subsets.size( );
+    for ( uint32_t ss = 0; ss < subsetCount; ++ss ) {
+        const uint32_t baseIndex  = m.subsets[ ss ].base_index( );
+        const uint32_t indexCount = m.subsets[ ss ].index_count( );
+
+        // The subset temporaries are released before the next subset.
+        const apemode::ArenaScope subsetArenaScope( "Simplify subset" );
+
+        // Compact the subset to the vertices it references, the LOD indices are mapped back.
+        apemode::ArenaVector< uint32_t >     indices( indexCount );
+        apemode::ArenaVector< uint32_t >     subsetVertices;
+        apemode::ArenaVector< mathfu::vec3 > subsetPositions;
+        subsetVertices.reserve( std::min( indexCount, vertexCount ) );
+        subsetPositions.reserve( std::min( indexCount, vertexCount ) );
+        for ( uint32_t i = 0; i < indexCount; ++i ) {
+            const uint32_t vertexId = reinterpret_cast< const TIndex* >( m.subsetIndices.data( ) )[ baseIndex + i ];
+            if ( subsetVertexIds[ vertexId ] == uint32_t( -1 ) ) {
+                subsetVertexIds[ vertexId ] = (uint32_t) subsetVertices.size( );
+                subsetVertices.push_back( vertexId );
+                subsetPositions.push_back( positions[ vertexId ] );
+            }
+
+            indices[ i ] = subsetVertexIds[ vertexId ];
+        }
+
+        for ( const uint32_t vertexId : subsetVertices ) {
+            subsetVertexIds[ vertexId ] = uint32_t( -1 );
+        }
+
+        const uint32_t subsetVertexCount = (uint32_t) subsetVertices.size( );
+
+        apemode::ArenaVector< Quadric > quadrics( subsetVertexCount );
+        for ( uint32_t i = 0; i < indexCount; i += 3 ) {
+            const mathfu::vec3 p0     = subsetPositions[ indices[ i + 0 ] ];
+            const mathfu::vec3 normal = GetNormal( p0, subsetPositions[ indices[ i + 1 ] ], subsetPositions[ indices[ i + 2 ] ] );
+            const float        length = normal.Length( );
+
+            if ( length > 0.0f ) {
+                // The plane quadrics are weighted with the triangle area.
+                const mathfu::vec3 n = normal / length;
+                const double       d = -mathfu::vec3::DotProduct( n, p0 );
+
+                Quadric q;
+                q.AddPlane( n.x, n.y, n.z, d, length * 0.5 );
+                quadrics[ indices[ i + 0 ] ] += q;
+                quadrics[ indices[ i + 1 ] ] += q;
+                quadrics[ indices[ i + 2 ] ] += q;
+            }
+        }
+
+        const apemode::ArenaVector< uint8_t > locked = GetLockedVertices( indices, subsetVertexCount );
+        SimplifyBuffers                       buffers( subsetVertexCount, indexCount );
+
+        double   maxCost = 0;
+        uint32_t previousTriangleCount = indexCount / 3;
+        sourceTriangleCount += previousTriangleCount;
+
+        for ( uint32_t lod = 1; lod <= maxLodCount; ++lod ) {
+            const uint32_t targetTriangleCount = std::max( 1u, ( indexCount / 3 ) >> lod );
+            Simplify( indices, quadrics, subsetPositions, locked, targetTriangleCount, maxError * maxError, maxCost, buffers );
+
+            const uint32_t triangleCount = (uint32_t) indices.size( ) / 3;
+            if ( 0 == triangleCount || triangleCount * 10 > previousTriangleCount * 9 )
+                break;
+
+            const uint32_t lodBaseIndex = (uint32_t) ( m.subsetIndices.size( ) / sizeof( TIndex ) );
+            m.subsetIndices.resize( m.subsetIndices.size( ) + indices.size( ) * sizeof( TIndex ) );
+
+            auto lodIndices = reinterpret_cast< TIndex* >( m.subsetIndices.data( ) ) + lodBaseIndex;
+            for ( size_t i = 0; i < indices.size( ); ++i ) {
+                lodIndices[ i ] = (TIndex) subsetVertices[ indices[ i ] ];
+            }
+
+            if ( optimize ) {
+                if ( std::is_same< TIndex, uint16_t >::value ) {
+                    OptimizeIndices16( m, lodBaseIndex, (uint32_t) indices.size( ), vertexCount );
+                } else if ( std::is_same< TIndex, uint32_t >::value ) {
+                    OptimizeIndices32( m, lodBaseIndex, (uint32_t) indices.size( ), vertexCount );
+                }
+            }
+
+            const float error = (float) sqrt( maxCost );
+            m.subsetLods.emplace_back( ss,                          // subset id
+                                       lod,                         // lod
+                                       lodBaseIndex,                // base index
+                                       (uint32_t) indices.size( ),  // index count
+                                       error                        // error
+                                       );
+
+            s.console->info( "Mesh \"{}\" subset #{} LOD {}: {} triangles ({:.1f}%), error {:.6f} ({:.4f}% of the mesh size).",
+                             meshName,
+                             ss,
+                             lod,
+                             triangleCount,
+                             100.0 * triangleCount * 3 / indexCount,
+                             error,
+                             meshSize > 0 ? 100.0 * error / meshSize : 0.0 );
+
+            lodTriangles += triangleCount;
+            previousTriangleCount = triangleCount;
+        }
+    }
+
+    const uint64_t microseconds = std::chrono::duration_cast< std::chrono::microseconds >( std::chrono::steady_clock::now( ) - startTime ).count( );
+
+    lodCount += m.subsetLods.size( );
+    lodSourceTriangleCount += sourceTriangleCount;
+    lodTriangleCount += lodTriangles;
+    lodBuildMicroseconds += microseconds;
+
+    s.console->info( "Mesh \"{}\" has {} subset LOD(s) ({:.3f} ms).", meshName, m.subsetLods.size( ), microseconds * 0.001 );
+}
+
+void GenerateLods16( apemode::Mesh& mesh, uint32_t vertexCount, uint32_t maxLodCount, float lodError, bool optimize, const char* meshName ) {
+    GenerateLods< uint16_t >( mesh, vertexCount, maxLodCount, lodError, optimize, meshName );
+}
+
+void GenerateLods32( apemode::Mesh& mesh, uint32_t vertexCount, uint32_t maxLodCount, float lodError, bool optimize, const char* meshName ) {
+    GenerateLods< uint32_t >( mesh, vertexCount, maxLodCount, lodError, optimize, meshName );
+}
+
+/**
+ * Prints the LOD triangle counts and the build time of all the meshes (since the last call).
+ **/
+void LogLodStats( ) {
+    const uint64_t lods            = lodCount.exchange( 0 );
+    const uint64_t sourceTriangles = lodSourceTriangleCount.exchange( 0 );
+    const uint64_t triangles       = lodTriangleCount.exchange( 0 );
+    const uint64_t microseconds    = lodBuildMicroseconds.exchange( 0 );
+
+    if ( sourceTriangles ) {
+        apemode::Get( ).console->info( "LODs: {} subset LOD(s), {} triangles ({:.1f}% of {} base triangles), {:.1f} ms per million base triangles.",
+                                       lods,
+                                       triangles,
+                                       100.0 * triangles / sourceTriangles,
+                                       sourceTriangles,
+                                       microseconds * 1000.0 / sourceTriangles );
+    }
+}
@@ -1,5 +1,7 @@
 #include <fbxppch.h>
 #include <fbxpstate.h>
+#include <fbxparena.h>
+#include <fbxpmeshopt.h>
 
 #pragma warning( push )
 #pragma warning( disable : 4244 ) // int64 to int32 conversion
@@ -7,6 +9,10 @@
 #pragma warning( pop )
 
 #include <meshoptimizer.hpp>
+#include <city.h>
+#include <atomic>
+#include <chrono>
+#include <limits>
 
 using namespace apemode;
 using namespace apemodefb;
@@ -139,105 +145,362 @@ void set_vertex( VcacheMesh< uint32_t >& m, uint32_t const& sm, uint32_t& index,
 
 #pragma endregion
 
-const bool bUseVcacheOptimizer = false;
-
 template < typename TIndex >
-void GenerateSubset( apemode::Mesh& m, uint32_t& vertexCount, uint32_t vertexStride ) {
-    if ( false == m.subsets.empty( ) )
-        return;
+void OptimizeSubsetVcache( apemode::Mesh& mesh, uint32_t subsetIndex ) {
+    VcacheMesh< TIndex > meshWrapper;
+    meshWrapper.m = &mesh;
 
-    std::vector< uint32_t > indexBuffer;
-    indexBuffer.resize( vertexCount );
+    vcache_optimizer::vcache_optimizer< VcacheMesh< TIndex > > optimizer;
+    optimizer( meshWrapper, subsetIndex, mesh.subsets.size( ) == 1 );
+}
 
-    const uint32_t vc = (uint32_t) generateIndexBuffer( indexBuffer.data( ), m.vertices.data( ), vertexCount, vertexStride );
+//
+// Mesh optimization passes (-t option), the pass list is set with --optimize-passes:
+//  - vcache: linear-time post-transform cache optimization (Tipsify, meshoptimizer),
+//  - forsyth: post-transform cache optimization with Forsyth's algorithm (vcache_optimizer), slower,
+//  - overdraw: reorders the triangle clusters from the front to the back (meshoptimizer),
+//    the ACMR is allowed to grow up to --overdraw-threshold times,
+//  - fetch: renumbers the vertices in the order of their first use, so the vertex buffer is read sequentially.
+// The index passes run per subset on the job pool in the listed order, the fetch pass renumbers
+// the vertices shared by the subsets, so it always runs after them.
+//
+
+namespace {
+    const uint32_t kCacheSize                = apemode::kPostTransformCacheSize;
+    const float    kDefaultOverdrawThreshold = 1.05f;
+
+    enum EOptimizationPass {
+        eOptimizationPass_Vcache,
+        eOptimizationPass_Forsyth,
+        eOptimizationPass_Overdraw,
+        eOptimizationPass_Fetch,
+        eOptimizationPass_Count
+    };
 
-    std::vector< uint8_t > vertexBuffer;
-    vertexBuffer.resize( vc * vertexStride );
-    generateVertexBuffer( vertexBuffer.data( ), indexBuffer.data( ), m.vertices.data( ), vertexCount, vertexStride );
+    const char* const kOptimizationPassNames[ eOptimizationPass_Count ] = {"vcache", "forsyth", "overdraw", "fetch"};
+
+    /**
+     * The pass metrics (since the last LogOptimizationStats call).
+     * The cache misses are divided by the triangle count (ACMR), the fetched bytes are divided by the vertex buffer size (overfetch).
+     **/
+    struct PassStats {
+        std::atomic< uint64_t > before;
+        std::atomic< uint64_t > after;
+        std::atomic< uint64_t > units;
+        std::atomic< uint64_t > microseconds;
+    };
 
-    m.vertices.swap( vertexBuffer );
-    vertexCount = vc;
+    PassStats                        passStats[ eOptimizationPass_Count ];
+    std::vector< EOptimizationPass > subsetPasses;
+    bool                             fetchPass = false;
 
-    m.subsetIndices.resize( sizeof( TIndex ) * vertexCount );
-    auto indices = reinterpret_cast< TIndex* >( m.subsetIndices.data( ) );
-    for ( uint32_t i = 0; i < vc; ++i ) {
-        indices[ i ] = (TIndex) indexBuffer[ i ];
+    /**
+     * Runs the index passes for the subset, reports the cache misses before and after every pass.
+     * @param stats The pass stats of the subset, indexed by the pass position in subsetPasses.
+     **/
+    template < typename TIndex >
+    void OptimizeSubset( apemode::Mesh& m, uint32_t vertexCount, uint32_t ss, float overdrawThreshold, apemode::ArenaVector< uint64_t* > const& stats ) {
+        TIndex*        indices    = reinterpret_cast< TIndex* >( m.subsetIndices.data( ) ) + m.subsets[ ss ].base_index( );
+        const uint32_t indexCount = m.subsets[ ss ].index_count( );
+
+        if ( 0 == indexCount )
+            return;
+
+        // The clusters are passed to meshoptimizer as std::vector, so they are not in the arena.
+        apemode::ArenaVector< TIndex > indexBuffer;
+        std::vector< uint32_t >        clusters; // The triangle clusters of the last vcache pass.
+        indexBuffer.reserve( indexCount );
+
+        for ( size_t p = 0; p < subsetPasses.size( ); ++p ) {
+            const auto startTime = std::chrono::steady_clock::now( );
+            stats[ p ][ 0 ] = CountCacheMisses( indices, indexCount, kCacheSize );
+
+            switch ( subsetPasses[ p ] ) {
+                case eOptimizationPass_Vcache:
+                    clusters.clear( );
+                    indexBuffer.assign( indices, indices + indexCount );
+                    optimizePostTransform( indices, indexBuffer.data( ), indexCount, vertexCount, kCacheSize, &clusters );
+                    break;
+
+                case eOptimizationPass_Forsyth:
+                    clusters.clear( );
+                    OptimizeSubsetVcache< TIndex >( m, ss );
+                    break;
+
+                case eOptimizationPass_Overdraw:
+                    // The clusters are the triangle runs that are optimized for the cache, they are reordered as a whole.
+                    if ( clusters.empty( ) ) {
+                        indexBuffer.assign( indices, indices + indexCount );
+                        optimizePostTransform( indices, indexBuffer.data( ), indexCount, vertexCount, kCacheSize, &clusters );
+                    }
+
+                    indexBuffer.assign( indices, indices + indexCount );
+                    optimizeOverdraw( indices,
+                                      indexBuffer.data( ),
+                                      indexCount,
+                                      reinterpret_cast< const Vertex* >( m.vertices.data( ) ),
+                                      sizeof( Vertex ),
+                                      vertexCount,
+                                      clusters,
+                                      kCacheSize,
+                                      overdrawThreshold );
+
+                    // The clusters are reordered, the next overdraw pass needs the new ones.
+                    clusters.clear( );
+                    break;
+
+                default:
+                    assert( false );
+                    break;
+            }
+
+            stats[ p ][ 1 ] = CountCacheMisses( indices, indexCount, kCacheSize );
+            stats[ p ][ 2 ] = indexCount / 3;
+            stats[ p ][ 3 ] = std::chrono::duration_cast< std::chrono::microseconds >( std::chrono::steady_clock::now( ) - startTime ).count( );
+        }
     }
 
-    m.subsets.emplace_back( (uint32_t) 0, (uint32_t) 0, (uint32_t) vc );
+    /**
+     * Renumbers the vertices in the order of their first use in the subset indices.
+     * The unused vertices (if any) are moved to the end in their original order.
+     **/
+    template < typename TIndex >
+    void OptimizeVertexFetch( apemode::Mesh& m, uint32_t vertexCount ) {
+        TIndex*        indices    = reinterpret_cast< TIndex* >( m.subsetIndices.data( ) );
+        const uint32_t indexCount = (uint32_t) ( m.subsetIndices.size( ) / sizeof( TIndex ) );
+
+        apemode::ArenaVector< uint32_t > remap( vertexCount, uint32_t( -1 ) );
+        uint32_t                         nextVertex = 0;
+
+        for ( uint32_t i = 0; i < indexCount; ++i ) {
+            uint32_t& vertex = remap[ indices[ i ] ];
+            if ( vertex == uint32_t( -1 ) )
+                vertex = nextVertex++;
+
+            indices[ i ] = (TIndex) vertex;
+        }
+
+        for ( uint32_t& vertex : remap ) {
+            if ( vertex == uint32_t( -1 ) )
+                vertex = nextVertex++;
+        }
+
+        // The vertices are copied to the arena and moved back to their new places.
+        const apemode::ArenaVector< uint8_t > vertices( m.vertices.begin( ), m.vertices.end( ) );
+        for ( uint32_t i = 0; i < vertexCount; ++i ) {
+            memcpy( m.vertices.data( ) + remap[ i ] * sizeof( Vertex ), vertices.data( ) + i * sizeof( Vertex ), sizeof( Vertex ) );
+        }
+    }
 }
 
-template < typename TIndex >
-void OptimizeSubsetVcache( apemode::Mesh& mesh, uint32_t subsetIndex ) {
-    VcacheMesh< TIndex > meshWrapper;
-    meshWrapper.m = &mesh;
+/**
+ * Parses the pass list (--optimize-passes), the unknown passes are reported and skipped.
+ * Must be called before the meshes are optimized.
+ **/
+void InitializeOptimizationPasses( ) {
+    auto& s = apemode::Get( );
 
-    vcache_optimizer::vcache_optimizer< VcacheMesh< TIndex > > optimizer;
-    optimizer( meshWrapper, subsetIndex, mesh.subsets.size( ) == 1 );
-}
+    const std::string passList = s.options.count( "optimize-passes" ) ? s.options[ "optimize-passes" ].as< std::string >( ) : "vcache,overdraw,fetch";
 
-template < typename TIndex >
-void OptimizeSubset(apemode::Mesh& m, const Vertex * vertices, uint32_t& vertexCount, uint32_t vertexStride, uint32_t ss ) {
-    const uint32_t kCacheSize = 16;
+    subsetPasses.clear( );
+    fetchPass = false;
 
-    std::vector< uint8_t > indexBuffer;
-    indexBuffer.resize( m.subsets[ ss ].index_count( ) * sizeof( TIndex ) );
+    std::string log;
+    for ( size_t first = 0; first <= passList.size( ); ) {
+        size_t last = passList.find( ',', first );
+        if ( last == std::string::npos )
+            last = passList.size( );
 
-#if 0
+        const std::string passName = passList.substr( first, last - first );
+        first = last + 1;
 
-    std::vector< uint32_t > clusters;
-    optimizePostTransform( reinterpret_cast< TIndex* >( indexBuffer.data( ) ),
-                           reinterpret_cast< TIndex* >( m.subsetIndices.data( ) ) + m.subsets[ ss ].base_index( ),
-                           m.subsets[ ss ].index_count( ),
-                           vertexCount,
-                           kCacheSize,
-                           &clusters );
+        if ( passName.empty( ) )
+            continue;
 
-    memcpy( reinterpret_cast< TIndex* >( m.subsetIndices.data( ) ) + m.subsets[ ss ].base_index( ),
-            indexBuffer.data( ),
-            m.subsets[ ss ].index_count( ) * sizeof( TIndex ) );
+        const auto pass = std::find( kOptimizationPassNames, kOptimizationPassNames + eOptimizationPass_Count, passName );
+        if ( pass == kOptimizationPassNames + eOptimizationPass_Count ) {
+            s.console->warn( "Unknown mesh optimization pass \"{}\" (vcache, forsyth, overdraw or fetch), skipped.", passName );
+            continue;
+        }
 
-    optimizeOverdraw( reinterpret_cast< TIndex* >( indexBuffer.data( ) ),
-                      reinterpret_cast< TIndex* >( m.subsetIndices.data( ) ) + m.subsets[ ss ].base_index( ),
-                      m.subsets[ ss ].index_count( ),
-                      vertices,
-                      vertexStride,
-                      vertexCount,
-                      clusters,
-                      kCacheSize,
-                      1.05f );
+        if ( pass - kOptimizationPassNames == eOptimizationPass_Fetch )
+            fetchPass = true;
+        else
+            subsetPasses.push_back( EOptimizationPass( pass - kOptimizationPassNames ) );
 
-    memcpy( reinterpret_cast< TIndex* >( m.subsetIndices.data( ) ) + m.subsets[ ss ].base_index( ),
-            indexBuffer.data( ),
-            m.subsets[ ss ].index_count( ) * sizeof( TIndex ) );
+        log += log.empty( ) ? passName : ", " + passName;
+    }
 
-#else
+    s.console->info( "Mesh optimization passes: {}.", log.empty( ) ? "none" : log );
+}
 
-    optimizePostTransform( reinterpret_cast< TIndex* >( indexBuffer.data( ) ),
-                           reinterpret_cast< TIndex* >( m.subsetIndices.data( ) ) + m.subsets[ ss ].base_index( ),
-                           m.subsets[ ss ].index_count( ),
-                           vertexCount,
-                           kCacheSize );
+/**
+ * Welds the identical vertices (in place).
+ * The vertices are hashed into the open addressing (linear probing) table, the first vertex of the
+ * identical ones is kept. The vertices are compared by their raw bytes, or by their components
+ * quantized with the epsilon if it is positive (the vertices that fall into the same cell are welded).
+ * The epsilon is rejected (only the identical vertices are welded) if the quantized components do not fit into int32.
+ * @param vertices The vertex buffer, shrinks to the welded vertices.
+ * @param remap The welded vertex index for every source vertex.
+ * @return The welded vertex count.
+ **/
+uint32_t WeldVertices( std::vector< uint8_t >& vertices, uint32_t vertexCount, uint32_t vertexStride, float epsilon, std::vector< uint32_t >& remap ) {
+    FBXP_PROFILE_ZONE( "Weld vertices" );
+    const apemode::ArenaScope arenaScope( "Weld vertices" );
+    assert( vertexStride % sizeof( float ) == 0 );
+    assert( vertices.size( ) >= vertexCount * vertexStride );
+
+    //
+    // The keys are the vertices themselves or their quantized components.
+    // The welded keys are moved to the front along with the vertices, the welded vertex index
+    // is always less or equal to the source vertex index, so it is safe to do it in place.
+    //
+
+    apemode::ArenaVector< int32_t > quantizedKeys;
+    uint8_t* keys = vertices.data( );
+
+    if ( epsilon > 0 && std::isfinite( epsilon ) ) {
+        const uint32_t componentCount = vertexCount * vertexStride / sizeof( float );
+        const float*   components     = reinterpret_cast< const float* >( vertices.data( ) );
+        const double   invEpsilon     = 1.0 / epsilon;
+
+        quantizedKeys.resize( componentCount );
+
+        uint32_t i = 0;
+        for ( ; i < componentCount; ++i ) {
+            // The out of range (or NaN) value cannot be converted to int32.
+            const double quantizedKey = std::floor( components[ i ] * invEpsilon + 0.5 );
+            if ( !( quantizedKey >= std::numeric_limits< int32_t >::min( ) && quantizedKey <= std::numeric_limits< int32_t >::max( ) ) )
+                break;
+
+            quantizedKeys[ i ] = (int32_t) quantizedKey;
+        }
+
+        if ( i == componentCount ) {
+            keys = reinterpret_cast< uint8_t* >( quantizedKeys.data( ) );
+        } else {
+            apemode::Get( ).console->warn( "Weld epsilon {} is too small for the vertex component {} (only the identical vertices are welded).",
+                                           epsilon,
+                                           components[ i ] );
+        }
+    }
+
+    // Keep the load factor below 1/2 to have short probe sequences.
+    uint64_t slotCount = 64;
+    while ( slotCount < uint64_t( vertexCount ) * 2 )
+        slotCount <<= 1;
+
+    const uint64_t mask = slotCount - 1;
+    apemode::ArenaVector< uint32_t > slots( (size_t) slotCount, 0 ); // Welded vertex index + 1, 0 means empty slot.
+
+    remap.resize( vertexCount );
+    uint32_t weldedCount = 0;
+
+    for ( uint32_t i = 0; i < vertexCount; ++i ) {
+        const uint8_t* key  = keys + i * vertexStride;
+        uint64_t       slot = CityHash64( reinterpret_cast< const char* >( key ), vertexStride ) & mask;
+
+        for ( ;; ) {
+            const uint32_t weldedIndex = slots[ slot ];
+            if ( 0 == weldedIndex ) {
+                if ( weldedCount != i ) {
+                    memcpy( vertices.data( ) + weldedCount * vertexStride, vertices.data( ) + i * vertexStride, vertexStride );
+                    if ( keys != vertices.data( ) )
+                        memcpy( keys + weldedCount * vertexStride, key, vertexStride );
+                }
+
+                remap[ i ]    = weldedCount++;
+                slots[ slot ] = weldedCount;
+                break;
+            }
+
+            if ( 0 == memcmp( keys + ( weldedIndex - 1 ) * vertexStride, key, vertexStride ) ) {
+                remap[ i ] = weldedIndex - 1;
+                break;
+            }
+
+            slot = ( slot + 1 ) & mask;
+        }
+    }
 
-#endif
+    vertices.resize( weldedCount * vertexStride );
+    vertices.shrink_to_fit( );
+    return weldedCount;
 }
 
+/**
+ * Runs the optimization passes (see InitializeOptimizationPasses), the index passes run per subset on the job pool.
+ * The vertices are reordered in place by the fetch pass (the vertex count does not change).
+ **/
 template < typename TIndex >
-void Optimize( apemode::Mesh& m, const Vertex * vertices, uint32_t& vertexCount, uint32_t vertexStride ) {
-
+void Optimize( apemode::Mesh& m, uint32_t vertexCount, const char* meshName ) {
+    FBXP_PROFILE_ZONE( "Optimize" );
+    const apemode::ArenaScope arenaScope( "Optimize" );
     auto& s = apemode::Get( );
 
-    VcacheMesh< TIndex > mm;
-    mm.m = &m;
+    // The vertices are welded and every mesh has at least one subset (see ExportMesh).
+    assert( false == m.subsets.empty( ) );
+    assert( m.vertices.size( ) == vertexCount * sizeof( Vertex ) );
+
+    const float overdrawThreshold = s.options[ "overdraw-threshold" ].as< float >( ) > 0 ? s.options[ "overdraw-threshold" ].as< float >( ) : kDefaultOverdrawThreshold;
+
+    // Misses before, misses after, triangles and microseconds for every subset and pass.
+    apemode::ArenaVector< uint64_t > subsetStats( m.subsets.size( ) * subsetPasses.size( ) * 4, 0 );
+
+    // The subset jobs run on the workers, every job opens the arena of its worker.
+    apemode::ParallelFor( *s.jobs, (uint32_t) m.subsets.size( ), [&]( uint32_t ss ) {
+        const apemode::ArenaScope arenaScope( "Optimize subset" );
+
+        apemode::ArenaVector< uint64_t* > stats( subsetPasses.size( ) );
+        for ( size_t p = 0; p < subsetPasses.size( ); ++p )
+            stats[ p ] = subsetStats.data( ) + ( ss * subsetPasses.size( ) + p ) * 4;
+
+        OptimizeSubset< TIndex >( m, vertexCount, ss, overdrawThreshold, stats );
+    } );
+
+    for ( size_t p = 0; p < subsetPasses.size( ); ++p ) {
+        uint64_t passTotals[ 4 ] = {0, 0, 0, 0};
+        for ( size_t ss = 0; ss < m.subsets.size( ); ++ss )
+            for ( size_t i = 0; i < 4; ++i )
+                passTotals[ i ] += subsetStats[ ( ss * subsetPasses.size( ) + p ) * 4 + i ];
+
+        PassStats& stats = passStats[ subsetPasses[ p ] ];
+        stats.before += passTotals[ 0 ];
+        stats.after += passTotals[ 1 ];
+        stats.units += passTotals[ 2 ];
+        stats.microseconds += passTotals[ 3 ];
 
-    if ( m.subsets.empty( ) ) {
-        GenerateSubset< TIndex >( m, vertexCount, vertexStride );
-        // OptimizeSubset< TIndex >( m, vertices, vertexCount, vertexStride, 0 );
+        s.console->info( "Mesh \"{}\" {} pass: ACMR {:.3f} -> {:.3f} ({:.3f} ms).",
+                         meshName,
+                         kOptimizationPassNames[ subsetPasses[ p ] ],
+                         passTotals[ 2 ] ? double( passTotals[ 0 ] ) / passTotals[ 2 ] : 0.0,
+                         passTotals[ 2 ] ? double( passTotals[ 1 ] ) / passTotals[ 2 ] : 0.0,
+                         passTotals[ 3 ] * 0.001 );
     }
 
-    for ( uint32_t ss = 0; ss < m.subsets.size( ); ++ss ) {
-        // OptimizeSubset< TIndex >( m, vertices, vertexCount, vertexStride, ss );
-        OptimizeSubsetVcache< TIndex >( m, ss );
+    if ( fetchPass ) {
+        const auto     startTime   = std::chrono::steady_clock::now( );
+        const TIndex*  indices     = reinterpret_cast< const TIndex* >( m.subsetIndices.data( ) );
+        const uint32_t indexCount  = (uint32_t) ( m.subsetIndices.size( ) / sizeof( TIndex ) );
+        const uint64_t vertexBytes = uint64_t( vertexCount ) * sizeof( Vertex );
+        const uint64_t before      = CountFetchedBytes( indices, indexCount, sizeof( Vertex ) );
+
+        OptimizeVertexFetch< TIndex >( m, vertexCount );
+
+        const uint64_t after        = CountFetchedBytes( indices, indexCount, sizeof( Vertex ) );
+        const uint64_t microseconds = std::chrono::duration_cast< std::chrono::microseconds >( std::chrono::steady_clock::now( ) - startTime ).count( );
+
+        PassStats& stats = passStats[ eOptimizationPass_Fetch ];
+        stats.before += before;
+        stats.after += after;
+        stats.units += vertexBytes;
+        stats.microseconds += microseconds;
+
+        s.console->info( "Mesh \"{}\" fetch pass: overfetch {:.3f} -> {:.3f} ({:.3f} ms).",
+                         meshName,
+                         vertexBytes ? double( before ) / vertexBytes : 0.0,
+                         vertexBytes ? double( after ) / vertexBytes : 0.0,
+                         microseconds * 0.001 );
     }
 }
 
@@ -246,10 +509,49 @@ void Optimize( apemode::Mesh& m, const Vertex * vertices, uint32_t& vertexCount,
 // E:\Media\Models\m4a1-sopmod-overkill\source\M4A1 SOPMOD Overkill HIGH POLY.obj
 // E:\Media\Models\mech-m-6k\source\93d43cf18ad5406ba0176c9fae7d4927.fbx
 
-void Optimize32( apemode::Mesh& mesh, const Vertex* vertices, uint32_t& vertexCount, uint32_t vertexStride ) {
-    Optimize< uint32_t >( mesh, vertices, vertexCount, vertexStride );
+void Optimize32( apemode::Mesh& mesh, uint32_t vertexCount, const char* meshName ) {
+    Optimize< uint32_t >( mesh, vertexCount, meshName );
 }
 
-void Optimize16( apemode::Mesh& mesh, const Vertex* vertices, uint32_t& vertexCount, uint32_t vertexStride ) {
-    Optimize< uint16_t >( mesh, vertices, vertexCount, vertexStride );
-}
\ No newline at end of file
+void Optimize16( apemode::Mesh& mesh, uint32_t vertexCount, const char* meshName ) {
+    Optimize< uint16_t >( mesh, vertexCount, meshName );
+}
+
+/**
+ * Prints the metrics of the optimization passes for all the meshes (since the last call).
+ **/
+void LogOptimizationStats( ) {
+    for ( uint32_t p = 0; p < eOptimizationPass_Count; ++p ) {
+        const uint64_t before       = passStats[ p ].before.exchange( 0 );
+        const uint64_t after        = passStats[ p ].after.exchange( 0 );
+        const uint64_t units        = passStats[ p ].units.exchange( 0 );
+        const uint64_t microseconds = passStats[ p ].microseconds.exchange( 0 );
+
+        if ( units ) {
+            apemode::Get( ).console->info( "Optimization ({}): {} {:.3f} -> {:.3f}, {:.3f} ms.",
+                                           kOptimizationPassNames[ p ],
+                                           p == eOptimizationPass_Fetch ? "overfetch" : "ACMR",
+                                           double( before ) / units,
+                                           double( after ) / units,
+                                           microseconds * 0.001 );
+        }
+    }
+}
+
+/**
+ * Optimizes the index range that is not a subset (for example, the subset LOD) for the post-transform cache.
+ **/
+template < typename TIndex >
+void OptimizeIndices( apemode::Mesh& m, uint32_t baseIndex, uint32_t indexCount, uint32_t vertexCount ) {
+    TIndex* indices = reinterpret_cast< TIndex* >( m.subsetIndices.data( ) ) + baseIndex;
+    const apemode::ArenaVector< TIndex > indexBuffer( indices, indices + indexCount );
+    optimizePostTransform( indices, indexBuffer.data( ), indexCount, vertexCount, kCacheSize );
+}
+
+void OptimizeIndices32( apemode::Mesh& mesh, uint32_t baseIndex, uint32_t indexCount, uint32_t vertexCount ) {
+    OptimizeIndices< uint32_t >( mesh, baseIndex, indexCount, vertexCount );
+}
+
+void OptimizeIndices16( apemode::Mesh& mesh, uint32_t baseIndex, uint32_t indexCount, uint32_t vertexCount ) {
+    OptimizeIndices< uint16_t >( mesh, baseIndex, indexCount, vertexCount );
+}
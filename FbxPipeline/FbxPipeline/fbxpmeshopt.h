@@ -0,0 +1,105 @@
+#pragma once
+
+#include <fbxppch.h>
+#include <fbxparena.h>
+#include <algorithm>
+
+//
+// Vertex cache and vertex fetch simulation, shared by the optimization pass stats (fbxpmeshopt.cpp)
+// and the mesh analysis (fbxpanalysis.cpp), so both report the same numbers for the same indices.
+//
+
+namespace apemode {
+    const uint32_t kPostTransformCacheSize = 16;  // FIFO size of the optimization passes and of the fetch simulation.
+    const uint32_t kFetchLineSize          = 64;  // Vertex buffer cache line size.
+    const uint32_t kFetchCacheLineCount    = 256; // Direct-mapped vertex buffer cache of 16 KB.
+
+    /**
+     * Counts the post-transform cache misses.
+     * FIFO: the vertex is in the cache if it was pushed less than cacheSize misses ago (push times, linear time).
+     * LRU: the cache is small, so it is searched linearly.
+     **/
+    template < typename TIndex >
+    uint64_t CountCacheMisses( const TIndex* indices, uint32_t indexCount, uint32_t cacheSize, bool lru = false ) {
+        if ( 0 == indexCount || 0 == cacheSize )
+            return indexCount;
+
+        uint64_t misses = 0;
+
+        if ( lru ) {
+            ArenaVector< uint32_t > cache;
+            cache.reserve( cacheSize );
+
+            for ( uint32_t i = 0; i < indexCount; ++i ) {
+                const uint32_t vertex = indices[ i ];
+                const auto     cached = std::find( cache.begin( ), cache.end( ), vertex );
+
+                // The used vertex moves to the front, the missed one replaces the last one.
+                if ( cached != cache.end( ) ) {
+                    std::rotate( cache.begin( ), cached, cached + 1 );
+                    continue;
+                }
+
+                ++misses;
+                if ( cache.size( ) < cacheSize )
+                    cache.push_back( vertex );
+                else
+                    cache.back( ) = vertex;
+                std::rotate( cache.begin( ), cache.end( ) - 1, cache.end( ) );
+            }
+
+            return misses;
+        }
+
+        const auto     range      = std::minmax_element( indices, indices + indexCount );
+        const uint32_t baseVertex = *range.first;
+
+        // The push time of the vertex (+1), 0 means never pushed.
+        ArenaVector< uint64_t > pushTimes( *range.second - baseVertex + 1, 0 );
+
+        for ( uint32_t i = 0; i < indexCount; ++i ) {
+            uint64_t& pushTime = pushTimes[ indices[ i ] - baseVertex ];
+            if ( 0 == pushTime || misses - pushTime >= cacheSize )
+                pushTime = ++misses;
+        }
+
+        return misses;
+    }
+
+    /**
+     * Counts the bytes read from the vertex buffer: the post-transform cache misses (FIFO of kPostTransformCacheSize)
+     * read the vertex cache lines through the direct-mapped cache of kFetchCacheLineCount lines.
+     **/
+    template < typename TIndex >
+    uint64_t CountFetchedBytes( const TIndex* indices, uint32_t indexCount, uint32_t vertexStride ) {
+        if ( 0 == indexCount )
+            return 0;
+
+        const auto     range      = std::minmax_element( indices, indices + indexCount );
+        const uint32_t baseVertex = *range.first;
+
+        ArenaVector< uint64_t > pushTimes( *range.second - baseVertex + 1, 0 );
+        ArenaVector< uint64_t > lines( kFetchCacheLineCount, uint64_t( -1 ) );
+        uint64_t                misses  = 0;
+        uint64_t                fetched = 0;
+
+        for ( uint32_t i = 0; i < indexCount; ++i ) {
+            uint64_t& pushTime = pushTimes[ indices[ i ] - baseVertex ];
+            if ( 0 != pushTime && misses - pushTime < kPostTransformCacheSize )
+                continue;
+
+            pushTime = ++misses;
+
+            const uint64_t firstByte = uint64_t( indices[ i ] ) * vertexStride;
+            for ( uint64_t line = firstByte / kFetchLineSize; line <= ( firstByte + vertexStride - 1 ) / kFetchLineSize; ++line ) {
+                uint64_t& cachedLine = lines[ line % kFetchCacheLineCount ];
+                if ( cachedLine != line ) {
+                    cachedLine = line;
+                    fetched += kFetchLineSize;
+                }
+            }
+        }
+
+        return fetched;
+    }
+}
@@ -0,0 +1,71 @@
+#include <fbxppch.h>
+#include <fbxpnames.h>
+
+apemode::NameTable::NameTable( ) {
+    for ( auto& shard : shards )
+        Rehash( shard, 64 );
+}
+
+void apemode::NameTable::Rehash( Shard& shard, size_t slotCount ) {
+    assert( ( slotCount & ( slotCount - 1 ) ) == 0 );
+
+    shard.slots.assign( slotCount, 0 );
+    const uint64_t mask = slotCount - 1;
+
+    for ( uint32_t i = 0; i < (uint32_t) shard.entries.size( ); ++i ) {
+        uint64_t slot = shard.entries[ i ].hash & mask;
+        while ( shard.slots[ slot ] )
+            slot = ( slot + 1 ) & mask;
+        shard.slots[ slot ] = i + 1;
+    }
+}
+
+apemode::NameTable::EPushResult apemode::NameTable::Push( uint64_t hash, std::string const& name ) {
+    Shard& shard = shards[ hash >> ( 64 - kShardBits ) ];
+    std::lock_guard< std::mutex > lock( shard.mutex );
+
+    const uint64_t mask = shard.slots.size( ) - 1;
+    uint64_t       slot = hash & mask;
+
+    while ( const uint32_t entryIndex = shard.slots[ slot ] ) {
+        const Entry& entry = shard.entries[ entryIndex - 1 ];
+        if ( entry.hash == hash )
+            return entry.value == name ? ePushResult_Exists : ePushResult_Collision;
+        slot = ( slot + 1 ) & mask;
+    }
+
+    shard.entries.push_back( Entry{hash, name} );
+    shard.slots[ slot ] = (uint32_t) shard.entries.size( );
+
+    // Keep the load factor below 1/2 to have short probe sequences.
+    if ( shard.entries.size( ) * 2 > shard.slots.size( ) )
+        Rehash( shard, shard.slots.size( ) * 2 );
+
+    return ePushResult_Added;
+}
+
+void apemode::NameTable::Sort( JobPool& jobs ) {
+    ParallelFor( jobs, kShardCount, [&]( uint32_t i ) {
+        Shard& shard = shards[ i ];
+        std::sort( shard.entries.begin( ), shard.entries.end( ), []( const Entry& a, const Entry& b ) {
+            return a.hash < b.hash;
+        } );
+
+        // Entry indices have changed.
+        Rehash( shard, shard.slots.size( ) );
+    } );
+}
+
+size_t apemode::NameTable::GetSize( ) const {
+    size_t size = 0;
+    for ( auto& shard : shards )
+        size += shard.entries.size( );
+    return size;
+}
+
+void apemode::NameTable::Clear( ) {
+    for ( auto& shard : shards ) {
+        shard.entries.clear( );
+        Rehash( shard, 64 );
+    }
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <fbxppch.h>
+#include <fbxpjobs.h>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace apemode {
+
+    /**
+     * Thread-safe name interning table keyed by the 64-bit name hash.
+     * The table is split into shards by the highest bits of the hash, every shard has its own lock
+     * and an open addressing (linear probing) slot array. Since the shards partition the hash range,
+     * the shards sorted individually and visited in order give the names sorted by hash.
+     **/
+    class NameTable {
+    public:
+        struct Entry {
+            uint64_t    hash;
+            std::string value;
+        };
+
+        enum EPushResult {
+            ePushResult_Added,
+            ePushResult_Exists,
+            ePushResult_Collision, // Same hash, but different string, the first string is kept.
+        };
+
+        NameTable( );
+
+        EPushResult Push( uint64_t hash, std::string const& name );
+
+        /**
+         * Sorts the entries by hash in every shard (in parallel).
+         * Not thread-safe, must not be called concurrently with Push( ).
+         **/
+        void Sort( JobPool& jobs );
+
+        /**
+         * Visits the entries in the shard order, the entries are sorted by hash if Sort( ) was called.
+         **/
+        template < typename TFunc >
+        void ForEach( TFunc func ) const {
+            for ( auto& shard : shards )
+                for ( auto& entry : shard.entries )
+                    func( entry );
+        }
+
+        size_t GetSize( ) const;
+        void   Clear( );
+
+    private:
+        static const uint32_t kShardBits  = 6;
+        static const uint32_t kShardCount = 1u << kShardBits;
+
+        struct Shard {
+            std::mutex              mutex;
+            std::vector< uint32_t > slots; // Entry index + 1, 0 means empty slot.
+            std::vector< Entry >    entries;
+        };
+
+        static void Rehash( Shard& shard, size_t slotCount );
+
+        Shard shards[ kShardCount ];
+    };
+}
@@ -2,21 +2,21 @@
 #include <fbxpstate.h>
 #include <queue>
 
-void ExportMesh( FbxNode* node, apemode::Node& n, bool pack, bool optimize );
+void ExportMesh( FbxNode* node, apemode::Node& n );
+void ExportMeshes( bool pack, bool optimize );
 void ExportMaterials( FbxScene* scene );
 void ExportMaterials( FbxNode* node, apemode::Node& n );
 void ExportTransform( FbxNode* node, apemode::Node& n );
 void ExportAnimation( FbxNode* node, apemode::Node& n );
+void LogMemoryUsage( const char* stage );
 
 void ExportNodeAttributes( FbxNode* node, apemode::Node& n ) {
-    auto& s = apemode::Get( );
-
     n.cullingType = (apemodefb::ECullingType) node->mCullingType;
-    s.console->info( "Node \"{}\" has {} culling type.", node->GetName(), n.cullingType );
+    FBXP_TRACE( "Node \"{}\" has {} culling type.", node->GetName( ), n.cullingType );
 
     ExportTransform( node, n );
     ExportAnimation( node, n );
-    ExportMesh( node, n, s.options[ "p" ].as< bool >( ), s.options[ "t" ].as< bool >( ) );
+    ExportMesh( node, n );
     ExportMaterials( node, n );
 }
 
@@ -49,21 +49,29 @@ uint32_t ExportNode( FbxNode* node ) {
  *                      > Split meshes per material
  **/
 void PreprocessMeshes( FbxScene* scene ) {
+    FBXP_PROFILE_ZONE( "Preprocess meshes" );
     auto& s = apemode::Get( );
 
     FbxGeometryConverter geometryConverter( s.manager );
 
-    s.console->info( "Triangulating..." );
-    if ( false == geometryConverter.Triangulate( s.scene, true ) ) {
-        s.console->warn( "Triangulation failed for some nodes." );
-        s.console->warn( "Nodes that failed triangulation will be detected in mesh exporting stage." );
-    } else {
-        s.console->info( "Triangulation succeeded for all nodes." );
+    {
+        FBXP_PROFILE_ZONE( "Triangulate" );
+        s.console->info( "Triangulating..." );
+        if ( false == geometryConverter.Triangulate( s.scene, true ) ) {
+            s.console->warn( "Triangulation failed for some nodes." );
+            s.console->warn( "Nodes that failed triangulation will be detected in mesh exporting stage." );
+        } else {
+            s.console->info( "Triangulation succeeded for all nodes." );
+        }
     }
 
     FbxArray< FbxNode* > affectedNodes;
-    s.console->info( "Removing bad polygons..." );
-    geometryConverter.RemoveBadPolygonsFromMeshes( s.scene, &affectedNodes );
+    {
+        FBXP_PROFILE_ZONE( "Remove bad polygons" );
+        s.console->info( "Removing bad polygons..." );
+        geometryConverter.RemoveBadPolygonsFromMeshes( s.scene, &affectedNodes );
+    }
+
     if ( 0 != affectedNodes.Size( ) ) {
         s.console->warn( "Removed bad polygons from {} nodes:", affectedNodes.Size( ) );
         for ( int32_t i = 0; i < affectedNodes.Size( ); ++i ) {
@@ -76,6 +84,7 @@ void PreprocessMeshes( FbxScene* scene ) {
 
     if ( s.options[ "s" ].as< bool >( ) ) {
         s.console->info( "Splitting per material..." );
+        FBXP_PROFILE_ZONE( "Split meshes per material" );
         if ( false == geometryConverter.SplitMeshesPerMaterial( s.scene, true ) ) {
             s.console->warn( "Splitting per material failed for some nodes." );
             s.console->warn( "Nodes that were not splitted will have subsets." );
@@ -97,6 +106,7 @@ void ExportScene( FbxScene* scene ) {
 
     PreprocessMeshes( scene );
     PreprocessAnimation( scene );
+    LogMemoryUsage( "Preprocess" );
 
     // Pre-allocate nodes and attributes.
     s.nodes.reserve( (size_t) scene->GetNodeCount( ) );
@@ -107,5 +117,12 @@ void ExportScene( FbxScene* scene ) {
     ExportMaterials( scene );
 
     // Export nodes recursively.
-    ExportNode( scene->GetRootNode( ) );
+    // Meshes are only collected here, their geometry is processed in parallel afterwards.
+    {
+        FBXP_PROFILE_ZONE( "Export nodes" );
+        ExportNode( scene->GetRootNode( ) );
+    }
+
+    ExportMeshes( s.options[ "p" ].as< bool >( ) || s.options[ "pack-octahedral" ].as< bool >( ), s.options[ "t" ].as< bool >( ) );
+    LogMemoryUsage( "Export meshes" );
 }
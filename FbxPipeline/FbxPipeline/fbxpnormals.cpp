@@ -0,0 +1,141 @@
+#include <fbxppch.h>
+#include <fbxpstate.h>
+#include <fbxparena.h>
+#include <numeric>
+
+//
+// Smooth normals for the meshes without the normal layer (see CalculateSmoothNormals in fbxpmesh.cpp).
+// The polygon vertices of the control point share the normal: every polygon vertex sums the face normals of the
+// control point polygons that are within the crease angle and share a smoothing group (if the mesh has them),
+// weighted by the polygon vertex angle or the polygon area.
+// The polygon vertices are sorted by control point (counting sort) and the control point groups are reduced in parallel,
+// every polygon vertex writes only its own normal (no scattering, no atomics). The groups are reduced in the same order
+// for all the polygon vertices, so the polygon vertices of the smooth surface get equal normals and are welded.
+//
+
+/**
+ * Calculates the smooth normals of the triangles (no FBX dependencies).
+ * @param positions The position of the first vertex, vertexStride floats between the vertices.
+ * @param normals The normal of the first vertex (written), vertexStride floats between the vertices.
+ * @param controlPointIndices The control point of every vertex (the vertices of the control point are smoothed together).
+ * @param vertexCount The vertex count, 3 vertices per triangle.
+ * @param smoothingGroups The smoothing group bit masks of the triangles (nullptr if the mesh has no smoothing groups).
+ * @param creaseAngle The faces with the larger angle are not smoothed (degrees, 180 or above smooths all the faces).
+ * @param areaWeighted The face normals are weighted by the triangle area if set, by the corner angle otherwise.
+ **/
+void CalculateSmoothNormals( const float*    positions,
+                             float*          normals,
+                             uint32_t        vertexStride,
+                             const uint32_t* controlPointIndices,
+                             uint32_t        vertexCount,
+                             uint32_t        controlPointCount,
+                             const int*      smoothingGroups,
+                             float           creaseAngle,
+                             bool            areaWeighted ) {
+    FBXP_PROFILE_ZONE( "Calculate smooth normals" );
+    const apemode::ArenaScope arenaScope( "Calculate smooth normals" );
+    auto& s = apemode::Get( );
+
+    const uint32_t pc = vertexCount / 3;
+    const uint32_t cc = controlPointCount;
+
+    const float creaseCosine = creaseAngle >= 180.0f ? -2.0f : cosf( creaseAngle * 3.14159265f / 180.0f );
+
+    const uint32_t kChunkSize = 64 * 1024;
+    const uint32_t chunkCount = ( pc + kChunkSize - 1 ) / kChunkSize;
+
+    //
+    // Face normals and polygon vertex weights.
+    //
+
+    apemode::ArenaVector< mathfu::vec3 > faceNormals( pc );
+    apemode::ArenaVector< float >        weights( vertexCount );
+
+    apemode::ParallelFor( *s.jobs, chunkCount, [&]( uint32_t chunk ) {
+        for ( uint32_t pi = chunk * kChunkSize; pi < std::min( pc, ( chunk + 1 ) * kChunkSize ); ++pi ) {
+            const mathfu::vec3 p[ 3 ] = {mathfu::vec3( positions + ( pi * 3 + 0 ) * vertexStride ),
+                                         mathfu::vec3( positions + ( pi * 3 + 1 ) * vertexStride ),
+                                         mathfu::vec3( positions + ( pi * 3 + 2 ) * vertexStride )};
+
+            const mathfu::vec3 n      = mathfu::cross( p[ 1 ] - p[ 0 ], p[ 2 ] - p[ 0 ] );
+            const float        length = n.Length( );
+            faceNormals[ pi ]         = length > 0 ? n / length : mathfu::kZeros3f;
+
+            for ( uint32_t k = 0; k < 3; ++k ) {
+                if ( areaWeighted ) {
+                    weights[ pi * 3 + k ] = length;
+                } else {
+                    const mathfu::vec3 e1 = p[ ( k + 1 ) % 3 ] - p[ k ];
+                    const mathfu::vec3 e2 = p[ ( k + 2 ) % 3 ] - p[ k ];
+                    const float        l  = e1.Length( ) * e2.Length( );
+                    weights[ pi * 3 + k ] = l > 0 ? acosf( std::max( -1.0f, std::min( 1.0f, mathfu::dot( e1, e2 ) / l ) ) ) : 0.0f;
+                }
+            }
+        }
+    } );
+
+    //
+    // Sort the polygon vertices by control point (counting sort, the polygon vertices keep their order).
+    //
+
+    apemode::ArenaVector< uint32_t > groupOffsets( cc + 1, 0 );
+    apemode::ArenaVector< uint32_t > groupVertices( vertexCount );
+
+    for ( uint32_t vi = 0; vi < vertexCount; ++vi )
+        ++groupOffsets[ controlPointIndices[ vi ] + 1 ];
+
+    std::partial_sum( groupOffsets.begin( ), groupOffsets.end( ), groupOffsets.begin( ) );
+
+    {
+        apemode::ArenaVector< uint32_t > cursors( groupOffsets.begin( ), groupOffsets.end( ) - 1 );
+        for ( uint32_t vi = 0; vi < vertexCount; ++vi )
+            groupVertices[ cursors[ controlPointIndices[ vi ] ]++ ] = vi;
+    }
+
+    //
+    // Reduce the control point groups.
+    // Without the crease angle and the smoothing groups all the polygon vertices of the group get the same normal,
+    // so the group is summed once (avoids quadratic reductions for the high valence control points).
+    //
+
+    const bool smoothAll = creaseCosine < -1.0f && nullptr == smoothingGroups;
+
+    apemode::ParallelFor( *s.jobs, ( cc + kChunkSize - 1 ) / kChunkSize, [&]( uint32_t chunk ) {
+        for ( uint32_t ci = chunk * kChunkSize; ci < std::min( cc, ( chunk + 1 ) * kChunkSize ); ++ci ) {
+            const uint32_t* groupFirst = groupVertices.data( ) + groupOffsets[ ci ];
+            const uint32_t* groupLast  = groupVertices.data( ) + groupOffsets[ ci + 1 ];
+
+            mathfu::vec3 groupNormal = mathfu::kZeros3f;
+            if ( smoothAll ) {
+                for ( const uint32_t* b = groupFirst; b != groupLast; ++b )
+                    groupNormal += faceNormals[ *b / 3 ] * weights[ *b ];
+            }
+
+            for ( const uint32_t* a = groupFirst; a != groupLast; ++a ) {
+                const uint32_t     fa         = *a / 3;
+                const mathfu::vec3 faceNormal = faceNormals[ fa ];
+                const bool         degenerate = faceNormal.LengthSquared( ) == 0;
+
+                mathfu::vec3 n = groupNormal;
+                if ( false == smoothAll ) {
+                    for ( const uint32_t* b = groupFirst; b != groupLast; ++b ) {
+                        const uint32_t fb = *b / 3;
+                        if ( ( degenerate || mathfu::dot( faceNormal, faceNormals[ fb ] ) >= creaseCosine ) &&
+                             ( nullptr == smoothingGroups || fa == fb || 0 != ( smoothingGroups[ fa ] & smoothingGroups[ fb ] ) ) ) {
+                            n += faceNormals[ fb ] * weights[ *b ];
+                        }
+                    }
+                }
+
+                // The normals of the opposite faces can cancel out, the face normal is used then.
+                const float length = n.Length( );
+                n = length > 1e-6f ? n / length : degenerate ? mathfu::kAxisZ3f : faceNormal;
+
+                float* normal = normals + *a * vertexStride;
+                normal[ 0 ] = n.x;
+                normal[ 1 ] = n.y;
+                normal[ 2 ] = n.z;
+            }
+        }
+    } );
+}
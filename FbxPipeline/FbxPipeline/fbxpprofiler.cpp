@@ -0,0 +1,212 @@
+#include <fbxppch.h>
+#include <fbxpstate.h>
+#include <fbxpprofiler.h>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <mutex>
+
+#if FBXP_PROFILE
+
+//
+// The zones are appended to the buffer of the thread that records them (no locks, no atomics on the hot path),
+// the buffers are registered once per thread and owned by the profiler, so they outlive the worker threads.
+// The times are nanoseconds since the profiler initialization.
+//
+
+namespace {
+    struct ProfilerEvent {
+        const char* name;
+        std::string arg;
+        uint64_t    beginTime;
+        uint64_t    endTime;
+    };
+
+    struct ProfilerThread {
+        uint32_t                     id;
+        uint32_t                     workerIndex;
+        std::vector< ProfilerEvent > events;
+    };
+
+    std::atomic< bool >                             profilerEnabled( false );
+    std::chrono::steady_clock::time_point           profilerStartTime;
+    std::mutex                                      profilerMutex;
+    std::vector< std::unique_ptr< ProfilerThread > > profilerThreads;
+    thread_local ProfilerThread*                    profilerThread = nullptr;
+
+    uint64_t GetProfilerTime( ) {
+        return (uint64_t) std::chrono::duration_cast< std::chrono::nanoseconds >( std::chrono::steady_clock::now( ) - profilerStartTime ).count( );
+    }
+
+    ProfilerThread& GetProfilerThread( ) {
+        if ( nullptr == profilerThread ) {
+            std::lock_guard< std::mutex > lock( profilerMutex );
+            profilerThreads.emplace_back( new ProfilerThread( ) );
+            profilerThread              = profilerThreads.back( ).get( );
+            profilerThread->id          = (uint32_t) profilerThreads.size( );
+            profilerThread->workerIndex = apemode::JobPool::GetWorkerIndex( );
+            profilerThread->events.reserve( 4096 );
+        }
+
+        return *profilerThread;
+    }
+
+    void WriteJsonString( std::ofstream& stream, const char* value ) {
+        stream << '"';
+        for ( const char* c = value; *c; ++c ) {
+            switch ( *c ) {
+                case '"':  stream << "\\\""; break;
+                case '\\': stream << "\\\\"; break;
+                case '\n': stream << "\\n"; break;
+                case '\r': stream << "\\r"; break;
+                case '\t': stream << "\\t"; break;
+                default:
+                    if ( (unsigned char) *c < 0x20 ) {
+                        char escaped[ 8 ];
+                        sprintf_s( escaped, "\\u%04x", (unsigned) *c );
+                        stream << escaped;
+                    } else {
+                        stream << *c;
+                    }
+            }
+        }
+        stream << '"';
+    }
+
+    /**
+     * Writes the Chrome trace (the complete events in microseconds, the thread names are the metadata events).
+     **/
+    bool WriteTrace( std::string const& traceFile ) {
+        std::ofstream stream( traceFile );
+        if ( false == stream.good( ) )
+            return false;
+
+        const uint32_t pid = (uint32_t) GetCurrentProcessId( );
+
+        stream << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+        bool first = true;
+        for ( const auto& thread : profilerThreads ) {
+            stream << ( first ? "\n" : ",\n" );
+            stream << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << thread->id
+                   << ",\"args\":{\"name\":\"Worker #" << thread->workerIndex << "\"}}";
+            first = false;
+
+            for ( const auto& event : thread->events ) {
+                char times[ 64 ];
+                sprintf_s( times, "%.3f,\"dur\":%.3f", event.beginTime * 1e-3, ( event.endTime - event.beginTime ) * 1e-3 );
+
+                stream << ",\n{\"name\":";
+                WriteJsonString( stream, event.name );
+                stream << ",\"cat\":\"fbxp\",\"ph\":\"X\",\"ts\":" << times << ",\"pid\":" << pid << ",\"tid\":" << thread->id;
+                if ( false == event.arg.empty( ) ) {
+                    stream << ",\"args\":{\"name\":";
+                    WriteJsonString( stream, event.arg.c_str( ) );
+                    stream << "}";
+                }
+                stream << "}";
+            }
+        }
+
+        stream << "\n]}\n";
+        return stream.good( );
+    }
+
+    /**
+     * Prints the total, average and maximum time of the zones (sorted by the total time).
+     **/
+    void LogProfilerSummary( ) {
+        struct ZoneStats {
+            uint64_t count     = 0;
+            uint64_t totalTime = 0;
+            uint64_t maxTime   = 0;
+        };
+
+        std::map< std::string, ZoneStats > zones;
+        for ( const auto& thread : profilerThreads ) {
+            for ( const auto& event : thread->events ) {
+                ZoneStats& zone = zones[ event.name ];
+                const uint64_t time = event.endTime - event.beginTime;
+                ++zone.count;
+                zone.totalTime += time;
+                zone.maxTime = std::max( zone.maxTime, time );
+            }
+        }
+
+        std::vector< std::pair< std::string, ZoneStats > > sortedZones( zones.begin( ), zones.end( ) );
+        std::stable_sort( sortedZones.begin( ), sortedZones.end( ), []( const std::pair< std::string, ZoneStats >& a, const std::pair< std::string, ZoneStats >& b ) {
+            return a.second.totalTime > b.second.totalTime;
+        } );
+
+        auto& s = apemode::Get( );
+        s.console->info( "Profile ({:.1f} ms):", GetProfilerTime( ) * 1e-6 );
+        s.console->info( "\t{:<28} {:>8} {:>12} {:>12} {:>12}", "Zone", "Count", "Total, ms", "Average, ms", "Max, ms" );
+        for ( const auto& zone : sortedZones ) {
+            s.console->info( "\t{:<28} {:>8} {:>12.3f} {:>12.3f} {:>12.3f}",
+                             zone.first,
+                             zone.second.count,
+                             zone.second.totalTime * 1e-6,
+                             zone.second.totalTime * 1e-6 / zone.second.count,
+                             zone.second.maxTime * 1e-6 );
+        }
+    }
+}
+
+apemode::ProfilerZone::ProfilerZone( const char* name ) : ProfilerZone( name, nullptr ) {
+}
+
+apemode::ProfilerZone::ProfilerZone( const char* name, const char* arg ) : name( name ), arg( arg ), beginTime( 0 ) {
+    if ( profilerEnabled.load( std::memory_order_relaxed ) )
+        beginTime = GetProfilerTime( );
+    else
+        this->name = nullptr;
+}
+
+apemode::ProfilerZone::~ProfilerZone( ) {
+    if ( nullptr != name ) {
+        const uint64_t endTime = GetProfilerTime( );
+
+        ProfilerEvent event;
+        event.name      = name;
+        event.beginTime = beginTime;
+        event.endTime   = endTime;
+        if ( arg )
+            event.arg = arg;
+
+        GetProfilerThread( ).events.push_back( std::move( event ) );
+    }
+}
+
+void apemode::InitializeProfiler( ) {
+    auto& s = apemode::Get( );
+
+    if ( false == s.options[ "trace" ].as< std::string >( ).empty( ) ) {
+        profilerStartTime = std::chrono::steady_clock::now( );
+        profilerEnabled   = true;
+    }
+}
+
+/**
+ * The batch processes write their own traces (the process id is appended to the trace file name).
+ **/
+void apemode::FinishProfiler( ) {
+    auto& s = apemode::Get( );
+
+    if ( false == profilerEnabled.exchange( false ) )
+        return;
+
+    std::string traceFile = s.options[ "trace" ].as< std::string >( );
+    if ( false == s.options[ "batch-report" ].as< std::string >( ).empty( ) )
+        traceFile += "." + std::to_string( GetCurrentProcessId( ) );
+
+    std::lock_guard< std::mutex > lock( profilerMutex );
+    LogProfilerSummary( );
+
+    if ( WriteTrace( traceFile ) )
+        s.console->info( "Trace: \"{}\".", traceFile );
+    else
+        s.console->error( "Failed to write trace file \"{}\".", traceFile );
+}
+
+#endif
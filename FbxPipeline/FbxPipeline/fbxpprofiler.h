@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+//
+// Scoped profiler zones (see --trace option).
+// The zones are recorded to the thread-local buffers, the buffers are merged at exit to the Chrome trace JSON
+// (chrome://tracing, ui.perfetto.dev) and to the summary table.
+// The zones are recorded only if the --trace option is set, FBXP_PROFILE=0 compiles the instrumentation out.
+//
+// Usage:
+//      FBXP_PROFILE_ZONE( "Weld vertices" );                // till the end of the scope.
+//      FBXP_PROFILE_ZONE_ARG( "Export mesh", meshName );    // the argument is shown in the trace.
+//
+
+#ifndef FBXP_PROFILE
+#define FBXP_PROFILE 0
+#endif
+
+#if FBXP_PROFILE
+
+namespace apemode {
+
+    /**
+     * Records the zone from its construction till its destruction.
+     * The name must be a string literal (the pointer is stored), the argument is copied.
+     **/
+    class ProfilerZone {
+    public:
+        explicit ProfilerZone( const char* name );
+        ProfilerZone( const char* name, const char* arg );
+        ~ProfilerZone( );
+
+    private:
+        const char* name;
+        const char* arg;
+        uint64_t    beginTime;
+    };
+
+    /**
+     * Enables the profiler if the --trace option is set.
+     **/
+    void InitializeProfiler( );
+
+    /**
+     * Writes the trace and prints the summary table of the recorded zones.
+     **/
+    void FinishProfiler( );
+}
+
+#define FBXP_PROFILE_CONCAT_IMPL( a, b ) a##b
+#define FBXP_PROFILE_CONCAT( a, b ) FBXP_PROFILE_CONCAT_IMPL( a, b )
+#define FBXP_PROFILE_ZONE( name ) const apemode::ProfilerZone FBXP_PROFILE_CONCAT( profilerZone, __LINE__ )( name )
+#define FBXP_PROFILE_ZONE_ARG( name, arg ) const apemode::ProfilerZone FBXP_PROFILE_CONCAT( profilerZone, __LINE__ )( name, arg )
+#define FBXP_PROFILE_INITIALIZE( ) apemode::InitializeProfiler( )
+#define FBXP_PROFILE_FINISH( ) apemode::FinishProfiler( )
+
+#else
+
+#define FBXP_PROFILE_ZONE( name )
+#define FBXP_PROFILE_ZONE_ARG( name, arg )
+#define FBXP_PROFILE_INITIALIZE( )
+#define FBXP_PROFILE_FINISH( )
+
+#endif
@@ -4,29 +4,92 @@
 #include <city.h>
 #include <fstream>
 #include <flatbuffers/util.h>
+#include <fbxpcontainer.h>
 
 std::string GetExecutable( );
 void SplitFilename( const std::string& filePath, std::string& parentFolderName, std::string& fileName );
 bool InitializeSdkObjects( FbxManager*& pManager, FbxScene*& pScene );
+void LogMemoryUsage( const char* stage );
 void DestroySdkObjects( FbxManager* pManager );
 bool LoadScene( FbxManager* pManager, FbxDocument* pScene, const char* pFilename );
 void InitializeSeachLocations( );
 
+//
+// See implementation in fbxpcontainer.cpp.
+//
+
+bool IsContainerEnabled( );
+void MoveToContainerSection( uint32_t type, uint32_t id, std::vector< uint8_t >& data );
+bool WriteContainer( const std::string& output, const uint8_t* sceneData, size_t sceneSize );
+
+//
+// See implementation in fbxpanalysis.cpp.
+//
+
+bool IsAnalysisEnabled( );
+bool WriteAnalysisReport( std::string const& reportFile );
+
+namespace {
+    /**
+     * The number of the console messages the workers can queue (must be a power of two).
+     **/
+    const size_t kConsoleQueueSize = 8192;
+
+    /**
+     * Creates the asynchronous console: the messages are formatted by the calling thread
+     * and written by the logger thread, so the workers are not blocked by the console output.
+     * The queue is bounded, the callers wait if it is full (no messages are dropped).
+     **/
+    std::shared_ptr< spdlog::logger > CreateConsole( ) {
+        spdlog::set_async_mode( kConsoleQueueSize, spdlog::async_overflow_policy::block_retry );
+        return spdlog::stdout_color_mt( "apemode" );
+    }
+}
+
 apemode::State  s;
 apemode::State& apemode::Get( ) {
     return s;
 }
 
-apemode::State::State( ) : console( spdlog::stdout_color_mt( "apemode" ) ), options( GetExecutable( ) ) {
-    options.add_options( "input" )( "i,input-file", "Input", cxxopts::value< std::string >( ) );
-    options.add_options( "input" )( "o,output-file", "Output", cxxopts::value< std::string >( ) );
+apemode::State::State( ) : console( CreateConsole( ) ), options( GetExecutable( ) ) {
+    options.add_options( "input" )( "i,input-file", "Input (can be repeated)", cxxopts::value< std::vector< std::string > >( ) );
+    options.add_options( "input" )( "o,output-file", "Output (matches the input at the same position)", cxxopts::value< std::vector< std::string > >( ) );
     options.add_options( "input" )( "k,convert", "Convert", cxxopts::value< bool >( ) );
-    options.add_options( "input" )( "c,compress", "Compress", cxxopts::value< bool >( ) );
+    options.add_options( "input" )( "c,compress", "Compress meshes with Draco (see compress-* options)", cxxopts::value< bool >( ) );
     options.add_options( "input" )( "p,pack-meshes", "Pack meshes", cxxopts::value< bool >( ) );
     options.add_options( "input" )( "s,split-meshes-per-material", "Split meshes per material", cxxopts::value< bool >( ) );
     options.add_options( "input" )( "t,optimize-meshes", "Optimize meshes", cxxopts::value< bool >( ) );
     options.add_options( "input" )( "e,search-location", "Add search location", cxxopts::value< std::vector< std::string > >( ) );
     options.add_options( "input" )( "m,embed-file", "Embed file", cxxopts::value< std::vector< std::string > >( ) );
+    options.add_options( "input" )( "j,jobs", "Number of export threads (0 = all cores)", cxxopts::value< int >( ) );
+    options.add_options( "input" )( "l,stream-meshes", "Serialize meshes as soon as they are processed (low memory)", cxxopts::value< bool >( ) );
+    options.add_options( "input" )( "pack-octahedral", "Pack meshes with octahedral normals and tangents (12-byte vertices, implies -p)", cxxopts::value< bool >( ) );
+    options.add_options( "input" )( "meshlets", "Build meshlets (clusters with culling bounds) for every subset", cxxopts::value< bool >( ) );
+    options.add_options( "input" )( "lods", "Number of simplified levels per subset", cxxopts::value< int >( ) );
+    options.add_options( "input" )( "lod-error", "LOD error limit relative to the mesh size (0 = 0.01)", cxxopts::value< float >( ) );
+    options.add_options( "input" )( "compress-indices", "Compress the subset indices (edge FIFO and rANS)", cxxopts::value< bool >( ) );
+    options.add_options( "input" )( "compress-position-bits", "Draco position quantization bits (0 = 14)", cxxopts::value< int >( ) );
+    options.add_options( "input" )( "compress-normal-bits", "Draco normal and tangent quantization bits (0 = 10)", cxxopts::value< int >( ) );
+    options.add_options( "input" )( "compress-texcoord-bits", "Draco texcoord quantization bits (0 = 12)", cxxopts::value< int >( ) );
+    options.add_options( "input" )( "compress-speed", "Draco encoding and decoding speed (0 - best compression, 10 - fastest, no option means 5)", cxxopts::value< int >( ) );
+    options.add_options( "input" )( "container", "Write the block-compressed container (lz4 - fast, lz4hc - strong)", cxxopts::value< std::string >( ) );
+    options.add_options( "input" )( "container-block-size", "Container block size in KB (0 = 256)", cxxopts::value< int >( ) );
+    options.add_options( "input" )( "optimize-passes", "Mesh optimization passes, comma-separated (vcache, forsyth, overdraw, fetch; no option means vcache,overdraw,fetch)", cxxopts::value< std::string >( ) );
+    options.add_options( "input" )( "overdraw-threshold", "Overdraw optimization ACMR threshold (0 = 1.05)", cxxopts::value< float >( ) );
+    options.add_options( "input" )( "analyze", "Analyze the cache, overdraw and fetch efficiency of the meshes (writes <output>.analysis.json)", cxxopts::value< bool >( ) );
+    options.add_options( "input" )( "analyze-cache", "Analysis cache models, comma-separated fifo<size> or lru<size> (no option means fifo16,fifo32,lru16)", cxxopts::value< std::string >( ) );
+    options.add_options( "input" )( "normals-crease-angle", "Smooth normals crease angle in degrees for the meshes without normals (0 = 60, 180 = smooth all)", cxxopts::value< float >( ) );
+    options.add_options( "input" )( "normals-weighting", "Smooth normals face weighting (angle or area, no option means angle)", cxxopts::value< std::string >( ) );
+    options.add_options( "input" )( "no-instancing", "Export a mesh per node (no sharing of the instanced and identical meshes)", cxxopts::value< bool >( ) );
+    options.add_options( "input" )( "arena-stats", "Print the peak and the total bytes of the mesh stage temporaries (per-worker arenas)", cxxopts::value< bool >( ) );
+    options.add_options( "input" )( "log-level", "Console level (trace, debug, info, warn, error, off; no option means info)", cxxopts::value< std::string >( ) );
+    options.add_options( "input" )( "q,quiet", "Print only the warnings and the errors (same as --log-level warn)", cxxopts::value< bool >( ) );
+    options.add_options( "input" )( "trace", "Write the Chrome trace of the export stages (JSON) and print the profile summary", cxxopts::value< std::string >( ) );
+    options.add_options( "input" )( "weld-epsilon", "Weld the vertices with the components closer than epsilon (0 = identical vertices only)", cxxopts::value< float >( ) );
+    options.add_options( "input" )( "cache-dir", "Processed mesh cache directory", cxxopts::value< std::string >( ) );
+    options.add_options( "batch" )( "manifest", "File with \"input[|output]\" lines to convert", cxxopts::value< std::string >( ) );
+    options.add_options( "batch" )( "batch-processes", "Number of batch processes (0 = auto)", cxxopts::value< int >( ) );
+    options.add_options( "batch" )( "batch-report", "Timing report file (used by the batch processes)", cxxopts::value< std::string >( ) );
 }
 
 apemode::State::~State( ) {
@@ -34,6 +97,11 @@ apemode::State::~State( ) {
 }
 
 bool apemode::State::Initialize( ) {
+    if ( !jobs ) {
+        jobs.reset( new JobPool( (uint32_t) std::max( 0, options[ "j" ].as< int >( ) ) ) );
+        console->info( "Job pool has {} worker(s).", jobs->GetWorkerCount( ) );
+    }
+
     if (!manager || !scene) {
         InitializeSdkObjects( manager, scene );
         InitializeSeachLocations( );
@@ -42,7 +110,44 @@ bool apemode::State::Initialize( ) {
     return manager && scene;
 }
 
+void apemode::State::InitializeConsole( ) {
+    const std::pair< const char*, spdlog::level::level_enum > levels[] = {
+        {"trace", spdlog::level::trace},
+        {"debug", spdlog::level::debug},
+        {"info", spdlog::level::info},
+        {"warn", spdlog::level::warn},
+        {"error", spdlog::level::err},
+        {"off", spdlog::level::off},
+    };
+
+    spdlog::level::level_enum level = options[ "q" ].as< bool >( ) ? spdlog::level::warn : spdlog::level::info;
+
+    const std::string levelName = options[ "log-level" ].as< std::string >( );
+    if ( false == levelName.empty( ) ) {
+        auto it = std::find_if( std::begin( levels ), std::end( levels ), [&]( const std::pair< const char*, spdlog::level::level_enum >& l ) {
+            return levelName == l.first;
+        } );
+
+        if ( it != std::end( levels ) )
+            level = it->second;
+        else
+            console->error( "Unknown log level \"{}\" (ignored).", levelName );
+    }
+
+    console->set_level( level );
+
+    // The errors are written immediately, the process can be terminated right after them.
+    console->flush_on( spdlog::level::err );
+
+#if !FBXP_LOG_TRACE
+    if ( level == spdlog::level::trace )
+        console->warn( "Trace messages are compiled out (FBXP_LOG_TRACE=0)." );
+#endif
+}
+
 void apemode::State::Release( ) {
+    jobs.reset( );
+
     if ( manager ) {
         DestroySdkObjects( manager );
         manager = nullptr;
@@ -50,31 +155,129 @@ void apemode::State::Release( ) {
 }
 
 bool apemode::State::Load( ) {
-    const std::string inputFile = options[ "i" ].as< std::string >( );
-    // SplitFilename( inputFile.c_str( ), folderPath, fileName );
+    SplitFilename( inputFile.c_str( ), folderPath, fileName );
     // console->info( "File name  : \"{}\"", fileName );
     // console->info( "Folder name: \"{}\"", folderPath );
-    return LoadScene( manager, scene, inputFile.c_str( ) );
+    FBXP_PROFILE_ZONE_ARG( "Load scene", inputFile.c_str( ) );
+    const bool loaded = LoadScene( manager, scene, inputFile.c_str( ) );
+    LogMemoryUsage( "Load" );
+    return loaded;
+}
+
+/**
+ * Clears the data of the previous file and creates a new scene.
+ * The manager (with its plugins and IO settings), the job pool and the search file index are reused.
+ **/
+void apemode::State::Reset( ) {
+    nodes.clear( );
+    materials.clear( );
+    textureDict.clear( );
+    materialDict.clear( );
+    meshDict.clear( );
+    names.Clear( );
+    transforms.clear( );
+    textures.clear( );
+    meshes.clear( );
+    pendingMeshes.clear( );
+    meshOffsets.clear( );
+    meshStreamed.clear( );
+    pendingSections.clear( );
+    streamedMeshCount = 0;
+    embedQueue = embedPatternFiles;
+    builder.Clear( );
+    fileName.clear( );
+    folderPath.clear( );
+
+    if ( scene ) {
+        scene->Destroy( );
+        scene = FbxScene::Create( manager, "" );
+    }
+}
+
+flatbuffers::Offset< apemodefb::MeshFb > apemode::State::SerializeMesh( Mesh& mesh, uint32_t meshId ) {
+    if ( IsContainerEnabled( ) ) {
+        MoveToContainerSection( eContainerSection_MeshVertices, meshId, mesh.vertices );
+        MoveToContainerSection( eContainerSection_MeshSubsetIndices, meshId, mesh.subsetIndices );
+        MoveToContainerSection( eContainerSection_MeshDraco, meshId, mesh.draco );
+    }
+
+    auto vsOffset = builder.CreateVector( mesh.vertices );
+    auto smOffset = builder.CreateVectorOfStructs( mesh.submeshes );
+    auto ssOffset = builder.CreateVectorOfStructs( mesh.subsets );
+    auto siOffset = builder.CreateVector( mesh.subsetIndices );
+    auto slOffset = builder.CreateVectorOfStructs( mesh.subsetLods );
+    auto mlOffset = builder.CreateVectorOfStructs( mesh.meshlets );
+    auto mvOffset = builder.CreateVector( mesh.meshletVertices );
+    auto miOffset = builder.CreateVector( mesh.meshletIndices );
+    auto dcOffset = builder.CreateVector( mesh.draco );
+
+    apemodefb::MeshFbBuilder meshBuilder( builder );
+    meshBuilder.add_vertices( vsOffset );
+    meshBuilder.add_submeshes( smOffset );
+    meshBuilder.add_subsets( ssOffset );
+    meshBuilder.add_subset_indices( siOffset );
+    meshBuilder.add_subset_index_type( mesh.subsetIndexType );
+    meshBuilder.add_subset_lods( slOffset );
+    meshBuilder.add_meshlets( mlOffset );
+    meshBuilder.add_meshlet_vertices( mvOffset );
+    meshBuilder.add_meshlet_indices( miOffset );
+    meshBuilder.add_draco( dcOffset );
+
+    // The data is in the builder now, release the buffers.
+    std::vector< uint8_t >( ).swap( mesh.vertices );
+    std::vector< uint8_t >( ).swap( mesh.subsetIndices );
+    std::vector< uint8_t >( ).swap( mesh.indices );
+    std::vector< apemodefb::SubsetLodFb >( ).swap( mesh.subsetLods );
+    std::vector< apemodefb::MeshletFb >( ).swap( mesh.meshlets );
+    std::vector< uint32_t >( ).swap( mesh.meshletVertices );
+    std::vector< uint8_t >( ).swap( mesh.meshletIndices );
+    std::vector< uint8_t >( ).swap( mesh.draco );
+
+    return meshBuilder.Finish( );
+}
+
+void apemode::State::StreamMesh( uint32_t meshId ) {
+    std::lock_guard< std::mutex > lock( builderMutex );
+
+    if ( meshStreamed.size( ) != meshes.size( ) ) {
+        meshStreamed.assign( meshes.size( ), false );
+        meshOffsets.resize( meshes.size( ) );
+        streamedMeshCount = 0;
+    }
+
+    meshStreamed[ meshId ] = true;
+
+    // Keep the mesh id order, the output must not depend on the job order.
+    while ( streamedMeshCount < meshes.size( ) && meshStreamed[ streamedMeshCount ] ) {
+        meshOffsets[ streamedMeshCount ] = SerializeMesh( meshes[ streamedMeshCount ], streamedMeshCount );
+        ++streamedMeshCount;
+    }
 }
 
 std::vector< uint8_t > ReadFile( const char* filepath );
+flatbuffers::Offset< flatbuffers::Vector< uint8_t > > ReadFile( const char* filepath, flatbuffers::FlatBufferBuilder& builder );
 
 bool apemode::State::Finish( ) {
+    FBXP_PROFILE_ZONE( "Finish" );
 
     //
     // Finalize names
     //
 
     std::vector< flatbuffers::Offset<apemodefb::NameFb > > nameOffsets; {
-        nameOffsets.reserve( names.size( ) );
-        for ( auto& namePair : names ) {
-            const auto valueOffset = builder.CreateString( namePair.second );
+        FBXP_PROFILE_ZONE( "Finish names" );
+        // Names are keys, they must be sorted by hash.
+        names.Sort( *jobs );
+
+        nameOffsets.reserve( names.GetSize( ) );
+        names.ForEach( [&]( const NameTable::Entry& name ) {
+            const auto valueOffset = builder.CreateString( name.value );
 
            apemodefb::NameFbBuilder nameBuilder( builder );
-            nameBuilder.add_h( namePair.first );
+            nameBuilder.add_h( name.hash );
             nameBuilder.add_v( valueOffset );
             nameOffsets.push_back( nameBuilder.Finish( ) );
-        }
+        } );
     }
 
     const auto namesOffset = builder.CreateVector( nameOffsets );
@@ -90,6 +293,7 @@ bool apemode::State::Finish( ) {
     //
 
     std::vector< flatbuffers::Offset<apemodefb::NodeFb > > nodeOffsets; {
+        FBXP_PROFILE_ZONE( "Finish nodes" );
         nodeOffsets.reserve( nodes.size( ) );
         for ( auto& node : nodes ) {
             const auto childIdsOffset = builder.CreateVector( node.childIds );
@@ -113,6 +317,7 @@ bool apemode::State::Finish( ) {
     // 
 
     std::vector< flatbuffers::Offset<apemodefb::MaterialFb > > materialOffsets; {
+        FBXP_PROFILE_ZONE( "Finish materials" );
         materialOffsets.reserve( materials.size( ) );
         for (auto& material : materials) {
             auto propsOffset = builder.CreateVectorOfStructs( material.props );
@@ -129,40 +334,48 @@ bool apemode::State::Finish( ) {
     // Finalize meshes
     //
 
-    std::vector< flatbuffers::Offset<apemodefb::MeshFb > > meshOffsets; {
-        materialOffsets.reserve( meshes.size( ) );
-        for ( auto& mesh : meshes ) {
-            auto vsOffset = builder.CreateVector( mesh.vertices );
-            auto smOffset = builder.CreateVectorOfStructs( mesh.submeshes );
-            auto ssOffset = builder.CreateVectorOfStructs( mesh.subsets );
-            auto siOffset = builder.CreateVector( mesh.subsetIndices );
-
-           apemodefb::MeshFbBuilder meshBuilder( builder );
-            meshBuilder.add_vertices( vsOffset );
-            meshBuilder.add_submeshes( smOffset );
-            meshBuilder.add_subsets( ssOffset );
-            meshBuilder.add_subset_indices( siOffset );
-            meshBuilder.add_subset_index_type( mesh.subsetIndexType );
-            meshOffsets.push_back( meshBuilder.Finish( ) );
+    if ( false == options[ "l" ].as< bool >( ) ) {
+        FBXP_PROFILE_ZONE( "Finish meshes" );
+        meshOffsets.reserve( meshes.size( ) );
+        for ( uint32_t meshId = 0; meshId < (uint32_t) meshes.size( ); ++meshId ) {
+            meshOffsets.push_back( SerializeMesh( meshes[ meshId ], meshId ) );
         }
     }
 
+    // Streamed meshes were serialized in ExportMeshes.
+    assert( meshOffsets.size( ) == meshes.size( ) );
+    LogMemoryUsage( "Finish meshes" );
+
     //
     // Finalize files
     //
 
     std::vector< flatbuffers::Offset<apemodefb::FileFb > > fileOffsets; {
+        FBXP_PROFILE_ZONE( "Finish files" );
         fileOffsets.reserve( embedQueue.size( ) );
 
-        std::vector< uint8_t > fileBuffer;
-
         for ( auto& embedded : embedQueue ) {
-            fileBuffer = ReadFile( embedded.c_str( ) );
-            if ( !fileBuffer.empty( ) ) {
-                auto bytesOffset = builder.CreateVectorOfStructs( fileBuffer );
-                fileOffsets.push_back(apemodefb::CreateFileFbDirect( builder, (uint32_t) fileOffsets.size( ), 0, &fileBuffer ) );
+            const uint32_t fileId = (uint32_t) fileOffsets.size( );
+
+            // The file goes to the container section (moved) or is read directly to the builder.
+            flatbuffers::Offset< flatbuffers::Vector< uint8_t > > bytesOffset;
+            if ( IsContainerEnabled( ) ) {
+                std::vector< uint8_t > fileBuffer = ReadFile( embedded.c_str( ) );
+                if ( fileBuffer.empty( ) )
+                    continue;
+
+                MoveToContainerSection( apemode::eContainerSection_FileBuffer, fileId, fileBuffer );
+                bytesOffset = builder.CreateVector( fileBuffer );
+            } else {
+                bytesOffset = ReadFile( embedded.c_str( ), builder );
+                if ( 0 == bytesOffset.o )
+                    continue;
             }
+
+            fileOffsets.push_back( apemodefb::CreateFileFb( builder, fileId, 0, bytesOffset ) );
         }
+
+        LogMemoryUsage( "Finish files" );
     }
 
     const auto meshesOffset = builder.CreateVector( meshOffsets );
@@ -189,16 +402,20 @@ bool apemode::State::Finish( ) {
     // Finalize scene
     //
 
-    apemodefb::SceneFbBuilder sceneBuilder( builder );
-    sceneBuilder.add_transforms( transformsOffset );
-    sceneBuilder.add_names( namesOffset );
-    sceneBuilder.add_nodes( nodesOffset );
-    sceneBuilder.add_meshes( meshesOffset );
-    sceneBuilder.add_textures( texturesOffset );
-    sceneBuilder.add_materials( materialsOffset );
-    sceneBuilder.add_files( filesOffset );
+    {
+        FBXP_PROFILE_ZONE( "Finish scene" );
+
+        apemodefb::SceneFbBuilder sceneBuilder( builder );
+        sceneBuilder.add_transforms( transformsOffset );
+        sceneBuilder.add_names( namesOffset );
+        sceneBuilder.add_nodes( nodesOffset );
+        sceneBuilder.add_meshes( meshesOffset );
+        sceneBuilder.add_textures( texturesOffset );
+        sceneBuilder.add_materials( materialsOffset );
+        sceneBuilder.add_files( filesOffset );
 
-    apemodefb::FinishSceneFbBuffer( builder, sceneBuilder.Finish( ) );
+        apemodefb::FinishSceneFbBuffer( builder, sceneBuilder.Finish( ) );
+    }
 
     //
     // Write the file
@@ -207,7 +424,7 @@ bool apemode::State::Finish( ) {
     flatbuffers::Verifier v( builder.GetBufferPointer( ), builder.GetSize( ) );
     assert( apemodefb::VerifySceneFbBuffer( v ) );
 
-    std::string output = options[ "o" ].as< std::string >( );
+    std::string output = outputFile;
     if ( output.empty( ) ) {
         output = folderPath + fileName + "." +apemodefb::SceneFbExtension( );
     } else {
@@ -217,7 +434,19 @@ bool apemode::State::Finish( ) {
         CreateDirectoryA( outputFolder.c_str( ), 0 );
     }
 
-    if ( flatbuffers::SaveFile(output.c_str( ), (const char*) builder.GetBufferPointer( ), (size_t) builder.GetSize( ), true ) ) {
+    bool saved = false; {
+        FBXP_PROFILE_ZONE( "Save file" );
+        saved = IsContainerEnabled( )
+                    ? WriteContainer( output, builder.GetBufferPointer( ), (size_t) builder.GetSize( ) )
+                    : flatbuffers::SaveFile( output.c_str( ), (const char*) builder.GetBufferPointer( ), (size_t) builder.GetSize( ), true );
+    }
+
+    if ( saved ) {
+        LogMemoryUsage( "Save" );
+
+        if ( IsAnalysisEnabled( ) )
+            WriteAnalysisReport( output + ".analysis.json" );
+
         return true;
     }
 
@@ -228,7 +457,10 @@ bool apemode::State::Finish( ) {
 
 uint64_t apemode::State::PushName( std::string const& name ) {
     const uint64_t hash = CityHash64( name.data( ), name.size( ) );
-    names.insert( std::make_pair( hash, name ) );
+    if ( NameTable::ePushResult_Collision == names.Push( hash, name ) ) {
+        console->error( "Name \"{}\" has the same hash {} as a different name (collision).", name, hash );
+    }
+
     return hash;
 }
 
@@ -2,6 +2,27 @@
 
 #include <fbxppch.h>
 #include <scene_generated.h>
+#include <fbxpjobs.h>
+#include <fbxpnames.h>
+#include <fbxpprofiler.h>
+#include <mutex>
+#include <unordered_map>
+
+//
+// Logging on the hot paths (per node, per subset).
+// The trace messages are compiled only if FBXP_LOG_TRACE is set (the debug builds by default),
+// the other levels are filtered at run time (see --log-level and --quiet options).
+//
+
+#ifndef FBXP_LOG_TRACE
+#define FBXP_LOG_TRACE FBXP_DEBUG
+#endif
+
+#if FBXP_LOG_TRACE
+#define FBXP_TRACE( ... ) apemode::Get( ).console->trace( __VA_ARGS__ )
+#else
+#define FBXP_TRACE( ... )
+#endif
 
 namespace apemode {
 
@@ -22,6 +43,11 @@ namespace apemode {
         std::vector< uint8_t >             vertices;
         std::vector< uint8_t >             indices;
         apemodefb::EIndexTypeFb             subsetIndexType;
+        std::vector< apemodefb::SubsetLodFb > subsetLods;
+        std::vector< apemodefb::MeshletFb > meshlets;
+        std::vector< uint32_t >            meshletVertices;
+        std::vector< uint8_t >             meshletIndices;
+        std::vector< uint8_t >             draco;
     };
 
     struct Node {
@@ -39,6 +65,25 @@ namespace apemode {
         std::vector<apemodefb::MaterialPropFb > props;
     };
 
+    /**
+     * Mesh found during the node traversal, its geometry processing is deferred
+     * to run on the job pool (see ExportMeshes).
+     **/
+    struct PendingMesh {
+        FbxNode* node   = nullptr;
+        FbxMesh* mesh   = nullptr;
+        uint32_t meshId = (uint32_t) -1;
+    };
+
+    /**
+     * Byte vector moved from the scene FlatBuffer to the container section (see fbxpcontainer.h).
+     **/
+    struct PendingSection {
+        uint32_t               type = 0;
+        uint32_t               id   = 0;
+        std::vector< uint8_t > data;
+    };
+
     using TupleUintUint = std::tuple< uint32_t, uint32_t >;
 
     struct State {
@@ -48,28 +93,62 @@ namespace apemode {
         std::shared_ptr< spdlog::logger > console;
         flatbuffers::FlatBufferBuilder    builder;
         cxxopts::Options                  options;
+        std::string                       inputFile;
+        std::string                       outputFile;
         std::string                       fileName;
         std::string                       folderPath;
         std::vector< Node >               nodes;
         std::vector< Material >           materials;
         std::map< uint64_t, uint32_t >    textureDict;
         std::map< uint64_t, uint32_t >    materialDict;
-        std::map< uint64_t, std::string > names;
+        std::unordered_map< fbxsdk::FbxMesh*, uint32_t > meshDict; // The mesh ids of the exported FbxMesh instances.
+        NameTable                         names;
         std::vector<apemodefb::TransformFb >    transforms;
         std::vector<apemodefb::TextureFb >      textures;
         std::vector< Mesh >               meshes;
+        std::vector< PendingMesh >        pendingMeshes;
+        std::vector< flatbuffers::Offset< apemodefb::MeshFb > > meshOffsets;
+        std::vector< bool >               meshStreamed;
+        std::vector< PendingSection >     pendingSections;
+        uint32_t                          streamedMeshCount = 0;
+        std::mutex                        builderMutex;
+        std::unique_ptr< JobPool >        jobs;
         std::vector< std::string >        searchLocations;
+        std::vector< std::string >        searchFiles;
+        std::unordered_map< std::string, uint32_t > searchFileIndex;
+        std::unordered_map< std::string, uint32_t > searchFileIndexLowerCase;
+        std::unordered_map< std::string, std::vector< uint32_t > > searchFileIndexByExtension;
         std::set< std::string >        embedQueue;
+        std::set< std::string >        embedPatternFiles;
 
         State( );
         ~State( );
 
         bool     Initialize( );
+
+        /**
+         * Sets the console level from the options (must be called after the options are parsed).
+         **/
+        void     InitializeConsole( );
         void     Release( );
         bool     Load( );
+        void     Reset( );
         bool     Finish( );
         uint64_t PushName( std::string const& name );
 
+        /**
+         * Serializes the mesh to the builder and releases its buffers.
+         * The large byte vectors are moved to the container sections if the container is enabled.
+         **/
+        flatbuffers::Offset< apemodefb::MeshFb > SerializeMesh( Mesh& mesh, uint32_t meshId );
+
+        /**
+         * Marks the mesh as processed and serializes all the processed meshes in mesh id order.
+         * The meshes are released as soon as they are serialized, which keeps the peak memory low.
+         * Can be called from the worker threads.
+         **/
+        void StreamMesh( uint32_t meshId );
+
         friend State& Get( );
     };
 }
\ No newline at end of file
@@ -0,0 +1,440 @@
+#include <fbxppch.h>
+#include <fbxpstate.h>
+#include <fbxparena.h>
+#include <atomic>
+#include <chrono>
+#include <numeric>
+#include <emmintrin.h>
+
+//
+// Tangent space generation for the meshes without the tangent layer (MikkTSpace-compatible).
+// The tangents are generated after welding, so the triangles share the vertices and the tangents are smooth.
+// The triangle tangents and the corner weights are the ones of MikkTSpace (mikktspace.c): the triangle tangent
+// is normalized and signed by the texcoord orientation, the corner contribution is the triangle tangent
+// projected to the vertex normal and weighted by the corner angle (in the plane of the normal).
+// The corners are grouped by (vertex, orientation), the vertices used by both the orientations (mirrored texcoords)
+// are split. Unlike MikkTSpace the groups are not split by the triangle connectivity around the vertex
+// (the non-manifold vertices share the tangent).
+//
+// 1) The triangles are processed 4 per iteration with SSE2, the corner vertices are loaded from the vertex buffer
+//    and transposed to SoA in registers (a 4x4 transpose per attribute, no SoA copy of the vertex buffer).
+// 2) The corners are sorted by group (counting sort), the groups are reduced in parallel,
+//    every group is summed in the same order, so the results do not depend on the job count.
+//
+
+namespace {
+    const uint32_t kVertexFloatCount   = sizeof( apemodefb::StaticVertexFb ) / sizeof( float );
+    const uint32_t kPositionOffset     = 0;
+    const uint32_t kNormalOffset       = 3;
+    const uint32_t kTangentOffset      = 6;
+    const uint32_t kTexcoordOffset     = 10;
+    const uint32_t kChunkTriangleCount = 16 * 1024;
+    const uint32_t kChunkVertexCount   = 64 * 1024;
+    const uint32_t kNoGroup            = 0xffffffff;
+    const uint8_t  kTriangleContributes = 1;
+    const uint8_t  kTriangleReversing   = 2;
+
+    static_assert( kVertexFloatCount == 12, "Position (3), normal (3), tangent (4), uv (2)." );
+    static_assert( kTexcoordOffset + 2 == kVertexFloatCount, "The uv is loaded with the 2 preceding floats." );
+
+    std::atomic< uint64_t > tangentTriangleCount( 0 );
+    std::atomic< uint64_t > tangentSplitVertexCount( 0 );
+    std::atomic< uint64_t > tangentMicroseconds( 0 );
+
+    /**
+     * 4 vectors, a register per component.
+     **/
+    struct Vec3x4 {
+        __m128 x, y, z;
+    };
+
+    inline Vec3x4 Sub( const Vec3x4& a, const Vec3x4& b ) {
+        return {_mm_sub_ps( a.x, b.x ), _mm_sub_ps( a.y, b.y ), _mm_sub_ps( a.z, b.z )};
+    }
+
+    inline Vec3x4 Scale( const Vec3x4& a, __m128 s ) {
+        return {_mm_mul_ps( a.x, s ), _mm_mul_ps( a.y, s ), _mm_mul_ps( a.z, s )};
+    }
+
+    inline __m128 Dot( const Vec3x4& a, const Vec3x4& b ) {
+        return _mm_add_ps( _mm_add_ps( _mm_mul_ps( a.x, b.x ), _mm_mul_ps( a.y, b.y ) ), _mm_mul_ps( a.z, b.z ) );
+    }
+
+    inline __m128 Select( __m128 mask, __m128 a, __m128 b ) {
+        return _mm_or_ps( _mm_and_ps( mask, a ), _mm_andnot_ps( mask, b ) );
+    }
+
+    /**
+     * Returns the lanes with |value| > FLT_MIN (NotZero in MikkTSpace).
+     **/
+    inline __m128 NotZero( __m128 value ) {
+        const __m128 absValue = _mm_andnot_ps( _mm_set1_ps( -0.0f ), value );
+        return _mm_cmpgt_ps( absValue, _mm_set1_ps( std::numeric_limits< float >::min( ) ) );
+    }
+
+    /**
+     * Normalizes the non-zero vectors, keeps the zero ones.
+     **/
+    inline Vec3x4 Normalize( const Vec3x4& a ) {
+        const __m128 length = _mm_sqrt_ps( Dot( a, a ) );
+        const __m128 mask   = NotZero( length );
+        const Vec3x4 n      = Scale( a, _mm_div_ps( _mm_set1_ps( 1.0f ), length ) );
+        return {Select( mask, n.x, a.x ), Select( mask, n.y, a.y ), Select( mask, n.z, a.z )};
+    }
+
+    /**
+     * Projects the vectors to the planes of the normals.
+     **/
+    inline Vec3x4 Project( const Vec3x4& a, const Vec3x4& n ) {
+        return Sub( a, Scale( n, Dot( n, a ) ) );
+    }
+
+    /**
+     * Arc cosine of [-1; 1] (Cephes acosf/asinf, the error is about 1e-7 of acosf).
+     * acos(x) = pi/2 - asin(x) for |x| <= 1/2, 2 asin(sqrt((1 - |x|) / 2)) (mirrored for x < 0) otherwise.
+     **/
+    inline __m128 Acos( __m128 x ) {
+        const __m128 absX  = _mm_andnot_ps( _mm_set1_ps( -0.0f ), x );
+        const __m128 large = _mm_cmpgt_ps( absX, _mm_set1_ps( 0.5f ) );
+        const __m128 z     = Select( large, _mm_mul_ps( _mm_set1_ps( 0.5f ), _mm_sub_ps( _mm_set1_ps( 1.0f ), absX ) ), _mm_mul_ps( x, x ) );
+        const __m128 a     = Select( large, _mm_sqrt_ps( z ), absX );
+
+        __m128 p = _mm_set1_ps( 4.2163199048e-2f );
+        p = _mm_add_ps( _mm_mul_ps( p, z ), _mm_set1_ps( 2.4181311049e-2f ) );
+        p = _mm_add_ps( _mm_mul_ps( p, z ), _mm_set1_ps( 4.5470025998e-2f ) );
+        p = _mm_add_ps( _mm_mul_ps( p, z ), _mm_set1_ps( 7.4953002686e-2f ) );
+        p = _mm_add_ps( _mm_mul_ps( p, z ), _mm_set1_ps( 1.6666752422e-1f ) );
+
+        // asin( a ), a is in [0; 1/2].
+        const __m128 asinA = _mm_add_ps( _mm_mul_ps( _mm_mul_ps( p, z ), a ), a );
+
+        const __m128 negative    = _mm_cmplt_ps( x, _mm_setzero_ps( ) );
+        const __m128 pi          = _mm_set1_ps( 3.14159265358979f );
+        const __m128 halfPi      = _mm_set1_ps( 1.57079632679490f );
+        const __m128 largeAcos   = _mm_add_ps( asinA, asinA );
+        const __m128 smallAcos   = _mm_sub_ps( halfPi, _mm_or_ps( asinA, _mm_and_ps( negative, _mm_set1_ps( -0.0f ) ) ) );
+        return Select( large, Select( negative, _mm_sub_ps( pi, largeAcos ), largeAcos ), smallAcos );
+    }
+
+    /**
+     * The attributes of 4 vertices (SoA).
+     **/
+    struct VertexX4 {
+        Vec3x4 position;
+        Vec3x4 normal;
+        __m128 u, v;
+    };
+
+    /**
+     * Loads 4 vertices, every attribute is loaded as 4 floats and transposed (the extra lane is dropped).
+     **/
+    inline VertexX4 LoadVertices( const float* vertices, const uint32_t* vertexIndices ) {
+        const float* v0 = vertices + vertexIndices[ 0 ] * kVertexFloatCount;
+        const float* v1 = vertices + vertexIndices[ 1 ] * kVertexFloatCount;
+        const float* v2 = vertices + vertexIndices[ 2 ] * kVertexFloatCount;
+        const float* v3 = vertices + vertexIndices[ 3 ] * kVertexFloatCount;
+
+        VertexX4 result;
+
+        __m128 a0 = _mm_loadu_ps( v0 + kPositionOffset ), a1 = _mm_loadu_ps( v1 + kPositionOffset );
+        __m128 a2 = _mm_loadu_ps( v2 + kPositionOffset ), a3 = _mm_loadu_ps( v3 + kPositionOffset );
+        _MM_TRANSPOSE4_PS( a0, a1, a2, a3 );
+        result.position = {a0, a1, a2};
+
+        a0 = _mm_loadu_ps( v0 + kNormalOffset ), a1 = _mm_loadu_ps( v1 + kNormalOffset );
+        a2 = _mm_loadu_ps( v2 + kNormalOffset ), a3 = _mm_loadu_ps( v3 + kNormalOffset );
+        _MM_TRANSPOSE4_PS( a0, a1, a2, a3 );
+        result.normal = {a0, a1, a2};
+
+        a0 = _mm_loadu_ps( v0 + kTexcoordOffset - 2 ), a1 = _mm_loadu_ps( v1 + kTexcoordOffset - 2 );
+        a2 = _mm_loadu_ps( v2 + kTexcoordOffset - 2 ), a3 = _mm_loadu_ps( v3 + kTexcoordOffset - 2 );
+        _MM_TRANSPOSE4_PS( a0, a1, a2, a3 );
+        result.u = a2;
+        result.v = a3;
+
+        return result;
+    }
+
+    /**
+     * The corner contributions (SoA), the corner k of the triangle t is at k * triangleCount + t.
+     * The triangles with the degenerate texcoords or positions do not contribute (kTriangleContributes is not set),
+     * the orientation-reversing triangles (the mirrored texcoords) have kTriangleReversing set.
+     **/
+    struct CornerStreams {
+        uint32_t               triangleCount;
+        apemode::ArenaVector< float >   x, y, z;
+        apemode::ArenaVector< uint8_t > triangleFlags;
+    };
+
+    /**
+     * Calculates the corner contributions of 4 triangles [firstTriangle; firstTriangle + laneCount).
+     * The missing lanes repeat the last triangle and are not stored.
+     **/
+    void EvaluateTriangles( const float*    vertices,
+                            const uint32_t* indices,
+                            uint32_t        firstTriangle,
+                            uint32_t        laneCount,
+                            CornerStreams&  corners ) {
+        // Corner vertex indices, [corner][lane].
+        uint32_t vertexIndices[ 3 ][ 4 ];
+        for ( uint32_t lane = 0; lane < 4; ++lane ) {
+            const uint32_t t = firstTriangle + std::min( lane, laneCount - 1 );
+            vertexIndices[ 0 ][ lane ] = indices[ t * 3 + 0 ];
+            vertexIndices[ 1 ][ lane ] = indices[ t * 3 + 1 ];
+            vertexIndices[ 2 ][ lane ] = indices[ t * 3 + 2 ];
+        }
+
+        const VertexX4 cornerVertices[ 3 ] = {LoadVertices( vertices, vertexIndices[ 0 ] ),
+                                              LoadVertices( vertices, vertexIndices[ 1 ] ),
+                                              LoadVertices( vertices, vertexIndices[ 2 ] )};
+
+        const Vec3x4 p[ 3 ] = {cornerVertices[ 0 ].position, cornerVertices[ 1 ].position, cornerVertices[ 2 ].position};
+
+        //
+        // Triangle tangent (InitTriInfo in MikkTSpace).
+        //
+
+        const __m128 t21x = _mm_sub_ps( cornerVertices[ 1 ].u, cornerVertices[ 0 ].u );
+        const __m128 t21y = _mm_sub_ps( cornerVertices[ 1 ].v, cornerVertices[ 0 ].v );
+        const __m128 t31x = _mm_sub_ps( cornerVertices[ 2 ].u, cornerVertices[ 0 ].u );
+        const __m128 t31y = _mm_sub_ps( cornerVertices[ 2 ].v, cornerVertices[ 0 ].v );
+
+        const Vec3x4 d1 = Sub( p[ 1 ], p[ 0 ] );
+        const Vec3x4 d2 = Sub( p[ 2 ], p[ 0 ] );
+
+        const __m128 signedAreaSTx2 = _mm_sub_ps( _mm_mul_ps( t21x, t31y ), _mm_mul_ps( t21y, t31x ) );
+        const Vec3x4 os             = Sub( Scale( d1, t31y ), Scale( d2, t21y ) );
+        const Vec3x4 ot             = Sub( Scale( d2, t21x ), Scale( d1, t31x ) );
+        const __m128 lengthOs       = _mm_sqrt_ps( Dot( os, os ) );
+        const __m128 lengthOt       = _mm_sqrt_ps( Dot( ot, ot ) );
+
+        const __m128 orientationPreserving = _mm_cmpgt_ps( signedAreaSTx2, _mm_setzero_ps( ) );
+        const __m128 sign                  = Select( orientationPreserving, _mm_set1_ps( 1.0f ), _mm_set1_ps( -1.0f ) );
+        const __m128 absArea               = _mm_andnot_ps( _mm_set1_ps( -0.0f ), signedAreaSTx2 );
+
+        const __m128 osMask     = NotZero( lengthOs );
+        const Vec3x4 osScaled   = Scale( os, _mm_div_ps( sign, lengthOs ) );
+        const Vec3x4 triangleOs = {Select( osMask, osScaled.x, os.x ), Select( osMask, osScaled.y, os.y ), Select( osMask, osScaled.z, os.z )};
+
+        // The triangles with the degenerate texcoords or the degenerate positions do not contribute.
+        __m128 contributes = NotZero( signedAreaSTx2 );
+        contributes        = _mm_and_ps( contributes, NotZero( _mm_div_ps( lengthOs, absArea ) ) );
+        contributes        = _mm_and_ps( contributes, NotZero( _mm_div_ps( lengthOt, absArea ) ) );
+        for ( uint32_t k = 0; k < 3; ++k ) {
+            const Vec3x4& a = p[ k ];
+            const Vec3x4& b = p[ ( k + 1 ) % 3 ];
+            const __m128  equal = _mm_and_ps( _mm_and_ps( _mm_cmpeq_ps( a.x, b.x ), _mm_cmpeq_ps( a.y, b.y ) ), _mm_cmpeq_ps( a.z, b.z ) );
+            contributes = _mm_andnot_ps( equal, contributes );
+        }
+
+        const int orientationMask = _mm_movemask_ps( orientationPreserving );
+        const int contributesMask = _mm_movemask_ps( contributes );
+
+        //
+        // Corner contributions (EvalTspace in MikkTSpace).
+        //
+
+        for ( uint32_t k = 0; k < 3; ++k ) {
+            const Vec3x4 n  = cornerVertices[ k ].normal;
+            const Vec3x4 t  = Normalize( Project( triangleOs, n ) );
+            const Vec3x4 v1 = Normalize( Project( Sub( p[ ( k + 2 ) % 3 ], p[ k ] ), n ) );
+            const Vec3x4 v2 = Normalize( Project( Sub( p[ ( k + 1 ) % 3 ], p[ k ] ), n ) );
+
+            const __m128 cosine       = _mm_max_ps( _mm_set1_ps( -1.0f ), _mm_min_ps( _mm_set1_ps( 1.0f ), Dot( v1, v2 ) ) );
+            const Vec3x4 contribution = Scale( t, Acos( cosine ) );
+
+            const uint32_t corner = k * corners.triangleCount + firstTriangle;
+            if ( laneCount == 4 ) {
+                _mm_storeu_ps( corners.x.data( ) + corner, contribution.x );
+                _mm_storeu_ps( corners.y.data( ) + corner, contribution.y );
+                _mm_storeu_ps( corners.z.data( ) + corner, contribution.z );
+            } else {
+                float x[ 4 ], y[ 4 ], z[ 4 ];
+                _mm_storeu_ps( x, contribution.x );
+                _mm_storeu_ps( y, contribution.y );
+                _mm_storeu_ps( z, contribution.z );
+                std::copy( x, x + laneCount, corners.x.data( ) + corner );
+                std::copy( y, y + laneCount, corners.y.data( ) + corner );
+                std::copy( z, z + laneCount, corners.z.data( ) + corner );
+            }
+        }
+
+        for ( uint32_t lane = 0; lane < laneCount; ++lane ) {
+            corners.triangleFlags[ firstTriangle + lane ] = ( ( contributesMask >> lane ) & 1 ? kTriangleContributes : 0 ) |
+                                                            ( ( orientationMask >> lane ) & 1 ? 0 : kTriangleReversing );
+        }
+    }
+
+    /**
+     * Returns the unit vector orthogonal to the normal (for the vertices without contributing triangles).
+     **/
+    mathfu::vec3 GetOrthogonal( const mathfu::vec3 n ) {
+        const mathfu::vec3 axis = fabsf( n.x ) < 0.9f ? mathfu::kAxisX3f : mathfu::kAxisY3f;
+        const mathfu::vec3 t    = axis - n * mathfu::dot( n, axis );
+        return t.LengthSquared( ) > 0 ? mathfu::normalize( t ) : mathfu::kAxisX3f;
+    }
+}
+
+/**
+ * Generates the tangents of the welded vertices (see the comment above).
+ * The vertices used by the triangles with the opposite texcoord orientations are split, the split vertices are appended
+ * and the indices are remapped.
+ * Can be used in multiple threads.
+ * @param indices The subset indices (the welded vertices).
+ * @param vertexCount The welded vertex count.
+ * @return The vertex count after splitting.
+ **/
+uint32_t GenerateTangents( apemode::Mesh& m, std::vector< uint32_t >& indices, uint32_t vertexCount, const char* meshName ) {
+    FBXP_PROFILE_ZONE( "Generate tangents" );
+    const apemode::ArenaScope arenaScope( "Generate tangents" );
+    auto& s = apemode::Get( );
+
+    const auto startTime = std::chrono::steady_clock::now( );
+
+    const uint32_t triangleCount = (uint32_t) ( indices.size( ) / 3 );
+    const uint32_t groupCount    = vertexCount * 2;
+
+    float* vertices = reinterpret_cast< float* >( m.vertices.data( ) );
+
+    //
+    // Corner contributions.
+    //
+
+    CornerStreams corners;
+    corners.triangleCount = triangleCount;
+    corners.x.resize( triangleCount * 3 );
+    corners.y.resize( triangleCount * 3 );
+    corners.z.resize( triangleCount * 3 );
+    corners.triangleFlags.resize( triangleCount );
+
+    apemode::ParallelFor( *s.jobs, ( triangleCount + kChunkTriangleCount - 1 ) / kChunkTriangleCount, [&]( uint32_t chunk ) {
+        const uint32_t lastTriangle = std::min( triangleCount, ( chunk + 1 ) * kChunkTriangleCount );
+        for ( uint32_t t = chunk * kChunkTriangleCount; t < lastTriangle; t += 4 )
+            EvaluateTriangles( vertices, indices.data( ), t, std::min( 4u, lastTriangle - t ), corners );
+    } );
+
+    //
+    // Sort the corners by group (counting sort, the corners keep their order).
+    //
+
+    // The group is vertex * 2 (+ 1 for the orientation-reversing triangles).
+    auto getCornerGroup = [&]( uint32_t t, uint32_t k ) {
+        const uint8_t flags = corners.triangleFlags[ t ];
+        return flags & kTriangleContributes ? indices[ t * 3 + k ] * 2 + ( flags & kTriangleReversing ? 1 : 0 ) : kNoGroup;
+    };
+
+    apemode::ArenaVector< uint32_t > groupOffsets( groupCount + 1, 0 );
+    for ( uint32_t t = 0; t < triangleCount; ++t )
+        for ( uint32_t k = 0; k < 3; ++k )
+            if ( corners.triangleFlags[ t ] & kTriangleContributes )
+                ++groupOffsets[ getCornerGroup( t, k ) + 1 ];
+
+    std::partial_sum( groupOffsets.begin( ), groupOffsets.end( ), groupOffsets.begin( ) );
+
+    apemode::ArenaVector< uint32_t > groupCorners( groupOffsets.back( ) );
+    {
+        apemode::ArenaVector< uint32_t > cursors( groupOffsets.begin( ), groupOffsets.end( ) - 1 );
+        for ( uint32_t t = 0; t < triangleCount; ++t )
+            for ( uint32_t k = 0; k < 3; ++k )
+                if ( corners.triangleFlags[ t ] & kTriangleContributes )
+                    groupCorners[ cursors[ getCornerGroup( t, k ) ]++ ] = k * triangleCount + t;
+    }
+
+    //
+    // The vertex of every group: the orientation-preserving group keeps the vertex, the orientation-reversing one
+    // gets the appended vertex if the vertex has both.
+    //
+
+    auto isGroupEmpty = [&]( uint32_t group ) { return groupOffsets[ group ] == groupOffsets[ group + 1 ]; };
+
+    // The group that the vertex keeps (the vertex without the groups keeps the empty orientation-preserving one).
+    auto getVertexGroup = [&]( uint32_t i ) { return isGroupEmpty( i * 2 ) && false == isGroupEmpty( i * 2 + 1 ) ? i * 2 + 1 : i * 2; };
+
+    apemode::ArenaVector< uint32_t > groupVertices( groupCount );
+    uint32_t splitVertexCount = vertexCount;
+    for ( uint32_t i = 0; i < vertexCount; ++i ) {
+        groupVertices[ i * 2 + 0 ] = i;
+        groupVertices[ i * 2 + 1 ] = isGroupEmpty( i * 2 ) || isGroupEmpty( i * 2 + 1 ) ? i : splitVertexCount++;
+    }
+
+    m.vertices.resize( splitVertexCount * kVertexFloatCount * sizeof( float ) );
+    vertices = reinterpret_cast< float* >( m.vertices.data( ) );
+
+    for ( uint32_t i = 0; i < vertexCount; ++i ) {
+        if ( groupVertices[ i * 2 + 1 ] != i )
+            memcpy( vertices + groupVertices[ i * 2 + 1 ] * kVertexFloatCount, vertices + i * kVertexFloatCount, kVertexFloatCount * sizeof( float ) );
+    }
+
+    //
+    // Reduce the groups and write the tangents (the vertices without the groups get the orthogonal tangents).
+    //
+
+    apemode::ParallelFor( *s.jobs, ( vertexCount + kChunkVertexCount - 1 ) / kChunkVertexCount, [&]( uint32_t chunk ) {
+        for ( uint32_t i = chunk * kChunkVertexCount; i < std::min( vertexCount, ( chunk + 1 ) * kChunkVertexCount ); ++i ) {
+            const mathfu::vec3 n( vertices + i * kVertexFloatCount + kNormalOffset );
+
+            for ( uint32_t group = i * 2; group < i * 2 + 2; ++group ) {
+                if ( isGroupEmpty( group ) && group != getVertexGroup( i ) )
+                    continue;
+
+                mathfu::vec3 t = mathfu::kZeros3f;
+                for ( uint32_t j = groupOffsets[ group ]; j < groupOffsets[ group + 1 ]; ++j ) {
+                    const uint32_t corner = groupCorners[ j ];
+                    t += mathfu::vec3( corners.x[ corner ], corners.y[ corner ], corners.z[ corner ] );
+                }
+
+                const float length = t.Length( );
+                t = length > std::numeric_limits< float >::min( ) ? t / length : GetOrthogonal( n );
+
+                float* tangent = vertices + groupVertices[ group ] * kVertexFloatCount + kTangentOffset;
+                tangent[ 0 ] = t.x;
+                tangent[ 1 ] = t.y;
+                tangent[ 2 ] = t.z;
+                tangent[ 3 ] = group & 1 ? -1.0f : 1.0f;
+            }
+        }
+    } );
+
+    //
+    // Remap the indices, the corners of the triangles that do not contribute use the existing group of the vertex.
+    //
+
+    apemode::ParallelFor( *s.jobs, ( triangleCount + kChunkTriangleCount - 1 ) / kChunkTriangleCount, [&]( uint32_t chunk ) {
+        for ( uint32_t t = chunk * kChunkTriangleCount; t < std::min( triangleCount, ( chunk + 1 ) * kChunkTriangleCount ); ++t ) {
+            for ( uint32_t k = 0; k < 3; ++k ) {
+                const uint32_t group = getCornerGroup( t, k );
+                indices[ t * 3 + k ] = groupVertices[ group != kNoGroup ? group : getVertexGroup( indices[ t * 3 + k ] ) ];
+            }
+        }
+    } );
+
+    const uint64_t microseconds = std::chrono::duration_cast< std::chrono::microseconds >( std::chrono::steady_clock::now( ) - startTime ).count( );
+
+    tangentTriangleCount += triangleCount;
+    tangentSplitVertexCount += splitVertexCount - vertexCount;
+    tangentMicroseconds += microseconds;
+
+    s.console->info( "Mesh \"{}\" has {} vertices after tangent generation ({} split by mirrored texcoords, {:.3f} ms).",
+                     meshName,
+                     splitVertexCount,
+                     splitVertexCount - vertexCount,
+                     microseconds * 0.001 );
+
+    return splitVertexCount;
+}
+
+/**
+ * Prints the tangent generation throughput of all the meshes (since the last call).
+ **/
+void LogTangentStats( ) {
+    const uint64_t triangles    = tangentTriangleCount.exchange( 0 );
+    const uint64_t splits       = tangentSplitVertexCount.exchange( 0 );
+    const uint64_t microseconds = tangentMicroseconds.exchange( 0 );
+
+    if ( triangles ) {
+        apemode::Get( ).console->info( "Tangents: {} triangle(s), {} split vertices, {:.1f} ms per million triangles.",
+                                       triangles,
+                                       splits,
+                                       microseconds * 1000.0 / triangles );
+    }
+}
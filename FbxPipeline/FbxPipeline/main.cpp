@@ -4,9 +4,15 @@
 void ExportScene( FbxScene* pScene );
 void ConvertScene( FbxManager* lSdkManager, FbxScene* lScene, FbxString lFilePath );
 
+// See implementation in fbxpbatch.cpp.
+int RunBatch( std::vector< std::string > const& args, bool convert );
+
 int main( int argc, char** argv ) {
     auto& s = apemode::Get( );
 
+    // The parser removes the recognized arguments, the batch processes need the original ones.
+    const std::vector< std::string > args( argv, argv + argc );
+
     bool convert = false;
 
     try {
@@ -17,18 +23,15 @@ int main( int argc, char** argv ) {
         std::exit( 1 );
     }
 
-    if ( s.Initialize( ) ) {
-        if ( s.Load( ) ) {
-            if ( convert )
-                ConvertScene( s.manager, s.scene, s.options[ "i" ].as< std::string >( ).c_str( ) );
-            else {
-                ExportScene( s.scene );
-                s.Finish( );
-            }
-        }
-    }
+    s.InitializeConsole( );
+
+    FBXP_PROFILE_INITIALIZE( );
+    const int result = RunBatch( args, convert );
+    FBXP_PROFILE_FINISH( );
 
-    return 0;
+    // The console is asynchronous, write the queued messages before exit.
+    s.console->flush( );
+    return result;
 }
 
 void ConvertScene( FbxManager* lSdkManager, FbxScene* lScene, FbxString lFilePath ) {
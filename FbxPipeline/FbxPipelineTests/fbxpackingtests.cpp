@@ -0,0 +1,219 @@
+#include <fbxppch.h>
+#include <fbxpstate.h>
+#include <fbxptests.h>
+#include <random>
+
+using namespace apemodefb;
+
+//
+// See implementation in fbxpacking.cpp and fbxpackingsimd.cpp.
+//
+
+void PackScalar( const StaticVertexFb* vertices,
+                 PackedVertexFb*       packed,
+                 const uint32_t        vertexCount,
+                 const mathfu::vec3    positionMin,
+                 const mathfu::vec3    positionMax,
+                 const mathfu::vec2    texcoordsMin,
+                 const mathfu::vec2    texcoordsMax );
+
+void PackOctahedral( const StaticVertexFb*     vertices,
+                     PackedOctahedralVertexFb* packed,
+                     const uint32_t            vertexCount,
+                     const mathfu::vec3        positionMin,
+                     const mathfu::vec3        positionMax,
+                     const mathfu::vec2        texcoordsMin,
+                     const mathfu::vec2        texcoordsMax,
+                     const char*               meshName );
+
+mathfu::vec3 UnpackNormal_Oct_11_11( const uint32_t bits );
+mathfu::vec3 UnpackTangent_Angle_12( const uint32_t bits, const mathfu::vec3 normal );
+uint32_t     PackNormal_10_10_10_2( const mathfu::vec3 normal );
+mathfu::vec3 UnpackNormal_10_10_10_2( const uint32_t bits );
+
+const char* GetPackSimdName( );
+uint32_t    PackSimd( const StaticVertexFb* vertices,
+                      PackedVertexFb*       packed,
+                      const uint32_t        vertexCount,
+                      const mathfu::vec3    positionMin,
+                      const mathfu::vec3    positionMax,
+                      const mathfu::vec2    texcoordsMin,
+                      const mathfu::vec2    texcoordsMax );
+
+namespace {
+    mathfu::vec3 Normalize( const mathfu::vec3 v ) {
+        const float invLength = 1.0f / sqrtf( v.x * v.x + v.y * v.y + v.z * v.z );
+        return mathfu::vec3( v.x * invLength, v.y * invLength, v.z * invLength );
+    }
+
+    /**
+     * The random vertices within the bounds, every 16th vertex is on the bounds,
+     * every 32nd vertex has the zero normal and tangent (the degenerate triangles).
+     **/
+    std::vector< StaticVertexFb > CreateVertices( uint32_t vertexCount, mathfu::vec3 positionMin, mathfu::vec3 positionMax, mathfu::vec2 texcoordsMin, mathfu::vec2 texcoordsMax ) {
+        std::mt19937 random( 17 );
+        std::uniform_real_distribution< float > unit( 0.0f, 1.0f );
+        std::uniform_real_distribution< float > direction( -1.0f, 1.0f );
+
+        std::vector< StaticVertexFb > vertices( vertexCount );
+        for ( uint32_t i = 0; i < vertexCount; ++i ) {
+            const bool  bounds = ( i % 16 ) == 0;
+            const float t      = bounds ? float( i / 16 % 2 ) : unit( random );
+            const float u      = bounds ? float( i / 32 % 2 ) : unit( random );
+
+            const vec3 position( positionMin.x + ( positionMax.x - positionMin.x ) * t,
+                                 positionMin.y + ( positionMax.y - positionMin.y ) * u,
+                                 positionMin.z + ( positionMax.z - positionMin.z ) * unit( random ) );
+            const vec2 texcoords( texcoordsMin.x + ( texcoordsMax.x - texcoordsMin.x ) * u, texcoordsMin.y + ( texcoordsMax.y - texcoordsMin.y ) * t );
+
+            if ( ( i % 32 ) == 1 ) {
+                vertices[ i ] = StaticVertexFb( position, vec3( 0, 0, 0 ), vec4( 0, 0, 0, 1 ), texcoords );
+            } else {
+                vertices[ i ] = StaticVertexFb( position,
+                                                vec3( direction( random ), direction( random ), direction( random ) ),
+                                                vec4( direction( random ), direction( random ), direction( random ), i % 2 ? 1.0f : -1.0f ),
+                                                texcoords );
+            }
+        }
+
+        return vertices;
+    }
+
+    /**
+     * @return The index of the first vertex the SIMD path packs differently from the scalar path, or the vertex count.
+     **/
+    uint32_t FindSimdMismatch( uint32_t vertexCount, mathfu::vec3 positionMin, mathfu::vec3 positionMax, mathfu::vec2 texcoordsMin, mathfu::vec2 texcoordsMax ) {
+        const std::vector< StaticVertexFb > vertices = CreateVertices( vertexCount, positionMin, positionMax, texcoordsMin, texcoordsMax );
+
+        std::vector< PackedVertexFb > reference( vertexCount );
+        std::vector< PackedVertexFb > packed( vertexCount );
+        PackScalar( vertices.data( ), reference.data( ), vertexCount, positionMin, positionMax, texcoordsMin, texcoordsMax );
+
+        const uint32_t simdCount = PackSimd( vertices.data( ), packed.data( ), vertexCount, positionMin, positionMax, texcoordsMin, texcoordsMax );
+        for ( uint32_t i = 0; i < simdCount; ++i )
+            if ( 0 != memcmp( &reference[ i ], &packed[ i ], sizeof( PackedVertexFb ) ) )
+                return i;
+
+        return vertexCount;
+    }
+}
+
+/**
+ * The kernel of the current CPU must match the scalar path bit by bit
+ * (the scalar path must not be contracted to FMA by the compiler, /fp:precise does not do it).
+ **/
+FBXP_TEST( PackSimdMatchesScalar ) {
+    auto& s = apemode::Get( );
+    s.console->info( "SIMD path: {}.", GetPackSimdName( ) );
+
+    // The vertex count is not a multiple of the kernel width.
+    const uint32_t kVertexCount = 100003;
+    FBXP_CHECK( kVertexCount == FindSimdMismatch( kVertexCount, mathfu::vec3( -3, -2, -1 ), mathfu::vec3( 1, 2, 3 ), mathfu::vec2( 0, 0 ), mathfu::vec2( 1, 1 ) ) );
+    FBXP_CHECK( kVertexCount == FindSimdMismatch( kVertexCount, mathfu::vec3( -1e4f, 0, 5 ), mathfu::vec3( 1e4f, 1e-3f, 7 ), mathfu::vec2( -4, -2 ), mathfu::vec2( 8, -1 ) ) );
+
+    // The flat mesh (the zero bounds size), the packed positions are not defined, but must be the same.
+    FBXP_CHECK( kVertexCount == FindSimdMismatch( kVertexCount, mathfu::vec3( -1, -1, 0.5f ), mathfu::vec3( 1, 1, 0.5f ), mathfu::vec2( 0, 0 ), mathfu::vec2( 1, 1 ) ) );
+}
+
+/**
+ * Decodes the octahedral vertices (see PackedOctahedralVertexFb) and compares the normal and tangent errors
+ * to the 10-10-10 ones, both the mean and the max errors must not be larger.
+ **/
+FBXP_TEST( PackOctahedralErrorWithin10_10_10 ) {
+    auto& s = apemode::Get( );
+
+    const uint32_t     kVertexCount = 200000;
+    const mathfu::vec3 positionMin( -1, -1, -1 );
+    const mathfu::vec3 positionMax( 1, 1, 1 );
+    const mathfu::vec2 texcoordsMin( 0, 0 );
+    const mathfu::vec2 texcoordsMax( 1, 1 );
+
+    std::mt19937 random( 5 );
+    std::normal_distribution< float > gaussian;
+
+    // The uniformly distributed unit normals and the unit tangents orthogonal to them.
+    std::vector< StaticVertexFb > vertices( kVertexCount );
+    std::vector< mathfu::vec3 >   normals( kVertexCount );
+    std::vector< mathfu::vec3 >   tangents( kVertexCount );
+    for ( uint32_t i = 0; i < kVertexCount; ++i ) {
+        const mathfu::vec3 n = Normalize( mathfu::vec3( gaussian( random ), gaussian( random ), gaussian( random ) ) );
+        const mathfu::vec3 t = mathfu::vec3( gaussian( random ), gaussian( random ), gaussian( random ) );
+        const float        d = n.x * t.x + n.y * t.y + n.z * t.z;
+
+        normals[ i ]  = n;
+        tangents[ i ] = Normalize( mathfu::vec3( t.x - n.x * d, t.y - n.y * d, t.z - n.z * d ) );
+        vertices[ i ] = StaticVertexFb( vec3( 0, 0, 0 ), vec3( n.x, n.y, n.z ), vec4( tangents[ i ].x, tangents[ i ].y, tangents[ i ].z, i % 2 ? 1.0f : -1.0f ), vec2( 0.5f, 0.5f ) );
+    }
+
+    std::vector< PackedOctahedralVertexFb > packed( kVertexCount );
+    PackOctahedral( vertices.data( ), packed.data( ), kVertexCount, positionMin, positionMax, texcoordsMin, texcoordsMax, "test" );
+
+    auto getDegrees = []( const mathfu::vec3 a, const mathfu::vec3 b ) {
+        return acos( std::max( -1.0f, std::min( 1.0f, a.x * b.x + a.y * b.y + a.z * b.z ) ) ) * 180.0 / 3.14159265358979;
+    };
+
+    double normalError = 0, tangentError = 0, normalError10 = 0, tangentError10 = 0;
+    double normalMaxError = 0, tangentMaxError = 0, normalMaxError10 = 0, tangentMaxError10 = 0;
+    uint32_t signMismatches = 0;
+
+    for ( uint32_t i = 0; i < kVertexCount; ++i ) {
+        const uint32_t position      = packed[ i ].position( );
+        const uint32_t normalTangent = packed[ i ].normal_tangent( );
+        const uint32_t uv            = packed[ i ].uv( );
+        const uint32_t tangentBits   = ( ( position >> 30 ) & 1 ) | ( ( normalTangent >> 22 ) << 1 ) | ( ( uv >> 31 ) << 11 );
+
+        const mathfu::vec3 normal  = UnpackNormal_Oct_11_11( normalTangent & 0x3fffff );
+        const mathfu::vec3 tangent = UnpackTangent_Angle_12( tangentBits, normal );
+
+        const double errors[] = {getDegrees( normals[ i ], normal ),
+                                 getDegrees( tangents[ i ], tangent ),
+                                 getDegrees( normals[ i ], UnpackNormal_10_10_10_2( PackNormal_10_10_10_2( normals[ i ] ) ) ),
+                                 getDegrees( tangents[ i ], UnpackNormal_10_10_10_2( PackNormal_10_10_10_2( tangents[ i ] ) ) )};
+
+        normalError += errors[ 0 ], normalMaxError = std::max( normalMaxError, errors[ 0 ] );
+        tangentError += errors[ 1 ], tangentMaxError = std::max( tangentMaxError, errors[ 1 ] );
+        normalError10 += errors[ 2 ], normalMaxError10 = std::max( normalMaxError10, errors[ 2 ] );
+        tangentError10 += errors[ 3 ], tangentMaxError10 = std::max( tangentMaxError10, errors[ 3 ] );
+        signMismatches += ( position >> 31 ) != ( i % 2 ) ? 1 : 0;
+    }
+
+    s.console->info( "Normal error: mean {:.4f}, max {:.4f} degrees (10-10-10: mean {:.4f}, max {:.4f}).",
+                     normalError / kVertexCount, normalMaxError, normalError10 / kVertexCount, normalMaxError10 );
+    s.console->info( "Tangent error: mean {:.4f}, max {:.4f} degrees (10-10-10: mean {:.4f}, max {:.4f}).",
+                     tangentError / kVertexCount, tangentMaxError, tangentError10 / kVertexCount, tangentMaxError10 );
+
+    FBXP_CHECK( normalError <= normalError10 );
+    FBXP_CHECK( normalMaxError <= normalMaxError10 );
+    FBXP_CHECK( tangentError <= tangentError10 );
+    FBXP_CHECK( tangentMaxError <= tangentMaxError10 );
+    FBXP_CHECK( 0 == signMismatches );
+}
+
+FBXP_BENCHMARK( PackThroughput ) {
+    auto& s = apemode::Get( );
+
+    const uint32_t     kVertexCount = 1000000;
+    const uint32_t     kRunCount    = 10;
+    const mathfu::vec3 positionMin( -3, -2, -1 );
+    const mathfu::vec3 positionMax( 1, 2, 3 );
+    const mathfu::vec2 texcoordsMin( 0, 0 );
+    const mathfu::vec2 texcoordsMax( 1, 1 );
+
+    const std::vector< StaticVertexFb > vertices = CreateVertices( kVertexCount, positionMin, positionMax, texcoordsMin, texcoordsMax );
+    std::vector< PackedVertexFb >       packed( kVertexCount );
+
+    const double scalarTime = apemode::tests::MeasureMilliseconds( kRunCount, [&] {
+        PackScalar( vertices.data( ), packed.data( ), kVertexCount, positionMin, positionMax, texcoordsMin, texcoordsMax );
+    } );
+
+    uint32_t     simdCount = 0;
+    const double simdTime  = apemode::tests::MeasureMilliseconds( kRunCount, [&] {
+        simdCount = PackSimd( vertices.data( ), packed.data( ), kVertexCount, positionMin, positionMax, texcoordsMin, texcoordsMax );
+        PackScalar( vertices.data( ) + simdCount, packed.data( ) + simdCount, kVertexCount - simdCount, positionMin, positionMax, texcoordsMin, texcoordsMax );
+    } );
+
+    s.console->info( "{} vertices, best of {} runs:", kVertexCount, kRunCount );
+    s.console->info( "|Path|Time (ms)|M vertices/s|" );
+    s.console->info( "|scalar|{:.2f}|{:.1f}|", scalarTime, kVertexCount / scalarTime * 1e-3 );
+    s.console->info( "|{}|{:.2f}|{:.1f}|", simdCount ? GetPackSimdName( ) : "scalar", simdTime, kVertexCount / simdTime * 1e-3 );
+}
@@ -0,0 +1,229 @@
+#include <fbxppch.h>
+#include <fbxpstate.h>
+#include <fbxpindexcodec.h>
+#include <fbxptests.h>
+#include <random>
+
+namespace {
+    /**
+     * The grid of quads (two triangles per quad) in the row order, similar to the vertex cache optimized meshes.
+     **/
+    std::vector< uint32_t > CreateGridIndices( uint32_t size, uint32_t baseVertex = 0 ) {
+        std::vector< uint32_t > indices;
+        indices.reserve( size * size * 6 );
+        for ( uint32_t y = 0; y < size; ++y ) {
+            for ( uint32_t x = 0; x < size; ++x ) {
+                const uint32_t v = baseVertex + y * ( size + 1 ) + x;
+                indices.insert( indices.end( ), {v, v + size + 1, v + 1, v + 1, v + size + 1, v + size + 2} );
+            }
+        }
+
+        return indices;
+    }
+
+    /**
+     * The random triangles, nothing to predict.
+     **/
+    std::vector< uint32_t > CreateRandomIndices( uint32_t triangleCount, uint32_t vertexCount ) {
+        std::mt19937 random( 11 );
+        std::vector< uint32_t > indices( triangleCount * 3 );
+        for ( auto& index : indices )
+            index = random( ) % vertexCount;
+
+        return indices;
+    }
+
+    /**
+     * The decoded triangles can be rotated (the winding is preserved).
+     **/
+    template < typename TIndex >
+    bool AreTrianglesEqual( std::vector< TIndex > const& a, std::vector< uint32_t > const& b ) {
+        if ( a.size( ) != b.size( ) )
+            return false;
+
+        for ( size_t i = 0; i < a.size( ); i += 3 ) {
+            const bool equal = ( a[ i ] == b[ i + 0 ] && a[ i + 1 ] == b[ i + 1 ] && a[ i + 2 ] == b[ i + 2 ] ) ||
+                               ( a[ i ] == b[ i + 1 ] && a[ i + 1 ] == b[ i + 2 ] && a[ i + 2 ] == b[ i + 0 ] ) ||
+                               ( a[ i ] == b[ i + 2 ] && a[ i + 1 ] == b[ i + 0 ] && a[ i + 2 ] == b[ i + 1 ] );
+            if ( false == equal )
+                return false;
+        }
+
+        return true;
+    }
+
+    template < typename TIndex >
+    std::vector< uint8_t > Encode( std::vector< uint32_t > const& indices ) {
+        const std::vector< TIndex > sourceIndices( indices.begin( ), indices.end( ) );
+
+        std::vector< uint8_t > encoded;
+        apemode::EncodeIndices( sourceIndices.data( ), sourceIndices.size( ), encoded );
+        return encoded;
+    }
+
+    /**
+     * @return True if the encoded data is decoded (the index count is read from it).
+     **/
+    template < typename TIndex >
+    bool Decode( const uint8_t* encoded, size_t encodedSize, std::vector< TIndex >& decoded ) {
+        size_t indexCount = 0;
+        if ( !apemode::GetEncodedIndexCount( encoded, encodedSize, indexCount ) || indexCount > ( 1 << 24 ) )
+            return false;
+
+        decoded.resize( indexCount );
+        return apemode::DecodeIndices( encoded, encodedSize, decoded.data( ), indexCount );
+    }
+
+    template < typename TIndex >
+    bool RoundTrip( std::vector< uint32_t > const& indices ) {
+        const std::vector< uint8_t > encoded = Encode< TIndex >( indices );
+
+        std::vector< TIndex > decoded;
+        return Decode( encoded.data( ), encoded.size( ), decoded ) && AreTrianglesEqual( decoded, indices );
+    }
+}
+
+FBXP_TEST( IndexCodecRoundTrip ) {
+    FBXP_CHECK( RoundTrip< uint16_t >( {} ) );
+    FBXP_CHECK( RoundTrip< uint32_t >( {} ) );
+
+    FBXP_CHECK( RoundTrip< uint16_t >( {0, 1, 2} ) );
+    FBXP_CHECK( RoundTrip< uint16_t >( {0, 0, 0, 5, 5, 1} ) ); // The degenerate triangles.
+    FBXP_CHECK( RoundTrip< uint16_t >( CreateGridIndices( 100 ) ) );
+    FBXP_CHECK( RoundTrip< uint16_t >( CreateRandomIndices( 10000, 65536 ) ) );
+    FBXP_CHECK( RoundTrip< uint16_t >( {65535, 0, 65534, 0, 65535, 1} ) );
+
+    FBXP_CHECK( RoundTrip< uint32_t >( CreateGridIndices( 300 ) ) );
+    FBXP_CHECK( RoundTrip< uint32_t >( CreateGridIndices( 50, 4000000000u ) ) );
+    FBXP_CHECK( RoundTrip< uint32_t >( CreateRandomIndices( 10000, 1 << 24 ) ) );
+    FBXP_CHECK( RoundTrip< uint32_t >( {0xffffffff, 0, 0x80000000, 0x7fffffff, 0xffffffff, 1} ) );
+}
+
+FBXP_TEST( IndexCodecRejectsTruncatedStreams ) {
+    const std::vector< uint8_t > encoded = Encode< uint32_t >( CreateGridIndices( 20 ) );
+
+    // Every section stores its size, so any missing byte is detected.
+    uint32_t decodedCount = 0;
+    for ( size_t size = 0; size < encoded.size( ); ++size ) {
+        std::vector< uint32_t > decoded;
+        if ( Decode( encoded.data( ), size, decoded ) )
+            ++decodedCount;
+    }
+
+    FBXP_CHECK( 0 == decodedCount );
+}
+
+FBXP_TEST( IndexCodecRejectsCorruptedStreams ) {
+    using namespace apemode::details;
+
+    // The index count does not match the expected one.
+    {
+        const std::vector< uint8_t > encoded = Encode< uint16_t >( CreateGridIndices( 10 ) );
+        std::vector< uint16_t > decoded( 6 );
+        FBXP_CHECK( false == apemode::DecodeIndices( encoded.data( ), encoded.size( ), decoded.data( ), decoded.size( ) ) );
+    }
+
+    // The symbol is listed twice (the frequencies still sum up to the rANS scale).
+    {
+        std::vector< uint8_t > encoded = {kIndexCodecVersion};
+        WriteVarint( encoded, 3 );
+        encoded.insert( encoded.end( ), {1, 1, 2, kIndexCodecCodeNext3} );
+        WriteVarint( encoded, kRansScale / 2 );
+        encoded.push_back( kIndexCodecCodeNext3 );
+        WriteVarint( encoded, kRansScale / 2 );
+        encoded.insert( encoded.end( ), {4, 0x80, 0, 0, 0} );
+        encoded.insert( encoded.end( ), {0, 0, 0} );
+
+        std::vector< uint16_t > decoded;
+        FBXP_CHECK( false == Decode( encoded.data( ), encoded.size( ), decoded ) );
+    }
+
+    // The section size is far larger than the index count allows (must be rejected before the allocation).
+    {
+        std::vector< uint8_t > encoded = {kIndexCodecVersion};
+        WriteVarint( encoded, 3 );
+        encoded.push_back( 1 );
+        WriteVarint( encoded, uint64_t( 1 ) << 40 );
+        encoded.insert( encoded.end( ), {1, kIndexCodecCodeNext3} );
+        WriteVarint( encoded, kRansScale );
+        encoded.insert( encoded.end( ), {4, 0x80, 0, 0, 0} );
+        encoded.insert( encoded.end( ), {0, 0, 0} );
+
+        std::vector< uint16_t > decoded;
+        FBXP_CHECK( false == Decode( encoded.data( ), encoded.size( ), decoded ) );
+    }
+
+    // The vertex does not fit into 16 bits.
+    {
+        const std::vector< uint8_t > encoded = Encode< uint32_t >( {70000, 0, 1} );
+        std::vector< uint16_t > decoded;
+        FBXP_CHECK( false == Decode( encoded.data( ), encoded.size( ), decoded ) );
+    }
+
+    // The random byte changes must not crash the decoder (some of them are still valid streams).
+    {
+        const std::vector< uint8_t > source = Encode< uint32_t >( CreateGridIndices( 30 ) );
+        std::mt19937 random( 3 );
+
+        for ( uint32_t i = 0; i < 10000; ++i ) {
+            std::vector< uint8_t > encoded = source;
+            for ( uint32_t j = 0; j < 1 + i % 4; ++j )
+                encoded[ random( ) % encoded.size( ) ] ^= uint8_t( 1 + random( ) % 255 );
+
+            std::vector< uint32_t > decoded32;
+            std::vector< uint16_t > decoded16;
+            Decode( encoded.data( ), encoded.size( ), decoded32 );
+            Decode( encoded.data( ), encoded.size( ), decoded16 );
+        }
+    }
+}
+
+/**
+ * Encodes and decodes the grid (~1M triangles) and the random triangles,
+ * the decoding is compared to copying the uncompressed indices.
+ **/
+FBXP_BENCHMARK( IndexCodecThroughput ) {
+    auto& s = apemode::Get( );
+
+    const uint32_t kRunCount = 5;
+
+    struct {
+        const char*             name;
+        std::vector< uint32_t > indices;
+    } meshes[] = {{"grid", CreateGridIndices( 700 )}, {"random", CreateRandomIndices( 980000, 500000 )}};
+
+    s.console->info( "Best of {} runs:", kRunCount );
+    s.console->info( "|Mesh|Triangles|Bits per triangle|Encoding (ms)|Decoding (ms)|Decoding (M triangles/s)|Copying (ms)|" );
+
+    for ( auto& mesh : meshes ) {
+        const size_t triangleCount = mesh.indices.size( ) / 3;
+
+        std::vector< uint8_t > encoded;
+        const double encodeTime = apemode::tests::MeasureMilliseconds( kRunCount, [&] {
+            encoded.clear( );
+            apemode::EncodeIndices( mesh.indices.data( ), mesh.indices.size( ), encoded );
+        } );
+
+        std::vector< uint32_t > decoded( mesh.indices.size( ) );
+        bool roundTrip = true;
+        const double decodeTime = apemode::tests::MeasureMilliseconds( kRunCount, [&] {
+            roundTrip &= apemode::DecodeIndices( encoded.data( ), encoded.size( ), decoded.data( ), decoded.size( ) );
+        } );
+
+        std::vector< uint32_t > copied;
+        const double copyTime = apemode::tests::MeasureMilliseconds( kRunCount, [&] {
+            copied.assign( mesh.indices.begin( ), mesh.indices.end( ) );
+        } );
+
+        FBXP_CHECK( roundTrip && AreTrianglesEqual( decoded, mesh.indices ) );
+
+        s.console->info( "|{}|{}|{:.2f}|{:.2f}|{:.2f}|{:.1f}|{:.2f}|",
+                         mesh.name,
+                         triangleCount,
+                         encoded.size( ) * 8.0 / triangleCount,
+                         encodeTime,
+                         decodeTime,
+                         triangleCount / decodeTime * 1e-3,
+                         copyTime );
+    }
+}
@@ -0,0 +1,43 @@
+#include <fbxppch.h>
+#include <fbxpstate.h>
+#include <fbxpjobs.h>
+#include <fbxptests.h>
+#include <atomic>
+
+namespace {
+    thread_local uint32_t tlsOuterJobDepth = 0;
+}
+
+/**
+ * The nested ParallelFor waits only run the jobs of their own group,
+ * so an outer job never starts inside the wait of another outer job.
+ **/
+FBXP_TEST( JobPoolNestedWaitRunsOnlyItsGroup ) {
+    const uint32_t kOuterCount = 64;
+    const uint32_t kInnerCount = 16;
+
+    for ( uint32_t workerCount : {1u, 2u, 4u} ) {
+        apemode::JobPool pool( workerCount );
+
+        std::atomic< uint32_t > innerRunCount( 0 );
+        std::atomic< uint32_t > maxOuterJobDepth( 0 );
+
+        apemode::ParallelFor( pool, kOuterCount, [&]( uint32_t ) {
+            const uint32_t depth = ++tlsOuterJobDepth;
+
+            uint32_t maxDepth = maxOuterJobDepth;
+            while ( maxDepth < depth && false == maxOuterJobDepth.compare_exchange_weak( maxDepth, depth ) ) {
+            }
+
+            apemode::ParallelFor( pool, kInnerCount, [&]( uint32_t ) {
+                std::this_thread::yield( );
+                ++innerRunCount;
+            } );
+
+            --tlsOuterJobDepth;
+        } );
+
+        FBXP_CHECK( innerRunCount == kOuterCount * kInnerCount );
+        FBXP_CHECK( 1 == maxOuterJobDepth );
+    }
+}
@@ -0,0 +1,107 @@
+#include <fbxppch.h>
+#include <fbxpstate.h>
+#include <fbxpnames.h>
+#include <fbxptests.h>
+#include <city.h>
+#include <map>
+
+namespace {
+    std::vector< std::string > CreateNames( uint32_t nameCount ) {
+        std::vector< std::string > names( nameCount );
+        for ( uint32_t i = 0; i < nameCount; ++i )
+            names[ i ] = "node_" + std::to_string( i ) + "_mesh";
+        return names;
+    }
+
+    uint64_t HashName( std::string const& name ) {
+        return CityHash64( name.data( ), name.size( ) );
+    }
+}
+
+FBXP_TEST( NameTableSortsByHash ) {
+    auto& s = apemode::Get( );
+
+    const std::vector< std::string > names = CreateNames( 10000 );
+
+    apemode::NameTable nameTable;
+    for ( auto& name : names )
+        FBXP_CHECK( apemode::NameTable::ePushResult_Added == nameTable.Push( HashName( name ), name ) );
+
+    FBXP_CHECK( apemode::NameTable::ePushResult_Exists == nameTable.Push( HashName( names[ 0 ] ), names[ 0 ] ) );
+    FBXP_CHECK( apemode::NameTable::ePushResult_Collision == nameTable.Push( HashName( names[ 0 ] ), names[ 1 ] ) );
+    FBXP_CHECK( nameTable.GetSize( ) == names.size( ) );
+
+    nameTable.Sort( *s.jobs );
+
+    std::map< uint64_t, std::string > expectedNames;
+    for ( auto& name : names )
+        expectedNames.insert( std::make_pair( HashName( name ), name ) );
+
+    auto expectedName = expectedNames.begin( );
+    nameTable.ForEach( [&]( const apemode::NameTable::Entry& entry ) {
+        FBXP_CHECK( expectedName != expectedNames.end( ) && expectedName->first == entry.hash && expectedName->second == entry.value );
+        if ( expectedName != expectedNames.end( ) )
+            ++expectedName;
+    } );
+
+    FBXP_CHECK( expectedName == expectedNames.end( ) );
+}
+
+/**
+ * Interns one million names (a third of them are pushed twice, as the shared material and mesh names are)
+ * to the name table from the job pool workers and to the std::map the state used before (single thread),
+ * and sorts them by hash (the name table sorts the shards, the map is already sorted).
+ **/
+FBXP_BENCHMARK( NameTableVsMap ) {
+    auto& s = apemode::Get( );
+
+    const uint32_t                   kNameCount = 1000000;
+    const uint32_t                   kRunCount  = 5;
+    const std::vector< std::string > names      = CreateNames( kNameCount );
+
+    std::vector< uint32_t > pushes( kNameCount + kNameCount / 3 );
+    for ( uint32_t i = 0; i < (uint32_t) pushes.size( ); ++i )
+        pushes[ i ] = i < kNameCount ? i : ( i - kNameCount ) * 3;
+
+    size_t mapSize = 0;
+    const double mapTime = apemode::tests::MeasureMilliseconds( kRunCount, [&] {
+        std::map< uint64_t, std::string > nameMap;
+        for ( uint32_t nameId : pushes )
+            nameMap.insert( std::make_pair( HashName( names[ nameId ] ), names[ nameId ] ) );
+        mapSize = nameMap.size( );
+    } );
+
+    size_t serialSize = 0;
+    const double serialTime = apemode::tests::MeasureMilliseconds( kRunCount, [&] {
+        std::unique_ptr< apemode::NameTable > nameTable( new apemode::NameTable( ) );
+        for ( uint32_t nameId : pushes )
+            nameTable->Push( HashName( names[ nameId ] ), names[ nameId ] );
+        nameTable->Sort( *s.jobs );
+        serialSize = nameTable->GetSize( );
+    } );
+
+    // The pushes are split into the chunks, a job per name would measure the job pool.
+    const uint32_t kChunkSize  = 4096;
+    const uint32_t chunkCount  = ( (uint32_t) pushes.size( ) + kChunkSize - 1 ) / kChunkSize;
+    size_t         parallelSize = 0;
+    const double parallelTime = apemode::tests::MeasureMilliseconds( kRunCount, [&] {
+        std::unique_ptr< apemode::NameTable > nameTable( new apemode::NameTable( ) );
+        apemode::ParallelFor( *s.jobs, chunkCount, [&]( uint32_t chunkId ) {
+            const uint32_t pushEnd = std::min( (uint32_t) pushes.size( ), ( chunkId + 1 ) * kChunkSize );
+            for ( uint32_t i = chunkId * kChunkSize; i < pushEnd; ++i )
+                nameTable->Push( HashName( names[ pushes[ i ] ] ), names[ pushes[ i ] ] );
+        } );
+        nameTable->Sort( *s.jobs );
+        parallelSize = nameTable->GetSize( );
+    } );
+
+    FBXP_CHECK( mapSize == kNameCount );
+    FBXP_CHECK( serialSize == kNameCount );
+    FBXP_CHECK( parallelSize == kNameCount );
+
+    s.console->info( "{} names ({} pushes), best of {} runs, {} worker(s):", kNameCount, pushes.size( ), kRunCount, s.jobs->GetWorkerCount( ) );
+    s.console->info( "|Container|Time (ms)|" );
+    s.console->info( "|std::map|{:.1f}|", mapTime );
+    s.console->info( "|NameTable (1 thread)|{:.1f}|", serialTime );
+    s.console->info( "|NameTable (job pool)|{:.1f}|", parallelTime );
+}
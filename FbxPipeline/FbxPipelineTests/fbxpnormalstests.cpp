@@ -0,0 +1,246 @@
+#include <fbxppch.h>
+#include <fbxpstate.h>
+#include <fbxptests.h>
+
+//
+// See implementation in fbxpnormals.cpp.
+//
+
+void CalculateSmoothNormals( const float*    positions,
+                             float*          normals,
+                             uint32_t        vertexStride,
+                             const uint32_t* controlPointIndices,
+                             uint32_t        vertexCount,
+                             uint32_t        controlPointCount,
+                             const int*      smoothingGroups,
+                             float           creaseAngle,
+                             bool            areaWeighted );
+
+//
+// See implementation in fbxpmeshopt.cpp.
+//
+
+uint32_t WeldVertices( std::vector< uint8_t >& vertices, uint32_t vertexCount, uint32_t vertexStride, float epsilon, std::vector< uint32_t >& remap );
+
+namespace {
+    /**
+     * The vertex of the pipeline before the packing (see StaticVertex in fbxpmesh.cpp).
+     **/
+    struct StaticVertex {
+        float position[ 3 ];
+        float normal[ 3 ];
+        float tangent[ 4 ];
+        float texCoords[ 2 ];
+    };
+
+    /**
+     * The triangles (3 vertices per triangle) that share the control points, like the polygon vertices of FbxMesh.
+     **/
+    struct TestMesh {
+        std::vector< mathfu::vec3 > controlPoints;
+        std::vector< uint32_t >     controlPointIndices;
+        std::vector< int >          smoothingGroups;
+
+        void AddTriangle( uint32_t a, uint32_t b, uint32_t c ) {
+            controlPointIndices.insert( controlPointIndices.end( ), {a, b, c} );
+        }
+    };
+
+    /**
+     * The cube [-1; 1], every face is 2 triangles (the triangles 2 * i and 2 * i + 1 are the face i).
+     * The control point i is at (i & 1, i & 2, i & 4) mapped to [-1; 1].
+     **/
+    TestMesh CreateCube( ) {
+        TestMesh mesh;
+        for ( uint32_t i = 0; i < 8; ++i )
+            mesh.controlPoints.push_back( mathfu::vec3( i & 1 ? 1.0f : -1.0f, i & 2 ? 1.0f : -1.0f, i & 4 ? 1.0f : -1.0f ) );
+
+        // The faces are counter-clockwise from the outside.
+        const uint32_t faces[ 6 ][ 4 ] = {{0, 4, 6, 2}, {1, 3, 7, 5}, {0, 1, 5, 4}, {2, 6, 7, 3}, {0, 2, 3, 1}, {4, 5, 7, 6}};
+        for ( auto& face : faces ) {
+            mesh.AddTriangle( face[ 0 ], face[ 1 ], face[ 2 ] );
+            mesh.AddTriangle( face[ 0 ], face[ 2 ], face[ 3 ] );
+        }
+
+        return mesh;
+    }
+
+    /**
+     * Two unit quads with the shared edge, the second quad is folded by 30 degrees.
+     **/
+    TestMesh CreateFold( ) {
+        const float c = cosf( 3.14159265f / 6 );
+        const float s = sinf( 3.14159265f / 6 );
+
+        TestMesh mesh;
+        mesh.controlPoints = {mathfu::vec3( 0, 0, 0 ),
+                              mathfu::vec3( 1, 0, 0 ),
+                              mathfu::vec3( 0, 1, 0 ),
+                              mathfu::vec3( 1, 1, 0 ),
+                              mathfu::vec3( 0, 1 + c, s ),
+                              mathfu::vec3( 1, 1 + c, s )};
+
+        mesh.AddTriangle( 0, 1, 3 );
+        mesh.AddTriangle( 0, 3, 2 );
+        mesh.AddTriangle( 2, 3, 5 );
+        mesh.AddTriangle( 2, 5, 4 );
+        return mesh;
+    }
+
+    std::vector< StaticVertex > CalculateNormals( TestMesh const& mesh, float creaseAngle, bool areaWeighted ) {
+        std::vector< StaticVertex > vertices( mesh.controlPointIndices.size( ) );
+        for ( size_t i = 0; i < vertices.size( ); ++i ) {
+            const mathfu::vec3 p = mesh.controlPoints[ mesh.controlPointIndices[ i ] ];
+            vertices[ i ]        = StaticVertex{{p.x, p.y, p.z}, {0, 0, 0}, {0, 0, 0, 0}, {0, 0}};
+        }
+
+        CalculateSmoothNormals( vertices[ 0 ].position,
+                                vertices[ 0 ].normal,
+                                (uint32_t) ( sizeof( StaticVertex ) / sizeof( float ) ),
+                                mesh.controlPointIndices.data( ),
+                                (uint32_t) vertices.size( ),
+                                (uint32_t) mesh.controlPoints.size( ),
+                                mesh.smoothingGroups.empty( ) ? nullptr : mesh.smoothingGroups.data( ),
+                                creaseAngle,
+                                areaWeighted );
+        return vertices;
+    }
+
+    /**
+     * @return The vertex count after welding the identical vertices (as the pipeline does it after the normals).
+     **/
+    uint32_t GetWeldedVertexCount( std::vector< StaticVertex > const& vertices ) {
+        std::vector< uint8_t > bytes( reinterpret_cast< const uint8_t* >( vertices.data( ) ),
+                                      reinterpret_cast< const uint8_t* >( vertices.data( ) + vertices.size( ) ) );
+
+        std::vector< uint32_t > remap;
+        return WeldVertices( bytes, (uint32_t) vertices.size( ), (uint32_t) sizeof( StaticVertex ), 0.0f, remap );
+    }
+
+    bool AreNormalsNear( const float* normal, mathfu::vec3 expected, float tolerance = 1e-5f ) {
+        return fabsf( normal[ 0 ] - expected.x ) <= tolerance && fabsf( normal[ 1 ] - expected.y ) <= tolerance &&
+               fabsf( normal[ 2 ] - expected.z ) <= tolerance;
+    }
+
+    /**
+     * @return True if all the vertices of the control point have the expected normal.
+     **/
+    bool AreControlPointNormalsNear( TestMesh const& mesh, std::vector< StaticVertex > const& vertices, uint32_t controlPoint, mathfu::vec3 expected ) {
+        for ( uint32_t i = 0; i < (uint32_t) vertices.size( ); ++i ) {
+            if ( mesh.controlPointIndices[ i ] == controlPoint && !AreNormalsNear( vertices[ i ].normal, expected ) )
+                return false;
+        }
+
+        return true;
+    }
+
+    mathfu::vec3 GetFaceNormal( TestMesh const& mesh, uint32_t triangle ) {
+        const mathfu::vec3 a = mesh.controlPoints[ mesh.controlPointIndices[ triangle * 3 + 0 ] ];
+        const mathfu::vec3 b = mesh.controlPoints[ mesh.controlPointIndices[ triangle * 3 + 1 ] ];
+        const mathfu::vec3 c = mesh.controlPoints[ mesh.controlPointIndices[ triangle * 3 + 2 ] ];
+        const mathfu::vec3 n = mathfu::cross( b - a, c - a );
+        return n / n.Length( );
+    }
+
+    /**
+     * @return True if every vertex normal is the normal of its triangle (no smoothing).
+     **/
+    bool AreFaceNormals( TestMesh const& mesh, std::vector< StaticVertex > const& vertices ) {
+        for ( uint32_t i = 0; i < (uint32_t) vertices.size( ); ++i ) {
+            if ( !AreNormalsNear( vertices[ i ].normal, GetFaceNormal( mesh, i / 3 ) ) )
+                return false;
+        }
+
+        return true;
+    }
+
+    /**
+     * @return True if every vertex normal of the cube points along the diagonal of its corner.
+     **/
+    bool AreCornerNormals( TestMesh const& mesh, std::vector< StaticVertex > const& vertices ) {
+        const float d = 1.0f / sqrtf( 3.0f );
+        for ( uint32_t i = 0; i < (uint32_t) vertices.size( ); ++i ) {
+            const mathfu::vec3 p = mesh.controlPoints[ mesh.controlPointIndices[ i ] ];
+            if ( !AreNormalsNear( vertices[ i ].normal, mathfu::vec3( p.x * d, p.y * d, p.z * d ) ) )
+                return false;
+        }
+
+        return true;
+    }
+}
+
+FBXP_TEST( SmoothNormalsCreaseAngle ) {
+    const TestMesh cube = CreateCube( );
+
+    // The cube faces are at 90 degrees: split by 60 degrees (4 vertices per face), smoothed by 180 degrees (one per corner).
+    const auto creased = CalculateNormals( cube, 60.0f, false );
+    FBXP_CHECK( AreFaceNormals( cube, creased ) );
+    FBXP_CHECK( 24 == GetWeldedVertexCount( creased ) );
+
+    const auto smoothed = CalculateNormals( cube, 180.0f, false );
+    FBXP_CHECK( AreCornerNormals( cube, smoothed ) );
+    FBXP_CHECK( 8 == GetWeldedVertexCount( smoothed ) );
+
+    // The fold of 30 degrees is smoothed by 60 degrees, split by 20 degrees (the 2 vertices of the shared edge).
+    const TestMesh fold = CreateFold( );
+    FBXP_CHECK( 6 == GetWeldedVertexCount( CalculateNormals( fold, 60.0f, false ) ) );
+    FBXP_CHECK( 8 == GetWeldedVertexCount( CalculateNormals( fold, 20.0f, false ) ) );
+    FBXP_CHECK( AreFaceNormals( fold, CalculateNormals( fold, 20.0f, false ) ) );
+}
+
+FBXP_TEST( SmoothNormalsSmoothingGroups ) {
+    TestMesh cube = CreateCube( );
+
+    // The smoothing groups split the faces within the crease angle.
+    cube.smoothingGroups.resize( 12 );
+    for ( uint32_t i = 0; i < 12; ++i )
+        cube.smoothingGroups[ i ] = 1 << ( i / 2 );
+
+    const auto faces = CalculateNormals( cube, 180.0f, false );
+    FBXP_CHECK( AreFaceNormals( cube, faces ) );
+    FBXP_CHECK( 24 == GetWeldedVertexCount( faces ) );
+
+    // The single group smooths the whole cube.
+    std::fill( cube.smoothingGroups.begin( ), cube.smoothingGroups.end( ), 1 );
+
+    const auto smoothed = CalculateNormals( cube, 180.0f, false );
+    FBXP_CHECK( AreCornerNormals( cube, smoothed ) );
+    FBXP_CHECK( 8 == GetWeldedVertexCount( smoothed ) );
+
+    // The top face (+Z, the face 5) in its own group: the top corners are split into the top and the side vertices.
+    cube.smoothingGroups[ 10 ] = cube.smoothingGroups[ 11 ] = 2;
+    FBXP_CHECK( 12 == GetWeldedVertexCount( CalculateNormals( cube, 180.0f, false ) ) );
+
+    // The shared bit joins the groups (3 shares a bit with both 1 and 2).
+    cube.smoothingGroups[ 10 ] = cube.smoothingGroups[ 11 ] = 3;
+    FBXP_CHECK( 8 == GetWeldedVertexCount( CalculateNormals( cube, 180.0f, false ) ) );
+
+    // The crease angle still splits the faces of the same group.
+    std::fill( cube.smoothingGroups.begin( ), cube.smoothingGroups.end( ), 1 );
+    FBXP_CHECK( 24 == GetWeldedVertexCount( CalculateNormals( cube, 60.0f, false ) ) );
+}
+
+FBXP_TEST( SmoothNormalsWeighting ) {
+    const TestMesh cube = CreateCube( );
+
+    // Every cube corner has 90 degrees of every face, the angle weighting does not depend on the triangulation.
+    const auto angleWeighted = CalculateNormals( cube, 180.0f, false );
+    FBXP_CHECK( AreCornerNormals( cube, angleWeighted ) );
+
+    // The corner has 1 or 2 triangles of the face, so the area weighting tilts the corner normals to the faces
+    // with 2 triangles at the corner.
+    const auto areaWeighted = CalculateNormals( cube, 180.0f, true );
+    FBXP_CHECK( false == AreCornerNormals( cube, areaWeighted ) );
+    FBXP_CHECK( 8 == GetWeldedVertexCount( areaWeighted ) );
+
+    // The corner 0 has 2 triangles of every face (-X, -Y and -Z), so it is still the diagonal.
+    const float d = 1.0f / sqrtf( 3.0f );
+    FBXP_CHECK( AreControlPointNormalsNear( cube, areaWeighted, 0, mathfu::vec3( -d, -d, -d ) ) );
+
+    // The corner 2 has 1 triangle of -X, 2 triangles of +Y and 1 triangle of -Z: the normal is (-1, 2, -1) / sqrt( 6 ).
+    const float e = 1.0f / sqrtf( 6.0f );
+    FBXP_CHECK( AreControlPointNormalsNear( cube, areaWeighted, 2, mathfu::vec3( -e, 2 * e, -e ) ) );
+
+    // The crease angle splits the faces with both the weightings.
+    FBXP_CHECK( AreFaceNormals( cube, CalculateNormals( cube, 60.0f, true ) ) );
+}
@@ -0,0 +1,250 @@
+#include <fbxppch.h>
+#include <fbxpstate.h>
+#include <fbxptests.h>
+#include <mikktspace/mikktspace.h>
+
+//
+// See implementation in fbxptangents.cpp.
+//
+
+uint32_t GenerateTangents( apemode::Mesh& m, std::vector< uint32_t >& indices, uint32_t vertexCount, const char* meshName );
+
+namespace {
+    /**
+     * The vertex of the pipeline before the packing (see StaticVertex in fbxpmesh.cpp).
+     **/
+    struct StaticVertex {
+        float position[ 3 ];
+        float normal[ 3 ];
+        float tangent[ 4 ];
+        float texCoords[ 2 ];
+    };
+
+    /**
+     * The welded vertices and the triangle indices (the input of GenerateTangents).
+     **/
+    struct TestMesh {
+        std::vector< StaticVertex > vertices;
+        std::vector< uint32_t >     indices;
+    };
+
+    /**
+     * The grid of (segmentCount + 1)^2 vertices, the position and the normal are the functions of the texcoord.
+     * The vertices of the texcoord seams are not shared (like the exported meshes).
+     **/
+    template < typename TSurface >
+    TestMesh CreateGridMesh( uint32_t segmentCount, TSurface surface ) {
+        TestMesh mesh;
+        for ( uint32_t y = 0; y <= segmentCount; ++y ) {
+            for ( uint32_t x = 0; x <= segmentCount; ++x ) {
+                StaticVertex vertex = {};
+                vertex.texCoords[ 0 ] = float( x ) / segmentCount;
+                vertex.texCoords[ 1 ] = float( y ) / segmentCount;
+                surface( vertex.texCoords[ 0 ], vertex.texCoords[ 1 ], vertex.position, vertex.normal );
+                mesh.vertices.push_back( vertex );
+            }
+        }
+
+        for ( uint32_t y = 0; y < segmentCount; ++y ) {
+            for ( uint32_t x = 0; x < segmentCount; ++x ) {
+                const uint32_t v = y * ( segmentCount + 1 ) + x;
+                mesh.indices.insert( mesh.indices.end( ), {v, v + segmentCount + 1, v + 1, v + 1, v + segmentCount + 1, v + segmentCount + 2} );
+            }
+        }
+
+        return mesh;
+    }
+
+    /**
+     * The UV sphere without the poles (the vertices of the degenerate triangles only get the arbitrary tangents).
+     **/
+    TestMesh CreateSphere( uint32_t segmentCount ) {
+        return CreateGridMesh( segmentCount, []( float u, float v, float* p, float* n ) {
+            const float theta = 3.14159265f * ( 0.05f + 0.9f * v );
+            const float phi   = 2 * 3.14159265f * u;
+            n[ 0 ] = p[ 0 ] = sinf( theta ) * cosf( phi );
+            n[ 1 ] = p[ 1 ] = sinf( theta ) * sinf( phi );
+            n[ 2 ] = p[ 2 ] = cosf( theta );
+        } );
+    }
+
+    /**
+     * The torus, the texcoords are stretched (the tangents and the bitangents are not orthogonal).
+     **/
+    TestMesh CreateTorus( uint32_t segmentCount ) {
+        TestMesh mesh = CreateGridMesh( segmentCount, []( float u, float v, float* p, float* n ) {
+            const float phi   = 2 * 3.14159265f * u;
+            const float theta = 2 * 3.14159265f * v + phi;
+            n[ 0 ] = cosf( theta ) * cosf( phi );
+            n[ 1 ] = cosf( theta ) * sinf( phi );
+            n[ 2 ] = sinf( theta );
+            p[ 0 ] = cosf( phi ) * 2 + n[ 0 ] * 0.5f;
+            p[ 1 ] = sinf( phi ) * 2 + n[ 1 ] * 0.5f;
+            p[ 2 ] = n[ 2 ] * 0.5f;
+        } );
+
+        for ( auto& vertex : mesh.vertices )
+            vertex.texCoords[ 0 ] *= 3;
+
+        return mesh;
+    }
+
+    /**
+     * The wavy grid, the texcoords of the right half are mirrored (the middle column is shared by both the orientations).
+     **/
+    TestMesh CreateMirroredGrid( uint32_t segmentCount ) {
+        TestMesh mesh = CreateGridMesh( segmentCount, []( float u, float v, float* p, float* n ) {
+            const float h  = 0.1f * sinf( 6 * u ) * cosf( 5 * v );
+            const float dx = 0.6f * cosf( 6 * u ) * cosf( 5 * v );
+            const float dy = -0.5f * sinf( 6 * u ) * sinf( 5 * v );
+            const float l  = sqrtf( dx * dx + dy * dy + 1 );
+            p[ 0 ] = u, p[ 1 ] = v, p[ 2 ] = h;
+            n[ 0 ] = -dx / l, n[ 1 ] = -dy / l, n[ 2 ] = 1 / l;
+        } );
+
+        for ( auto& vertex : mesh.vertices )
+            vertex.texCoords[ 0 ] = 0.5f - fabsf( vertex.texCoords[ 0 ] - 0.5f );
+
+        return mesh;
+    }
+
+    /**
+     * Calls the reference MikkTSpace implementation (mikktspace.c).
+     * @return The tangent (xyz) and the sign (w) of every triangle corner.
+     **/
+    std::vector< float > GenerateMikkTSpaceTangents( TestMesh const& mesh ) {
+        struct UserData {
+            TestMesh const*       mesh;
+            std::vector< float >* tangents;
+
+            static UserData* Get( const SMikkTSpaceContext* context ) {
+                return reinterpret_cast< UserData* >( context->m_pUserData );
+            }
+
+            static const StaticVertex& GetVertex( const SMikkTSpaceContext* context, int face, int vert ) {
+                return Get( context )->mesh->vertices[ Get( context )->mesh->indices[ face * 3 + vert ] ];
+            }
+        };
+
+        std::vector< float > tangents( mesh.indices.size( ) * 4 );
+        UserData             userData = {&mesh, &tangents};
+
+        SMikkTSpaceInterface callbacks = {};
+        callbacks.m_getNumFaces = []( const SMikkTSpaceContext* context ) {
+            return int( UserData::Get( context )->mesh->indices.size( ) / 3 );
+        };
+        callbacks.m_getNumVerticesOfFace = []( const SMikkTSpaceContext*, const int ) { return 3; };
+        callbacks.m_getPosition = []( const SMikkTSpaceContext* context, float position[], const int face, const int vert ) {
+            memcpy( position, UserData::GetVertex( context, face, vert ).position, sizeof( float ) * 3 );
+        };
+        callbacks.m_getNormal = []( const SMikkTSpaceContext* context, float normal[], const int face, const int vert ) {
+            memcpy( normal, UserData::GetVertex( context, face, vert ).normal, sizeof( float ) * 3 );
+        };
+        callbacks.m_getTexCoord = []( const SMikkTSpaceContext* context, float texcoord[], const int face, const int vert ) {
+            memcpy( texcoord, UserData::GetVertex( context, face, vert ).texCoords, sizeof( float ) * 2 );
+        };
+        callbacks.m_setTSpaceBasic = []( const SMikkTSpaceContext* context, const float tangent[], const float sign, const int face, const int vert ) {
+            float* corner = UserData::Get( context )->tangents->data( ) + ( face * 3 + vert ) * 4;
+            memcpy( corner, tangent, sizeof( float ) * 3 );
+            corner[ 3 ] = sign;
+        };
+
+        SMikkTSpaceContext context = {&callbacks, &userData};
+        genTangSpaceDefault( &context );
+        return tangents;
+    }
+
+    /**
+     * Runs GenerateTangents on the copy of the mesh.
+     * @return The split vertices, the indices are remapped.
+     **/
+    TestMesh GenerateTangents( TestMesh const& mesh ) {
+        apemode::Mesh m;
+        m.vertices.assign( reinterpret_cast< const uint8_t* >( mesh.vertices.data( ) ),
+                           reinterpret_cast< const uint8_t* >( mesh.vertices.data( ) + mesh.vertices.size( ) ) );
+
+        TestMesh result;
+        result.indices = mesh.indices;
+
+        const uint32_t vertexCount = ::GenerateTangents( m, result.indices, (uint32_t) mesh.vertices.size( ), "test" );
+        result.vertices.resize( vertexCount );
+        memcpy( result.vertices.data( ), m.vertices.data( ), vertexCount * sizeof( StaticVertex ) );
+        return result;
+    }
+
+    struct TangentDifference {
+        float    maxAngle          = 0; // Radians.
+        uint32_t signMismatchCount = 0;
+        uint32_t splitVertexCount  = 0;
+    };
+
+    /**
+     * Compares the tangents of every triangle corner to MikkTSpace.
+     **/
+    TangentDifference CompareToMikkTSpace( TestMesh const& mesh ) {
+        const TestMesh             generated = GenerateTangents( mesh );
+        const std::vector< float > reference = GenerateMikkTSpaceTangents( mesh );
+
+        TangentDifference difference;
+        difference.splitVertexCount = uint32_t( generated.vertices.size( ) - mesh.vertices.size( ) );
+
+        for ( size_t i = 0; i < mesh.indices.size( ); ++i ) {
+            const float* tangent         = generated.vertices[ generated.indices[ i ] ].tangent;
+            const float* expectedTangent = reference.data( ) + i * 4;
+
+            const float dot = tangent[ 0 ] * expectedTangent[ 0 ] + tangent[ 1 ] * expectedTangent[ 1 ] + tangent[ 2 ] * expectedTangent[ 2 ];
+            difference.maxAngle = std::max( difference.maxAngle, acosf( std::min( 1.0f, dot ) ) );
+            difference.signMismatchCount += tangent[ 3 ] != expectedTangent[ 3 ];
+        }
+
+        apemode::Get( ).console->info( "MikkTSpace difference: {:.2e} rad max, {} sign mismatch(es), {} split vertices.",
+                                       difference.maxAngle,
+                                       difference.signMismatchCount,
+                                       difference.splitVertexCount );
+        return difference;
+    }
+
+    /**
+     * The tangents match MikkTSpace up to the float rounding (the sums are in the different order and acos is a polynomial),
+     * the meshes are manifold (the groups are not split by the fan connectivity, see fbxptangents.cpp).
+     **/
+    const float kMaxTangentAngle = 1e-3f;
+}
+
+FBXP_TEST( TangentsMatchMikkTSpace ) {
+    const TangentDifference sphere = CompareToMikkTSpace( CreateSphere( 48 ) );
+    FBXP_CHECK( sphere.maxAngle <= kMaxTangentAngle );
+    FBXP_CHECK( 0 == sphere.signMismatchCount );
+    FBXP_CHECK( 0 == sphere.splitVertexCount );
+
+    const TangentDifference torus = CompareToMikkTSpace( CreateTorus( 40 ) );
+    FBXP_CHECK( torus.maxAngle <= kMaxTangentAngle );
+    FBXP_CHECK( 0 == torus.signMismatchCount );
+    FBXP_CHECK( 0 == torus.splitVertexCount );
+
+    // The middle column is used by both the orientations, its 33 vertices are split.
+    const TangentDifference mirrored = CompareToMikkTSpace( CreateMirroredGrid( 32 ) );
+    FBXP_CHECK( mirrored.maxAngle <= kMaxTangentAngle );
+    FBXP_CHECK( 0 == mirrored.signMismatchCount );
+    FBXP_CHECK( 33 == mirrored.splitVertexCount );
+}
+
+/**
+ * Generates the tangents of the UV sphere (2M triangles) with GenerateTangents (on the job pool, see -j)
+ * and MikkTSpace (single-threaded, a single run).
+ **/
+FBXP_BENCHMARK( TangentsThroughput ) {
+    auto& s = apemode::Get( );
+
+    const uint32_t kRunCount     = 3;
+    const TestMesh sphere        = CreateSphere( 1000 );
+    const uint32_t triangleCount = uint32_t( sphere.indices.size( ) / 3 );
+
+    const double generateTime  = apemode::tests::MeasureMilliseconds( kRunCount, [&] { GenerateTangents( sphere ); } );
+    const double referenceTime = apemode::tests::MeasureMilliseconds( 1, [&] { GenerateMikkTSpaceTangents( sphere ); } );
+
+    s.console->info( "Best of {} runs, {} job(s), {} triangles:", kRunCount, s.jobs->GetWorkerCount( ), triangleCount );
+    s.console->info( "|Implementation|Time (ms)|M triangles/s|" );
+    s.console->info( "|GenerateTangents|{:.1f}|{:.1f}|", generateTime, triangleCount * 1e-3 / generateTime );
+    s.console->info( "|MikkTSpace|{:.1f}|{:.1f}|", referenceTime, triangleCount * 1e-3 / referenceTime );
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <fbxppch.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+//
+// Minimal test runner of the FbxPipelineTests project.
+// The tests run by default, the benchmarks run with the --bench argument (see main.cpp).
+//
+// Usage:
+//      FBXP_TEST( IndexCodecRoundTrip ) {
+//          FBXP_CHECK( decoded == indices );
+//      }
+//      FBXP_BENCHMARK( IndexCodecThroughput ) {
+//          const double ms = apemode::tests::MeasureMilliseconds( 5, [&] { ... } );
+//      }
+//
+
+namespace apemode {
+    namespace tests {
+        typedef void ( *TestFunc )( );
+
+        struct TestCase {
+            const char* name;
+            TestFunc    func;
+            bool        benchmark;
+        };
+
+        /**
+         * @return The registered tests and benchmarks (in the registration order).
+         **/
+        std::vector< TestCase >& GetTestCases( );
+
+        /**
+         * Reports the failed check, the test continues (see FBXP_CHECK).
+         **/
+        void ReportFailure( const char* file, int line, const char* expression );
+
+        struct TestRegistrar {
+            TestRegistrar( const char* name, TestFunc func, bool benchmark ) {
+                GetTestCases( ).push_back( TestCase{name, func, benchmark} );
+            }
+        };
+
+        /**
+         * @return The best time of the runs in milliseconds.
+         **/
+        template < typename TFunc >
+        double MeasureMilliseconds( uint32_t runCount, TFunc func ) {
+            double bestTime = 0;
+            for ( uint32_t i = 0; i < runCount; ++i ) {
+                const auto startTime = std::chrono::steady_clock::now( );
+                func( );
+                const std::chrono::duration< double, std::milli > time = std::chrono::steady_clock::now( ) - startTime;
+                bestTime = i ? std::min( bestTime, time.count( ) ) : time.count( );
+            }
+
+            return bestTime;
+        }
+    }
+}
+
+#define FBXP_TEST( name )                                                                         \
+    static void name( );                                                                          \
+    static const apemode::tests::TestRegistrar name##Registrar( #name, &name, false );            \
+    static void name( )
+
+#define FBXP_BENCHMARK( name )                                                                    \
+    static void name( );                                                                          \
+    static const apemode::tests::TestRegistrar name##Registrar( #name, &name, true );             \
+    static void name( )
+
+#define FBXP_CHECK( expression )                                                                  \
+    do {                                                                                          \
+        if ( !( expression ) )                                                                    \
+            apemode::tests::ReportFailure( __FILE__, __LINE__, #expression );                     \
+    } while ( 0 )
@@ -0,0 +1,81 @@
+#include <fbxppch.h>
+#include <fbxpstate.h>
+#include <fbxptests.h>
+#include <atomic>
+#include <cstring>
+
+//
+// Runs the tests (or the benchmarks with --bench) of the pipeline stages.
+// Usage: FbxPipelineTests [--bench] [--filter <name part>] [pipeline options, e.g. -j 4]
+//
+
+namespace {
+    std::atomic< uint32_t > failureCount( 0 );
+}
+
+std::vector< apemode::tests::TestCase >& apemode::tests::GetTestCases( ) {
+    static std::vector< TestCase > testCases;
+    return testCases;
+}
+
+void apemode::tests::ReportFailure( const char* file, int line, const char* expression ) {
+    ++failureCount;
+    apemode::Get( ).console->error( "{}({}): Check failed: {}", file, line, expression );
+}
+
+int main( int argc, char** argv ) {
+    auto& s = apemode::Get( );
+
+    bool        benchmark = false;
+    const char* filter    = nullptr;
+
+    // The runner arguments are removed, the rest is parsed as the pipeline options.
+    std::vector< char* > args( 1, argv[ 0 ] );
+    for ( int i = 1; i < argc; ++i ) {
+        if ( 0 == strcmp( argv[ i ], "--bench" ) )
+            benchmark = true;
+        else if ( 0 == strcmp( argv[ i ], "--filter" ) && i + 1 < argc )
+            filter = argv[ ++i ];
+        else
+            args.push_back( argv[ i ] );
+    }
+
+    try {
+        int    optionCount = (int) args.size( );
+        char** options     = args.data( );
+        s.options.parse( optionCount, options );
+    } catch ( const cxxopts::OptionException& e ) {
+        s.console->critical( "error parsing options: {0}", e.what( ) );
+        std::exit( 1 );
+    }
+
+    s.InitializeConsole( );
+    s.jobs.reset( new apemode::JobPool( (uint32_t) std::max( 0, s.options[ "j" ].as< int >( ) ) ) );
+
+    uint32_t runCount    = 0;
+    uint32_t failedCount = 0;
+
+    for ( auto& testCase : apemode::tests::GetTestCases( ) ) {
+        if ( testCase.benchmark != benchmark || ( filter && nullptr == strstr( testCase.name, filter ) ) )
+            continue;
+
+        s.console->info( "[ RUN    ] {}", testCase.name );
+
+        const uint32_t failures = failureCount;
+        testCase.func( );
+        ++runCount;
+
+        if ( failures != failureCount ) {
+            s.console->error( "[ FAILED ] {}", testCase.name );
+            ++failedCount;
+        } else {
+            s.console->info( "[     OK ] {}", testCase.name );
+        }
+    }
+
+    s.console->info( "{} {}(s) run, {} failed.", runCount, benchmark ? "benchmark" : "test", failedCount );
+
+    s.jobs.reset( );
+    s.console->flush( );
+    return failedCount ? 1 : 0;
+}
@@ -1,6 +1,11 @@
 #pragma once
 
 #include <fbxvpch.h>
+#include <fbxpindexcodec.h>
+#include <fbxpdraco.h>
+#include <fbxpcontainer.h>
+#include <atomic>
+#include <thread>
 
 namespace apemode {
     void *Malloc( size_t bytes );
@@ -24,12 +29,24 @@ namespace apemode {
     struct SceneMesh {
         void *                         deviceAsset;
         std::vector< SceneMeshSubset > subsets;
+        std::vector< uint8_t >         indices;
+        std::vector< apemodefb::StaticVertexFb > vertices; // Decoded Draco vertices (see fbxpdraco.h).
+        std::vector< uint8_t >         vertexData;         // MeshFb.vertices (in the vertex format of the submesh).
+        apemodefb::EVertexFormat       vertexFormat = apemodefb::EVertexFormat_Static;
+        uint32_t                       vertexStride = 0;
+        apemodefb::EIndexTypeFb        indexType = apemodefb::EIndexTypeFb_UInt16;
         mathfu::vec3                   positionOffset;
         mathfu::vec3                   positionScale;
         mathfu::vec2                   texcoordOffset;
         mathfu::vec2                   texcoordScale;
     };
 
+    struct SceneFile {
+        uint32_t               id     = 0;
+        uint64_t               nameId = 0;
+        std::vector< uint8_t > buffer; // FileFb.buffer (the embedded file).
+    };
+
     /**
      * Transfrom class that stores main FBX SDK transform properties
      * and calculates local and geometric matrices.
@@ -124,6 +141,7 @@ namespace apemode {
         std::vector< SceneNodeTransform > transforms;
         std::vector< SceneMesh >          meshes;
         std::vector< SceneMaterial >      materials;
+        std::vector< SceneFile >          files;
 
         //
         // Transform matrices storage.
@@ -205,12 +223,104 @@ namespace apemode {
         }
     };
 
+    /**
+     * Runs the task for every index in [0, count) on the worker threads and the calling thread,
+     * every thread takes the next index.
+     **/
+    template < typename TTask >
+    void RunParallel( size_t count, TTask task ) {
+        std::atomic< size_t > nextIndex( 0 );
+        auto runTasks = [&]( ) {
+            for ( size_t i = nextIndex++; i < count; i = nextIndex++ )
+                task( i );
+        };
+
+        const size_t threadCount = std::min( count, (size_t) std::max( 1u, std::thread::hardware_concurrency( ) ) );
+        const size_t workerCount = threadCount ? threadCount - 1 : 0;
+        std::vector< std::thread > workers;
+        workers.reserve( workerCount );
+        for ( size_t i = 0; i < workerCount; ++i )
+            workers.emplace_back( runTasks );
+
+        runTasks( );
+        for ( auto &worker : workers )
+            worker.join( );
+    }
+
     Scene * LoadSceneFromFile(const char * filename) {
         std::string fileData;
         if ( flatbuffers::LoadFile( filename, true, &fileData ) ) {
-            if ( auto sceneFb = apemodefb::GetSceneFb( fileData.c_str( ) ) ) {
+
+            //
+            // The block-compressed container (see fbxpcontainer.h): the scene section is decompressed here,
+            // the mesh sections are decompressed in parallel before the meshes are loaded.
+            //
+
+            ContainerReader        container;
+            std::vector< uint8_t > containerScene;
+            const bool             isContainer = IsContainer( (const uint8_t *) fileData.data( ), fileData.size( ) );
+
+            if ( isContainer ) {
+                if ( false == container.Open( (const uint8_t *) fileData.data( ), fileData.size( ) ) )
+                    return nullptr;
+
+                const ContainerSection *sceneSection = container.FindSection( eContainerSection_Scene, 0 );
+                if ( nullptr == sceneSection || false == container.DecompressSection( *sceneSection, containerScene ) )
+                    return nullptr;
+            }
+
+            const char *sceneData = isContainer ? (const char *) containerScene.data( ) : fileData.c_str( );
+            if ( auto sceneFb = apemodefb::GetSceneFb( sceneData ) ) {
                 std::unique_ptr< Scene > scene( new Scene( ) );
 
+                //
+                // The container sections of the meshes and the embedded files (the vectors in MeshFb and FileFb are empty),
+                // all the blocks are decompressed in parallel.
+                //
+
+                const size_t meshCount = sceneFb->meshes( ) ? sceneFb->meshes( )->size( ) : 0;
+                const size_t fileCount = sceneFb->files( ) ? sceneFb->files( )->size( ) : 0;
+
+                std::vector< std::vector< uint8_t > > containerVertices( meshCount );
+                std::vector< std::vector< uint8_t > > containerIndices( meshCount );
+                std::vector< std::vector< uint8_t > > containerDraco( meshCount );
+                std::vector< std::vector< uint8_t > > containerFiles( fileCount );
+
+                if ( isContainer ) {
+                    std::vector< std::pair< const ContainerSection *, uint32_t > > blocks;
+                    std::vector< std::vector< uint8_t > * >                       blockSections;
+
+                    for ( const auto &section : container.GetSections( ) ) {
+                        std::vector< uint8_t > *sectionData = nullptr;
+                        if ( section.type == eContainerSection_MeshVertices && section.id < meshCount )
+                            sectionData = &containerVertices[ section.id ];
+                        else if ( section.type == eContainerSection_MeshSubsetIndices && section.id < meshCount )
+                            sectionData = &containerIndices[ section.id ];
+                        else if ( section.type == eContainerSection_MeshDraco && section.id < meshCount )
+                            sectionData = &containerDraco[ section.id ];
+                        else if ( section.type == eContainerSection_FileBuffer && section.id < fileCount )
+                            sectionData = &containerFiles[ section.id ];
+
+                        if ( sectionData ) {
+                            sectionData->resize( (size_t) section.rawSize );
+                            for ( uint32_t i = 0; i < section.blockCount; ++i ) {
+                                blocks.emplace_back( &section, i );
+                                blockSections.push_back( sectionData );
+                            }
+                        }
+                    }
+
+                    std::atomic< bool > decompressed( true );
+                    RunParallel( blocks.size( ), [&]( size_t i ) {
+                        if ( false == container.DecompressBlock( *blocks[ i ].first, blocks[ i ].second, blockSections[ i ]->data( ) ) )
+                            decompressed = false;
+                    } );
+
+                    assert( decompressed );
+                    if ( false == decompressed )
+                        return nullptr;
+                }
+
                 //
                 // Since the format is not final, I do not rely much on a
                 // current structure and do not use memcpy, I want to keep
@@ -307,14 +417,50 @@ namespace apemode {
                     //PackedVertex::InitializeOnce( );
                     scene->meshes.reserve( meshesFb->size( ) );
 
+                    struct DracoMesh {
+                        SceneMesh *                mesh;
+                        const apemodefb::MeshFb *  meshFb;
+                        const uint8_t *            data;
+                        size_t                     size;
+                    };
+
+                    // The Draco meshes are decoded in parallel after the loop.
+                    std::vector< DracoMesh > dracoMeshes;
+
                     for ( auto meshFb : *meshesFb ) {
                         assert( meshFb );
-                        assert( meshFb->vertices( ) && meshFb->vertices( )->size( ) );
                         assert( meshFb->submeshes( ) && meshFb->submeshes( )->size( ) == 1 );
 
+                        const size_t meshId = scene->meshes.size( );
                         scene->meshes.emplace_back( );
                         auto &mesh = scene->meshes.back( );
 
+                        const uint8_t *indicesData = nullptr;
+                        size_t         indicesSize = 0;
+                        const uint8_t *dracoData   = nullptr;
+                        size_t         dracoSize   = 0;
+
+                        if ( isContainer ) {
+                            mesh.vertexData = std::move( containerVertices[ meshId ] );
+                            indicesData     = containerIndices[ meshId ].data( );
+                            indicesSize     = containerIndices[ meshId ].size( );
+                            dracoData       = containerDraco[ meshId ].data( );
+                            dracoSize       = containerDraco[ meshId ].size( );
+                        } else {
+                            assert( ( meshFb->vertices( ) && meshFb->vertices( )->size( ) ) || ( meshFb->draco( ) && meshFb->draco( )->size( ) ) );
+                            if ( meshFb->vertices( ) ) {
+                                mesh.vertexData.assign( meshFb->vertices( )->Data( ), meshFb->vertices( )->Data( ) + meshFb->vertices( )->size( ) );
+                            }
+                            if ( meshFb->subset_indices( ) ) {
+                                indicesData = meshFb->subset_indices( )->Data( );
+                                indicesSize = meshFb->subset_indices( )->size( );
+                            }
+                            if ( meshFb->draco( ) ) {
+                                dracoData = meshFb->draco( )->Data( );
+                                dracoSize = meshFb->draco( )->size( );
+                            }
+                        }
+
                         /*mesh.vertexBufferHandle = bgfx::createVertexBuffer(
                             bgfxUtils::makeReleasableCopy( meshFb->vertices( )->Data( ), meshFb->vertices( )->size( ) ),
                             PackedVertex::vertexDecl );
@@ -339,6 +485,8 @@ namespace apemode {
                             mesh.texcoordOffset.y = submeshFb->uv_offset( ).y( );
                             mesh.texcoordScale.x  = submeshFb->uv_scale( ).x( );
                             mesh.texcoordScale.y  = submeshFb->uv_scale( ).y( );
+                            mesh.vertexFormat     = submeshFb->vertex_format( );
+                            mesh.vertexStride     = submeshFb->vertex_stride( );
                         }
 
                         mesh.subsets.reserve( meshFb->subsets( )->size( ) );
@@ -358,7 +506,85 @@ namespace apemode {
 
                                             return subset;
                                         } );
+
+                        //
+                        // The compressed indices are decoded (see fbxpindexcodec.h),
+                        // the subset ranges refer to the decoded indices.
+                        //
+
+                        if ( indicesSize ) {
+                            switch ( meshFb->subset_index_type( ) ) {
+                                case apemodefb::EIndexTypeFb_UInt16Compressed:
+                                case apemodefb::EIndexTypeFb_UInt32Compressed: {
+                                    const bool indices32  = meshFb->subset_index_type( ) == apemodefb::EIndexTypeFb_UInt32Compressed;
+                                    size_t     indexCount = 0;
+
+                                    // The subsets and the LODs cover all the indices, the corrupted count is rejected before the allocation.
+                                    size_t expectedIndexCount = 0;
+                                    for ( auto subsetFb : *meshFb->subsets( ) )
+                                        expectedIndexCount = std::max< size_t >( expectedIndexCount, size_t( subsetFb->base_index( ) ) + subsetFb->index_count( ) );
+                                    if ( meshFb->subset_lods( ) )
+                                        for ( auto subsetLodFb : *meshFb->subset_lods( ) )
+                                            expectedIndexCount = std::max< size_t >( expectedIndexCount, size_t( subsetLodFb->base_index( ) ) + subsetLodFb->index_count( ) );
+
+                                    bool decoded = GetEncodedIndexCount( indicesData, indicesSize, indexCount ) && indexCount == expectedIndexCount;
+                                    if ( decoded ) {
+                                        mesh.indices.resize( indexCount * ( indices32 ? sizeof( uint32_t ) : sizeof( uint16_t ) ) );
+                                        decoded = indices32 ? DecodeIndices( indicesData, indicesSize, (uint32_t *) mesh.indices.data( ), indexCount )
+                                                            : DecodeIndices( indicesData, indicesSize, (uint16_t *) mesh.indices.data( ), indexCount );
+                                    }
+
+                                    assert( decoded );
+                                    if ( false == decoded )
+                                        mesh.indices.clear( );
+
+                                    mesh.indexType = indices32 ? apemodefb::EIndexTypeFb_UInt32 : apemodefb::EIndexTypeFb_UInt16;
+                                } break;
+
+                                default:
+                                    mesh.indices.assign( indicesData, indicesData + indicesSize );
+                                    mesh.indexType = meshFb->subset_index_type( );
+                                    break;
+                            }
+                        }
+
+                        if ( dracoSize ) {
+                            dracoMeshes.push_back( DracoMesh{&mesh, meshFb, dracoData, dracoSize} );
+                        }
                     }
+
+                    //
+                    // The Draco meshes are decoded (see fbxpdraco.h) in parallel, the meshes are independent.
+                    //
+
+                    RunParallel( dracoMeshes.size( ), [&]( size_t i ) {
+                        auto &mesh   = *dracoMeshes[ i ].mesh;
+                        auto  meshFb = dracoMeshes[ i ].meshFb;
+
+                        std::vector< uint32_t > indices;
+                        const bool decoded = DecodeDracoMesh( dracoMeshes[ i ].data,
+                                                              dracoMeshes[ i ].size,
+                                                              (const apemodefb::SubsetFb *) meshFb->subsets( )->Data( ),
+                                                              meshFb->subsets( )->size( ),
+                                                              mesh.vertices,
+                                                              indices );
+
+                        assert( decoded );
+                        if ( false == decoded ) {
+                            mesh.vertices.clear( );
+                            return;
+                        }
+
+                        if ( mesh.vertices.size( ) < 0xffff ) {
+                            mesh.indices.resize( indices.size( ) * sizeof( uint16_t ) );
+                            std::copy( indices.begin( ), indices.end( ), (uint16_t *) mesh.indices.data( ) );
+                            mesh.indexType = apemodefb::EIndexTypeFb_UInt16;
+                        } else {
+                            mesh.indices.resize( indices.size( ) * sizeof( uint32_t ) );
+                            memcpy( mesh.indices.data( ), indices.data( ), mesh.indices.size( ) );
+                            mesh.indexType = apemodefb::EIndexTypeFb_UInt32;
+                        }
+                    } );
                 }
 
                 if (auto materialsFb = sceneFb->materials()) {
@@ -375,6 +601,24 @@ namespace apemode {
                     }
                 }
 
+                if ( auto filesFb = sceneFb->files( ) ) {
+                    scene->files.reserve( filesFb->size( ) );
+
+                    for ( auto fileFb : *filesFb ) {
+                        scene->files.emplace_back( );
+                        auto &file = scene->files.back( );
+
+                        file.id     = fileFb->id( );
+                        file.nameId = fileFb->name_id( );
+
+                        // The container section id is the file id.
+                        if ( isContainer && file.id < fileCount )
+                            file.buffer = std::move( containerFiles[ file.id ] );
+                        else if ( fileFb->buffer( ) )
+                            file.buffer.assign( fileFb->buffer( )->Data( ), fileFb->buffer( )->Data( ) + fileFb->buffer( )->size( ) );
+                    }
+                }
+
                 return scene.release( );
             }
         }
@@ -1,5 +1,9 @@
 #!/bin/sh
 
+# FbxPipeline/fbxpdraco.h and fbxpdraco.cpp use the pre-1.0 Draco API (compression/encode.h, EncoderOptions)
+# and the include directories of the projects use its source layout (compression/, core/, io/, mesh/).
+git -C draco checkout 0.9.1 || exit 1
+
 mkdir draco_build_v140x86
 cd draco_build_v140x86
 cmake -G "Visual Studio 14 2015" ../draco/